@@ -977,6 +977,10 @@ static bool common_params_parse_ex(int argc, char ** argv, common_params_context
     postprocess_cpu_params(params.speculative.cpuparams,       &params.cpuparams);
     postprocess_cpu_params(params.speculative.cpuparams_batch, &params.cpuparams_batch);
 
+    for (auto & pool : params.server_pools) {
+        postprocess_cpu_params(pool.cpuparams, &params.cpuparams);
+    }
+
     if (params.prompt_cache_all && (params.interactive || params.interactive_first)) {
         throw std::invalid_argument("error: --prompt-cache-all not supported in interactive mode yet\n");
     }
@@ -1358,6 +1362,14 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             }
         }
     ));
+    add_opt(common_arg(
+        {"--threads-auto"},
+        string_format("measure the compute time of the batches and use the fastest number of threads up to --threads and --threads-batch,\n"
+            "separately for single token generation and for each batch size (default: %s)", params.auto_threads ? "true" : "false"),
+        [](common_params & params) {
+            params.auto_threads = true;
+        }
+    ).set_env("LLAMA_ARG_THREADS_AUTO"));
     add_opt(common_arg(
         {"-C", "--cpu-mask"}, "M",
         "CPU affinity mask: arbitrarily long hex. Complements cpu-range (default: \"\")",
@@ -1566,6 +1578,13 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.sampling.no_perf = true;
         }
     ).set_env("LLAMA_ARG_NO_PERF"));
+    add_opt(common_arg(
+        {"--profile-ops"},
+        string_format("record the time spent in each op of the compute graphs, printed with the performance timings (default: %s)", params.profile_ops ? "true" : "false"),
+        [](common_params & params) {
+            params.profile_ops = true;
+        }
+    ).set_env("LLAMA_ARG_PROFILE_OPS"));
     add_opt(common_arg(
         {"-f", "--file"}, "FNAME",
         "a file containing the prompt (default: none)",
@@ -2149,6 +2168,14 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.no_extra_bufts = true;
         }
     ).set_env("LLAMA_ARG_NO_REPACK"));
+    add_opt(common_arg(
+        {"--repack-cache"}, "DIR",
+        "directory of a cache of the weights repacked for the CPU, shared by the processes that load the same model\n"
+        "(default: none, repack at every load)",
+        [](common_params & params, const std::string & value) {
+            params.repack_cache = value;
+        }
+    ).set_env("LLAMA_ARG_REPACK_CACHE"));
     add_opt(common_arg(
         {"-ctk", "--cache-type-k"}, "TYPE",
         string_format(
@@ -2252,6 +2279,14 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.defrag_thold = std::stof(value);
         }
     ).set_env("LLAMA_ARG_DEFRAG_THOLD"));
+    add_opt(common_arg(
+        {"--logits-top"}, "N",
+        string_format("select only the top N logits of each output on the backend and sample from them, instead of copying the full logits to the host\n"
+            "sampling is limited to these N candidates (default: %d, 0 = disabled)", params.n_logits_top),
+        [](common_params & params, int value) {
+            params.n_logits_top = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_MAIN, LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_LOGITS_TOP"));
     add_opt(common_arg(
         {"-np", "--parallel"}, "N",
         string_format("number of parallel sequences to decode (default: %d)", params.n_parallel),
@@ -2346,12 +2381,14 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
         "- distribute: spread execution evenly over all nodes\n"
         "- isolate: only spawn threads on CPUs on the node that execution started on\n"
         "- numactl: use the CPU map provided by numactl\n"
+        "- mirror: like distribute, with a copy of the weights on each node\n"
         "if run without this previously, it is recommended to drop the system page cache before using this\n"
         "see https://github.com/ggml-org/llama.cpp/issues/1437",
         [](common_params & params, const std::string & value) {
             /**/ if (value == "distribute" || value == "") { params.numa = GGML_NUMA_STRATEGY_DISTRIBUTE; }
             else if (value == "isolate") { params.numa = GGML_NUMA_STRATEGY_ISOLATE; }
             else if (value == "numactl") { params.numa = GGML_NUMA_STRATEGY_NUMACTL; }
+            else if (value == "mirror") { params.numa = GGML_NUMA_STRATEGY_MIRROR; }
             else { throw std::invalid_argument("invalid value"); }
         }
     ).set_env("LLAMA_ARG_NUMA"));
@@ -2742,6 +2779,18 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.i_chunk = value;
         }
     ).set_examples({LLAMA_EXAMPLE_IMATRIX}));
+    add_opt(common_arg(
+        {"--shard"}, "K/N",
+        string_format("process only the chunks K, K+N, K+2N, ... of the input, the shards can be merged with --in-file (default: %d/%d)", params.i_shard, params.n_shards),
+        [](common_params & params, const std::string & value) {
+            const auto parts = string_split<int>(value, '/');
+            if (parts.size() != 2 || parts[1] < 1 || parts[0] < 0 || parts[0] >= parts[1]) {
+                throw std::invalid_argument("invalid shard, expected K/N with 0 <= K < N");
+            }
+            params.i_shard  = parts[0];
+            params.n_shards = parts[1];
+        }
+    ).set_examples({LLAMA_EXAMPLE_IMATRIX}));
     add_opt(common_arg(
         {"--show-statistics"},
         string_format("show imatrix statistics and then exit (default: %s)", params.show_statistics ? "true" : "false"),
@@ -2889,6 +2938,49 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             key_file.close();
         }
     ).set_examples({LLAMA_EXAMPLE_SERVER}));
+    add_opt(common_arg(
+        {"--pool"}, "ALIAS[,api-key=KEY][,threads=N][,cpu-mask=M][,cpu-range=lo-hi]",
+        "add a serving pool with its own context, slots and threads, sharing the loaded model (repeatable)\n"
+        "requests for the model ALIAS or with one of the pool's API keys are served by the pool, the others by the main pool",
+        [](common_params & params, const std::string & value) {
+            const auto parts = string_split<std::string>(value, ',');
+            if (parts.empty() || parts[0].empty() || parts[0].find('=') != std::string::npos) {
+                throw std::invalid_argument("invalid pool, the alias is required");
+            }
+            common_server_pool pool;
+            pool.alias = parts[0];
+            for (size_t i = 1; i < parts.size(); ++i) {
+                const size_t pos = parts[i].find('=');
+                if (pos == std::string::npos) {
+                    throw std::invalid_argument(string_format("invalid pool option '%s'", parts[i].c_str()));
+                }
+                const std::string key = parts[i].substr(0, pos);
+                const std::string val = parts[i].substr(pos + 1);
+                if (key == "api-key") {
+                    pool.api_keys.push_back(val);
+                } else if (key == "threads") {
+                    pool.cpuparams.n_threads = std::stoi(val);
+                } else if (key == "cpu-mask") {
+                    pool.cpuparams.mask_valid = true;
+                    if (!parse_cpu_mask(val, pool.cpuparams.cpumask)) {
+                        throw std::invalid_argument("invalid cpumask");
+                    }
+                } else if (key == "cpu-range") {
+                    pool.cpuparams.mask_valid = true;
+                    if (!parse_cpu_range(val, pool.cpuparams.cpumask)) {
+                        throw std::invalid_argument("invalid range");
+                    }
+                } else {
+                    throw std::invalid_argument(string_format("unknown pool option '%s'", key.c_str()));
+                }
+            }
+            if (pool.cpuparams.mask_valid && pool.cpuparams.n_threads <= 0) {
+                // one thread per CPU of the mask
+                pool.cpuparams.n_threads = std::count(std::begin(pool.cpuparams.cpumask), std::end(pool.cpuparams.cpumask), true);
+            }
+            params.server_pools.push_back(std::move(pool));
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}));
     add_opt(common_arg(
         {"--ssl-key-file"}, "FNAME",
         "path to file a PEM-encoded SSL private key",
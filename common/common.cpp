@@ -8,6 +8,7 @@
 #include "common.h"
 #include "log.h"
 #include "llama.h"
+#include "sampling.h"
 
 #include <algorithm>
 #include <cinttypes>
@@ -910,15 +911,29 @@ std::string fs_get_cache_file(const std::string & filename) {
 //
 
 struct common_init_result common_init_from_params(common_params & params) {
-    common_init_result iparams;
     auto mparams = common_model_params_to_llama(params);
 
     llama_model * model = llama_model_load_from_file(params.model.path.c_str(), mparams);
     if (model == NULL) {
         LOG_ERR("%s: failed to load model '%s'\n", __func__, params.model.path.c_str());
-        return iparams;
+        return common_init_result();
+    }
+
+    common_init_result iparams = common_init_from_model(model, params);
+    if (iparams.context == nullptr) {
+        iparams.lora.clear();
+        llama_model_free(model);
+        return common_init_result();
     }
 
+    iparams.model.reset(model);
+
+    return iparams;
+}
+
+struct common_init_result common_init_from_model(llama_model * model, common_params & params) {
+    common_init_result iparams;
+
     const llama_vocab * vocab = llama_model_get_vocab(model);
 
     auto cparams = common_context_params_to_llama(params);
@@ -926,10 +941,13 @@ struct common_init_result common_init_from_params(common_params & params) {
     llama_context * lctx = llama_init_from_model(model, cparams);
     if (lctx == NULL) {
         LOG_ERR("%s: failed to create context with model '%s'\n", __func__, params.model.path.c_str());
-        llama_model_free(model);
         return iparams;
     }
 
+    if (params.profile_ops) {
+        llama_perf_ops_enable(lctx, true);
+    }
+
     if (params.ctx_shift && !llama_memory_can_shift(llama_get_memory(lctx))) {
         LOG_WRN("%s: KV cache shifting is not supported for this context, disabling KV cache shifting\n", __func__);
         params.ctx_shift = false;
@@ -942,7 +960,6 @@ struct common_init_result common_init_from_params(common_params & params) {
         const auto cvec = common_control_vector_load(params.control_vectors);
         if (cvec.n_embd == -1) {
             llama_free(lctx);
-            llama_model_free(model);
 
             return iparams;
         }
@@ -956,7 +973,6 @@ struct common_init_result common_init_from_params(common_params & params) {
                 params.control_vector_layer_end);
         if (err) {
             llama_free(lctx);
-            llama_model_free(model);
 
             return iparams;
         }
@@ -985,7 +1001,6 @@ struct common_init_result common_init_from_params(common_params & params) {
 
         if (!ok) {
             llama_free(lctx);
-            llama_model_free(model);
 
             return iparams;
         }
@@ -993,12 +1008,15 @@ struct common_init_result common_init_from_params(common_params & params) {
 
     // load and optionally apply lora adapters
     for (auto & la : params.lora_adapters) {
+        if (la.ptr != nullptr) {
+            continue;
+        }
+
         llama_adapter_lora_ptr lora;
         lora.reset(llama_adapter_lora_init(model, la.path.c_str()));
         if (lora == nullptr) {
             LOG_ERR("%s: failed to apply lora adapter '%s'\n", __func__, la.path.c_str());
             llama_free(lctx);
-            llama_model_free(model);
             return iparams;
         }
 
@@ -1030,6 +1048,11 @@ struct common_init_result common_init_from_params(common_params & params) {
                 params.sampling.logit_bias_eog.begin(), params.sampling.logit_bias_eog.end());
     }
 
+    if (llama_n_logits_top(lctx) > 0 && common_sampler_need_logits_full(params.sampling, llama_n_logits_top(lctx))) {
+        LOG_WRN("%s: the grammar, the logit bias or n_probs need the full logits, disabling --logits-top\n", __func__);
+        llama_set_logits_top(lctx, false);
+    }
+
     if (params.sampling.penalty_last_n == -1) {
         LOG_INF("%s: setting penalty_last_n to ctx_size = %d\n", __func__, llama_n_ctx(lctx));
         params.sampling.penalty_last_n = llama_n_ctx(lctx);
@@ -1078,7 +1101,6 @@ struct common_init_result common_init_from_params(common_params & params) {
         llama_set_warmup(lctx, false);
     }
 
-    iparams.model.reset(model);
     iparams.context.reset(lctx);
 
     return iparams;
@@ -1124,6 +1146,7 @@ struct llama_model_params common_model_params_to_llama(common_params & params) {
     mparams.use_mlock       = params.use_mlock;
     mparams.check_tensors   = params.check_tensors;
     mparams.use_extra_bufts = !params.no_extra_bufts;
+    mparams.repack_cache    = params.repack_cache.empty() ? nullptr : params.repack_cache.c_str();
 
     if (params.kv_overrides.empty()) {
         mparams.kv_overrides = NULL;
@@ -1167,6 +1190,7 @@ struct llama_context_params common_context_params_to_llama(const common_params &
     cparams.pooling_type      = params.pooling_type;
     cparams.attention_type    = params.attention_type;
     cparams.defrag_thold      = params.defrag_thold;
+    cparams.n_logits_top      = params.n_logits_top;
     cparams.cb_eval           = params.cb_eval;
     cparams.cb_eval_user_data = params.cb_eval_user_data;
     cparams.offload_kqv       = !params.no_kv_offload;
@@ -1175,6 +1199,7 @@ struct llama_context_params common_context_params_to_llama(const common_params &
     cparams.op_offload        = !params.no_op_offload;
     cparams.swa_full          = params.swa_full;
     cparams.kv_unified        = params.kv_unified;
+    cparams.auto_threads      = params.auto_threads;
 
     cparams.type_k = params.cache_type_k;
     cparams.type_v = params.cache_type_v;
@@ -1321,6 +1346,53 @@ std::vector<llama_token> common_tokenize(
     return result;
 }
 
+std::vector<std::vector<llama_token>> common_tokenize_batch(
+    const struct llama_vocab * vocab,
+  const std::vector<std::string> & texts,
+                        bool   add_special,
+                        bool   parse_special,
+                     int32_t   n_threads) {
+    const int32_t n_texts = texts.size();
+
+    std::vector<std::vector<llama_token>> result(n_texts);
+
+    std::vector<const char *>  text_ptrs(n_texts);
+    std::vector<int32_t>       text_lens(n_texts);
+    std::vector<llama_token *> token_ptrs(n_texts);
+    std::vector<int32_t>       n_tokens_max(n_texts);
+    std::vector<int32_t>       n_tokens(n_texts);
+
+    for (int32_t i = 0; i < n_texts; ++i) {
+        // upper limit for the number of tokens
+        result[i].resize(texts[i].length() + 2 * add_special);
+
+        text_ptrs[i]    = texts[i].data();
+        text_lens[i]    = texts[i].length();
+        token_ptrs[i]   = result[i].data();
+        n_tokens_max[i] = result[i].size();
+    }
+
+    const int32_t n_failed = llama_tokenize_batch(vocab, text_ptrs.data(), text_lens.data(), n_texts,
+            token_ptrs.data(), n_tokens_max.data(), n_tokens.data(), add_special, parse_special, n_threads);
+
+    for (int32_t i = 0; i < n_texts; ++i) {
+        if (n_tokens[i] == std::numeric_limits<int32_t>::min()) {
+            throw std::runtime_error("Tokenization failed: input text too large, tokenization result exceeds int32_t limit");
+        }
+        if (n_tokens[i] < 0) {
+            // rare - the upper limit does not hold for some vocabs, tokenize again with the exact size
+            GGML_ASSERT(n_failed > 0);
+            result[i].resize(-n_tokens[i]);
+            int check = llama_tokenize(vocab, texts[i].data(), texts[i].length(), result[i].data(), result[i].size(), add_special, parse_special);
+            GGML_ASSERT(check == -n_tokens[i]);
+        } else {
+            result[i].resize(n_tokens[i]);
+        }
+    }
+
+    return result;
+}
+
 std::string common_token_to_piece(const struct llama_context * ctx, llama_token token, bool special) {
     const llama_model * model = llama_get_model(ctx);
     const llama_vocab * vocab = llama_model_get_vocab(model);
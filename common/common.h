@@ -189,6 +189,13 @@ struct common_params_sampling {
     std::string print() const;
 };
 
+// an additional serving pool of llama-server, sharing the model of the main one
+struct common_server_pool {
+    std::string              alias;     // requests for this model are served by the pool
+    std::vector<std::string> api_keys;  // requests with one of these keys are served by the pool
+    struct cpu_params        cpuparams; // threads of the pool (default: same as the main pool)
+};
+
 struct common_params_model {
     std::string path    = ""; // model local path                                           // NOLINT
     std::string url     = ""; // model url to download                                      // NOLINT
@@ -286,6 +293,7 @@ struct common_params {
     float   yarn_beta_slow        =  1.0f; // YaRN high correction dim
     int32_t yarn_orig_ctx         =     0; // YaRN original context length
     float   defrag_thold          =  0.1f; // KV cache defragmentation threshold
+    int32_t n_logits_top          =     0; // if > 0, select only the top n logits on the backend (0 = full logits)
 
     // offload params
     std::vector<ggml_backend_dev_t> devices; // devices to use for offloading
@@ -326,6 +334,7 @@ struct common_params {
     std::string lookup_cache_static  = ""; // path of static ngram cache file for lookup decoding           // NOLINT
     std::string lookup_cache_dynamic = ""; // path of dynamic ngram cache file for lookup decoding          // NOLINT
     std::string logits_file          = ""; // file for saving *all* logits                                  // NOLINT
+    std::string repack_cache         = ""; // directory of the cache of the repacked CPU weights            // NOLINT
 
     std::vector<std::string> in_files;   // all input files
     std::vector<std::string> antiprompt; // strings upon which more user input is prompted (a.k.a. reverse prompts)
@@ -372,9 +381,11 @@ struct common_params {
     bool cont_batching     = true;  // insert new sequences for decoding on-the-fly
     bool flash_attn        = false; // flash attention
     bool no_perf           = false; // disable performance metrics
+    bool profile_ops       = false; // record the time spent in each graph op
     bool ctx_shift         = true;  // context shift on inifinite text generation
     bool swa_full          = false; // use full-size SWA cache (https://github.com/ggml-org/llama.cpp/pull/13194#issuecomment-2868343055)
     bool kv_unified        = false; // enable unified KV cache
+    bool auto_threads      = false; // adapt the number of threads of each ubatch to the fastest measured
 
     bool input_prefix_bos  = false; // prefix BOS to user inputs, preceding input_prefix
     bool use_mmap          = true;  // use mmap for faster loads
@@ -432,6 +443,8 @@ struct common_params {
 
     std::vector<std::string> api_keys;
 
+    std::vector<common_server_pool> server_pools; // additional pools with their own context, slots and threads
+
     std::string ssl_file_key  = "";                                                                         // NOLINT
     std::string ssl_file_cert = "";                                                                         // NOLINT
 
@@ -480,6 +493,8 @@ struct common_params {
     int32_t n_out_freq  = 10; // output the imatrix every n_out_freq iterations
     int32_t n_save_freq =  0; // save the imatrix every n_save_freq iterations
     int32_t i_chunk     =  0; // start processing from this chunk
+    int32_t i_shard     =  0; // process only the chunks i_shard, i_shard + n_shards, ...
+    int32_t n_shards    =  1; // number of processes the chunks are split between
     int8_t  imat_dat    =  0; // whether the legacy imatrix.dat format should be output (gguf <= 0 < dat)
 
     bool process_output  = false; // collect data for the output tensor
@@ -620,6 +635,10 @@ struct common_init_result {
 
 struct common_init_result     common_init_from_params(common_params & params);
 
+// create a context for an already loaded model, the model is not owned by the result
+// the LoRA adapters of params that are already loaded (ptr != nullptr) are reused
+struct common_init_result     common_init_from_model(llama_model * model, common_params & params);
+
 struct llama_model_params     common_model_params_to_llama  (      common_params & params);
 struct llama_context_params   common_context_params_to_llama(const common_params & params);
 struct ggml_threadpool_params ggml_threadpool_params_from_cpu_params(const cpu_params & params);
@@ -670,6 +689,15 @@ std::vector<llama_token> common_tokenize(
                         bool   add_special,
                         bool   parse_special = false);
 
+// tokenizes several strings in parallel, same result as common_tokenize of each string
+// n_threads <= 0 uses all hardware threads
+std::vector<std::vector<llama_token>> common_tokenize_batch(
+    const struct llama_vocab * vocab,
+  const std::vector<std::string> & texts,
+                        bool   add_special,
+                        bool   parse_special = false,
+                     int32_t   n_threads     = 0);
+
 // tokenizes a token into a piece, optionally renders special/control tokens
 // should work similar to Python's `tokenizer.id_to_piece`
 std::string common_token_to_piece(
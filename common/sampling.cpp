@@ -3,7 +3,13 @@
 #include "common.h"
 #include "log.h"
 
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <algorithm>
 
@@ -112,13 +118,32 @@ struct common_sampler {
 
     llama_token_data_array cur_p;
 
-    void set_logits(struct llama_context * ctx, int idx) {
-        const auto * logits = llama_get_logits_ith(ctx, idx);
+    // if > 0, the chain effectively starts with top-k, so only the top-k logits need to become candidates
+    int32_t prefilter_k = 0;
 
-        const llama_model * model = llama_get_model(ctx);
-        const llama_vocab * vocab = llama_model_get_vocab(model);
+    // if prefilter is true, build only the top-k candidates (sorted) instead of the full vocab
+    // the sampling result is the same as with the full candidate array
+    // if ids is not null, the logits are the top logits of the context (sorted) for the tokens in ids
+    void set_logits(const float * logits, const llama_token * ids, int n_vocab, bool prefilter = false) {
+        if (ids) {
+            const int n = prefilter && prefilter_k > 0 ? std::min(prefilter_k, n_vocab) : n_vocab;
 
-        const int n_vocab = llama_vocab_n_tokens(vocab);
+            cur.resize(n);
+
+            for (int i = 0; i < n; i++) {
+                cur[i] = llama_token_data{ids[i], logits[i], 0.0f};
+            }
+
+            cur_p = { cur.data(), cur.size(), -1, true };
+            return;
+        }
+
+        if (prefilter && prefilter_k > 0 && prefilter_k < n_vocab) {
+            common_sampler_prefilter_top_k(logits, n_vocab, prefilter_k, cur);
+
+            cur_p = { cur.data(), cur.size(), -1, true };
+            return;
+        }
 
         cur.resize(n_vocab);
 
@@ -130,6 +155,66 @@ struct common_sampler {
     }
 };
 
+// returns the k of the top-k sampler if all samplers before it leave the candidates untouched, 0 otherwise
+static int32_t common_sampler_get_prefilter_k(const struct common_params_sampling & params) {
+    if (params.mirostat != 0 || !params.logit_bias.empty()) {
+        return 0;
+    }
+
+    for (const auto & cnstr : params.samplers) {
+        switch (cnstr) {
+            case COMMON_SAMPLER_TYPE_TOP_K:
+                return std::max(0, params.top_k);
+            case COMMON_SAMPLER_TYPE_DRY:
+                if (params.dry_multiplier != 0.0f && params.dry_base >= 1.0f && params.dry_penalty_last_n != 0) {
+                    return 0;
+                }
+                break;
+            case COMMON_SAMPLER_TYPE_TOP_P:
+                if (params.top_p < 1.0f) {
+                    return 0;
+                }
+                break;
+            case COMMON_SAMPLER_TYPE_TOP_N_SIGMA:
+                if (params.top_n_sigma > 0.0f) {
+                    return 0;
+                }
+                break;
+            case COMMON_SAMPLER_TYPE_MIN_P:
+                if (params.min_p > 0.0f) {
+                    return 0;
+                }
+                break;
+            case COMMON_SAMPLER_TYPE_XTC:
+                if (params.xtc_probability > 0.0f && params.xtc_threshold <= 0.5f) {
+                    return 0;
+                }
+                break;
+            case COMMON_SAMPLER_TYPE_TYPICAL_P:
+                if (params.typ_p < 1.0f) {
+                    return 0;
+                }
+                break;
+            case COMMON_SAMPLER_TYPE_TEMPERATURE:
+                // plain temperature scaling preserves the order of the logits
+                if (params.temp <= 0.0f || params.dynatemp_range > 0.0f) {
+                    return 0;
+                }
+                break;
+            case COMMON_SAMPLER_TYPE_PENALTIES:
+                if (params.penalty_last_n != 0 &&
+                    (params.penalty_repeat != 1.0f || params.penalty_freq != 0.0f || params.penalty_present != 0.0f)) {
+                    return 0;
+                }
+                break;
+            default:
+                return 0;
+        }
+    }
+
+    return 0;
+}
+
 std::string common_params_sampling::print() const {
     char result[1024];
 
@@ -220,6 +305,7 @@ struct common_sampler * common_sampler_init(const struct llama_model * model, co
         /* .prev   = */ ring_buffer<llama_token>(std::max(32, params.n_prev)),
         /* .cur    = */ {},
         /* .cur_p  = */ {},
+        /* .prefilter_k = */ common_sampler_get_prefilter_k(params),
     };
 
     llama_sampler_chain_add(result->chain,
@@ -321,6 +407,7 @@ struct common_sampler * common_sampler_clone(common_sampler * gsmpl) {
         /* .prev   = */ gsmpl->prev,
         /* .cur    = */ gsmpl->cur,
         /* .cur_p  = */ gsmpl->cur_p,
+        /* .prefilter_k = */ gsmpl->prefilter_k,
     };
 }
 
@@ -335,8 +422,28 @@ void common_perf_print(const struct llama_context * ctx, const struct common_sam
     }
 }
 
-llama_token common_sampler_sample(struct common_sampler * gsmpl, struct llama_context * ctx, int idx, bool grammar_first) {
-    gsmpl->set_logits(ctx, idx);
+// the output of the context for a single token - either the full logits or only the top logits
+struct common_sampler_logits {
+    const float       * logits;
+    const llama_token * ids; // null for the full logits
+    int                 n;
+};
+
+static common_sampler_logits common_sampler_get_logits_ith(struct llama_context * ctx, int idx) {
+    const int n_top = llama_n_logits_top(ctx);
+    if (n_top > 0) {
+        return { llama_get_logits_top_ith(ctx, idx), llama_get_logits_top_ids_ith(ctx, idx), n_top };
+    }
+
+    const llama_model * model = llama_get_model(ctx);
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+
+    return { llama_get_logits_ith(ctx, idx), nullptr, llama_vocab_n_tokens(vocab) };
+}
+
+static llama_token common_sampler_sample_logits(struct common_sampler * gsmpl, const common_sampler_logits & out, bool grammar_first) {
+    // the grammar must see the full vocab, so the prefilter is only used when the chain runs first
+    gsmpl->set_logits(out.logits, out.ids, out.n, !grammar_first);
 
     auto & grmr  = gsmpl->grmr;
     auto & chain = gsmpl->chain;
@@ -371,7 +478,7 @@ llama_token common_sampler_sample(struct common_sampler * gsmpl, struct llama_co
 
     // resampling:
     // if the token is not valid, sample again, but first apply the grammar sampler and then the sampling chain
-    gsmpl->set_logits(ctx, idx);
+    gsmpl->set_logits(out.logits, out.ids, out.n);
 
     llama_sampler_apply(grmr,  &cur_p);
     llama_sampler_apply(chain, &cur_p);
@@ -381,6 +488,135 @@ llama_token common_sampler_sample(struct common_sampler * gsmpl, struct llama_co
     return cur_p.data[cur_p.selected].id;
 }
 
+llama_token common_sampler_sample(struct common_sampler * gsmpl, struct llama_context * ctx, int idx, bool grammar_first) {
+    return common_sampler_sample_logits(gsmpl, common_sampler_get_logits_ith(ctx, idx), grammar_first);
+}
+
+struct common_sampler_pool {
+    std::vector<std::thread> threads;
+
+    std::function<void()> task;
+
+    uint64_t n_runs    = 0;
+    int      n_pending = 0;
+    bool     stop      = false;
+
+    std::exception_ptr error;
+
+    std::mutex              mutex;
+    std::condition_variable cv_task;
+    std::condition_variable cv_done;
+
+    explicit common_sampler_pool(int n_threads) {
+        for (int i = 1; i < n_threads; ++i) {
+            threads.emplace_back([this] {
+                uint64_t n_seen = 0;
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        cv_task.wait(lock, [this, n_seen] { return stop || n_runs != n_seen; });
+                        if (stop) {
+                            return;
+                        }
+                        n_seen = n_runs;
+                    }
+                    execute();
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (--n_pending == 0) {
+                            cv_done.notify_one();
+                        }
+                    }
+                }
+            });
+        }
+    }
+
+    ~common_sampler_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv_task.notify_all();
+        for (auto & t : threads) {
+            t.join();
+        }
+    }
+
+    // run the task, keeping the first exception to rethrow it on the calling thread
+    void execute() {
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+
+    // run compute on n_threads threads (including the calling one) and wait for all of them
+    void run(std::function<void()> compute, int n_threads) {
+        n_threads = std::min(n_threads, (int) threads.size() + 1);
+
+        task  = std::move(compute);
+        error = nullptr;
+
+        if (n_threads > 1) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                n_pending = (int) threads.size();
+                n_runs++;
+            }
+            cv_task.notify_all();
+        }
+
+        execute();
+
+        if (n_threads > 1) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv_done.wait(lock, [this] { return n_pending == 0; });
+        }
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+struct common_sampler_pool * common_sampler_pool_init(int n_threads) {
+    return new common_sampler_pool(std::max(1, n_threads));
+}
+
+void common_sampler_pool_free(struct common_sampler_pool * pool) {
+    delete pool;
+}
+
+std::vector<llama_token> common_sampler_sample_batch(const std::vector<common_sampler *> & gsmpls, struct llama_context * ctx, const std::vector<int> & idxs, struct common_sampler_pool * pool, bool grammar_first) {
+    GGML_ASSERT(gsmpls.size() == idxs.size() && "gsmpls.size() must be equal to idxs.size()");
+
+    const int n_smpl = (int) gsmpls.size();
+
+    // the logits are obtained upfront, because llama_get_logits_ith() synchronizes the context
+    std::vector<common_sampler_logits> logits(n_smpl);
+    for (int i = 0; i < n_smpl; ++i) {
+        logits[i] = common_sampler_get_logits_ith(ctx, idxs[i]);
+    }
+
+    std::vector<llama_token> result(n_smpl);
+
+    // the samplers are independent of each other, so each worker picks the next one to process
+    std::atomic<int> i_next = 0;
+
+    pool->run([&]() {
+        for (int i = i_next++; i < n_smpl; i = i_next++) {
+            result[i] = common_sampler_sample_logits(gsmpls[i], logits[i], grammar_first);
+        }
+    }, n_smpl);
+
+    return result;
+}
+
 std::vector<llama_token> common_sampler_sample_and_accept_n(struct common_sampler * gsmpl, struct llama_context * ctx, const std::vector<int> & idxs, const llama_tokens & draft, bool grammar_first) {
     GGML_ASSERT(idxs.size() == draft.size() + 1 && "idxs.size() must be draft.size() + 1");
 
@@ -426,6 +662,81 @@ uint32_t common_sampler_get_seed(const struct common_sampler * gsmpl) {
 
 // helpers
 
+bool common_sampler_need_logits_full(const struct common_params_sampling & params, int32_t n_logits_top) {
+    return !params.grammar.empty() || !params.logit_bias.empty() || params.n_probs > n_logits_top;
+}
+
+void common_sampler_prefilter_top_k(const float * logits, int32_t n_vocab, int32_t k, std::vector<llama_token_data> & cur) {
+    k = std::min(k, n_vocab);
+
+    cur.clear();
+
+    if (k <= 0) {
+        return;
+    }
+
+    // equal logits are ordered by token id, as in llama_sampler_top_k, so that the same candidates are selected
+    auto comp = [](const llama_token_data & a, const llama_token_data & b) {
+        return a.logit > b.logit || (a.logit == b.logit && a.id < b.id);
+    };
+
+    // single pass with a running threshold: the candidates are gathered into a small buffer and whenever
+    // it fills up, it is cut down to the current top-k and the threshold is raised to the k-th logit
+    // blocks of logits that are all below the threshold are skipped after a (vectorized) max
+    constexpr int32_t block = 16;
+
+    const size_t n_cap = std::max<size_t>(2*k, 256);
+
+    cur.reserve(n_cap + block);
+
+    float threshold = -INFINITY;
+
+    auto gather = [&](int32_t i0, int32_t i1) {
+        for (llama_token token_id = i0; token_id < i1; token_id++) {
+            if (logits[token_id] >= threshold) {
+                cur.push_back(llama_token_data{token_id, logits[token_id], 0.0f});
+            }
+        }
+
+        if (cur.size() >= n_cap) {
+            std::nth_element(cur.begin(), cur.begin() + (k - 1), cur.end(), comp);
+            cur.resize(k);
+            threshold = cur[k - 1].logit;
+        }
+    };
+
+    int32_t i = 0;
+    for (; i + block <= n_vocab; i += block) {
+        float max_l = logits[i];
+        for (int32_t j = 1; j < block; ++j) {
+            max_l = logits[i + j] > max_l ? logits[i + j] : max_l;
+        }
+        if (max_l < threshold) {
+            continue;
+        }
+        gather(i, i + block);
+    }
+    gather(i, n_vocab);
+
+    if ((int32_t) cur.size() < k) {
+        // not enough comparable logits (e.g. nan) - fallback to all of them
+        cur.resize(n_vocab);
+        for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
+            cur[token_id] = llama_token_data{token_id, logits[token_id], 0.0f};
+        }
+        std::partial_sort(cur.begin(), cur.begin() + k, cur.end(), comp);
+        cur.resize(k);
+        return;
+    }
+
+    if ((int32_t) cur.size() > k) {
+        std::nth_element(cur.begin(), cur.begin() + (k - 1), cur.end(), comp);
+        cur.resize(k);
+    }
+
+    std::sort(cur.begin(), cur.end(), comp);
+}
+
 llama_token_data_array * common_sampler_get_candidates(struct common_sampler * gsmpl) {
     return &gsmpl->cur_p;
 }
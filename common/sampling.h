@@ -60,6 +60,22 @@ void common_perf_print(const struct llama_context * ctx, const struct common_sam
 //
 llama_token common_sampler_sample(struct common_sampler * gsmpl, struct llama_context * ctx, int idx, bool grammar_first = false);
 
+// persistent worker threads for common_sampler_sample_batch, the calling thread is one of the n_threads
+struct common_sampler_pool;
+
+struct common_sampler_pool * common_sampler_pool_init(int n_threads);
+void                         common_sampler_pool_free(struct common_sampler_pool * pool);
+
+// batched version of common_sampler_sample, e.g. for the sequences of a batch that have an output
+//
+// samples gsmpls[i] from the logits of output idxs[i], in parallel using the threads of pool
+// the samplers must be distinct, as each of them is used by a single thread
+// an exception thrown by a sampler is rethrown on the calling thread
+//
+// equivalent to calling common_sampler_sample(gsmpls[i], ctx, idxs[i], grammar_first) for each i
+//
+std::vector<llama_token> common_sampler_sample_batch(const std::vector<struct common_sampler *> & gsmpls, struct llama_context * ctx, const std::vector<int> & idxs, struct common_sampler_pool * pool, bool grammar_first = false);
+
 // generalized version of common_sampler_sample
 //
 // will cross-reference the sampled tokens with a batch of draft tokens and accept those that match
@@ -85,6 +101,14 @@ uint32_t common_sampler_get_seed(const struct common_sampler * gsmpl);
 
 // helpers
 
+// true if sampling with these params needs the full logits instead of the top n_logits_top logits of the backend:
+// the grammar and the logit bias can select tokens outside of the top logits, and n_probs can be larger
+bool common_sampler_need_logits_full(const struct common_params_sampling & params, int32_t n_logits_top);
+
+// select the k largest logits into cur, sorted in descending order (the candidates are the ones of the top-k sampler)
+// a max/threshold prefilter avoids building the full n_vocab candidate array
+void common_sampler_prefilter_top_k(const float * logits, int32_t n_vocab, int32_t k, std::vector<llama_token_data> & cur);
+
 // access the internal list of current candidate tokens
 llama_token_data_array * common_sampler_get_candidates(struct common_sampler * gsmpl);
 
@@ -190,8 +190,16 @@ extern "C" {
     typedef void                         (*ggml_backend_set_n_threads_t)(ggml_backend_t backend, int n_threads);
     // Get additional buffer types provided by the device (returns a NULL-terminated array)
     typedef ggml_backend_buffer_type_t * (*ggml_backend_dev_get_extra_bufts_t)(ggml_backend_dev_t device);
+    // Create a read-only buffer of an extra buffer type over weights that are already in its layout, e.g. mapped from a
+    // cache of repacked weights (returns NULL if the buffer type does not support it)
+    typedef ggml_backend_buffer_t        (*ggml_backend_dev_extra_buffer_from_ptr_t)(ggml_backend_buffer_type_t buft, void * ptr, size_t size);
     // Set the abort callback for the backend
     typedef void                         (*ggml_backend_set_abort_callback_t)(ggml_backend_t backend, ggml_abort_callback abort_callback, void * abort_callback_data);
+    // Time spent by thread ith of the backend in a graph node, in ns (see ggml_time_ns)
+    // called before the graph compute returns, in node order and for each thread of a node
+    typedef void                         (*ggml_backend_profile_callback)(const struct ggml_tensor * node, int ith, int64_t t_start, int64_t t_end, void * user_data);
+    // Set the profiling callback for the backend, NULL to disable profiling
+    typedef void                         (*ggml_backend_set_profile_callback_t)(ggml_backend_t backend, ggml_backend_profile_callback callback, void * user_data);
     // Get a list of feature flags supported by the backend (returns a NULL-terminated array)
     struct ggml_backend_feature {
         const char * name;
@@ -321,6 +329,18 @@ extern "C" {
     // Set a callback to be called for each resulting node during graph compute
     GGML_API void                 ggml_backend_sched_set_eval_callback(ggml_backend_sched_t sched, ggml_backend_sched_eval_callback callback, void * user_data);
 
+    // Record the time spent in each node during graph compute, per backend and per thread
+    // backends without a profiling callback (ggml_backend_set_profile_callback) are synchronized after each node
+    GGML_API void                 ggml_backend_sched_set_profiling(ggml_backend_sched_t sched, bool enable);
+    GGML_API bool                 ggml_backend_sched_get_profiling(ggml_backend_sched_t sched);
+    GGML_API void                 ggml_backend_sched_profile_reset(ggml_backend_sched_t sched);
+
+    // The recorded profile, written to buf like snprintf, returns the length of the full output
+    // summary: markdown table of the time, GFLOP/s and GB/s per backend, op, types and shapes
+    GGML_API size_t               ggml_backend_sched_profile_summary(ggml_backend_sched_t sched, char * buf, size_t buf_size);
+    // trace: Chrome trace event JSON (chrome://tracing, https://ui.perfetto.dev), one event per node and thread
+    GGML_API size_t               ggml_backend_sched_profile_trace(ggml_backend_sched_t sched, char * buf, size_t buf_size);
+
     //
     // Utils
     //
@@ -19,6 +19,9 @@ extern "C" {
         // abort ggml_graph_compute when true
         ggml_abort_callback abort_callback;
         void *              abort_callback_data;
+
+        // optional, per-node timings in ns: [n_threads][n_nodes] pairs of start and end time, zero for the nodes not computed by a thread
+        int64_t * profile_data;
     };
 
     // numa strategies
@@ -70,6 +73,10 @@ extern "C" {
     // note: the drawback of this API is that you must have ensured that the context has enough memory for the work data
     GGML_BACKEND_API enum ggml_status  ggml_graph_compute_with_ctx(struct ggml_context * ctx, struct ggml_cgraph * cgraph, int n_threads);
 
+    // number of thread barriers used by ggml_graph_compute() to compute the graph with the plan
+    // the threads only synchronize before the nodes that depend on the nodes computed since the previous barrier
+    GGML_BACKEND_API int               ggml_graph_n_barriers(const struct ggml_cgraph * cgraph, const struct ggml_cplan * cplan);
+
     //
     // system info
     //
@@ -131,6 +138,7 @@ extern "C" {
     GGML_BACKEND_API void ggml_backend_cpu_set_n_threads     (ggml_backend_t backend_cpu, int n_threads);
     GGML_BACKEND_API void ggml_backend_cpu_set_threadpool    (ggml_backend_t backend_cpu, ggml_threadpool_t threadpool);
     GGML_BACKEND_API void ggml_backend_cpu_set_abort_callback(ggml_backend_t backend_cpu, ggml_abort_callback abort_callback, void * abort_callback_data);
+    GGML_BACKEND_API void ggml_backend_cpu_set_profile_callback(ggml_backend_t backend_cpu, ggml_backend_profile_callback profile_callback, void * profile_callback_data);
 
     GGML_BACKEND_API ggml_backend_reg_t ggml_backend_cpu_reg(void);
 
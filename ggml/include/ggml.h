@@ -546,6 +546,8 @@ extern "C" {
 
         GGML_OP_GLU,
 
+        GGML_OP_ARGSORT_TOP_K,
+
         GGML_OP_COUNT,
     };
 
@@ -671,6 +673,7 @@ extern "C" {
     GGML_API void    ggml_time_init(void); // call this once at the beginning of the program
     GGML_API int64_t ggml_time_ms(void);
     GGML_API int64_t ggml_time_us(void);
+    GGML_API int64_t ggml_time_ns(void);
     GGML_API int64_t ggml_cycles(void);
     GGML_API int64_t ggml_cycles_per_ms(void);
 
@@ -2073,6 +2076,14 @@ extern "C" {
             struct ggml_tensor  * a,
             int                   k);
 
+    // indices of the top k elements per row, in descending order of their values
+    // same as ggml_top_k, but does not sort the full rows and the result is contiguous
+    // intended for long rows with small k (e.g. selecting the sampling candidates from the logits)
+    GGML_API struct ggml_tensor * ggml_argsort_top_k(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            int                   k);
+
 #define GGML_KQ_MASK_PAD 64
 
     // q:    [n_embd_k, n_batch,     n_head,    ne3 ]
@@ -118,6 +118,10 @@ extern "C" {
     // get ith C string from array with given key_id
     GGML_API const char * gguf_get_arr_str (const struct gguf_context * ctx, int64_t key_id, size_t i);
 
+    // get ith string from array with given key_id without copying it, the string is NOT NUL-terminated
+    // for a context read from a file, the string points into the file mapping or buffer, valid until gguf_free
+    GGML_API const char * gguf_get_arr_str_view(const struct gguf_context * ctx, int64_t key_id, size_t i, size_t * len);
+
     GGML_API int64_t        gguf_get_n_tensors    (const struct gguf_context * ctx);
     GGML_API int64_t        gguf_find_tensor      (const struct gguf_context * ctx, const char * name); // returns -1 if the tensor is not found
     GGML_API size_t         gguf_get_tensor_offset(const struct gguf_context * ctx, int64_t tensor_id);
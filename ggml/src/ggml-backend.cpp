@@ -14,6 +14,7 @@
 #include "ggml-impl.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -22,6 +23,8 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <mutex>
+#include <unordered_map>
 
 #ifdef __APPLE__
 #include <sys/types.h>
@@ -615,6 +618,54 @@ struct ggml_backend_sched_split {
     struct ggml_cgraph graph;
 };
 
+// the nodes computed with the same backend, op, types and shapes
+struct ggml_backend_sched_profile_op {
+    int            backend_id;
+    const char *   desc;
+    enum ggml_type type;
+    enum ggml_type src_type[2]; // GGML_TYPE_COUNT when there is no source
+    int64_t        ne[GGML_MAX_DIMS];
+    int64_t        src_ne[2][GGML_MAX_DIMS];
+
+    // estimates per node
+    double flops;
+    double bytes;
+
+    int64_t n_nodes;
+    int64_t t_ns;        // from the start of the first thread to the end of the last thread, summed over the nodes
+    int64_t t_thread_ns; // summed over the threads and the nodes
+};
+
+struct ggml_backend_sched_profile_event {
+    int     op; // index in ops
+    int     ith;
+    int64_t t_start;
+    int64_t t_end;
+    char    name[GGML_MAX_NAME];
+};
+
+struct ggml_backend_sched_profile {
+    std::mutex mutex;
+
+    std::vector<ggml_backend_sched_profile_op> ops;
+    std::unordered_map<std::string, int>       op_ids;
+
+    std::vector<ggml_backend_sched_profile_event> events;
+    size_t  max_events;
+    int64_t n_dropped;
+
+    // the backend provides the timings of the nodes, otherwise the sched computes the nodes one by one
+    bool has_callback[GGML_SCHED_MAX_BACKENDS];
+
+    // node being recorded
+    int                 cur_backend_id;
+    const ggml_tensor * cur_node;
+    int                 cur_op;
+    int64_t             cur_t_start;
+    int64_t             cur_t_end;
+    int64_t             cur_t_thread;
+};
+
 struct ggml_backend_sched {
     bool is_reset; // true if the scheduler has been reset since the last graph split
     bool is_alloc;
@@ -657,6 +708,9 @@ struct ggml_backend_sched {
     ggml_backend_sched_eval_callback callback_eval;
     void * callback_eval_user_data;
 
+    // NULL when profiling is disabled
+    struct ggml_backend_sched_profile * profile;
+
     char * context_buffer;
     size_t context_buffer_size;
 
@@ -1349,6 +1403,149 @@ static bool ggml_backend_sched_alloc_splits(ggml_backend_sched_t sched) {
     return true;
 }
 
+// profiling
+
+static double ggml_backend_sched_profile_flops(const struct ggml_tensor * node) {
+    switch (node->op) {
+        case GGML_OP_MUL_MAT:
+        case GGML_OP_MUL_MAT_ID:
+            return 2.0 * node->src[0]->ne[0] * ggml_nelements(node);
+        case GGML_OP_OUT_PROD:
+            return 2.0 * node->src[0]->ne[1] * ggml_nelements(node);
+        case GGML_OP_FLASH_ATTN_EXT:
+            {
+                const struct ggml_tensor * q = node->src[0];
+                const struct ggml_tensor * k = node->src[1];
+                const struct ggml_tensor * v = node->src[2];
+                return 2.0 * q->ne[1] * q->ne[2] * q->ne[3] * k->ne[1] * (k->ne[0] + v->ne[0]);
+            }
+        default:
+            return ggml_is_view_op(node->op) || node->op == GGML_OP_NONE ? 0.0 : (double) ggml_nelements(node);
+    }
+}
+
+static double ggml_backend_sched_profile_bytes(const struct ggml_tensor * node) {
+    if (ggml_is_view_op(node->op) || node->op == GGML_OP_NONE) {
+        return 0.0;
+    }
+
+    switch (node->op) {
+        case GGML_OP_GET_ROWS:
+            // only the selected rows are read
+            return 2.0 * ggml_nbytes(node) + ggml_nbytes(node->src[1]);
+        case GGML_OP_MUL_MAT_ID:
+            {
+                // at most the experts used by the tokens are read
+                const struct ggml_tensor * as  = node->src[0];
+                const struct ggml_tensor * ids = node->src[2];
+                const int64_t n_used = std::min(as->ne[2], ids->ne[0] * ids->ne[1]);
+                return (double) ggml_nbytes(as) / as->ne[2] * n_used + ggml_nbytes(node->src[1]) + ggml_nbytes(node);
+            }
+        default:
+            break;
+    }
+
+    double bytes = ggml_nbytes(node);
+    for (int i = 0; i < GGML_MAX_SRC; i++) {
+        if (node->src[i]) {
+            bytes += ggml_nbytes(node->src[i]);
+        }
+    }
+
+    return bytes;
+}
+
+static int ggml_backend_sched_profile_op_id(struct ggml_backend_sched_profile * profile, int backend_id, const struct ggml_tensor * node) {
+    const struct ggml_tensor * src0 = node->src[0];
+    const struct ggml_tensor * src1 = node->src[1];
+
+    std::string key = std::to_string(backend_id) + " " + ggml_op_desc(node);
+    for (const struct ggml_tensor * t : { node, src0, src1 }) {
+        if (t == NULL) {
+            key += " -";
+            continue;
+        }
+        key += " " + std::to_string(t->type);
+        for (int j = 0; j < GGML_MAX_DIMS; j++) {
+            key += " " + std::to_string(t->ne[j]);
+        }
+    }
+
+    auto it = profile->op_ids.find(key);
+    if (it != profile->op_ids.end()) {
+        return it->second;
+    }
+
+    ggml_backend_sched_profile_op op = {};
+    op.backend_id = backend_id;
+    op.desc       = ggml_op_desc(node);
+    op.type       = node->type;
+    for (int i = 0; i < 2; i++) {
+        const struct ggml_tensor * src = node->src[i];
+        op.src_type[i] = src ? src->type : GGML_TYPE_COUNT;
+        for (int j = 0; j < GGML_MAX_DIMS; j++) {
+            op.src_ne[i][j] = src ? src->ne[j] : 0;
+        }
+    }
+    for (int j = 0; j < GGML_MAX_DIMS; j++) {
+        op.ne[j] = node->ne[j];
+    }
+    op.flops = ggml_backend_sched_profile_flops(node);
+    op.bytes = ggml_backend_sched_profile_bytes(node);
+
+    const int id = (int) profile->ops.size();
+    profile->ops.push_back(op);
+    profile->op_ids.emplace(key, id);
+
+    return id;
+}
+
+static void ggml_backend_sched_profile_flush(struct ggml_backend_sched_profile * profile) {
+    if (profile->cur_node == NULL) {
+        return;
+    }
+
+    auto & op = profile->ops[profile->cur_op];
+    op.n_nodes     += 1;
+    op.t_ns        += profile->cur_t_end - profile->cur_t_start;
+    op.t_thread_ns += profile->cur_t_thread;
+
+    profile->cur_node = NULL;
+}
+
+static void ggml_backend_sched_profile_node(const struct ggml_tensor * node, int ith, int64_t t_start, int64_t t_end, void * user_data) {
+    ggml_backend_sched_t sched = (ggml_backend_sched_t) user_data;
+    struct ggml_backend_sched_profile * profile = sched->profile;
+
+    if (node != profile->cur_node) {
+        ggml_backend_sched_profile_flush(profile);
+
+        profile->cur_node     = node;
+        profile->cur_op       = ggml_backend_sched_profile_op_id(profile, profile->cur_backend_id, node);
+        profile->cur_t_start  = t_start;
+        profile->cur_t_end    = t_end;
+        profile->cur_t_thread = 0;
+    }
+
+    profile->cur_t_start   = std::min(profile->cur_t_start, t_start);
+    profile->cur_t_end     = std::max(profile->cur_t_end,   t_end);
+    profile->cur_t_thread += t_end - t_start;
+
+    if (profile->events.size() >= profile->max_events) {
+        profile->n_dropped++;
+        return;
+    }
+
+    ggml_backend_sched_profile_event event;
+    event.op      = profile->cur_op;
+    event.ith     = ith;
+    event.t_start = t_start;
+    event.t_end   = t_end;
+    snprintf(event.name, sizeof(event.name), "%s", node->name);
+
+    profile->events.push_back(event);
+}
+
 static enum ggml_status ggml_backend_sched_compute_splits(ggml_backend_sched_t sched) {
     struct ggml_backend_sched_split * splits = sched->splits;
 
@@ -1392,11 +1589,38 @@ static enum ggml_status ggml_backend_sched_compute_splits(ggml_backend_sched_t s
             }
         }
 
-        if (!sched->callback_eval) {
+        // the backend cannot time the nodes, compute them one by one
+        const bool profile_nodes = sched->profile && !sched->profile->has_callback[split_backend_id];
+
+        if (sched->profile) {
+            sched->profile->cur_backend_id = split_backend_id;
+        }
+
+        if (!sched->callback_eval && !profile_nodes) {
             enum ggml_status ec = ggml_backend_graph_compute_async(split_backend, &split->graph);
             if (ec != GGML_STATUS_SUCCESS) {
                 return ec;
             }
+        } else if (!sched->callback_eval) {
+            ggml_backend_synchronize(split_backend);
+
+            for (int j = 0; j < split->graph.n_nodes; j++) {
+                struct ggml_tensor * t = split->graph.nodes[j];
+
+                struct ggml_cgraph gv = ggml_graph_view(&split->graph, j, j + 1);
+
+                const int64_t t_start = ggml_time_ns();
+
+                enum ggml_status ec = ggml_backend_graph_compute_async(split_backend, &gv);
+                if (ec != GGML_STATUS_SUCCESS) {
+                    return ec;
+                }
+                ggml_backend_synchronize(split_backend);
+
+                if (!ggml_is_view_op(t->op) && t->op != GGML_OP_NONE) {
+                    ggml_backend_sched_profile_node(t, 0, t_start, ggml_time_ns(), sched);
+                }
+            }
         } else {
             // similar to ggml_backend_compare_graph_backend
             for (int j0 = 0; j0 < split->graph.n_nodes; j0++) {
@@ -1431,6 +1655,10 @@ static enum ggml_status ggml_backend_sched_compute_splits(ggml_backend_sched_t s
             }
         }
 
+        if (sched->profile) {
+            ggml_backend_sched_profile_flush(sched->profile);
+        }
+
         // record the event of this copy
         if (split->n_inputs > 0) {
             if (sched->events[split_backend_id][sched->cur_copy] != NULL) {
@@ -1504,6 +1732,8 @@ void ggml_backend_sched_free(ggml_backend_sched_t sched) {
     if (sched == NULL) {
         return;
     }
+    // the backends may already be freed, so their profiling callbacks are not reset here
+    delete sched->profile;
     for (int b = 0; b < sched->n_backends; b++) {
         for (int c = 0; c < sched->n_copies; c++) {
             ggml_backend_event_free(sched->events[b][c]);
@@ -1587,6 +1817,11 @@ enum ggml_status ggml_backend_sched_graph_compute_async(ggml_backend_sched_t sch
         }
     }
 
+    if (sched->profile) {
+        std::lock_guard<std::mutex> lock(sched->profile->mutex);
+        return ggml_backend_sched_compute_splits(sched);
+    }
+
     return ggml_backend_sched_compute_splits(sched);
 }
 
@@ -1607,6 +1842,208 @@ void ggml_backend_sched_set_eval_callback(ggml_backend_sched_t sched, ggml_backe
     sched->callback_eval_user_data = user_data;
 }
 
+static ggml_backend_set_profile_callback_t ggml_backend_sched_get_profile_fn(ggml_backend_t backend) {
+    ggml_backend_dev_t dev = ggml_backend_get_device(backend);
+    ggml_backend_reg_t reg = dev ? ggml_backend_dev_backend_reg(dev) : NULL;
+    if (reg == NULL) {
+        return NULL;
+    }
+    return (ggml_backend_set_profile_callback_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_set_profile_callback");
+}
+
+void ggml_backend_sched_set_profiling(ggml_backend_sched_t sched, bool enable) {
+    if (enable == (sched->profile != NULL)) {
+        return;
+    }
+
+    if (!enable) {
+        for (int i = 0; i < sched->n_backends; i++) {
+            if (sched->profile->has_callback[i]) {
+                ggml_backend_sched_get_profile_fn(sched->backends[i])(sched->backends[i], NULL, NULL);
+            }
+        }
+        delete sched->profile;
+        sched->profile = NULL;
+        return;
+    }
+
+    struct ggml_backend_sched_profile * profile = new ggml_backend_sched_profile;
+
+    const char * GGML_SCHED_PROFILE_MAX_EVENTS = getenv("GGML_SCHED_PROFILE_MAX_EVENTS");
+    profile->max_events     = GGML_SCHED_PROFILE_MAX_EVENTS ? (size_t) atoll(GGML_SCHED_PROFILE_MAX_EVENTS) : (size_t) 1 << 20;
+    profile->n_dropped      = 0;
+    profile->cur_backend_id = 0;
+    profile->cur_node       = NULL;
+    profile->cur_op         = -1;
+    profile->cur_t_start    = 0;
+    profile->cur_t_end      = 0;
+    profile->cur_t_thread   = 0;
+
+    for (int i = 0; i < sched->n_backends; i++) {
+        ggml_backend_set_profile_callback_t set_profile_callback_fn = ggml_backend_sched_get_profile_fn(sched->backends[i]);
+        profile->has_callback[i] = set_profile_callback_fn != NULL;
+        if (set_profile_callback_fn) {
+            set_profile_callback_fn(sched->backends[i], ggml_backend_sched_profile_node, sched);
+        }
+    }
+
+    sched->profile = profile;
+}
+
+bool ggml_backend_sched_get_profiling(ggml_backend_sched_t sched) {
+    return sched->profile != NULL;
+}
+
+void ggml_backend_sched_profile_reset(ggml_backend_sched_t sched) {
+    if (sched->profile == NULL) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(sched->profile->mutex);
+
+    sched->profile->ops.clear();
+    sched->profile->op_ids.clear();
+    sched->profile->events.clear();
+    sched->profile->n_dropped = 0;
+}
+
+static size_t ggml_backend_sched_profile_output(const std::string & str, char * buf, size_t buf_size) {
+    if (buf_size > 0) {
+        const size_t n = std::min(str.size(), buf_size - 1);
+        memcpy(buf, str.data(), n);
+        buf[n] = '\0';
+    }
+    return str.size();
+}
+
+// type and shape of a tensor, without the trailing dimensions of size 1: "q4_0 4096x4096"
+static std::string ggml_backend_sched_profile_tensor_desc(enum ggml_type type, const int64_t * ne) {
+    if (type == GGML_TYPE_COUNT) {
+        return "-";
+    }
+
+    int n_dims = GGML_MAX_DIMS;
+    while (n_dims > 1 && ne[n_dims - 1] == 1) {
+        n_dims--;
+    }
+
+    std::string desc = ggml_type_name(type);
+    for (int i = 0; i < n_dims; i++) {
+        desc += (i == 0 ? " " : "x") + std::to_string(ne[i]);
+    }
+    return desc;
+}
+
+size_t ggml_backend_sched_profile_summary(ggml_backend_sched_t sched, char * buf, size_t buf_size) {
+    if (sched->profile == NULL) {
+        return ggml_backend_sched_profile_output("", buf, buf_size);
+    }
+
+    std::lock_guard<std::mutex> lock(sched->profile->mutex);
+
+    const auto & ops = sched->profile->ops;
+
+    std::vector<int> order(ops.size());
+    for (size_t i = 0; i < ops.size(); i++) {
+        order[i] = (int) i;
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return ops[a].t_ns > ops[b].t_ns; });
+
+    int64_t t_total = 0;
+    int64_t n_nodes = 0;
+    for (const auto & op : ops) {
+        t_total += op.t_ns;
+        n_nodes += op.n_nodes;
+    }
+
+    std::string str;
+    char line[1024];
+
+    snprintf(line, sizeof(line), "total: %.3f ms, %" PRId64 " nodes, %zu trace events, %" PRId64 " dropped\n\n",
+        1e-6*t_total, n_nodes, sched->profile->events.size(), sched->profile->n_dropped);
+    str += line;
+
+    str += "| backend | op | type | src0 | src1 | nodes | time (ms) | time (%) | avg (us) | threads | GFLOP/s | GB/s |\n";
+    str += "| ------- | -- | ---- | ---- | ---- | ----: | --------: | -------: | -------: | ------: | ------: | ---: |\n";
+
+    for (int i : order) {
+        const auto & op = ops[i];
+        if (op.n_nodes == 0) {
+            continue;
+        }
+
+        const double t_s = 1e-9*op.t_ns;
+
+        snprintf(line, sizeof(line), "| %s | %s | %s | %s | %s | %" PRId64 " | %.3f | %.2f | %.2f | %.2f | %.2f | %.2f |\n",
+            ggml_backend_name(sched->backends[op.backend_id]), op.desc,
+            ggml_backend_sched_profile_tensor_desc(op.type, op.ne).c_str(),
+            ggml_backend_sched_profile_tensor_desc(op.src_type[0], op.src_ne[0]).c_str(),
+            ggml_backend_sched_profile_tensor_desc(op.src_type[1], op.src_ne[1]).c_str(),
+            op.n_nodes, 1e-6*op.t_ns, t_total > 0 ? 100.0*op.t_ns/t_total : 0.0, 1e-3*op.t_ns/op.n_nodes,
+            op.t_ns > 0 ? (double) op.t_thread_ns/op.t_ns : 0.0,
+            t_s > 0 ? 1e-9*op.flops*op.n_nodes/t_s : 0.0,
+            t_s > 0 ? 1e-9*op.bytes*op.n_nodes/t_s : 0.0);
+        str += line;
+    }
+
+    return ggml_backend_sched_profile_output(str, buf, buf_size);
+}
+
+static std::string ggml_backend_sched_profile_json_str(const char * s) {
+    std::string res = "\"";
+    for (; *s; s++) {
+        const unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            res += '\\';
+            res += c;
+        } else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            res += esc;
+        } else {
+            res += c;
+        }
+    }
+    return res + "\"";
+}
+
+size_t ggml_backend_sched_profile_trace(ggml_backend_sched_t sched, char * buf, size_t buf_size) {
+    if (sched->profile == NULL) {
+        return ggml_backend_sched_profile_output("", buf, buf_size);
+    }
+
+    std::lock_guard<std::mutex> lock(sched->profile->mutex);
+
+    const auto & ops = sched->profile->ops;
+
+    std::string str = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    char line[1024];
+
+    // one process per backend
+    for (int i = 0; i < sched->n_backends; i++) {
+        snprintf(line, sizeof(line), "%s\n{\"ph\":\"M\",\"pid\":%d,\"name\":\"process_name\",\"args\":{\"name\":%s}}",
+            i == 0 ? "" : ",", i, ggml_backend_sched_profile_json_str(ggml_backend_name(sched->backends[i])).c_str());
+        str += line;
+    }
+
+    // one thread per backend thread
+    for (const auto & event : sched->profile->events) {
+        const auto & op = ops[event.op];
+
+        snprintf(line, sizeof(line), ",\n{\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"%s\",\"args\":{\"node\":%s,\"type\":\"%s\",\"src0\":\"%s\",\"src1\":\"%s\"}}",
+            op.backend_id, event.ith, 1e-3*event.t_start, 1e-3*(event.t_end - event.t_start), op.desc,
+            ggml_backend_sched_profile_json_str(event.name).c_str(),
+            ggml_backend_sched_profile_tensor_desc(op.type, op.ne).c_str(),
+            ggml_backend_sched_profile_tensor_desc(op.src_type[0], op.src_ne[0]).c_str(),
+            ggml_backend_sched_profile_tensor_desc(op.src_type[1], op.src_ne[1]).c_str());
+        str += line;
+    }
+
+    str += "\n]}\n";
+
+    return ggml_backend_sched_profile_output(str, buf, buf_size);
+}
+
 int ggml_backend_sched_get_n_splits(ggml_backend_sched_t sched) {
     return sched->n_splits;
 }
@@ -116,6 +116,19 @@ static ggml_backend_buffer_i ggml_backend_amx_buffer_interface = {
     /* .reset           = */ nullptr,
 };
 
+// buffer over weights that are already converted, the memory is not owned by the buffer and may be read-only
+static ggml_backend_buffer_i ggml_backend_amx_buffer_from_ptr_interface = {
+    /* .free_buffer     = */ nullptr,
+    /* .get_base        = */ ggml_backend_amx_buffer_get_base,
+    /* .init_tensor     = */ ggml_backend_amx_buffer_init_tensor,
+    /* .memset_tensor   = */ nullptr,
+    /* .set_tensor      = */ nullptr,
+    /* .get_tensor      = */ nullptr,
+    /* .cpy_tensor      = */ nullptr,
+    /* .clear           = */ nullptr,
+    /* .reset           = */ nullptr,
+};
+
 static const char * ggml_backend_amx_buffer_type_get_name(ggml_backend_buffer_type_t buft) {
     return "AMX";
 
@@ -132,6 +145,11 @@ static ggml_backend_buffer_t ggml_backend_amx_buffer_type_alloc_buffer(ggml_back
     return ggml_backend_buffer_init(buft, ggml_backend_amx_buffer_interface, data, size);
 }
 
+ggml_backend_buffer_t ggml_backend_amx_buffer_from_ptr(void * ptr, size_t size) {
+    GGML_ASSERT((uintptr_t) ptr % TENSOR_ALIGNMENT == 0 && "buffer pointer must be aligned");
+    return ggml_backend_buffer_init(ggml_backend_amx_buffer_type(), ggml_backend_amx_buffer_from_ptr_interface, ptr, size);
+}
+
 static size_t ggml_backend_amx_buffer_type_get_alignment(ggml_backend_buffer_type_t buft) {
     return TENSOR_ALIGNMENT;
 
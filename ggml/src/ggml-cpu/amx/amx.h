@@ -5,4 +5,7 @@
 
 #if defined(__AMX_INT8__) && defined(__AVX512VNNI__)
 ggml_backend_buffer_type_t ggml_backend_amx_buffer_type(void);
+
+// read-only buffer over weights that are already converted
+ggml_backend_buffer_t ggml_backend_amx_buffer_from_ptr(void * ptr, size_t size);
 #endif
@@ -1127,6 +1127,95 @@ void ggml_vec_dot_q8_0_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const voi
     *s = sumf;
 }
 
+void ggml_vec_mad_q4_0(int n, float * GGML_RESTRICT y, const void * GGML_RESTRICT vx, float v) {
+    const int qk = QK4_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q4_0 * GGML_RESTRICT x = vx;
+
+    int ib = 0;
+
+#if defined(__ARM_NEON)
+    const uint8x16_t m4b = vdupq_n_u8(0x0F);
+    const int8x16_t  s8b = vdupq_n_s8(0x8);
+
+    for (; ib < nb; ++ib) {
+        const float32x4_t d = vdupq_n_f32(GGML_CPU_FP16_TO_FP32(x[ib].d)*v);
+
+        // low nibbles are the first 16 values, high nibbles the last 16
+        const uint8x16_t q  = vld1q_u8(x[ib].qs);
+        const int8x16_t  q0 = vsubq_s8(vreinterpretq_s8_u8(vandq_u8(q, m4b)), s8b);
+        const int8x16_t  q1 = vsubq_s8(vreinterpretq_s8_u8(vshrq_n_u8(q, 4)), s8b);
+
+        const int16x8_t q00 = vmovl_s8(vget_low_s8 (q0));
+        const int16x8_t q01 = vmovl_s8(vget_high_s8(q0));
+        const int16x8_t q10 = vmovl_s8(vget_low_s8 (q1));
+        const int16x8_t q11 = vmovl_s8(vget_high_s8(q1));
+
+        float * GGML_RESTRICT yb = y + ib*qk;
+
+        vst1q_f32(yb +  0, vfmaq_f32(vld1q_f32(yb +  0), vcvtq_f32_s32(vmovl_s16(vget_low_s16 (q00))), d));
+        vst1q_f32(yb +  4, vfmaq_f32(vld1q_f32(yb +  4), vcvtq_f32_s32(vmovl_s16(vget_high_s16(q00))), d));
+        vst1q_f32(yb +  8, vfmaq_f32(vld1q_f32(yb +  8), vcvtq_f32_s32(vmovl_s16(vget_low_s16 (q01))), d));
+        vst1q_f32(yb + 12, vfmaq_f32(vld1q_f32(yb + 12), vcvtq_f32_s32(vmovl_s16(vget_high_s16(q01))), d));
+        vst1q_f32(yb + 16, vfmaq_f32(vld1q_f32(yb + 16), vcvtq_f32_s32(vmovl_s16(vget_low_s16 (q10))), d));
+        vst1q_f32(yb + 20, vfmaq_f32(vld1q_f32(yb + 20), vcvtq_f32_s32(vmovl_s16(vget_high_s16(q10))), d));
+        vst1q_f32(yb + 24, vfmaq_f32(vld1q_f32(yb + 24), vcvtq_f32_s32(vmovl_s16(vget_low_s16 (q11))), d));
+        vst1q_f32(yb + 28, vfmaq_f32(vld1q_f32(yb + 28), vcvtq_f32_s32(vmovl_s16(vget_high_s16(q11))), d));
+    }
+#endif
+    for (; ib < nb; ++ib) {
+        const float d = GGML_CPU_FP16_TO_FP32(x[ib].d)*v;
+
+        for (int j = 0; j < qk/2; ++j) {
+            const int v0 = (x[ib].qs[j] & 0x0F) - 8;
+            const int v1 = (x[ib].qs[j] >>   4) - 8;
+
+            y[ib*qk + j       ] += v0*d;
+            y[ib*qk + j + qk/2] += v1*d;
+        }
+    }
+}
+
+void ggml_vec_mad_q8_0(int n, float * GGML_RESTRICT y, const void * GGML_RESTRICT vx, float v) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q8_0 * GGML_RESTRICT x = vx;
+
+    int ib = 0;
+
+#if defined(__ARM_NEON)
+    for (; ib < nb; ++ib) {
+        const float32x4_t d = vdupq_n_f32(GGML_CPU_FP16_TO_FP32(x[ib].d)*v);
+
+        float * GGML_RESTRICT yb = y + ib*qk;
+
+        for (int j = 0; j < qk; j += 16) {
+            const int8x16_t q  = vld1q_s8(x[ib].qs + j);
+            const int16x8_t q0 = vmovl_s8(vget_low_s8 (q));
+            const int16x8_t q1 = vmovl_s8(vget_high_s8(q));
+
+            vst1q_f32(yb + j +  0, vfmaq_f32(vld1q_f32(yb + j +  0), vcvtq_f32_s32(vmovl_s16(vget_low_s16 (q0))), d));
+            vst1q_f32(yb + j +  4, vfmaq_f32(vld1q_f32(yb + j +  4), vcvtq_f32_s32(vmovl_s16(vget_high_s16(q0))), d));
+            vst1q_f32(yb + j +  8, vfmaq_f32(vld1q_f32(yb + j +  8), vcvtq_f32_s32(vmovl_s16(vget_low_s16 (q1))), d));
+            vst1q_f32(yb + j + 12, vfmaq_f32(vld1q_f32(yb + j + 12), vcvtq_f32_s32(vmovl_s16(vget_high_s16(q1))), d));
+        }
+    }
+#endif
+    for (; ib < nb; ++ib) {
+        const float d = GGML_CPU_FP16_TO_FP32(x[ib].d)*v;
+
+        for (int j = 0; j < qk; ++j) {
+            y[ib*qk + j] += x[ib].qs[j]*d;
+        }
+    }
+}
+
 void ggml_vec_dot_tq1_0_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, size_t bx, const void * GGML_RESTRICT vy, size_t by, int nrc) {
     assert(nrc == 1);
     UNUSED(nrc);
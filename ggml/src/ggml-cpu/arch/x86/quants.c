@@ -1076,6 +1076,108 @@ void ggml_vec_dot_q8_0_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const voi
     *s = sumf;
 }
 
+void ggml_vec_mad_q4_0(int n, float * GGML_RESTRICT y, const void * GGML_RESTRICT vx, float v) {
+    const int qk = QK4_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q4_0 * GGML_RESTRICT x = vx;
+
+    int ib = 0;
+
+#if defined(__AVX512F__)
+    const __m128i m4 = _mm_set1_epi8(0x0F);
+    const __m128i s8 = _mm_set1_epi8(8);
+
+    for (; ib < nb; ++ib) {
+        const __m512 d = _mm512_set1_ps(GGML_CPU_FP16_TO_FP32(x[ib].d)*v);
+
+        // low nibbles are the first 16 values, high nibbles the last 16
+        const __m128i q  = _mm_loadu_si128((const __m128i *)x[ib].qs);
+        const __m128i q0 = _mm_sub_epi8(_mm_and_si128(q, m4), s8);
+        const __m128i q1 = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(q, 4), m4), s8);
+
+        float * GGML_RESTRICT yb = y + ib*qk;
+
+        _mm512_storeu_ps(yb +  0, _mm512_fmadd_ps(_mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(q0)), d, _mm512_loadu_ps(yb +  0)));
+        _mm512_storeu_ps(yb + 16, _mm512_fmadd_ps(_mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(q1)), d, _mm512_loadu_ps(yb + 16)));
+    }
+#elif defined(__AVX2__)
+    const __m128i m4 = _mm_set1_epi8(0x0F);
+    const __m128i s8 = _mm_set1_epi8(8);
+
+    for (; ib < nb; ++ib) {
+        const __m256 d = _mm256_set1_ps(GGML_CPU_FP16_TO_FP32(x[ib].d)*v);
+
+        // low nibbles are the first 16 values, high nibbles the last 16
+        const __m128i q  = _mm_loadu_si128((const __m128i *)x[ib].qs);
+        const __m128i q0 = _mm_sub_epi8(_mm_and_si128(q, m4), s8);
+        const __m128i q1 = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(q, 4), m4), s8);
+
+        float * GGML_RESTRICT yb = y + ib*qk;
+
+        _mm256_storeu_ps(yb +  0, _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(q0)),                    d, _mm256_loadu_ps(yb +  0)));
+        _mm256_storeu_ps(yb +  8, _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(q0, 8))), d, _mm256_loadu_ps(yb +  8)));
+        _mm256_storeu_ps(yb + 16, _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(q1)),                    d, _mm256_loadu_ps(yb + 16)));
+        _mm256_storeu_ps(yb + 24, _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(q1, 8))), d, _mm256_loadu_ps(yb + 24)));
+    }
+#endif
+    for (; ib < nb; ++ib) {
+        const float d = GGML_CPU_FP16_TO_FP32(x[ib].d)*v;
+
+        for (int j = 0; j < qk/2; ++j) {
+            const int v0 = (x[ib].qs[j] & 0x0F) - 8;
+            const int v1 = (x[ib].qs[j] >>   4) - 8;
+
+            y[ib*qk + j       ] += v0*d;
+            y[ib*qk + j + qk/2] += v1*d;
+        }
+    }
+}
+
+void ggml_vec_mad_q8_0(int n, float * GGML_RESTRICT y, const void * GGML_RESTRICT vx, float v) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q8_0 * GGML_RESTRICT x = vx;
+
+    int ib = 0;
+
+#if defined(__AVX512F__)
+    for (; ib < nb; ++ib) {
+        const __m512 d = _mm512_set1_ps(GGML_CPU_FP16_TO_FP32(x[ib].d)*v);
+
+        float * GGML_RESTRICT yb = y + ib*qk;
+
+        for (int j = 0; j < qk; j += 16) {
+            const __m512 q = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *)(x[ib].qs + j))));
+            _mm512_storeu_ps(yb + j, _mm512_fmadd_ps(q, d, _mm512_loadu_ps(yb + j)));
+        }
+    }
+#elif defined(__AVX2__)
+    for (; ib < nb; ++ib) {
+        const __m256 d = _mm256_set1_ps(GGML_CPU_FP16_TO_FP32(x[ib].d)*v);
+
+        float * GGML_RESTRICT yb = y + ib*qk;
+
+        for (int j = 0; j < qk; j += 8) {
+            const __m256 q = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)(x[ib].qs + j))));
+            _mm256_storeu_ps(yb + j, _mm256_fmadd_ps(q, d, _mm256_loadu_ps(yb + j)));
+        }
+    }
+#endif
+    for (; ib < nb; ++ib) {
+        const float d = GGML_CPU_FP16_TO_FP32(x[ib].d)*v;
+
+        for (int j = 0; j < qk; ++j) {
+            y[ib*qk + j] += x[ib].qs[j]*d;
+        }
+    }
+}
+
 void ggml_vec_dot_tq1_0_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, size_t bx, const void * GGML_RESTRICT vy, size_t by, int nrc) {
     assert(nrc == 1);
     UNUSED(nrc);
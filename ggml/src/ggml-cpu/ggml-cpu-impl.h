@@ -512,6 +512,11 @@ void ggml_barrier(struct ggml_threadpool * tp);
 void ggml_threadpool_chunk_set(struct ggml_threadpool * tp, int value);
 int  ggml_threadpool_chunk_add(struct ggml_threadpool * tp, int value);
 
+// number of NUMA nodes the weights are replicated on, 1 unless the NUMA strategy is GGML_NUMA_STRATEGY_MIRROR
+int ggml_cpu_numa_mirror_n_nodes(void);
+// NUMA node the compute thread ith runs on with GGML_NUMA_STRATEGY_MIRROR
+int ggml_cpu_numa_mirror_node(int ith);
+
 #ifdef __cplusplus
 }
 #endif
@@ -129,6 +129,15 @@ static LONG atomic_fetch_add_explicit(atomic_int * ptr, LONG inc, memory_order m
     // TODO: add support for explicit memory order
     return InterlockedExchangeAdd(ptr, inc);
 }
+static bool atomic_compare_exchange_weak_explicit(atomic_int * ptr, int * expected, int desired, memory_order mo_succ, memory_order mo_fail) {
+    // TODO: add support for explicit memory order
+    const LONG prev = InterlockedCompareExchange(ptr, desired, *expected);
+    if (prev == *expected) {
+        return true;
+    }
+    *expected = prev;
+    return false;
+}
 static atomic_bool atomic_flag_test_and_set(atomic_flag * ptr) {
     return InterlockedExchange(ptr, 1);
 }
@@ -445,6 +454,8 @@ struct ggml_threadpool {
     struct ggml_cgraph * cgraph;
     struct ggml_cplan  * cplan;
 
+    const struct ggml_graph_sched * sched; // dependency schedule of cgraph, NULL to compute the nodes one by one
+
     // synchronization primitives
     atomic_int n_graph;       // incremented when there is work to be done (i.e each graph)
     atomic_int GGML_CACHE_ALIGN n_barrier;
@@ -476,6 +487,9 @@ struct ggml_compute_state {
 #endif
     struct ggml_threadpool * threadpool;
     int ith;
+
+    // range of matrix multiplication chunks of the thread, see ggml_chunk_range_init
+    atomic_int GGML_CACHE_ALIGN chunks;
 };
 
 // Helpers for polling loops
@@ -572,6 +586,62 @@ int ggml_threadpool_chunk_add(struct ggml_threadpool * tp, int value) {
     return atomic_fetch_add_explicit(&tp->current_chunk, value, memory_order_relaxed);
 }
 
+// work-stealing chunk ranges
+//
+// the chunks of a matrix multiplication are split into one contiguous range per thread, in the same way for every graph,
+// so that a thread keeps computing the same weight rows. a thread takes the chunks of its range from the front,
+// and when it is empty, steals chunks from the back of the ranges of the other threads.
+// a range [begin, end) is packed in one atomic int, 16 bits each
+// the chunks are limited to 15 bits, so that begin << 16 does not overflow the int
+
+#define GGML_CHUNK_MAX 0x7FFF
+
+static void ggml_chunk_range_init(struct ggml_threadpool * tp, int ith, int nth, int n_chunks) {
+    GGML_ASSERT(n_chunks <= GGML_CHUNK_MAX);
+
+    const int begin = (int) (((int64_t) n_chunks*ith)/nth);
+    const int end   = (int) (((int64_t) n_chunks*(ith + 1))/nth);
+
+    atomic_store_explicit(&tp->workers[ith].chunks, (begin << 16) | end, memory_order_relaxed);
+}
+
+static bool ggml_chunk_range_take(atomic_int * range, bool front, int * chunk) {
+    int cur = atomic_load_explicit(range, memory_order_relaxed);
+
+    while (true) {
+        const int begin = (cur >> 16) & 0xFFFF;
+        const int end   =  cur        & 0xFFFF;
+
+        if (begin >= end) {
+            return false;
+        }
+
+        const int next = front ? ((begin + 1) << 16) | end : (begin << 16) | (end - 1);
+
+        if (atomic_compare_exchange_weak_explicit(range, &cur, next, memory_order_relaxed, memory_order_relaxed)) {
+            *chunk = front ? begin : end - 1;
+            return true;
+        }
+    }
+}
+
+// next chunk to compute by thread ith, -1 when all the chunks have been taken
+static int ggml_chunk_range_next(struct ggml_threadpool * tp, int ith, int nth) {
+    int chunk;
+
+    if (ggml_chunk_range_take(&tp->workers[ith].chunks, true, &chunk)) {
+        return chunk;
+    }
+
+    for (int i = 1; i < nth; i++) {
+        if (ggml_chunk_range_take(&tp->workers[(ith + i) % nth].chunks, false, &chunk)) {
+            return chunk;
+        }
+    }
+
+    return -1;
+}
+
 #if defined(__gnu_linux__)
 static cpu_set_t ggml_get_numa_affinity(void) {
     cpu_set_t cpuset;
@@ -679,6 +749,19 @@ bool ggml_is_numa(void) {
     return g_state.numa.n_nodes > 1;
 }
 
+int ggml_cpu_numa_mirror_n_nodes(void) {
+    if (!ggml_is_numa() || g_state.numa.numa_strategy != GGML_NUMA_STRATEGY_MIRROR) {
+        return 1;
+    }
+
+    return g_state.numa.n_nodes;
+}
+
+int ggml_cpu_numa_mirror_node(int ith) {
+    // same placement as set_numa_thread_affinity
+    return ith % ggml_cpu_numa_mirror_n_nodes();
+}
+
 #if defined(__ARM_ARCH)
 
 #if defined(__linux__) && defined(__aarch64__)
@@ -693,6 +776,91 @@ static void ggml_init_arm_arch_features(void) {
 
 #endif // __ARM_ARCH
 
+// size of the L2 cache of a core, the matrix multiplication chunks are sized to fit in it
+static size_t ggml_cpu_l2_cache_size = 1024*1024;
+
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+
+static void ggml_init_cache_sizes(void) {
+    size_t l2 = 0;
+
+#if defined(__linux__)
+    for (int i = 0; i < 16; i++) {
+        char path[128];
+        char type[32]  = { 0 };
+        int  level     = 0;
+        size_t size    = 0;
+        char unit      = 0;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+        FILE * f = fopen(path, "r");
+        if (f == NULL) {
+            break;
+        }
+        if (fscanf(f, "%d", &level) != 1) {
+            level = 0;
+        }
+        fclose(f);
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+        f = fopen(path, "r");
+        if (f) {
+            if (fscanf(f, "%31s", type) != 1) {
+                type[0] = 0;
+            }
+            fclose(f);
+        }
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+        f = fopen(path, "r");
+        if (f) {
+            if (fscanf(f, "%zu%c", &size, &unit) < 1) {
+                size = 0;
+            }
+            fclose(f);
+        }
+        size *= unit == 'K' ? 1024 : unit == 'M' ? 1024*1024 : 1;
+
+        if (level == 2 && strcmp(type, "Instruction") != 0) {
+            l2 = size;
+        }
+    }
+#elif defined(__APPLE__)
+    // the L2 cache is shared by the cores of a cluster
+    uint64_t size = 0;
+    int      ncpu = 0;
+    size_t   len  = sizeof(size);
+    if (sysctlbyname("hw.perflevel0.l2cachesize", &size, &len, NULL, 0) == 0) {
+        len = sizeof(ncpu);
+        if (sysctlbyname("hw.perflevel0.cpusperl2", &ncpu, &len, NULL, 0) == 0 && ncpu > 0) {
+            size /= ncpu;
+        }
+        l2 = size;
+    }
+#elif defined(_WIN32)
+    DWORD len = 0;
+    GetLogicalProcessorInformation(NULL, &len);
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION * info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION *) malloc(len);
+    if (info && GetLogicalProcessorInformation(info, &len)) {
+        for (DWORD i = 0; i < len/sizeof(*info); i++) {
+            if (info[i].Relationship == RelationCache && info[i].Cache.Level == 2 && info[i].Cache.Type != CacheInstruction) {
+                l2 = info[i].Cache.Size;
+            }
+        }
+    }
+    free(info);
+#endif
+
+    // ignore implausible values
+    if (l2 >= 64*1024 && l2 <= 64*1024*1024) {
+        ggml_cpu_l2_cache_size = l2;
+    }
+
+    GGML_PRINT_DEBUG("%s: L2 cache size = %zu\n", __func__, ggml_cpu_l2_cache_size);
+}
+
 struct ggml_tensor * ggml_new_i32(struct ggml_context * ctx, int32_t value) {
     GGML_ASSERT(!ggml_get_no_alloc(ctx));
 
@@ -1199,6 +1367,56 @@ static void ggml_compute_forward_mul_mat_one_chunk(
     }
 }
 
+// rows of src0 (dr0) and of src1 (dr1) per chunk of a matrix multiplication
+// the src0 and src1 rows of a chunk fit in half of the L2 cache, and there are at least min_chunks chunks
+// when the rows can be split further, and at most max_chunks
+static void ggml_mul_mat_chunk_size(
+        int64_t nr0, int64_t nr1, size_t row_size0, size_t row_size1,
+        int64_t min_chunks, int64_t max_chunks, int64_t * dr0, int64_t * dr1) {
+    const size_t budget = ggml_cpu_l2_cache_size/2;
+
+    // half of the budget for the src1 rows, then as many src0 rows as fit in the rest, each of them is used with all the src1 rows
+    int64_t c1 = MIN(nr1, MAX(1, (int64_t) (budget/2/row_size1)));
+    const size_t budget0 = budget > c1*row_size1 ? budget - c1*row_size1 : 0;
+    int64_t c0 = MIN(nr0, MAX(16, (int64_t) (budget0/row_size0)));
+
+    // multiples of the 16x16 blocks of ggml_compute_forward_mul_mat_one_chunk
+    if (c0 < nr0) {
+        c0 = c0/16*16;
+    }
+    if (c1 < nr1 && c1 > 16) {
+        c1 = c1/16*16;
+    }
+
+#define GGML_N_CHUNKS(c0, c1) (((nr0 + (c0) - 1)/(c0))*((nr1 + (c1) - 1)/(c1)))
+
+    // enough chunks to balance the work between the threads, split src0 first since it is usually the largest
+    while (GGML_N_CHUNKS(c0, c1) < min_chunks) {
+        if (c0 > 16) {
+            c0 = MAX(16, (c0/2 + 15)/16*16);
+        } else if (c1 > 16) {
+            c1 = MAX(16, (c1/2 + 15)/16*16);
+        } else {
+            break;
+        }
+    }
+
+    while (GGML_N_CHUNKS(c0, c1) > max_chunks) {
+        if (c0 < nr0) {
+            c0 = MIN(nr0, 2*c0);
+        } else if (c1 < nr1) {
+            c1 = MIN(nr1, 2*c1);
+        } else {
+            break;
+        }
+    }
+
+#undef GGML_N_CHUNKS
+
+    *dr0 = c0;
+    *dr1 = c1;
+}
+
 void ggml_compute_forward_mul_mat(
         const struct ggml_compute_params * params,
               struct ggml_tensor * dst) {
@@ -1298,10 +1516,21 @@ UseGgmlGemm1:;
     #endif
     }
 
-    if (ith == 0) {
-        // Every thread starts at ith, so the first unprocessed chunk is nth.  This save a bit of coordination right at the start.
-        atomic_store_explicit(&params->threadpool->current_chunk, nth, memory_order_relaxed);
-    }
+    // This is the size of the first dimension of the result, so we can iterate that way. (see the ASSERT above, these are the same numbers)
+    const int64_t nr0 = ne0;
+
+    // This is the size of the rest of the dimensions of the result
+    const int64_t nr1 = ne1 * ne2 * ne3;
+
+    // chunks sized to the L2 cache
+    int64_t dr0;
+    int64_t dr1;
+    ggml_mul_mat_chunk_size(nr0, nr1, nb01, ggml_row_size(vec_dot_type, ne10), 4*nth, GGML_CHUNK_MAX, &dr0, &dr1);
+
+    const int64_t nchunk0 = (nr0 + dr0 - 1)/dr0;
+    const int64_t nchunk1 = (nr1 + dr1 - 1)/dr1;
+
+    ggml_chunk_range_init(params->threadpool, ith, nth, (int) (nchunk0*nchunk1));
 
     ggml_barrier(params->threadpool);
 
@@ -1329,45 +1558,12 @@ UseGgmlGemm1:;
 UseGgmlGemm2:;
 #endif
 
-    // This is the size of the first dimension of the result, so we can iterate that way. (see the ASSERT above, these are the same numbers)
-    const int64_t nr0 = ne0;
+    int current_chunk;
 
-    // This is the size of the rest of the dimensions of the result
-    const int64_t nr1 = ne1 * ne2 * ne3;
-
-    // Now select a reasonable chunk size.
-    int chunk_size = 16;
-
-    // We need to step up the size if it's small
-    if (nr0 == 1 || nr1 == 1) {
-        chunk_size = 64;
-    }
-
-    // distribute the work across the inner or outer loop based on which one is larger
-    // The number of chunks in the 0/1 dim.
-    // CEIL(nr0/chunk_size)
-    int64_t nchunk0 = (nr0 + chunk_size - 1) / chunk_size;
-    int64_t nchunk1 = (nr1 + chunk_size - 1) / chunk_size;
-
-    // If the chunking is poor for the number of threads on this setup, scrap the whole plan.  Re-chunk it by thread.
-    //   Also, chunking by thread was measured to have perform better on NUMA systems.  See https://github.com/ggml-org/llama.cpp/pull/6915
-    //   In theory, chunking should be just as useful on NUMA and non NUMA systems, but testing disagreed with that.
-    if (nchunk0 * nchunk1 < nth * 4 || ggml_is_numa()) {
-        // distribute the thread work across the inner or outer loop based on which one is larger
-        nchunk0 = nr0 > nr1 ? nth : 1; // parallelize by src0 rows
-        nchunk1 = nr0 > nr1 ? 1 : nth; // parallelize by src1 rows
-    }
-
-    // The number of elements in each chunk
-    const int64_t dr0 = (nr0 + nchunk0 - 1) / nchunk0;
-    const int64_t dr1 = (nr1 + nchunk1 - 1) / nchunk1;
-
-    // The first chunk comes from our thread_id, the rest will get auto-assigned.
-    int current_chunk = ith;
-
-    while (current_chunk < nchunk0 * nchunk1) {
-        const int64_t ith0 = current_chunk % nchunk0;
-        const int64_t ith1 = current_chunk / nchunk0;
+    while ((current_chunk = ggml_chunk_range_next(params->threadpool, ith, nth)) >= 0) {
+        // consecutive chunks use the same src0 rows
+        const int64_t ith0 = current_chunk / nchunk1;
+        const int64_t ith1 = current_chunk % nchunk1;
 
         const int64_t ir0_start = dr0 * ith0;
         const int64_t ir0_end = MIN(ir0_start + dr0, nr0);
@@ -1384,12 +1580,6 @@ UseGgmlGemm2:;
             num_rows_per_vec_dot = 1;
         }
         ggml_compute_forward_mul_mat_one_chunk(params, dst, src0->type, num_rows_per_vec_dot, ir0_start, ir0_end, ir1_start, ir1_end);
-
-        if (nth >= nchunk0 * nchunk1) {
-            break;
-        }
-
-        current_chunk = atomic_fetch_add_explicit(&params->threadpool->current_chunk, 1, memory_order_relaxed);
     }
 }
 
@@ -1402,6 +1592,13 @@ struct mmid_row_mapping {
     int32_t i2;
 };
 
+// chunks of one expert, the chunks of all the experts are numbered consecutively
+struct mmid_chunking {
+    int64_t offset; // first chunk of the expert
+    int64_t dr0;
+    int64_t dr1;
+};
+
 static void ggml_compute_forward_mul_mat_id_one_chunk(
     struct ggml_tensor * dst,
     const struct ggml_tensor * src0,
@@ -1473,7 +1670,7 @@ static void * incr_ptr_aligned(void ** p, size_t size, size_t align) {
     return ptr;
 }
 
-static void ggml_compute_forward_mul_mat_id(
+void ggml_compute_forward_mul_mat_id(
         const struct ggml_compute_params * params,
               struct ggml_tensor * dst) {
 
@@ -1507,6 +1704,8 @@ static void ggml_compute_forward_mul_mat_id(
     const int n_ids = ids->ne[0]; // n_expert_used
     const int n_as  = ne02;       // n_expert
 
+    const size_t row_size = ggml_row_size(vec_dot_type, ne10);
+
     void * wdata_cur = params->wdata;
 
     if (src1->type != vec_dot_type) {
@@ -1519,8 +1718,8 @@ static void ggml_compute_forward_mul_mat_id(
     struct mmid_row_mapping * matrix_rows = // [n_as][ids->ne[0]*ids->ne[1]]
         incr_ptr_aligned(&wdata_cur, n_as*ids->ne[0]*ids->ne[1]*sizeof(struct mmid_row_mapping), sizeof(int64_t));
 
-    char (*atomic_current_chunk)[CACHE_LINE_SIZE] = // [n_as]
-        incr_ptr_aligned(&wdata_cur, CACHE_LINE_SIZE * n_as, CACHE_LINE_SIZE);
+    struct mmid_chunking * chunking = // [n_as + 1]
+        incr_ptr_aligned(&wdata_cur, (n_as + 1)*sizeof(struct mmid_chunking), sizeof(int64_t));
 
     GGML_ASSERT(params->wsize >= (size_t)((char *) wdata_cur - (char *) params->wdata));
 
@@ -1576,80 +1775,87 @@ static void ggml_compute_forward_mul_mat_id(
                 matrix_row_counts[i02] += 1;
             }
         }
-    }
 
-    // reset current_chunk
-    for (int cur_a = ith; cur_a < n_as; cur_a += nth) {
-        atomic_int * current_chunk_ctr = (atomic_int *)(atomic_current_chunk + cur_a);
-        *current_chunk_ctr = nth;
-    }
+        int n_active = 0;
+        for (int cur_a = 0; cur_a < n_as; ++cur_a) {
+            n_active += matrix_row_counts[cur_a] > 0;
+        }
 
-    ggml_barrier(params->threadpool);
+        // tile each expert to the L2 cache, with enough chunks in total to balance the work between the threads
+        const int64_t min_chunks = n_active > 0 ? (4*nth + n_active - 1)/n_active : 1;
+        const int64_t max_chunks = GGML_CHUNK_MAX/n_as;
 
-    for (int cur_a = 0; cur_a < n_as; ++cur_a) {
-        const int64_t cne1 = matrix_row_counts[cur_a];
+        int64_t n_chunks = 0;
+        for (int cur_a = 0; cur_a < n_as; ++cur_a) {
+            const int64_t cne1 = matrix_row_counts[cur_a];
 
-        if (cne1 == 0) {
-            continue;
-        }
+            chunking[cur_a].offset = n_chunks;
+            chunking[cur_a].dr0    = 1;
+            chunking[cur_a].dr1    = 1;
 
-        const char * src0_cur = (const char *) src0->data + cur_a * nb02;
-        const void * wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
-        const size_t row_size = ggml_row_size(vec_dot_type, ne10);
+            if (cne1 == 0) {
+                continue;
+            }
 
-        const int64_t nr0 = ne01;
-        const int64_t nr1 = cne1;
+            ggml_mul_mat_chunk_size(ne01, cne1, nb01, row_size, min_chunks, max_chunks, &chunking[cur_a].dr0, &chunking[cur_a].dr1);
 
-        int chunk_size = 16;
-        if (nr0 == 1 || nr1 == 1) {
-            chunk_size = 64;
+            n_chunks += ((ne01 + chunking[cur_a].dr0 - 1)/chunking[cur_a].dr0)*((cne1 + chunking[cur_a].dr1 - 1)/chunking[cur_a].dr1);
         }
+        chunking[n_as].offset = n_chunks;
 
-#if defined(__aarch64__)
-        // disable for ARM
-        const bool disable_chunking = true;
-#else
-        // disable for NUMA
-        const bool disable_chunking = ggml_is_numa();
-#endif // defined(__aarch64__)
+        for (int j = 0; j < nth; ++j) {
+            ggml_chunk_range_init(params->threadpool, j, nth, (int) n_chunks);
+        }
+    }
+
+    ggml_barrier(params->threadpool);
 
-        int64_t nchunk0 = (nr0 + chunk_size - 1) / chunk_size;
-        int64_t nchunk1 = (nr1 + chunk_size - 1) / chunk_size;
+    const void * wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
 
-        if (nchunk0 * nchunk1 < nth * 4 || disable_chunking) {
-            nchunk0 = nr0 > nr1 ? nth : 1;
-            nchunk1 = nr0 > nr1 ? 1 : nth;
+    int current_chunk;
+
+    while ((current_chunk = ggml_chunk_range_next(params->threadpool, ith, nth)) >= 0) {
+        // last expert with its first chunk at or before current_chunk, experts without rows have no chunks
+        int lo = 0;
+        int hi = n_as - 1;
+        while (lo < hi) {
+            const int mid = (lo + hi + 1)/2;
+            if (chunking[mid].offset <= current_chunk) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
         }
 
-        const int64_t dr0 = (nr0 + nchunk0 - 1) / nchunk0;
-        const int64_t dr1 = (nr1 + nchunk1 - 1) / nchunk1;
+        const int cur_a = lo;
 
-        int current_chunk = ith;
+        const int64_t nr0 = ne01;
+        const int64_t nr1 = matrix_row_counts[cur_a];
 
-        atomic_int * current_chunk_ctr = (atomic_int *)(atomic_current_chunk + cur_a);
+        const int64_t dr0 = chunking[cur_a].dr0;
+        const int64_t dr1 = chunking[cur_a].dr1;
 
-        while (current_chunk < nchunk0 * nchunk1) {
-            const int64_t ith0 = current_chunk % nchunk0;
-            const int64_t ith1 = current_chunk / nchunk0;
+        const int64_t nchunk1 = (nr1 + dr1 - 1)/dr1;
 
-            const int64_t ir0_start = dr0 * ith0;
-            const int64_t ir0_end = MIN(ir0_start + dr0, nr0);
+        const int64_t chunk = current_chunk - chunking[cur_a].offset;
 
-            const int64_t ir1_start = dr1 * ith1;
-            const int64_t ir1_end = MIN(ir1_start + dr1, nr1);
+        // consecutive chunks use the same src0 rows
+        const int64_t ith0 = chunk / nchunk1;
+        const int64_t ith1 = chunk % nchunk1;
 
-            ggml_compute_forward_mul_mat_id_one_chunk(
-                dst, src0, src1, ids, cur_a,
-                ir0_start, ir0_end, ir1_start, ir1_end,
-                src0_cur, matrix_rows, row_size, src1_cont, wdata
-            );
+        const int64_t ir0_start = dr0 * ith0;
+        const int64_t ir0_end = MIN(ir0_start + dr0, nr0);
 
-            if (nth >= nchunk0 * nchunk1) {
-                break;
-            }
+        const int64_t ir1_start = dr1 * ith1;
+        const int64_t ir1_end = MIN(ir1_start + dr1, nr1);
 
-            current_chunk = atomic_fetch_add_explicit(current_chunk_ctr, 1, memory_order_relaxed);
-        }
+        const char * src0_cur = (const char *) src0->data + cur_a * nb02;
+
+        ggml_compute_forward_mul_mat_id_one_chunk(
+            dst, src0, src1, ids, cur_a,
+            ir0_start, ir0_end, ir1_start, ir1_end,
+            src0_cur, matrix_rows, row_size, src1_cont, wdata
+        );
     }
 }
 
@@ -1928,6 +2134,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_argsort(params, tensor);
             } break;
+        case GGML_OP_ARGSORT_TOP_K:
+            {
+                ggml_compute_forward_argsort_top_k(params, tensor);
+            } break;
         case GGML_OP_LEAKY_RELU:
             {
                 ggml_compute_forward_leaky_relu(params, tensor);
@@ -2051,7 +2261,9 @@ static void set_numa_thread_affinity(int thread_n) {
 
     switch(g_state.numa.numa_strategy) {
         case GGML_NUMA_STRATEGY_DISTRIBUTE:
+        case GGML_NUMA_STRATEGY_MIRROR:
             // run thread on node_num thread_n / (threads per node)
+            // with MIRROR, see ggml_cpu_numa_mirror_node
             node_num = thread_n % g_state.numa.n_nodes;
             break;
         case GGML_NUMA_STRATEGY_ISOLATE:
@@ -2112,7 +2324,7 @@ static void set_numa_thread_affinity(int thread_n) { UNUSED(thread_n);  }
 static void clear_numa_thread_affinity(void) {}
 #endif
 
-static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
+static int ggml_get_n_tasks(const struct ggml_tensor * node, int n_threads) {
     int n_tasks = 0;
 
     if (ggml_is_empty(node)) {
@@ -2271,6 +2483,7 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
         case GGML_OP_ARANGE:
         case GGML_OP_TIMESTEP_EMBEDDING:
         case GGML_OP_ARGSORT:
+        case GGML_OP_ARGSORT_TOP_K:
         case GGML_OP_FLASH_ATTN_EXT:
         case GGML_OP_FLASH_ATTN_BACK:
         case GGML_OP_SSM_CONV:
@@ -2649,6 +2862,498 @@ void ggml_threadpool_resume(struct ggml_threadpool * threadpool) {
 #endif
 }
 
+// size of the work buffer needed to compute the node with n_tasks threads
+static size_t ggml_graph_node_work_size(const struct ggml_tensor * node, int n_tasks, int n_threads) {
+    size_t cur = 0;
+
+    if (!ggml_cpu_extra_work_size(n_threads, node, &cur)) {
+        switch (node->op) {
+            case GGML_OP_CPY:
+            case GGML_OP_DUP:
+                {
+                    if (ggml_is_quantized(node->type) ||
+                        // F16 -> BF16 and BF16 -> F16 copies go through intermediate F32
+                        (node->src[0]->type == GGML_TYPE_F16  && node->src[1] && node->src[1]->type == GGML_TYPE_BF16) ||
+                        (node->src[0]->type == GGML_TYPE_BF16 && node->src[1] && node->src[1]->type == GGML_TYPE_F16)) {
+                        cur = ggml_type_size(GGML_TYPE_F32) * node->ne[0] * n_tasks;
+                    }
+                } break;
+            case GGML_OP_ADD:
+            case GGML_OP_ADD_ID:
+            case GGML_OP_ADD1:
+                {
+                    if (ggml_is_quantized(node->src[0]->type)) {
+                        cur = ggml_type_size(GGML_TYPE_F32) * node->src[0]->ne[0] * n_tasks;
+                    }
+                } break;
+            case GGML_OP_ACC:
+                {
+                    if (ggml_is_quantized(node->src[0]->type)) {
+                        cur = ggml_type_size(GGML_TYPE_F32) * node->src[1]->ne[0] * n_tasks;
+                    }
+                } break;
+            case GGML_OP_COUNT_EQUAL:
+                {
+                    cur = ggml_type_size(node->type)*n_tasks;
+                } break;
+            case GGML_OP_MUL_MAT:
+                {
+                    const enum ggml_type vec_dot_type = type_traits_cpu[node->src[0]->type].vec_dot_type;
+
+                    if (node->src[1]->type != vec_dot_type) {
+                        cur = ggml_row_size(vec_dot_type, ggml_nelements(node->src[1]));
+                    }
+                } break;
+            case GGML_OP_MUL_MAT_ID:
+                {
+                    cur = 0;
+                    const struct ggml_tensor * src0 = node->src[0];
+                    const struct ggml_tensor * src1 = node->src[1];
+                    const struct ggml_tensor * ids = node->src[2];
+                    const enum ggml_type vec_dot_type = type_traits_cpu[src0->type].vec_dot_type;
+                    const int n_as = src0->ne[2];
+                    // src1
+                    if (src1->type != vec_dot_type) {
+                        cur += ggml_row_size(vec_dot_type, ggml_nelements(src1)) + sizeof(int64_t);
+                    }
+                    // matrix_row_counts
+                    cur += n_as * sizeof(int64_t) + sizeof(int64_t);
+                    // matrix_rows
+                    cur += n_as*ids->ne[0]*ids->ne[1]*sizeof(struct mmid_row_mapping) + sizeof(int64_t);
+                    // chunking
+                    cur += (n_as + 1)*sizeof(struct mmid_chunking) + sizeof(int64_t);
+                } break;
+            case GGML_OP_OUT_PROD:
+                {
+                    if (ggml_is_quantized(node->src[0]->type)) {
+                        cur = ggml_type_size(GGML_TYPE_F32) * node->src[0]->ne[0] * n_tasks;
+                    }
+                } break;
+            case GGML_OP_SOFT_MAX:
+            case GGML_OP_ROPE:
+            case GGML_OP_ROPE_BACK:
+                {
+                    cur = ggml_type_size(GGML_TYPE_F32) * node->ne[0] * n_tasks;
+                } break;
+            case GGML_OP_CONV_TRANSPOSE_1D:
+                {
+                    GGML_ASSERT(node->src[0]->ne[3] == 1);
+                    GGML_ASSERT(node->src[1]->ne[2] == 1);
+                    GGML_ASSERT(node->src[1]->ne[3] == 1);
+
+                    const int64_t ne00 = node->src[0]->ne[0];  // K
+                    const int64_t ne01 = node->src[0]->ne[1];  // Cout
+                    const int64_t ne02 = node->src[0]->ne[2];  // Cin
+                    const int64_t ne10 = node->src[1]->ne[0];  // L
+                    const int64_t ne11 = node->src[1]->ne[1];  // Cin
+
+                    if ((node->src[0]->type == GGML_TYPE_F16 ||
+                         node->src[0]->type == GGML_TYPE_BF16) &&
+                        node->src[1]->type == GGML_TYPE_F32) {
+                        cur += sizeof(ggml_fp16_t)*ne00*ne01*ne02;
+                        cur += sizeof(ggml_fp16_t)*ne10*ne11;
+                    } else if (node->src[0]->type == GGML_TYPE_F32 &&
+                               node->src[1]->type == GGML_TYPE_F32) {
+                        cur += sizeof(float)*ne00*ne01*ne02;
+                        cur += sizeof(float)*ne10*ne11;
+                    } else {
+                        GGML_ABORT("fatal error");
+                    }
+                } break;
+            case GGML_OP_CONV_2D:
+                {
+                    cur = GGML_IM2COL_WORK_SIZE;
+                } break;
+            case GGML_OP_CONV_TRANSPOSE_2D:
+                {
+                    const int64_t ne00 = node->src[0]->ne[0]; // W
+                    const int64_t ne01 = node->src[0]->ne[1]; // H
+                    const int64_t ne02 = node->src[0]->ne[2]; // Channels Out
+                    const int64_t ne03 = node->src[0]->ne[3]; // Channels In
+
+                    const int64_t ne10 = node->src[1]->ne[0]; // W
+                    const int64_t ne11 = node->src[1]->ne[1]; // H
+                    const int64_t ne12 = node->src[1]->ne[2]; // Channels In
+
+                    cur += sizeof(ggml_fp16_t)*ne00*ne01*ne02*ne03;
+                    cur += sizeof(ggml_fp16_t)*ne10*ne11*ne12;
+                } break;
+            case GGML_OP_FLASH_ATTN_EXT:
+                {
+                    cur = ggml_flash_attn_ext_work_size(node, n_tasks);
+                } break;
+            case GGML_OP_FLASH_ATTN_BACK:
+                {
+                    const int64_t    D = node->src[0]->ne[0];
+                    const int64_t ne11 = ggml_up(node->src[1]->ne[1], GGML_SOFT_MAX_UNROLL);
+                    const int64_t mxDn = MAX(D, ne11) * 2; // *2 because of S and SM in ggml_compute_forward_flash_attn_back
+                    if (node->src[1]->type == GGML_TYPE_F32) {
+                        cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
+                        cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
+                    } else if (node->src[1]->type == GGML_TYPE_F16) {
+                        cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
+                        cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
+                    } else if (node->src[1]->type == GGML_TYPE_BF16) {
+                        cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
+                        cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
+                    }
+                } break;
+
+            case GGML_OP_CROSS_ENTROPY_LOSS:
+                {
+                    cur = ggml_type_size(node->type)*(n_tasks + node->src[0]->ne[0]*n_tasks);
+                } break;
+            case GGML_OP_ARGSORT_TOP_K:
+                {
+                    // candidate buffer per thread, see ggml_compute_forward_argsort_top_k_f32
+                    const int64_t n_cap = MAX(2*node->ne[0], 256);
+                    cur = sizeof(int32_t)*(n_cap + 16 + CACHE_LINE_SIZE_F32)*n_tasks;
+                } break;
+            case GGML_OP_COUNT:
+                {
+                    GGML_ABORT("fatal error");
+                }
+            default:
+                break;
+        }
+    }
+
+    return cur;
+}
+
+// dependency schedule of a graph
+//
+// instead of a barrier after each node, the threads only wait for each other before a node that depends on the
+// nodes computed since the last barrier, i.e. when the memory the node reads or writes overlaps the memory written
+// by these nodes, or when the node writes memory that these nodes read
+// independent nodes between two barriers are computed concurrently: small nodes are distributed over the threads and
+// each of them is computed by a single thread, the other nodes are computed by all threads
+//
+// the schedule is stored at the start of the work buffer and is only rebuilt when the graph changes,
+// so that it is reused when the same graph is computed again
+
+#define GGML_SCHED_BARRIER 1 // wait for all threads before computing the node
+#define GGML_SCHED_NOOP    2 // nothing to compute (view, reshape, ...)
+#define GGML_SCHED_SINGLE  4 // computed by a single thread
+
+// max nodes between two barriers
+#define GGML_SCHED_MAX_LEVEL 64
+
+// max elements of a node computed by a single thread
+#define GGML_SCHED_SINGLE_MAX_NE 16384
+
+struct ggml_graph_sched_node {
+    int32_t flags;
+    int32_t ord;  // index of a single thread node between two barriers, the node is computed by the thread ord % nth
+};
+
+// what the schedule of a node depends on: the node, its sources and the memory they use
+struct ggml_graph_sched_tensor {
+    const void * data;
+    const void * buffer;
+    int64_t      ne[GGML_MAX_DIMS];
+    size_t       nb[GGML_MAX_DIMS];
+    int32_t      type;
+};
+
+struct ggml_graph_sched_key {
+    const struct ggml_tensor * node;
+    int32_t                    op;
+    int32_t                    op_params[GGML_MAX_OP_PARAMS / sizeof(int32_t)];
+
+    struct ggml_graph_sched_tensor dst;
+    struct ggml_graph_sched_tensor src[GGML_MAX_SRC];
+};
+
+struct ggml_graph_sched {
+    int32_t n_threads;  // threads the schedule was built for
+    int32_t n_nodes;
+    int32_t n_barriers; // barriers needed to compute the graph, including the final one
+
+    struct ggml_graph_sched_node nodes[];
+
+    // followed by the n_nodes keys of the graph the schedule was built for
+};
+
+enum ggml_graph_sched_class {
+    GGML_SCHED_CLASS_FREE,   // only depends on its sources and destination
+    GGML_SCHED_CLASS_SHARED, // also uses state shared by all threads: the work buffer or the chunk counter
+    GGML_SCHED_CLASS_SERIAL, // needs barriers before and after
+};
+
+static size_t ggml_graph_sched_keys_offs(int n_nodes) {
+    return GGML_PAD(sizeof(struct ggml_graph_sched) + n_nodes*sizeof(struct ggml_graph_sched_node), sizeof(void *));
+}
+
+static size_t ggml_graph_sched_size(int n_nodes) {
+    return GGML_PAD(ggml_graph_sched_keys_offs(n_nodes) + n_nodes*sizeof(struct ggml_graph_sched_key), CACHE_LINE_SIZE);
+}
+
+static struct ggml_graph_sched_key * ggml_graph_sched_keys(struct ggml_graph_sched * sched, int n_nodes) {
+    return (struct ggml_graph_sched_key *) ((char *) sched + ggml_graph_sched_keys_offs(n_nodes));
+}
+
+static bool ggml_graph_sched_is_noop(const struct ggml_tensor * node) {
+    switch (node->op) {
+        case GGML_OP_NONE:
+        case GGML_OP_RESHAPE:
+        case GGML_OP_VIEW:
+        case GGML_OP_PERMUTE:
+        case GGML_OP_TRANSPOSE:
+            return true;
+        default:
+            return ggml_is_empty(node);
+    }
+}
+
+static enum ggml_graph_sched_class ggml_graph_sched_get_class(const struct ggml_tensor * node, int n_threads) {
+    if (ggml_cpu_extra_has_tensor_traits(node)) {
+        // extra buffer types may rely on a barrier after each node
+        return GGML_SCHED_CLASS_SERIAL;
+    }
+
+    switch (node->op) {
+        case GGML_OP_MUL_MAT:
+        case GGML_OP_MUL_MAT_ID:
+        case GGML_OP_FLASH_ATTN_EXT:
+            return GGML_SCHED_CLASS_SHARED;
+        case GGML_OP_DUP:
+        case GGML_OP_ADD:
+        case GGML_OP_ADD_ID:
+        case GGML_OP_ADD1:
+        case GGML_OP_SUB:
+        case GGML_OP_MUL:
+        case GGML_OP_DIV:
+        case GGML_OP_SQR:
+        case GGML_OP_SQRT:
+        case GGML_OP_LOG:
+        case GGML_OP_SIN:
+        case GGML_OP_COS:
+        case GGML_OP_SUM:
+        case GGML_OP_SUM_ROWS:
+        case GGML_OP_MEAN:
+        case GGML_OP_ARGMAX:
+        case GGML_OP_REPEAT:
+        case GGML_OP_CONCAT:
+        case GGML_OP_NORM:
+        case GGML_OP_RMS_NORM:
+        case GGML_OP_L2_NORM:
+        case GGML_OP_SCALE:
+        case GGML_OP_CPY:
+        case GGML_OP_CONT:
+        case GGML_OP_GET_ROWS:
+        case GGML_OP_SET_ROWS:
+        case GGML_OP_SOFT_MAX:
+        case GGML_OP_ROPE:
+        case GGML_OP_CLAMP:
+        case GGML_OP_PAD:
+        case GGML_OP_ARGSORT:
+        case GGML_OP_ARGSORT_TOP_K:
+        case GGML_OP_LEAKY_RELU:
+        case GGML_OP_UNARY:
+        case GGML_OP_GLU:
+            return ggml_graph_node_work_size(node, ggml_get_n_tasks(node, n_threads), n_threads) > 0 ?
+                GGML_SCHED_CLASS_SHARED : GGML_SCHED_CLASS_FREE;
+        default:
+            return GGML_SCHED_CLASS_SERIAL;
+    }
+}
+
+static void ggml_graph_sched_tensor_set(struct ggml_graph_sched_tensor * key, const struct ggml_tensor * t) {
+    if (t == NULL) {
+        memset(key, 0, sizeof(*key));
+        key->type = -1;
+        return;
+    }
+
+    key->data   = t->data;
+    key->buffer = t->buffer;
+    key->type   = t->type;
+    for (int i = 0; i < GGML_MAX_DIMS; i++) {
+        key->ne[i] = t->ne[i];
+        key->nb[i] = t->nb[i];
+    }
+}
+
+static bool ggml_graph_sched_tensor_eq(const struct ggml_graph_sched_tensor * key, const struct ggml_tensor * t) {
+    if (t == NULL) {
+        return key->type == -1;
+    }
+
+    if (key->data != t->data || key->buffer != t->buffer || key->type != (int32_t) t->type) {
+        return false;
+    }
+    for (int i = 0; i < GGML_MAX_DIMS; i++) {
+        if (key->ne[i] != t->ne[i] || key->nb[i] != t->nb[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void ggml_graph_sched_key_set(struct ggml_graph_sched_key * key, const struct ggml_tensor * node) {
+    key->node = node;
+    key->op   = node->op;
+    memcpy(key->op_params, node->op_params, sizeof(key->op_params));
+
+    ggml_graph_sched_tensor_set(&key->dst, node);
+    for (int j = 0; j < GGML_MAX_SRC; j++) {
+        ggml_graph_sched_tensor_set(&key->src[j], node->src[j]);
+    }
+}
+
+static bool ggml_graph_sched_key_eq(const struct ggml_graph_sched_key * key, const struct ggml_tensor * node) {
+    if (key->node != node || key->op != (int32_t) node->op ||
+        memcmp(key->op_params, node->op_params, sizeof(key->op_params)) != 0) {
+        return false;
+    }
+
+    if (!ggml_graph_sched_tensor_eq(&key->dst, node)) {
+        return false;
+    }
+    for (int j = 0; j < GGML_MAX_SRC; j++) {
+        if (!ggml_graph_sched_tensor_eq(&key->src[j], node->src[j])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// true if the schedule was built for this graph and number of threads
+static bool ggml_graph_sched_match(struct ggml_graph_sched * sched, const struct ggml_cgraph * cgraph, int n_threads) {
+    if (sched->n_threads != n_threads || sched->n_nodes != cgraph->n_nodes) {
+        return false;
+    }
+
+    const struct ggml_graph_sched_key * keys = ggml_graph_sched_keys(sched, cgraph->n_nodes);
+
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        if (!ggml_graph_sched_key_eq(&keys[i], cgraph->nodes[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool ggml_graph_sched_overlap(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    if (a == NULL || b == NULL || a->data == NULL || b->data == NULL) {
+        return false;
+    }
+
+    const char * a0 = (const char *) a->data;
+    const char * b0 = (const char *) b->data;
+
+    return a0 < b0 + ggml_nbytes(b) && b0 < a0 + ggml_nbytes(a);
+}
+
+// true if node must be computed after prev
+static bool ggml_graph_sched_depends(const struct ggml_tensor * node, const struct ggml_tensor * prev) {
+    // write after write
+    if (ggml_graph_sched_overlap(node, prev)) {
+        return true;
+    }
+
+    for (int j = 0; j < GGML_MAX_SRC; j++) {
+        // read after write
+        if (ggml_graph_sched_overlap(node->src[j], prev)) {
+            return true;
+        }
+
+        // write after read
+        if (ggml_graph_sched_overlap(node, prev->src[j])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void ggml_graph_sched_build(struct ggml_graph_sched * sched, const struct ggml_cgraph * cgraph, int n_threads) {
+    // nodes computed since the last barrier
+    int  level[GGML_SCHED_MAX_LEVEL];
+    int  n_level       = 0;
+    bool level_shared  = false;
+    bool level_serial  = false;
+    int  n_single      = 0;
+
+    sched->n_threads  = n_threads;
+    sched->n_nodes    = cgraph->n_nodes;
+    sched->n_barriers = 1;
+
+    struct ggml_graph_sched_key * keys = ggml_graph_sched_keys(sched, cgraph->n_nodes);
+
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        const struct ggml_tensor * node = cgraph->nodes[i];
+
+        struct ggml_graph_sched_node * snode = &sched->nodes[i];
+
+        snode->flags = 0;
+        snode->ord   = 0;
+
+        ggml_graph_sched_key_set(&keys[i], node);
+
+        if (ggml_graph_sched_is_noop(node)) {
+            snode->flags = GGML_SCHED_NOOP;
+            continue;
+        }
+
+        const enum ggml_graph_sched_class cls = ggml_graph_sched_get_class(node, n_threads);
+
+        bool barrier = n_level == GGML_SCHED_MAX_LEVEL || level_serial || cls == GGML_SCHED_CLASS_SERIAL ||
+            (cls == GGML_SCHED_CLASS_SHARED && level_shared);
+
+        for (int j = 0; j < n_level && !barrier; j++) {
+            barrier = ggml_graph_sched_depends(node, cgraph->nodes[level[j]]);
+        }
+
+        if (barrier && n_level > 0) {
+            snode->flags |= GGML_SCHED_BARRIER;
+            sched->n_barriers++;
+
+            n_level      = 0;
+            level_shared = false;
+            level_serial = false;
+            n_single     = 0;
+        }
+
+        if (cls == GGML_SCHED_CLASS_FREE && ggml_nelements(node) <= GGML_SCHED_SINGLE_MAX_NE) {
+            snode->flags |= GGML_SCHED_SINGLE;
+            snode->ord    = n_single++;
+        }
+
+        level[n_level++] = i;
+        level_shared |= cls == GGML_SCHED_CLASS_SHARED;
+        level_serial |= cls == GGML_SCHED_CLASS_SERIAL;
+    }
+}
+
+// get the schedule of the graph from the work buffer, build it if needed
+static const struct ggml_graph_sched * ggml_graph_get_sched(const struct ggml_cgraph * cgraph, const struct ggml_cplan * cplan) {
+    if (cplan->work_data == NULL || cplan->work_size < ggml_graph_sched_size(cgraph->n_nodes)) {
+        return NULL;
+    }
+
+    struct ggml_graph_sched * sched = (struct ggml_graph_sched *) cplan->work_data;
+
+    if (!ggml_graph_sched_match(sched, cgraph, cplan->n_threads)) {
+        ggml_graph_sched_build(sched, cgraph, cplan->n_threads);
+
+        GGML_PRINT_DEBUG("%s: graph with %d nodes: %d barriers (%d without the dependency schedule)\n",
+                __func__, cgraph->n_nodes, sched->n_barriers, cgraph->n_nodes);
+    }
+
+    return sched;
+}
+
+int ggml_graph_n_barriers(const struct ggml_cgraph * cgraph, const struct ggml_cplan * cplan) {
+    const struct ggml_graph_sched * sched = ggml_graph_get_sched(cgraph, cplan);
+
+    return sched ? sched->n_barriers : cgraph->n_nodes;
+}
+
 struct ggml_cplan ggml_graph_plan(
           const struct ggml_cgraph * cgraph,
                                int   n_threads,
@@ -2676,156 +3381,7 @@ struct ggml_cplan ggml_graph_plan(
 
         max_tasks = MAX(max_tasks, n_tasks);
 
-        size_t cur = 0;
-
-        if (!ggml_cpu_extra_work_size(n_threads, node, &cur)) {
-            switch (node->op) {
-                case GGML_OP_CPY:
-                case GGML_OP_DUP:
-                    {
-                        if (ggml_is_quantized(node->type) ||
-                            // F16 -> BF16 and BF16 -> F16 copies go through intermediate F32
-                            (node->src[0]->type == GGML_TYPE_F16  && node->src[1] && node->src[1]->type == GGML_TYPE_BF16) ||
-                            (node->src[0]->type == GGML_TYPE_BF16 && node->src[1] && node->src[1]->type == GGML_TYPE_F16)) {
-                            cur = ggml_type_size(GGML_TYPE_F32) * node->ne[0] * n_tasks;
-                        }
-                    } break;
-                case GGML_OP_ADD:
-                case GGML_OP_ADD_ID:
-                case GGML_OP_ADD1:
-                    {
-                        if (ggml_is_quantized(node->src[0]->type)) {
-                            cur = ggml_type_size(GGML_TYPE_F32) * node->src[0]->ne[0] * n_tasks;
-                        }
-                    } break;
-                case GGML_OP_ACC:
-                    {
-                        if (ggml_is_quantized(node->src[0]->type)) {
-                            cur = ggml_type_size(GGML_TYPE_F32) * node->src[1]->ne[0] * n_tasks;
-                        }
-                    } break;
-                case GGML_OP_COUNT_EQUAL:
-                    {
-                        cur = ggml_type_size(node->type)*n_tasks;
-                    } break;
-                case GGML_OP_MUL_MAT:
-                    {
-                        const enum ggml_type vec_dot_type = type_traits_cpu[node->src[0]->type].vec_dot_type;
-
-                        if (node->src[1]->type != vec_dot_type) {
-                            cur = ggml_row_size(vec_dot_type, ggml_nelements(node->src[1]));
-                        }
-                    } break;
-                case GGML_OP_MUL_MAT_ID:
-                    {
-                        cur = 0;
-                        const struct ggml_tensor * src0 = node->src[0];
-                        const struct ggml_tensor * src1 = node->src[1];
-                        const struct ggml_tensor * ids = node->src[2];
-                        const enum ggml_type vec_dot_type = type_traits_cpu[src0->type].vec_dot_type;
-                        const int n_as = src0->ne[2];
-                        // src1
-                        if (src1->type != vec_dot_type) {
-                            cur += ggml_row_size(vec_dot_type, ggml_nelements(src1)) + sizeof(int64_t);
-                        }
-                        // matrix_row_counts
-                        cur += n_as * sizeof(int64_t) + sizeof(int64_t);
-                        // matrix_rows
-                        cur += n_as*ids->ne[0]*ids->ne[1]*sizeof(struct mmid_row_mapping) + sizeof(int64_t);
-                        // atomic_current_chunk
-                        cur += CACHE_LINE_SIZE*n_as + CACHE_LINE_SIZE;
-                    } break;
-                case GGML_OP_OUT_PROD:
-                    {
-                        if (ggml_is_quantized(node->src[0]->type)) {
-                            cur = ggml_type_size(GGML_TYPE_F32) * node->src[0]->ne[0] * n_tasks;
-                        }
-                    } break;
-                case GGML_OP_SOFT_MAX:
-                case GGML_OP_ROPE:
-                case GGML_OP_ROPE_BACK:
-                    {
-                        cur = ggml_type_size(GGML_TYPE_F32) * node->ne[0] * n_tasks;
-                    } break;
-                case GGML_OP_CONV_TRANSPOSE_1D:
-                    {
-                        GGML_ASSERT(node->src[0]->ne[3] == 1);
-                        GGML_ASSERT(node->src[1]->ne[2] == 1);
-                        GGML_ASSERT(node->src[1]->ne[3] == 1);
-
-                        const int64_t ne00 = node->src[0]->ne[0];  // K
-                        const int64_t ne01 = node->src[0]->ne[1];  // Cout
-                        const int64_t ne02 = node->src[0]->ne[2];  // Cin
-                        const int64_t ne10 = node->src[1]->ne[0];  // L
-                        const int64_t ne11 = node->src[1]->ne[1];  // Cin
-
-                        if ((node->src[0]->type == GGML_TYPE_F16 ||
-                             node->src[0]->type == GGML_TYPE_BF16) &&
-                            node->src[1]->type == GGML_TYPE_F32) {
-                            cur += sizeof(ggml_fp16_t)*ne00*ne01*ne02;
-                            cur += sizeof(ggml_fp16_t)*ne10*ne11;
-                        } else if (node->src[0]->type == GGML_TYPE_F32 &&
-                                   node->src[1]->type == GGML_TYPE_F32) {
-                            cur += sizeof(float)*ne00*ne01*ne02;
-                            cur += sizeof(float)*ne10*ne11;
-                        } else {
-                            GGML_ABORT("fatal error");
-                        }
-                    } break;
-                case GGML_OP_CONV_2D:
-                    {
-                        cur = GGML_IM2COL_WORK_SIZE;
-                    } break;
-                case GGML_OP_CONV_TRANSPOSE_2D:
-                    {
-                        const int64_t ne00 = node->src[0]->ne[0]; // W
-                        const int64_t ne01 = node->src[0]->ne[1]; // H
-                        const int64_t ne02 = node->src[0]->ne[2]; // Channels Out
-                        const int64_t ne03 = node->src[0]->ne[3]; // Channels In
-
-                        const int64_t ne10 = node->src[1]->ne[0]; // W
-                        const int64_t ne11 = node->src[1]->ne[1]; // H
-                        const int64_t ne12 = node->src[1]->ne[2]; // Channels In
-
-                        cur += sizeof(ggml_fp16_t)*ne00*ne01*ne02*ne03;
-                        cur += sizeof(ggml_fp16_t)*ne10*ne11*ne12;
-                    } break;
-                case GGML_OP_FLASH_ATTN_EXT:
-                    {
-                        const int64_t ne10 = node->src[1]->ne[0]; // DK
-                        const int64_t ne20 = node->src[2]->ne[0]; // DV
-
-                        cur = sizeof(float)*(1*ne10 + 2*ne20)*n_tasks; // 1x head size K + 2x head size V (per thread)
-                    } break;
-                case GGML_OP_FLASH_ATTN_BACK:
-                    {
-                        const int64_t    D = node->src[0]->ne[0];
-                        const int64_t ne11 = ggml_up(node->src[1]->ne[1], GGML_SOFT_MAX_UNROLL);
-                        const int64_t mxDn = MAX(D, ne11) * 2; // *2 because of S and SM in ggml_compute_forward_flash_attn_back
-                        if (node->src[1]->type == GGML_TYPE_F32) {
-                            cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
-                        } else if (node->src[1]->type == GGML_TYPE_F16) {
-                            cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
-                        } else if (node->src[1]->type == GGML_TYPE_BF16) {
-                            cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
-                        }
-                    } break;
-
-                case GGML_OP_CROSS_ENTROPY_LOSS:
-                    {
-                        cur = ggml_type_size(node->type)*(n_tasks + node->src[0]->ne[0]*n_tasks);
-                    } break;
-                case GGML_OP_COUNT:
-                    {
-                        GGML_ABORT("fatal error");
-                    }
-                default:
-                    break;
-            }
-        }
+        const size_t cur = ggml_graph_node_work_size(node, n_tasks, n_threads);
 
         work_size = MAX(work_size, cur);
     }
@@ -2834,6 +3390,9 @@ struct ggml_cplan ggml_graph_plan(
         work_size += CACHE_LINE_SIZE*(n_threads);
     }
 
+    // dependency schedule
+    work_size += ggml_graph_sched_size(cgraph->n_nodes);
+
     cplan.threadpool = threadpool;
     cplan.n_threads  = MIN(max_tasks, n_threads);
     cplan.work_size  = work_size;
@@ -2842,41 +3401,110 @@ struct ggml_cplan ggml_graph_plan(
     return cplan;
 }
 
+static inline void ggml_graph_compute_node(struct ggml_compute_params * params, struct ggml_tensor * node, int64_t * t) {
+    if (t == NULL) {
+        ggml_compute_forward(params, node);
+        return;
+    }
+
+    t[0] = ggml_time_ns();
+    ggml_compute_forward(params, node);
+    t[1] = ggml_time_ns();
+}
+
 static thread_ret_t ggml_graph_compute_thread(void * data) {
     struct ggml_compute_state * state = (struct ggml_compute_state *) data;
     struct ggml_threadpool    * tp    = state->threadpool;
 
-    const struct ggml_cgraph * cgraph = tp->cgraph;
-    const struct ggml_cplan  * cplan  = tp->cplan;
+    const struct ggml_cgraph      * cgraph = tp->cgraph;
+    const struct ggml_cplan       * cplan  = tp->cplan;
+    const struct ggml_graph_sched * sched  = tp->sched;
 
     set_numa_thread_affinity(state->ith);
 
+    // the schedule is stored at the start of the work buffer
+    const size_t sched_size = sched ? ggml_graph_sched_size(cgraph->n_nodes) : 0;
+
     struct ggml_compute_params params = {
         /*.ith       =*/ state->ith,
         /*.nth       =*/ atomic_load_explicit(&tp->n_threads_cur, memory_order_relaxed),
-        /*.wsize     =*/ cplan->work_size,
-        /*.wdata     =*/ cplan->work_data,
+        /*.wsize     =*/ cplan->work_size - sched_size,
+        /*.wdata     =*/ cplan->work_data + sched_size,
         /*.threadpool=*/ tp,
     };
 
-    for (int node_n = 0; node_n < cgraph->n_nodes && atomic_load_explicit(&tp->abort, memory_order_relaxed) != node_n; node_n++) {
-        struct ggml_tensor * node = cgraph->nodes[node_n];
+    // start and end time of the nodes computed by this thread
+    int64_t * profile = cplan->profile_data ? cplan->profile_data + (size_t) 2*state->ith*cgraph->n_nodes : NULL;
+
+    if (sched == NULL) {
+        for (int node_n = 0; node_n < cgraph->n_nodes && atomic_load_explicit(&tp->abort, memory_order_relaxed) != node_n; node_n++) {
+            struct ggml_tensor * node = cgraph->nodes[node_n];
 
-        ggml_compute_forward(&params, node);
+            ggml_graph_compute_node(&params, node, profile ? profile + 2*node_n : NULL);
 
-        if (state->ith == 0 && cplan->abort_callback &&
-                cplan->abort_callback(cplan->abort_callback_data)) {
-            atomic_store_explicit(&tp->abort, node_n + 1, memory_order_relaxed);
-            tp->ec    = GGML_STATUS_ABORTED;
+            if (state->ith == 0 && cplan->abort_callback &&
+                    cplan->abort_callback(cplan->abort_callback_data)) {
+                atomic_store_explicit(&tp->abort, node_n + 1, memory_order_relaxed);
+                tp->ec    = GGML_STATUS_ABORTED;
+            }
+
+            if (node_n + 1 < cgraph->n_nodes) {
+                ggml_barrier(state->threadpool);
+            }
         }
 
-        if (node_n + 1 < cgraph->n_nodes) {
+        ggml_barrier(state->threadpool);
+
+        return 0;
+    }
+
+    // nodes computed by a single thread
+    struct ggml_compute_params params_single = params;
+    params_single.ith = 0;
+    params_single.nth = 1;
+
+    for (int node_n = 0; node_n < cgraph->n_nodes; node_n++) {
+        struct ggml_tensor * node = cgraph->nodes[node_n];
+
+        const struct ggml_graph_sched_node * snode = &sched->nodes[node_n];
+
+        if (snode->flags & GGML_SCHED_BARRIER) {
+            // the threads can only stop together at a barrier
+            if (state->ith == 0 && cplan->abort_callback &&
+                    cplan->abort_callback(cplan->abort_callback_data)) {
+                atomic_store_explicit(&tp->abort, node_n, memory_order_relaxed);
+                tp->ec    = GGML_STATUS_ABORTED;
+            }
+
             ggml_barrier(state->threadpool);
+
+            if (atomic_load_explicit(&tp->abort, memory_order_relaxed) == node_n) {
+                break;
+            }
+        }
+
+        if (snode->flags & GGML_SCHED_NOOP) {
+            continue;
+        }
+
+        int64_t * t = profile ? profile + 2*node_n : NULL;
+
+        if (snode->flags & GGML_SCHED_SINGLE) {
+            if (snode->ord % params.nth == params.ith) {
+                ggml_graph_compute_node(&params_single, node, t);
+            }
+        } else {
+            ggml_graph_compute_node(&params, node, t);
         }
     }
 
     ggml_barrier(state->threadpool);
 
+    if (state->ith == 0 && tp->ec == GGML_STATUS_SUCCESS && cplan->abort_callback &&
+            cplan->abort_callback(cplan->abort_callback_data)) {
+        tp->ec = GGML_STATUS_ABORTED;
+    }
+
     return 0;
 }
 
@@ -3037,6 +3665,7 @@ static struct ggml_threadpool * ggml_threadpool_new_impl(
     {
         threadpool->cgraph           = cgraph;
         threadpool->cplan            = cplan;
+        threadpool->sched            = NULL;
         threadpool->n_graph          = 0;
         threadpool->n_barrier        = 0;
         threadpool->n_barrier_passed = 0;
@@ -3126,6 +3755,9 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
         threadpool->ec               = GGML_STATUS_SUCCESS;
     }
 
+    // a single thread does not need barriers
+    threadpool->sched = n_threads > 1 ? ggml_graph_get_sched(cgraph, cplan) : NULL;
+
 #ifdef GGML_USE_OPENMP
     if (n_threads > 1) {
         #pragma omp parallel num_threads(n_threads)
@@ -3565,6 +4197,8 @@ void ggml_cpu_init(void) {
         ggml_init_arm_arch_features();
 #endif
 
+        ggml_init_cache_sizes();
+
         is_first_call = false;
     }
 
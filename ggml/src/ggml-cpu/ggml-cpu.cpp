@@ -2,6 +2,7 @@
 #include "ggml-backend-impl.h"
 #include "ggml-cpu.h"
 #include "repack.h"
+#include "numa.h"
 #include "traits.h"
 #include "ggml-impl.h"
 #include "amx/amx.h"
@@ -39,6 +40,9 @@ std::vector<ggml_backend_buffer_type_t> & ggml_backend_cpu_get_extra_buffer_type
     static std::vector<ggml_backend_buffer_type_t> bufts = []() {
         std::vector<ggml_backend_buffer_type_t> bufts;
 
+        // first, so that the weights are replicated when GGML_NUMA_STRATEGY_MIRROR is used
+        bufts.push_back(ggml_backend_cpu_numa_mirror_buffer_type());
+
 #if defined(__AMX_INT8__) && defined(__AVX512VNNI__)
         if (ggml_backend_amx_buffer_type()) {
             bufts.push_back(ggml_backend_amx_buffer_type());
@@ -95,6 +99,10 @@ struct ggml_backend_cpu_context {
 
     ggml_abort_callback abort_callback;
     void *              abort_callback_data;
+
+    ggml_backend_profile_callback profile_callback;
+    void *                        profile_callback_data;
+    std::vector<int64_t>          profile_data;
 };
 
 static const char * ggml_backend_cpu_get_name(ggml_backend_t backend) {
@@ -173,7 +181,26 @@ static enum ggml_status ggml_backend_cpu_graph_compute(ggml_backend_t backend, s
     cplan.abort_callback      = cpu_ctx->abort_callback;
     cplan.abort_callback_data = cpu_ctx->abort_callback_data;
 
-    return ggml_graph_compute(cgraph, &cplan);
+    if (cpu_ctx->profile_callback == NULL) {
+        return ggml_graph_compute(cgraph, &cplan);
+    }
+
+    auto & profile_data = cpu_ctx->profile_data;
+    profile_data.assign((size_t) 2*cplan.n_threads*cgraph->n_nodes, 0);
+    cplan.profile_data = profile_data.data();
+
+    enum ggml_status status = ggml_graph_compute(cgraph, &cplan);
+
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        for (int ith = 0; ith < cplan.n_threads; ith++) {
+            const int64_t * t = &profile_data[2*((size_t) ith*cgraph->n_nodes + i)];
+            if (t[1] != 0) {
+                cpu_ctx->profile_callback(cgraph->nodes[i], ith, t[0], t[1], cpu_ctx->profile_callback_data);
+            }
+        }
+    }
+
+    return status;
 }
 
 static const struct ggml_backend_i ggml_backend_cpu_i = {
@@ -212,6 +239,8 @@ ggml_backend_t ggml_backend_cpu_init(void) {
     ctx->work_size           = 0;
     ctx->abort_callback      = NULL;
     ctx->abort_callback_data = NULL;
+    ctx->profile_callback      = NULL;
+    ctx->profile_callback_data = NULL;
 
     ggml_backend_t cpu_backend = new ggml_backend {
         /* .guid    = */ ggml_backend_cpu_guid(),
@@ -259,6 +288,14 @@ void ggml_backend_cpu_set_abort_callback(ggml_backend_t backend_cpu, ggml_abort_
     ctx->abort_callback_data = abort_callback_data;
 }
 
+void ggml_backend_cpu_set_profile_callback(ggml_backend_t backend_cpu, ggml_backend_profile_callback profile_callback, void * profile_callback_data) {
+    GGML_ASSERT(ggml_backend_is_cpu(backend_cpu));
+
+    struct ggml_backend_cpu_context * ctx = (struct ggml_backend_cpu_context *)backend_cpu->context;
+    ctx->profile_callback = profile_callback;
+    ctx->profile_callback_data = profile_callback_data;
+}
+
 // CPU backend - device
 
 struct ggml_backend_cpu_device_context {
@@ -438,6 +475,8 @@ static bool ggml_backend_cpu_device_supports_op(ggml_backend_dev_t dev, const st
             return src0->type == GGML_TYPE_F32 && src1->type == GGML_TYPE_F32;
         case GGML_OP_GET_ROWS_BACK:
             return src0->type == GGML_TYPE_F32 || src0->type == GGML_TYPE_F16;
+        case GGML_OP_ARGSORT_TOP_K:
+            return src0->type == GGML_TYPE_F32;
         case GGML_OP_OUT_PROD:
             return (src0->type == GGML_TYPE_F32 || (ggml_is_quantized(src0->type) && src0->ne[2] == src1->ne[2] && src0->ne[3] == src1->ne[3])) &&
                 src1->type == GGML_TYPE_F32 && op->type == GGML_TYPE_F32;
@@ -611,6 +650,27 @@ static ggml_backend_feature * ggml_backend_cpu_get_features(ggml_backend_reg_t r
     GGML_UNUSED(reg);
 }
 
+static ggml_backend_buffer_t ggml_backend_cpu_device_extra_buffer_from_ptr(ggml_backend_buffer_type_t buft, void * ptr, size_t size) {
+#if defined(__AMX_INT8__) && defined(__AVX512VNNI__)
+    if (buft == ggml_backend_amx_buffer_type()) {
+        return ggml_backend_amx_buffer_from_ptr(ptr, size);
+    }
+#endif
+
+#ifdef GGML_USE_CPU_REPACK
+    if (buft == ggml_backend_cpu_repack_buffer_type()) {
+        return ggml_backend_cpu_repack_buffer_from_ptr(ptr, size);
+    }
+#endif
+
+    // the KleidiAI layouts are not cached
+    return nullptr;
+
+    GGML_UNUSED(buft);
+    GGML_UNUSED(ptr);
+    GGML_UNUSED(size);
+}
+
 static void * ggml_backend_cpu_get_proc_address(ggml_backend_reg_t reg, const char * name) {
     if (strcmp(name, "ggml_backend_set_n_threads") == 0) {
         ggml_backend_set_n_threads_t fct = ggml_backend_cpu_set_n_threads;
@@ -620,12 +680,20 @@ static void * ggml_backend_cpu_get_proc_address(ggml_backend_reg_t reg, const ch
         ggml_backend_dev_get_extra_bufts_t fct = ggml_backend_cpu_device_get_extra_buffers_type;
         return (void *)fct;
     }
+    if (strcmp(name, "ggml_backend_dev_extra_buffer_from_ptr") == 0) {
+        ggml_backend_dev_extra_buffer_from_ptr_t fct = ggml_backend_cpu_device_extra_buffer_from_ptr;
+        return (void *)fct;
+    }
     if (strcmp(name, "ggml_backend_get_features") == 0) {
         return (void *)ggml_backend_cpu_get_features;
     }
     if (strcmp(name, "ggml_backend_set_abort_callback") == 0) {
         return (void *)ggml_backend_cpu_set_abort_callback;
     }
+    if (strcmp(name, "ggml_backend_set_profile_callback") == 0) {
+        ggml_backend_set_profile_callback_t fct = ggml_backend_cpu_set_profile_callback;
+        return (void *)fct;
+    }
     if (strcmp(name, "ggml_backend_cpu_numa_init") == 0) {
         return (void *)ggml_numa_init;
     }
@@ -0,0 +1,264 @@
+#include "ops.h"
+
+#include "ggml-backend-impl.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+#include "ggml-impl.h"
+#include "ggml-cpu-impl.h"
+#include "traits.h"
+
+#include "numa.h"
+
+#if defined(__gnu_linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+// buffer type NUMA mirror
+//
+// the buffer holds a copy of its tensors on each NUMA node
+// the matrix multiplications read the weights from the copy on the NUMA node of the thread
+// the threads are placed on the nodes as with GGML_NUMA_STRATEGY_DISTRIBUTE
+
+struct ggml_backend_cpu_numa_mirror_buffer_context {
+    std::vector<void *> replicas; // one per NUMA node, replicas[0] is the base of the buffer
+    size_t size;
+};
+
+static void * ggml_backend_cpu_numa_mirror_alloc(size_t size, int node, int n_nodes) {
+#if defined(__gnu_linux__)
+    void * ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+
+#if defined(SYS_mbind)
+    if (n_nodes > 1) {
+        // prefer the memory of the node, the pages are allocated when the weights are copied
+        const int MPOL_PREFERRED_ = 1;
+
+        unsigned long mask = 1ul << node;
+        if (syscall(SYS_mbind, ptr, size, MPOL_PREFERRED_, &mask, sizeof(mask)*8, 0) != 0) {
+            GGML_LOG_WARN("%s: failed to bind the weights to NUMA node %d: %s\n", __func__, node, strerror(errno));
+        }
+    }
+#else
+    GGML_UNUSED(node);
+    GGML_UNUSED(n_nodes);
+#endif
+
+    return ptr;
+#else
+    GGML_UNUSED(node);
+    GGML_UNUSED(n_nodes);
+
+    return ggml_aligned_malloc(size);
+#endif
+}
+
+static void ggml_backend_cpu_numa_mirror_free(void * ptr, size_t size) {
+#if defined(__gnu_linux__)
+    munmap(ptr, size);
+#else
+    ggml_aligned_free(ptr, size);
+#endif
+}
+
+namespace ggml::cpu::numa {
+class tensor_traits : public ggml::cpu::tensor_traits {
+    bool work_size(int /* n_threads */, const struct ggml_tensor * /* op */, size_t & /* size */) override {
+        // same as the default matrix multiplication
+        return false;
+    }
+
+    bool compute_forward(struct ggml_compute_params * params, struct ggml_tensor * op) override {
+        if (op->op != GGML_OP_MUL_MAT && op->op != GGML_OP_MUL_MAT_ID) {
+            return false;
+        }
+
+        const ggml_tensor * src0 = op->src[0];
+
+        auto * ctx = (ggml_backend_cpu_numa_mirror_buffer_context *) src0->buffer->context;
+
+        const int node = ggml_cpu_numa_mirror_node(params->ith) % (int) ctx->replicas.size();
+
+        // the weights of the node, the copies have the same layout
+        ggml_tensor src0_node = *src0;
+        src0_node.data = (char *) ctx->replicas[node] + ((const char *) src0->data - (const char *) ctx->replicas[0]);
+
+        ggml_tensor dst = *op;
+        dst.src[0] = &src0_node;
+
+        if (op->op == GGML_OP_MUL_MAT) {
+            ggml_compute_forward_mul_mat(params, &dst);
+        } else {
+            ggml_compute_forward_mul_mat_id(params, &dst);
+        }
+
+        return true;
+    }
+};
+
+static ggml::cpu::tensor_traits * get_tensor_traits(ggml_backend_buffer_t, struct ggml_tensor *) {
+    static tensor_traits traits;
+    return &traits;
+}
+}  // namespace ggml::cpu::numa
+
+static void ggml_backend_cpu_numa_mirror_buffer_free_buffer(ggml_backend_buffer_t buffer) {
+    auto * ctx = (ggml_backend_cpu_numa_mirror_buffer_context *) buffer->context;
+
+    for (void * ptr : ctx->replicas) {
+        ggml_backend_cpu_numa_mirror_free(ptr, ctx->size);
+    }
+
+    delete ctx;
+}
+
+static void * ggml_backend_cpu_numa_mirror_buffer_get_base(ggml_backend_buffer_t buffer) {
+    auto * ctx = (ggml_backend_cpu_numa_mirror_buffer_context *) buffer->context;
+
+    return ctx->replicas[0];
+}
+
+static enum ggml_status ggml_backend_cpu_numa_mirror_buffer_init_tensor(ggml_backend_buffer_t buffer, struct ggml_tensor * tensor) {
+    tensor->extra = (void *) ggml::cpu::numa::get_tensor_traits(buffer, tensor);
+
+    return GGML_STATUS_SUCCESS;
+}
+
+static void ggml_backend_cpu_numa_mirror_buffer_memset_tensor(ggml_backend_buffer_t buffer, struct ggml_tensor * tensor,
+                                                              uint8_t value, size_t offset, size_t size) {
+    auto * ctx = (ggml_backend_cpu_numa_mirror_buffer_context *) buffer->context;
+
+    const size_t tensor_offset = (const char *) tensor->data - (const char *) ctx->replicas[0];
+
+    for (void * ptr : ctx->replicas) {
+        memset((char *) ptr + tensor_offset + offset, value, size);
+    }
+}
+
+static void ggml_backend_cpu_numa_mirror_buffer_set_tensor(ggml_backend_buffer_t buffer, struct ggml_tensor * tensor,
+                                                           const void * data, size_t offset, size_t size) {
+    auto * ctx = (ggml_backend_cpu_numa_mirror_buffer_context *) buffer->context;
+
+    const size_t tensor_offset = (const char *) tensor->data - (const char *) ctx->replicas[0];
+
+    for (void * ptr : ctx->replicas) {
+        memcpy((char *) ptr + tensor_offset + offset, data, size);
+    }
+}
+
+static void ggml_backend_cpu_numa_mirror_buffer_get_tensor(ggml_backend_buffer_t buffer, const struct ggml_tensor * tensor,
+                                                           void * data, size_t offset, size_t size) {
+    memcpy(data, (const char *) tensor->data + offset, size);
+
+    GGML_UNUSED(buffer);
+}
+
+static void ggml_backend_cpu_numa_mirror_buffer_clear(ggml_backend_buffer_t buffer, uint8_t value) {
+    auto * ctx = (ggml_backend_cpu_numa_mirror_buffer_context *) buffer->context;
+
+    for (void * ptr : ctx->replicas) {
+        memset(ptr, value, ctx->size);
+    }
+}
+
+static ggml_backend_buffer_i ggml_backend_cpu_numa_mirror_buffer_interface = {
+    /* .free_buffer     = */ ggml_backend_cpu_numa_mirror_buffer_free_buffer,
+    /* .get_base        = */ ggml_backend_cpu_numa_mirror_buffer_get_base,
+    /* .init_tensor     = */ ggml_backend_cpu_numa_mirror_buffer_init_tensor,
+    /* .memset_tensor   = */ ggml_backend_cpu_numa_mirror_buffer_memset_tensor,
+    /* .set_tensor      = */ ggml_backend_cpu_numa_mirror_buffer_set_tensor,
+    /* .get_tensor      = */ ggml_backend_cpu_numa_mirror_buffer_get_tensor,
+    /* .cpy_tensor      = */ nullptr,
+    /* .clear           = */ ggml_backend_cpu_numa_mirror_buffer_clear,
+    /* .reset           = */ nullptr,
+};
+
+static const char * ggml_backend_cpu_numa_mirror_buffer_type_get_name(ggml_backend_buffer_type_t buft) {
+    return "CPU_NUMA_MIRROR";
+
+    GGML_UNUSED(buft);
+}
+
+static ggml_backend_buffer_t ggml_backend_cpu_numa_mirror_buffer_type_alloc_buffer(ggml_backend_buffer_type_t buft, size_t size) {
+    const int n_nodes = ggml_cpu_numa_mirror_n_nodes();
+
+    auto * ctx = new ggml_backend_cpu_numa_mirror_buffer_context;
+    ctx->size = size;
+
+    for (int node = 0; node < n_nodes; ++node) {
+        void * ptr = ggml_backend_cpu_numa_mirror_alloc(size, node, n_nodes);
+        if (ptr == NULL) {
+            GGML_LOG_ERROR("%s: failed to allocate buffer of size %zu on NUMA node %d\n", __func__, size, node);
+            for (void * p : ctx->replicas) {
+                ggml_backend_cpu_numa_mirror_free(p, size);
+            }
+            delete ctx;
+            return NULL;
+        }
+        ctx->replicas.push_back(ptr);
+    }
+
+    return ggml_backend_buffer_init(buft, ggml_backend_cpu_numa_mirror_buffer_interface, ctx, size);
+}
+
+static size_t ggml_backend_cpu_numa_mirror_buffer_type_get_alignment(ggml_backend_buffer_type_t buft) {
+    return TENSOR_ALIGNMENT;
+
+    GGML_UNUSED(buft);
+}
+
+namespace ggml::cpu::numa {
+class extra_buffer_type : ggml::cpu::extra_buffer_type {
+    bool supports_op(ggml_backend_dev_t, const struct ggml_tensor * op) override {
+        // only used when the weights are replicated
+        if (ggml_cpu_numa_mirror_n_nodes() < 2) {
+            return false;
+        }
+
+        if ((op->op == GGML_OP_MUL_MAT || op->op == GGML_OP_MUL_MAT_ID) &&
+            op->src[0]->buffer &&
+            op->src[0]->buffer->buft == ggml_backend_cpu_numa_mirror_buffer_type()) {
+            // src1 must be host buffer
+            if (op->src[1]->buffer && !ggml_backend_buft_is_host(op->src[1]->buffer->buft)) {
+                return false;
+            }
+            return op->src[1]->type == GGML_TYPE_F32 || op->src[1]->type == ggml_get_type_traits_cpu(op->src[0]->type)->vec_dot_type;
+        }
+        return false;
+    }
+
+    ggml::cpu::tensor_traits * get_tensor_traits(const struct ggml_tensor * op) override {
+        if ((op->op == GGML_OP_MUL_MAT || op->op == GGML_OP_MUL_MAT_ID) && op->src[0]->buffer &&
+            op->src[0]->buffer->buft == ggml_backend_cpu_numa_mirror_buffer_type()) {
+            return (ggml::cpu::tensor_traits *) op->src[0]->extra;
+        }
+
+        return nullptr;
+    }
+};
+}  // namespace ggml::cpu::numa
+
+ggml_backend_buffer_type_t ggml_backend_cpu_numa_mirror_buffer_type(void) {
+    static struct ggml_backend_buffer_type ggml_backend_cpu_buffer_type_numa_mirror = {
+        /* .iface    = */ {
+                           /* .get_name         = */ ggml_backend_cpu_numa_mirror_buffer_type_get_name,
+                           /* .alloc_buffer     = */ ggml_backend_cpu_numa_mirror_buffer_type_alloc_buffer,
+                           /* .get_alignment    = */ ggml_backend_cpu_numa_mirror_buffer_type_get_alignment,
+                           /* .get_max_size     = */ nullptr,  // defaults to SIZE_MAX
+                           /* .get_alloc_size   = */ nullptr,  // defaults to ggml_nbytes
+                           /* .is_host          = */ nullptr,
+                           },
+        /* .device  = */ ggml_backend_reg_dev_get(ggml_backend_cpu_reg(), 0),
+        /* .context = */ new ggml::cpu::numa::extra_buffer_type(),
+    };
+
+    return &ggml_backend_cpu_buffer_type_numa_mirror;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "ggml-backend.h"
+#include "ggml.h"
+
+// GGML CPU internal header
+
+// weights replicated on each NUMA node, used with GGML_NUMA_STRATEGY_MIRROR
+ggml_backend_buffer_type_t ggml_backend_cpu_numa_mirror_buffer_type(void);
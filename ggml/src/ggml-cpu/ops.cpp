@@ -4,6 +4,7 @@
 #include "ggml-impl.h"
 #include "binary-ops.h"
 #include "ggml.h"
+#include "quants.h"
 #include "unary-ops.h"
 #include "vec.h"
 
@@ -8164,8 +8165,191 @@ void ggml_compute_forward_argsort(
     }
 }
 
+// ggml_compute_forward_argsort_top_k
+
+static void ggml_compute_forward_argsort_top_k_f32(
+    const ggml_compute_params * params,
+    ggml_tensor * dst) {
+
+    const ggml_tensor * src0 = dst->src[0];
+
+    GGML_TENSOR_UNARY_OP_LOCALS
+
+    GGML_ASSERT(nb00 == sizeof(float));
+    GGML_ASSERT(nb0  == sizeof(int32_t));
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t nr = ggml_nrows(src0);
+    const int64_t k  = ne0;
+
+    // candidate buffer of this thread, see ggml_graph_plan
+    const int64_t block = 16;
+    const int64_t n_cap = std::max<int64_t>(2*k, 256);
+
+    int32_t * buf = (int32_t *) params->wdata + ith*(n_cap + block + CACHE_LINE_SIZE_F32);
+
+    for (int64_t i = ith; i < nr; i += nth) {
+        const int64_t i03 = i/(ne02*ne01);
+        const int64_t i02 = (i - i03*ne02*ne01)/ne01;
+        const int64_t i01 = (i - i03*ne02*ne01 - i02*ne01);
+
+        const float * x = (const float *) ((const char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+        int32_t     * y = (int32_t     *) ((      char *)  dst->data + i01*nb1  + i02*nb2  + i03*nb3);
+
+        // ties are broken by index, so that the result is deterministic
+        auto comp = [x](int32_t a, int32_t b) {
+            return x[a] > x[b] || (x[a] == x[b] && a < b);
+        };
+
+        // gather the candidates with a running threshold - whenever the buffer fills up, it is cut down
+        // to the current top k and the threshold is raised to the k-th value
+        int64_t n = 0;
+        float   threshold = -INFINITY;
+
+        auto gather = [&](int64_t j0, int64_t j1) {
+            for (int64_t j = j0; j < j1; ++j) {
+                if (x[j] >= threshold) {
+                    buf[n++] = (int32_t) j;
+                }
+            }
+            if (n >= n_cap) {
+                std::nth_element(buf, buf + (k - 1), buf + n, comp);
+                n = k;
+                threshold = x[buf[k - 1]];
+            }
+        };
+
+        int64_t j = 0;
+        for (; j + block <= ne00; j += block) {
+            float max = x[j];
+            for (int64_t jj = 1; jj < block; ++jj) {
+                max = x[j + jj] > max ? x[j + jj] : max;
+            }
+            if (max < threshold) {
+                continue;
+            }
+            gather(j, j + block);
+        }
+        gather(j, ne00);
+
+        if (n > k) {
+            std::nth_element(buf, buf + (k - 1), buf + n, comp);
+            n = k;
+        }
+
+        std::sort(buf, buf + n, comp);
+
+        // not enough comparable values (nan) - fill up with the remaining indices
+        for (int64_t jn = 0; n < k && jn < ne00; ++jn) {
+            if (std::isnan(x[jn])) {
+                buf[n++] = (int32_t) jn;
+            }
+        }
+
+        memcpy(y, buf, k*sizeof(int32_t));
+    }
+}
+
+void ggml_compute_forward_argsort_top_k(
+    const ggml_compute_params * params,
+    ggml_tensor * dst) {
+
+    const ggml_tensor * src0 = dst->src[0];
+
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_argsort_top_k_f32(params, dst);
+            } break;
+        default:
+            {
+                GGML_ABORT("fatal error");
+            }
+    }
+}
+
 // ggml_compute_forward_flash_attn_ext
 
+// the work of the CPU flash attention kernel is divided into units:
+//  - rows:  a single q row (one head, one position)
+//  - tiles: all q heads that share a KV head, for a block of q positions
+//           each K/V row is loaded once for all rows of the tile
+// with too few units to keep the threads busy, the KV cells of each unit are further split into chunks
+struct ggml_fa_tiling {
+    int64_t n_q;         // q positions per tile, 0 if the work is divided into rows
+    int64_t n_rows;      // q rows per unit
+    int64_t n_units;
+    int64_t n_kv_chunks; // 1 if the KV cells are not split
+};
+
+static ggml_fa_tiling ggml_flash_attn_ext_get_tiling(const ggml_tensor * dst, int n_threads) {
+    const ggml_tensor * q = dst->src[0];
+    const ggml_tensor * k = dst->src[1];
+
+    const int64_t rk2  = q->ne[2]/k->ne[2];
+    const int64_t n_kv = k->ne[1];
+
+    ggml_fa_tiling res = { 0, 1, q->ne[1]*q->ne[2]*q->ne[3], 1 };
+
+    if (rk2 > 1 || q->ne[1] > 1) {
+        res.n_q     = MIN(q->ne[1], MAX(1, GGML_FA_TILE_Q/rk2));
+        res.n_rows  = rk2*res.n_q;
+        res.n_units = q->ne[3]*k->ne[2]*((q->ne[1] + res.n_q - 1)/res.n_q);
+    }
+
+    // with enough units, parallelizing over the units is better
+    if (res.n_units >= 2*n_threads) {
+        return res;
+    }
+
+    // the smallest number of chunks per unit for which the (unit, chunk) pairs are evenly distributed over the threads
+    int64_t a = res.n_units;
+    int64_t b = n_threads;
+    while (b != 0) {
+        const int64_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    // chunks of at least GGML_FA_KV_CHUNK_MIN KV cells
+    res.n_kv_chunks = MAX(1, MIN(n_threads/a, n_kv/GGML_FA_KV_CHUNK_MIN));
+
+    return res;
+}
+
+// per thread work buffer, in floats
+static int64_t ggml_flash_attn_ext_wsize_thread(const ggml_tensor * dst, const ggml_fa_tiling & tiling) {
+    const int64_t DK = dst->src[1]->ne[0];
+    const int64_t DV = dst->src[2]->ne[0];
+
+    if (tiling.n_q == 0) {
+        return 1*DK + 2*DV + CACHE_LINE_SIZE_F32; // 1x head size K + 2x head size V
+    }
+
+    // Q, KQ, VKQ and the softmax state of each row, V of each KV cell of a tile
+    return tiling.n_rows*(DK + GGML_FA_TILE_KV + DV + 2) + GGML_FA_TILE_KV*DV + CACHE_LINE_SIZE_F32;
+}
+
+size_t ggml_flash_attn_ext_work_size(const ggml_tensor * dst, int n_threads) {
+    const ggml_fa_tiling tiling = ggml_flash_attn_ext_get_tiling(dst, n_threads);
+
+    size_t res = sizeof(float)*ggml_flash_attn_ext_wsize_thread(dst, tiling)*n_threads;
+
+    if (tiling.n_kv_chunks > 1) {
+        const ggml_tensor * q = dst->src[0];
+
+        const int64_t DV = dst->src[2]->ne[0];
+        const int64_t nr = q->ne[1]*q->ne[2]*q->ne[3];
+
+        // split-KV partial results: max, sum and head size V for each q row and chunk
+        res += sizeof(float)*(2 + DV)*nr*tiling.n_kv_chunks;
+    }
+
+    return res;
+}
+
 static void ggml_compute_forward_flash_attn_ext_f16(
         const ggml_compute_params * params,
         ggml_tensor * dst) {
@@ -8254,11 +8438,26 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     ggml_vec_dot_t    const kq_vec_dot     = ggml_get_type_traits_cpu(k->type)->vec_dot;
     ggml_to_float_t   const v_to_float     = ggml_get_type_traits(v->type)->to_float;
 
+    // V += v*vs directly on the quantized V rows, without converting them to F32 first
+    void (* const v_mad)(int, float *, const void *, float) =
+        v->type == GGML_TYPE_Q8_0 ? ggml_vec_mad_q8_0 :
+        v->type == GGML_TYPE_Q4_0 ? ggml_vec_mad_q4_0 : nullptr;
+
     GGML_ASSERT((                            q_to_vec_dot) && "fattn: unsupported K-type");
     GGML_ASSERT((v->type == GGML_TYPE_F32 || v_to_float  ) && "fattn: unsupported V-type");
 
-    // loop over n_batch and n_head
-    for (int ir = ir0; ir < ir1; ++ir) {
+    const ggml_fa_tiling tiling = ggml_flash_attn_ext_get_tiling(dst, nth);
+
+    float * wdata = (float *) params->wdata + ith*ggml_flash_attn_ext_wsize_thread(dst, tiling);
+
+    float       * VKQ32 = wdata;                          // FP32 VKQ accumulator
+    float       * V32   =                 (VKQ32 + 1*DV); // (temporary) FP32 V buffer
+    ggml_fp16_t * VKQ16 = (ggml_fp16_t *) (VKQ32 + 1*DV); // (temporary) FP16 VKQ accumulator
+    ggml_fp16_t * Q_q   = (ggml_fp16_t *) (VKQ32 + 2*DV); // (temporary) buffer for Q converted to quantized/FP16
+
+    // online softmax over the KV cells [ic0, ic1) for the q row ir
+    // the result is left unnormalized in VKQ32, with the maximum KQ value in M and the sum of expf(KQ - M) in S
+    const auto attend = [&](int ir, int64_t ic0, int64_t ic1, float & M, float & S) {
         // q indices
         const int iq3 = ir/(neq2*neq1);
         const int iq2 = (ir - iq3*neq2*neq1)/neq1;
@@ -8267,13 +8466,8 @@ static void ggml_compute_forward_flash_attn_ext_f16(
         const uint32_t h = iq2; // head index
         const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
 
-        float S = 0.0f;      // sum
-        float M = -INFINITY; // maximum KQ value
-
-        float       * VKQ32 = (float       *) params->wdata + ith*(1*DK + 2*DV + CACHE_LINE_SIZE_F32); // FP32 VKQ accumulator
-        float       * V32   =                 (VKQ32 + 1*DV); // (temporary) FP32 V buffer
-        ggml_fp16_t * VKQ16 = (ggml_fp16_t *) (VKQ32 + 1*DV); // (temporary) FP16 VKQ accumulator
-        ggml_fp16_t * Q_q   = (ggml_fp16_t *) (VKQ32 + 2*DV); // (temporary) buffer for Q converted to quantized/FP16
+        S = 0.0f;      // sum
+        M = -INFINITY; // maximum KQ value
 
         if (v->type == GGML_TYPE_F16) {
             memset(VKQ16, 0, DV*sizeof(ggml_fp16_t));
@@ -8297,7 +8491,7 @@ static void ggml_compute_forward_flash_attn_ext_f16(
         // online softmax / attention
         // loop over n_kv and n_head_kv
         // ref: https://arxiv.org/pdf/2112.05682.pdf
-        for (int64_t ic = 0; ic < nek1; ++ic) {
+        for (int64_t ic = ic0; ic < ic1; ++ic) {
             const float mv = mp ? slope*GGML_CPU_FP16_TO_FP32(mp[ic]) : 0.0f;
             if (mv == -INFINITY) {
                 continue;
@@ -8352,7 +8546,9 @@ static void ggml_compute_forward_flash_attn_ext_f16(
                 }
 
                 // V += v*expf(s - M)
-                if (v_to_float) {
+                if (v_mad) {
+                    v_mad(DV, VKQ32, v_data, vs);
+                } else if (v_to_float) {
                     v_to_float(v_data, V32, DV);
                     ggml_vec_mad_f32(DV, VKQ32, V32, vs);
                 } else {
@@ -8369,6 +8565,171 @@ static void ggml_compute_forward_flash_attn_ext_f16(
                 VKQ32[d] = GGML_CPU_FP16_TO_FP32(VKQ16[d]);
             }
         }
+    };
+
+    // online softmax over the KV cells [ic0, ic1) for the q rows of the tile u, one KV tile at a time
+    // the results are passed to emit(ir, M, S, VKQ) as for attend
+    const int64_t n_tile_rows = tiling.n_rows;
+
+    const size_t row_size_q = ggml_row_size(k_vec_dot_type, DK);
+
+    float * T_Q   = wdata;                               // [n_tile_rows][DK]   Q converted to quantized/FP16
+    float * T_KQ  = T_Q   + n_tile_rows*DK;              // [n_tile_rows][TILE] KQ values, then softmax numerators
+    float * T_VKQ = T_KQ  + n_tile_rows*GGML_FA_TILE_KV; // [n_tile_rows][DV]   FP32 VKQ accumulators
+    float * T_M   = T_VKQ + n_tile_rows*DV;              // [n_tile_rows]       maximum KQ value
+    float * T_S   = T_M   + n_tile_rows;                 // [n_tile_rows]       sum
+    float * T_V32 = T_S   + n_tile_rows;                 // [TILE][DV]          V converted to FP32
+
+    const auto attend_tile = [&](int64_t u, int64_t ic0, int64_t ic1, const auto & emit) {
+        // unit indices: q positions [iq1_0, iq1_1) of the q heads [ik2*rk2, (ik2 + 1)*rk2)
+        const int64_t n_q_blocks = (neq1 + tiling.n_q - 1)/tiling.n_q;
+
+        const int64_t iq3   = u/(nek2*n_q_blocks);
+        const int64_t ik2   = (u - iq3*nek2*n_q_blocks)/n_q_blocks;
+        const int64_t iq1_0 = (u - iq3*nek2*n_q_blocks - ik2*n_q_blocks)*tiling.n_q;
+        const int64_t iq1_1 = MIN(iq1_0 + tiling.n_q, neq1);
+
+        const int64_t ik3 = iq3/rk3;
+        const int64_t iv2 = ik2*rk2/rv2;
+        const int64_t iv3 = iq3/rv3;
+
+        // the rows of the tile: r = (iq1 - iq1_0)*rk2 + (iq2 - ik2*rk2)
+        const int64_t n_rows = (iq1_1 - iq1_0)*rk2;
+
+        for (int64_t r = 0; r < n_rows; ++r) {
+            const int64_t iq1 = iq1_0 + r/rk2;
+            const int64_t iq2 = ik2*rk2 + r%rk2;
+
+            const float * pq = (const float *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3));
+            q_to_vec_dot(pq, (char *) T_Q + r*row_size_q, DK);
+
+            T_M[r] = -INFINITY;
+            T_S[r] = 0.0f;
+
+            memset(T_VKQ + r*DV, 0, DV*sizeof(float));
+        }
+
+        for (int64_t it0 = ic0; it0 < ic1; it0 += GGML_FA_TILE_KV) {
+            const int64_t it1 = MIN(it0 + GGML_FA_TILE_KV, ic1);
+
+            // KQ = Q*K^T for the tile, each K row is used by all q rows while it is in cache
+            for (int64_t r = 0; r < n_rows; ++r) {
+                const int64_t iq1 = iq1_0 + r/rk2;
+                const int64_t iq2 = ik2*rk2 + r%rk2;
+
+                const uint32_t h = iq2; // head index
+                const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+
+                const ggml_fp16_t * mp = mask ? (ggml_fp16_t *)((char *) mask->data + iq1*mask->nb[1] + (iq2%mask->ne[2])*mask->nb[2] + (iq3%mask->ne[3])*mask->nb[3]) : NULL;
+
+                // start with the mask, KQ is only computed for the cells that are not masked
+                float * kq = T_KQ + r*GGML_FA_TILE_KV;
+                for (int64_t ic = it0; ic < it1; ++ic) {
+                    kq[ic - it0] = mp ? slope*GGML_CPU_FP16_TO_FP32(mp[ic]) : 0.0f;
+                }
+            }
+
+            for (int64_t ic = it0; ic < it1; ++ic) {
+                const char * k_data = (const char *) k->data + (ic*nbk1 + ik2*nbk2 + ik3*nbk3);
+
+                for (int64_t r = 0; r < n_rows; ++r) {
+                    float & kq = T_KQ[r*GGML_FA_TILE_KV + ic - it0];
+                    if (kq == -INFINITY) {
+                        continue;
+                    }
+
+                    float s; // KQ value
+                    kq_vec_dot(DK, &s, 0, k_data, 0, (const char *) T_Q + r*row_size_q, 0, 1);
+
+                    s = s*scale; // scale KQ value
+
+                    if (logit_softcap != 0.0f) {
+                        s = logit_softcap*tanhf(s);
+                    }
+
+                    kq += s; // apply mask
+                }
+            }
+
+            // online softmax for the tile
+            for (int64_t r = 0; r < n_rows; ++r) {
+                float * kq = T_KQ + r*GGML_FA_TILE_KV;
+
+                float M = T_M[r];
+                for (int64_t i = 0; i < it1 - it0; ++i) {
+                    M = MAX(M, kq[i]);
+                }
+
+                if (M == -INFINITY) {
+                    // all KV cells so far are masked
+                    continue;
+                }
+
+                if (M > T_M[r]) {
+                    // new maximum, scale VKQ and the sum
+                    const float ms = expf(T_M[r] - M);
+
+                    ggml_vec_scale_f32(DV, T_VKQ + r*DV, ms);
+                    T_S[r] *= ms;
+                    T_M[r] = M;
+                }
+
+                float S = 0.0f;
+                for (int64_t i = 0; i < it1 - it0; ++i) {
+                    kq[i] = kq[i] == -INFINITY ? 0.0f : expf(kq[i] - M);
+                    S += kq[i];
+                }
+
+                T_S[r] += S;
+            }
+
+            // VKQ += softmax(KQ)*V, each V row is used by all q rows while it is in cache
+            for (int64_t ic = it0; ic < it1; ++ic) {
+                const char * v_data = (const char *) v->data + (ic*nbv1 + iv2*nbv2 + iv3*nbv3);
+
+                if (v_mad && n_rows == 1) {
+                    // a single q row, the V row would be converted to F32 only to be used once
+                    const float vs = T_M[0] == -INFINITY ? 0.0f : T_KQ[ic - it0];
+                    if (vs != 0.0f) {
+                        v_mad(DV, T_VKQ, v_data, vs);
+                    }
+                    continue;
+                }
+
+                const float * v32 = (const float *) v_data;
+                if (v->type == GGML_TYPE_F16) {
+                    ggml_cpu_fp16_to_fp32((const ggml_fp16_t *) v_data, T_V32, DV);
+                    v32 = T_V32;
+                } else if (v_to_float) {
+                    v_to_float(v_data, T_V32, DV);
+                    v32 = T_V32;
+                }
+
+                for (int64_t r = 0; r < n_rows; ++r) {
+                    const float vs = T_M[r] == -INFINITY ? 0.0f : T_KQ[r*GGML_FA_TILE_KV + ic - it0];
+                    if (vs != 0.0f) {
+                        ggml_vec_mad_f32(DV, T_VKQ + r*DV, v32, vs);
+                    }
+                }
+            }
+        }
+
+        for (int64_t r = 0; r < n_rows; ++r) {
+            const int64_t iq1 = iq1_0 + r/rk2;
+            const int64_t iq2 = ik2*rk2 + r%rk2;
+
+            emit(iq1 + neq1*(iq2 + neq2*iq3), T_M[r], T_S[r], T_VKQ + r*DV);
+        }
+    };
+
+    // apply the sinks, normalize VKQ and store it as the result for the q row ir
+    const auto store = [&](int64_t ir, float M, float S, float * VKQ) {
+        // q indices
+        const int iq3 = ir/(neq2*neq1);
+        const int iq2 = (ir - iq3*neq2*neq1)/neq1;
+        const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
+
+        const uint32_t h = iq2; // head index
 
         // sinks
         if (sinks) {
@@ -8379,7 +8740,7 @@ static void ggml_compute_forward_flash_attn_ext_f16(
 
             if (s > M) {
                 ms = expf(M - s);
-                ggml_vec_scale_f32(DV, VKQ32, ms);
+                ggml_vec_scale_f32(DV, VKQ, ms);
             } else {
                 vs = expf(s - M);
             }
@@ -8389,7 +8750,7 @@ static void ggml_compute_forward_flash_attn_ext_f16(
 
         // V /= S
         const float S_inv = 1.0f/S;
-        ggml_vec_scale_f32(DV, VKQ32, S_inv);
+        ggml_vec_scale_f32(DV, VKQ, S_inv);
 
         // dst indices
         const int i1 = iq1;
@@ -8400,7 +8761,95 @@ static void ggml_compute_forward_flash_attn_ext_f16(
         //memcpy((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3), V, nev0*sizeof(float));
 
         // permute(0, 2, 1, 3)
-        memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, VKQ32, nb1);
+        memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, VKQ, nb1);
+    };
+
+    const int64_t n_kv_chunks = tiling.n_kv_chunks;
+
+    if (n_kv_chunks <= 1) {
+        // units per thread
+        const int64_t du = (tiling.n_units + nth - 1)/nth;
+
+        for (int64_t u = du*ith; u < MIN(du*(ith + 1), tiling.n_units); ++u) {
+            if (tiling.n_q == 0) {
+                float M;
+                float S;
+
+                attend(u, 0, nek1, M, S);
+                store(u, M, S, VKQ32);
+            } else {
+                attend_tile(u, 0, nek1, store);
+            }
+        }
+
+        return;
+    }
+
+    // split-KV: there are too few units to keep all threads busy (e.g. single token decode)
+    // the KV cells of each unit are split into chunks that are processed by different threads,
+    // then the partial results of each row are merged using the maximum KQ value and the sum of each chunk
+    float * partials = (float *) params->wdata + nth*ggml_flash_attn_ext_wsize_thread(dst, tiling); // [nr][n_kv_chunks][2 + DV]
+
+    const int64_t n_items = tiling.n_units*n_kv_chunks;
+
+    // items per thread
+    const int64_t di = (n_items + nth - 1)/nth;
+
+    for (int64_t i = di*ith; i < MIN(di*(ith + 1), n_items); ++i) {
+        const int64_t u  = i/n_kv_chunks;
+        const int64_t ic = i%n_kv_chunks;
+
+        const int64_t ic0 = (nek1*ic)/n_kv_chunks;
+        const int64_t ic1 = (nek1*(ic + 1))/n_kv_chunks;
+
+        const auto store_partial = [&](int64_t ir, float M, float S, const float * VKQ) {
+            float * part = partials + (ir*n_kv_chunks + ic)*(2 + DV);
+
+            part[0] = M;
+            part[1] = S;
+            memcpy(part + 2, VKQ, DV*sizeof(float));
+        };
+
+        if (tiling.n_q == 0) {
+            float M;
+            float S;
+
+            attend(u, ic0, ic1, M, S);
+            store_partial(u, M, S, VKQ32);
+        } else {
+            attend_tile(u, ic0, ic1, store_partial);
+        }
+    }
+
+    ggml_barrier(params->threadpool);
+
+    for (int ir = ir0; ir < ir1; ++ir) {
+        const float * part = partials + ir*n_kv_chunks*(2 + DV);
+
+        float M = -INFINITY;
+        for (int64_t ic = 0; ic < n_kv_chunks; ++ic) {
+            M = MAX(M, part[ic*(2 + DV)]);
+        }
+
+        float S = 0.0f;
+        memset(VKQ32, 0, DV*sizeof(float));
+
+        for (int64_t ic = 0; ic < n_kv_chunks; ++ic) {
+            const float Mc = part[ic*(2 + DV) + 0];
+            const float Sc = part[ic*(2 + DV) + 1];
+
+            if (Mc == -INFINITY) {
+                // all KV cells of the chunk are masked
+                continue;
+            }
+
+            const float ms = expf(Mc - M);
+
+            S += Sc*ms;
+            ggml_vec_mad_f32(DV, VKQ32, part + ic*(2 + DV) + 2, ms);
+        }
+
+        store(ir, M, S, VKQ32);
     }
 }
 
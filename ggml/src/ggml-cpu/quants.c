@@ -332,6 +332,44 @@ void ggml_vec_dot_q8_0_q8_0_generic(int n, float * GGML_RESTRICT s, size_t bs, c
     *s = sumf;
 }
 
+void ggml_vec_mad_q4_0_generic(int n, float * GGML_RESTRICT y, const void * GGML_RESTRICT vx, float v) {
+    const int qk = QK4_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q4_0 * GGML_RESTRICT x = vx;
+
+    for (int ib = 0; ib < nb; ++ib) {
+        const float d = GGML_CPU_FP16_TO_FP32(x[ib].d)*v;
+
+        for (int j = 0; j < qk/2; ++j) {
+            const int v0 = (x[ib].qs[j] & 0x0F) - 8;
+            const int v1 = (x[ib].qs[j] >>   4) - 8;
+
+            y[ib*qk + j       ] += v0*d;
+            y[ib*qk + j + qk/2] += v1*d;
+        }
+    }
+}
+
+void ggml_vec_mad_q8_0_generic(int n, float * GGML_RESTRICT y, const void * GGML_RESTRICT vx, float v) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q8_0 * GGML_RESTRICT x = vx;
+
+    for (int ib = 0; ib < nb; ++ib) {
+        const float d = GGML_CPU_FP16_TO_FP32(x[ib].d)*v;
+
+        for (int j = 0; j < qk; ++j) {
+            y[ib*qk + j] += x[ib].qs[j]*d;
+        }
+    }
+}
+
 void ggml_vec_dot_tq1_0_q8_K_generic(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, size_t bx, const void * GGML_RESTRICT vy, size_t by, int nrc) {
     assert(nrc == 1);
     UNUSED(nrc);
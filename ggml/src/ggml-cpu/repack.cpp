@@ -1909,6 +1909,23 @@ static ggml_backend_buffer_t ggml_backend_cpu_repack_buffer_type_alloc_buffer(gg
     return buffer;
 }
 
+ggml_backend_buffer_t ggml_backend_cpu_repack_buffer_from_ptr(void * ptr, size_t size) {
+    ggml_backend_buffer_t buffer = ggml_backend_cpu_buffer_from_ptr(ptr, size);
+
+    if (buffer == nullptr) {
+        return nullptr;
+    }
+
+    // the memory may be a read-only mapping, the tensors are only allocated in it
+    buffer->buft                = ggml_backend_cpu_repack_buffer_type();
+    buffer->iface.init_tensor   = ggml_backend_cpu_repack_buffer_init_tensor;
+    buffer->iface.memset_tensor = nullptr;
+    buffer->iface.set_tensor    = nullptr;
+    buffer->iface.get_tensor    = nullptr;
+    buffer->iface.cpy_tensor    = nullptr;
+    return buffer;
+}
+
 static size_t ggml_backend_cpu_repack_buffer_type_get_alignment(ggml_backend_buffer_type_t buft) {
     return TENSOR_ALIGNMENT;
 
@@ -10,6 +10,9 @@
 
 ggml_backend_buffer_type_t ggml_backend_cpu_repack_buffer_type(void);
 
+// read-only buffer over weights that are already repacked
+ggml_backend_buffer_t ggml_backend_cpu_repack_buffer_from_ptr(void * ptr, size_t size);
+
 template <int K> constexpr int QK_0() {
     if constexpr (K == 4) {
         return QK4_0;
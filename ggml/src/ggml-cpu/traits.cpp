@@ -34,3 +34,15 @@ bool ggml_cpu_extra_work_size(int n_threads, const struct ggml_tensor * op, size
     }
     return false;
 }
+
+bool ggml_cpu_extra_has_tensor_traits(const struct ggml_tensor * op) {
+    for (auto extra : ggml_backend_cpu_get_extra_buffer_types()) {
+        if (extra && extra->context) {
+            auto buf_extra = (ggml::cpu::extra_buffer_type *) extra->context;
+            if (buf_extra->get_tensor_traits(op)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
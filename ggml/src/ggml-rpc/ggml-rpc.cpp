@@ -2,6 +2,7 @@
 #include "ggml-impl.h"
 #include "ggml-backend-impl.h"
 #include "ggml-cpp.h"
+#include "rpc-compress.h"
 
 #include <cinttypes>
 #include <string>
@@ -25,6 +26,9 @@
 #  include <netinet/tcp.h>
 #  include <netdb.h>
 #  include <unistd.h>
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
 #endif
 #include <cstring>
 #include <fstream>
@@ -42,9 +46,26 @@ using ssize_t = __int64;
 typedef int sockfd_t;
 #endif
 
+// graphs cached by the server for each connection
+static constexpr size_t GRAPH_CACHE_SIZE = 8;
+
 // cross-platform socket
 struct socket_t {
     sockfd_t fd;
+
+    // client state of the connection
+    uint32_t    n_pending = 0;                      // graph computes sent without reading the response
+    ggml_status status = GGML_STATUS_SUCCESS;       // first failure of the pending graph computes
+    std::vector<std::vector<uint8_t>> graphs;       // serialized graphs cached by the server, by slot
+    std::vector<uint64_t>             graphs_used;  // last use of each slot
+    uint64_t                          n_graphs = 0;
+
+    // writes and asynchronous reads, sent in a single command before the next command or on synchronize
+    bool                 batch     = false;         // the server supports RPC_CMD_SET_TENSORS and RPC_CMD_GET_TENSORS
+    std::vector<uint8_t> set_batch;                 // | n_tensors (4 bytes) | entries |, see rpc_server::set_tensors
+    std::vector<uint8_t> get_batch;                 // | n_tensors (4 bytes) | compress (4 bytes) | rpc_msg_get_tensor_req entries |
+    std::vector<void *>  get_dst;
+
     socket_t(sockfd_t fd) : fd(fd) {}
     ~socket_t() {
         GGML_PRINT_DEBUG("[%s] closing socket %d\n", __func__, this->fd);
@@ -99,12 +120,21 @@ enum rpc_cmd {
     RPC_CMD_INIT_TENSOR,
     RPC_CMD_GET_ALLOC_SIZE,
     RPC_CMD_HELLO,
+    RPC_CMD_GRAPH_RECOMPUTE,
+    RPC_CMD_SET_TENSORS,
+    RPC_CMD_GET_TENSORS,
     RPC_CMD_COUNT,
 };
 
 // Try RPC_CMD_SET_TENSOR_HASH first when data size is larger than this threshold
 const size_t HASH_THRESHOLD = 10 * 1024 * 1024;
 
+// Compress the data of the batched transfers larger than this threshold when GGML_RPC_COMPRESS is set
+const size_t COMPRESS_THRESHOLD = 4 * 1024;
+
+// Send the queued writes when they are larger than this
+const size_t MAX_BATCH_SIZE = 16 * 1024 * 1024;
+
 struct rpc_msg_hello_rsp {
     uint8_t major;
     uint8_t minor;
@@ -182,6 +212,10 @@ struct rpc_msg_copy_tensor_rsp {
     uint8_t result;
 };
 
+struct rpc_msg_graph_recompute_req {
+    uint32_t slot;
+};
+
 struct rpc_msg_graph_compute_rsp {
     uint8_t result;
 };
@@ -231,6 +265,22 @@ static uint64_t fnv_hash(const uint8_t * data, size_t len) {
     return hash;
 }
 
+static bool rpc_compress_enabled() {
+    static const bool enabled = [] {
+        const char * env = getenv("GGML_RPC_COMPRESS");
+        return env != nullptr && atoi(env) != 0;
+    }();
+    return enabled;
+}
+
+static int64_t rpc_get_pid() {
+#ifdef _WIN32
+    return (int64_t) GetCurrentProcessId();
+#else
+    return (int64_t) getpid();
+#endif
+}
+
 static std::shared_ptr<socket_t> make_socket(sockfd_t fd) {
 #ifdef _WIN32
     if (fd == INVALID_SOCKET) {
@@ -399,9 +449,12 @@ static bool parse_endpoint(const std::string & endpoint, std::string & host, int
     return true;
 }
 
+static bool flush_batch(const std::shared_ptr<socket_t> & sock);
+
 // RPC request : | rpc_cmd (1 byte) | request_size (8 bytes) | request_data (request_size bytes) |
 // No response
-static bool send_rpc_cmd(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cmd, const void * input, size_t input_size) {
+// Sends the command without the queued transfers, see send_rpc_cmd
+static bool send_rpc_req(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cmd, const void * input, size_t input_size) {
     uint8_t cmd_byte = cmd;
     if (!send_data(sock->fd, &cmd_byte, sizeof(cmd_byte))) {
         return false;
@@ -415,12 +468,43 @@ static bool send_rpc_cmd(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cm
     return true;
 }
 
+static bool send_rpc_cmd(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cmd, const void * input, size_t input_size) {
+    // the batched transfers were queued before this command
+    if (!flush_batch(sock)) {
+        return false;
+    }
+    return send_rpc_req(sock, cmd, input, input_size);
+}
+
+// Receives the responses of the graph computes that were sent without waiting for them
+// The server processes the commands in order, so these responses come before the response of any later command
+static bool recv_pending(const std::shared_ptr<socket_t> & sock, uint32_t n_keep = 0) {
+    while (sock->n_pending > n_keep) {
+        rpc_msg_graph_compute_rsp response;
+        uint64_t out_size;
+        if (!recv_data(sock->fd, &out_size, sizeof(out_size)) || out_size != sizeof(response)) {
+            return false;
+        }
+        if (!recv_data(sock->fd, &response, sizeof(response))) {
+            return false;
+        }
+        sock->n_pending--;
+        if (response.result != GGML_STATUS_SUCCESS && sock->status == GGML_STATUS_SUCCESS) {
+            sock->status = (enum ggml_status)response.result;
+        }
+    }
+    return true;
+}
+
 // RPC request : | rpc_cmd (1 byte) | request_size (8 bytes) | request_data (request_size bytes) |
 // RPC response: | response_size (8 bytes) | response_data (response_size bytes) |
 static bool send_rpc_cmd(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cmd, const void * input, size_t input_size, void * output, size_t output_size) {
     if (!send_rpc_cmd(sock, cmd, input, input_size)) {
         return false;
     }
+    if (!recv_pending(sock)) {
+        return false;
+    }
     // TODO: currently the output_size is always known, do we need support for commands with variable output size?
     // even if we do, we can skip sending output_size from the server for commands with known output size
     uint64_t out_size;
@@ -436,6 +520,69 @@ static bool send_rpc_cmd(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cm
     return true;
 }
 
+// RPC request : | rpc_cmd (1 byte) | request_size (8 bytes) | request_data (request_size bytes) |
+// RPC response: | response_size (8 bytes) | response_data (response_size bytes) |
+// For the commands with a variable response size
+static bool send_rpc_cmd(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cmd, const void * input, size_t input_size, std::vector<uint8_t> & output) {
+    if (!send_rpc_cmd(sock, cmd, input, input_size)) {
+        return false;
+    }
+    if (!recv_pending(sock)) {
+        return false;
+    }
+    return recv_msg(sock->fd, output);
+}
+
+// Sends the queued asynchronous transfers, the writes before the reads: a write is never queued after a read
+// get_batch response: | entries |, each entry is | compressed_size (8 bytes) | data |, the data is not compressed if compressed_size is 0
+static bool flush_batch(const std::shared_ptr<socket_t> & sock) {
+    if (!sock->set_batch.empty()) {
+        std::vector<uint8_t> input;
+        input.swap(sock->set_batch);
+        if (!send_rpc_req(sock, RPC_CMD_SET_TENSORS, input.data(), input.size())) {
+            return false;
+        }
+    }
+    if (!sock->get_batch.empty()) {
+        std::vector<uint8_t> input;
+        std::vector<void *> dst;
+        input.swap(sock->get_batch);
+        dst.swap(sock->get_dst);
+
+        std::vector<uint8_t> output;
+        if (!send_rpc_req(sock, RPC_CMD_GET_TENSORS, input.data(), input.size()) ||
+            !recv_pending(sock) || !recv_msg(sock->fd, output)) {
+            return false;
+        }
+
+        const rpc_msg_get_tensor_req * requests = (const rpc_msg_get_tensor_req *)(input.data() + 2*sizeof(uint32_t));
+        size_t pos = 0;
+        for (size_t i = 0; i < dst.size(); i++) {
+            uint64_t compressed_size;
+            if (output.size() - pos < sizeof(compressed_size)) {
+                return false;
+            }
+            memcpy(&compressed_size, output.data() + pos, sizeof(compressed_size));
+            pos += sizeof(compressed_size);
+
+            const size_t size = requests[i].size;
+            const size_t data_size = compressed_size ? compressed_size : size;
+            if (output.size() - pos < data_size) {
+                return false;
+            }
+            if (compressed_size) {
+                if (!rpc_decompress(output.data() + pos, compressed_size, (uint8_t *)dst[i], size)) {
+                    return false;
+                }
+            } else {
+                memcpy(dst[i], output.data() + pos, size);
+            }
+            pos += data_size;
+        }
+    }
+    return true;
+}
+
 // RPC client-side implementation
 
 static bool check_server_version(const std::shared_ptr<socket_t> & sock) {
@@ -449,6 +596,8 @@ static bool check_server_version(const std::shared_ptr<socket_t> & sock) {
     if (response.minor != RPC_PROTO_MINOR_VERSION || response.patch != RPC_PROTO_PATCH_VERSION) {
         fprintf(stderr, "WARNING: RPC server version mismatch: %d.%d.%d\n", response.major, response.minor, response.patch);
     }
+    // the batched transfers were added in 3.1.0
+    sock->batch = response.minor >= 1;
     return true;
 }
 
@@ -498,6 +647,9 @@ static void ggml_backend_rpc_buffer_free_buffer(ggml_backend_buffer_t buffer) {
     rpc_msg_free_buffer_req request = {ctx->remote_ptr};
     bool status = send_rpc_cmd(ctx->sock, RPC_CMD_FREE_BUFFER, &request, sizeof(request), nullptr, 0);
     RPC_STATUS_ASSERT(status);
+    // the server drops the cached graphs when a buffer is freed since they may reference it
+    ctx->sock->graphs.clear();
+    ctx->sock->graphs_used.clear();
     delete ctx;
 }
 
@@ -566,8 +718,55 @@ static enum ggml_status ggml_backend_rpc_buffer_init_tensor(ggml_backend_buffer_
     return GGML_STATUS_SUCCESS;
 }
 
+// The writes are not acknowledged by the server, so they are queued and sent together with the other writes
+// before the next command. The data of the tensors that are not weights is compressed when GGML_RPC_COMPRESS is set.
+static void queue_set_tensor(const std::shared_ptr<socket_t> & sock, ggml_tensor * tensor, const void * data, size_t offset, size_t size) {
+    // entry serialization format: | rpc_tensor | offset (8 bytes) | size (8 bytes) | compressed_size (8 bytes) | data |
+    // the data is not compressed if compressed_size is 0
+    if (!sock->get_batch.empty()) {
+        // the queued reads must see the data before this write
+        bool status = flush_batch(sock);
+        RPC_STATUS_ASSERT(status);
+    }
+    auto & batch = sock->set_batch;
+    if (batch.empty()) {
+        batch.resize(sizeof(uint32_t), 0);
+    }
+    rpc_tensor rpc_tensor = serialize_tensor(tensor);
+    uint64_t entry[3] = { offset, size, 0 };
+
+    const size_t pos = batch.size();
+    batch.resize(pos + sizeof(rpc_tensor) + sizeof(entry) + size);
+    uint8_t * dst = batch.data() + pos + sizeof(rpc_tensor) + sizeof(entry);
+    if (rpc_compress_enabled() && size > COMPRESS_THRESHOLD &&
+        ggml_backend_buffer_get_usage(tensor->buffer) != GGML_BACKEND_BUFFER_USAGE_WEIGHTS) {
+        entry[2] = rpc_compress((const uint8_t *)data, size, dst, size - 1);
+    }
+    if (entry[2] == 0) {
+        memcpy(dst, data, size);
+    } else {
+        batch.resize(pos + sizeof(rpc_tensor) + sizeof(entry) + entry[2]);
+    }
+    memcpy(batch.data() + pos, &rpc_tensor, sizeof(rpc_tensor));
+    memcpy(batch.data() + pos + sizeof(rpc_tensor), entry, sizeof(entry));
+
+    uint32_t n_tensors;
+    memcpy(&n_tensors, batch.data(), sizeof(n_tensors));
+    n_tensors++;
+    memcpy(batch.data(), &n_tensors, sizeof(n_tensors));
+
+    if (batch.size() > MAX_BATCH_SIZE) {
+        bool status = flush_batch(sock);
+        RPC_STATUS_ASSERT(status);
+    }
+}
+
 static void ggml_backend_rpc_buffer_set_tensor(ggml_backend_buffer_t buffer, ggml_tensor * tensor, const void * data, size_t offset, size_t size) {
     ggml_backend_rpc_buffer_context * ctx = (ggml_backend_rpc_buffer_context *)buffer->context;
+    if (ctx->sock->batch && size <= HASH_THRESHOLD) {
+        queue_set_tensor(ctx->sock, tensor, data, offset, size);
+        return;
+    }
     rpc_tensor rpc_tensor = serialize_tensor(tensor);
     if (size > HASH_THRESHOLD) {
         rpc_msg_set_tensor_hash_req request;
@@ -728,9 +927,65 @@ static void ggml_backend_rpc_free(ggml_backend_t backend) {
     delete backend;
 }
 
-static void ggml_backend_rpc_synchronize(ggml_backend_t backend) {
+// The asynchronous transfers are queued and sent in a single command before the next command
+static void ggml_backend_rpc_set_tensor_async(ggml_backend_t backend, ggml_tensor * tensor, const void * data, size_t offset, size_t size) {
+    // the writes are queued by set_tensor
+    ggml_backend_rpc_buffer_set_tensor(tensor->buffer, tensor, data, offset, size);
+    GGML_UNUSED(backend);
+}
+
+static void ggml_backend_rpc_get_tensor_async(ggml_backend_t backend, const ggml_tensor * tensor, void * data, size_t offset, size_t size) {
+    ggml_backend_rpc_buffer_context * ctx = (ggml_backend_rpc_buffer_context *)tensor->buffer->context;
+    auto & sock = ctx->sock;
+    if (!sock->batch) {
+        ggml_backend_rpc_buffer_get_tensor(tensor->buffer, tensor, data, offset, size);
+        return;
+    }
     GGML_UNUSED(backend);
-    // this is no-op because we don't have any async operations
+
+    auto & batch = sock->get_batch;
+    if (batch.empty()) {
+        const uint32_t header[2] = { 0, rpc_compress_enabled() };
+        batch.resize(sizeof(header));
+        memcpy(batch.data(), header, sizeof(header));
+    }
+    rpc_msg_get_tensor_req request;
+    request.tensor = serialize_tensor(tensor);
+    request.offset = offset;
+    request.size = size;
+
+    const size_t pos = batch.size();
+    batch.resize(pos + sizeof(request));
+    memcpy(batch.data() + pos, &request, sizeof(request));
+    sock->get_dst.push_back(data);
+
+    const uint32_t n_tensors = sock->get_dst.size();
+    memcpy(batch.data(), &n_tensors, sizeof(n_tensors));
+}
+
+static bool ggml_backend_rpc_cpy_tensor_async(ggml_backend_t backend_src, ggml_backend_t backend_dst, const ggml_tensor * src, ggml_tensor * dst) {
+    // the copies from host memory are queued with the writes
+    if (src->buffer == nullptr || !ggml_backend_buffer_is_host(src->buffer) ||
+        dst->buffer == nullptr || dst->buffer->iface.set_tensor != ggml_backend_rpc_buffer_set_tensor) {
+        return false;
+    }
+    // the data is copied now
+    ggml_backend_synchronize(backend_src);
+    ggml_backend_rpc_buffer_set_tensor(dst->buffer, dst, src->data, 0, ggml_nbytes(src));
+    GGML_UNUSED(backend_dst);
+    return true;
+}
+
+static void ggml_backend_rpc_synchronize(ggml_backend_t backend) {
+    ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend->context;
+    auto sock = get_socket(rpc_ctx->endpoint);
+    // the queued writes are not acknowledged, they only have to be sent before the next command
+    bool status = (sock->get_batch.empty() || flush_batch(sock)) && recv_pending(sock);
+    RPC_STATUS_ASSERT(status);
+    if (sock->status != GGML_STATUS_SUCCESS) {
+        GGML_LOG_ERROR("%s: graph compute failed on %s: %s\n", __func__, rpc_ctx->endpoint.c_str(), ggml_status_to_string(sock->status));
+        sock->status = GGML_STATUS_SUCCESS;
+    }
 }
 
 static void add_tensor(ggml_tensor * tensor, std::vector<rpc_tensor> & tensors, std::unordered_set<ggml_tensor*> & visited) {
@@ -770,23 +1025,65 @@ static void serialize_graph(const ggml_cgraph * cgraph, std::vector<uint8_t> & o
     memcpy(out_tensors, tensors.data(), n_tensors * sizeof(rpc_tensor));
 }
 
+// The graphs are cached by the server in GRAPH_CACHE_SIZE slots chosen by the client, a graph that is
+// already cached is computed again with only its slot. The computes are asynchronous: the response is
+// read when the next command needs a response, so the client can send the inputs of the next graph
+// while the server computes the current one.
 static enum ggml_status ggml_backend_rpc_graph_compute(ggml_backend_t backend, ggml_cgraph * cgraph) {
     ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend->context;
     std::vector<uint8_t> input;
     serialize_graph(cgraph, input);
-    rpc_msg_graph_compute_rsp response;
     auto sock = get_socket(rpc_ctx->endpoint);
-    bool status = send_rpc_cmd(sock, RPC_CMD_GRAPH_COMPUTE, input.data(), input.size(), &response, sizeof(response));
+
+    if (sock->graphs.empty()) {
+        sock->graphs.resize(GRAPH_CACHE_SIZE);
+        sock->graphs_used.resize(GRAPH_CACHE_SIZE, 0);
+    }
+
+    uint32_t slot = 0;
+    bool cached = false;
+    for (uint32_t i = 0; i < GRAPH_CACHE_SIZE; i++) {
+        if (sock->graphs[i] == input) {
+            slot = i;
+            cached = true;
+            break;
+        }
+        if (sock->graphs_used[i] < sock->graphs_used[slot]) {
+            slot = i;
+        }
+    }
+    sock->graphs_used[slot] = ++sock->n_graphs;
+
+    bool status;
+    if (cached) {
+        rpc_msg_graph_recompute_req request = {slot};
+        status = send_rpc_cmd(sock, RPC_CMD_GRAPH_RECOMPUTE, &request, sizeof(request));
+    } else {
+        // input serialization format: | slot (4 bytes) | graph |
+        std::vector<uint8_t> msg(sizeof(slot) + input.size());
+        memcpy(msg.data(), &slot, sizeof(slot));
+        memcpy(msg.data() + sizeof(slot), input.data(), input.size());
+        status = send_rpc_cmd(sock, RPC_CMD_GRAPH_COMPUTE, msg.data(), msg.size());
+        sock->graphs[slot] = std::move(input);
+    }
     RPC_STATUS_ASSERT(status);
-    return (enum ggml_status)response.result;
+    sock->n_pending++;
+
+    // keep at most one graph compute in flight
+    status = recv_pending(sock, 1);
+    RPC_STATUS_ASSERT(status);
+
+    enum ggml_status result = sock->status;
+    sock->status = GGML_STATUS_SUCCESS;
+    return result;
 }
 
 static ggml_backend_i ggml_backend_rpc_interface = {
     /* .get_name                = */ ggml_backend_rpc_name,
     /* .free                    = */ ggml_backend_rpc_free,
-    /* .set_tensor_async        = */ NULL,
-    /* .get_tensor_async        = */ NULL,
-    /* .cpy_tensor_async        = */ NULL,
+    /* .set_tensor_async        = */ ggml_backend_rpc_set_tensor_async,
+    /* .get_tensor_async        = */ ggml_backend_rpc_get_tensor_async,
+    /* .cpy_tensor_async        = */ ggml_backend_rpc_cpy_tensor_async,
     /* .synchronize             = */ ggml_backend_rpc_synchronize,
     /* .graph_plan_create       = */ NULL,
     /* .graph_plan_free         = */ NULL,
@@ -868,10 +1165,82 @@ void ggml_backend_rpc_get_device_memory(const char * endpoint, size_t * free, si
 
 // RPC server-side implementation
 
+// read-only mapping of a file of the server cache
+struct rpc_file_mapping {
+    void * addr = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE hfile    = INVALID_HANDLE_VALUE;
+    HANDLE hmapping = NULL;
+#endif
+
+    rpc_file_mapping() = default;
+    rpc_file_mapping(const rpc_file_mapping &) = delete;
+    rpc_file_mapping & operator=(const rpc_file_mapping &) = delete;
+
+    bool map(const fs::path & path) {
+#ifdef _WIN32
+        hfile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hfile == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(hfile, &file_size) || file_size.QuadPart == 0) {
+            return false;
+        }
+        size = (size_t) file_size.QuadPart;
+        hmapping = CreateFileMappingA(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (hmapping == NULL) {
+            return false;
+        }
+        addr = MapViewOfFile(hmapping, FILE_MAP_READ, 0, 0, 0);
+        return addr != nullptr;
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        size = (size_t) st.st_size;
+        addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) {
+            addr = nullptr;
+            return false;
+        }
+        // the data is read once, sequentially
+        posix_madvise(addr, size, POSIX_MADV_SEQUENTIAL);
+        return true;
+#endif
+    }
+
+    ~rpc_file_mapping() {
+#ifdef _WIN32
+        if (addr) {
+            UnmapViewOfFile(addr);
+        }
+        if (hmapping) {
+            CloseHandle(hmapping);
+        }
+        if (hfile != INVALID_HANDLE_VALUE) {
+            CloseHandle(hfile);
+        }
+#else
+        if (addr) {
+            munmap(addr, size);
+        }
+#endif
+    }
+};
+
 class rpc_server {
 public:
     rpc_server(ggml_backend_t backend, const char * cache_dir)
-        : backend(backend), cache_dir(cache_dir) {
+        : backend(backend), cache_dir(cache_dir), graphs(GRAPH_CACHE_SIZE) {
     }
     ~rpc_server();
 
@@ -884,14 +1253,18 @@ public:
     bool buffer_clear(const rpc_msg_buffer_clear_req & request);
     bool set_tensor(const std::vector<uint8_t> & input);
     bool set_tensor_hash(const rpc_msg_set_tensor_hash_req & request, rpc_msg_set_tensor_hash_rsp & response);
+    bool set_tensors(const std::vector<uint8_t> & input);
+    bool get_tensors(const std::vector<uint8_t> & input, std::vector<uint8_t> & response);
     bool get_tensor(const rpc_msg_get_tensor_req & request, std::vector<uint8_t> & response);
     bool copy_tensor(const rpc_msg_copy_tensor_req & request, rpc_msg_copy_tensor_rsp & response);
     bool graph_compute(const std::vector<uint8_t> & input, rpc_msg_graph_compute_rsp & response);
+    bool graph_recompute(const rpc_msg_graph_recompute_req & request, rpc_msg_graph_compute_rsp & response);
     bool init_tensor(const rpc_msg_init_tensor_req & request);
     bool get_alloc_size(const rpc_msg_get_alloc_size_req & request, rpc_msg_get_alloc_size_rsp & response);
 
 private:
-    bool get_cached_file(uint64_t hash, std::vector<uint8_t> & data);
+    std::unique_ptr<rpc_file_mapping> get_cached_file(uint64_t hash);
+    bool check_region(const char * func, const ggml_tensor * tensor, uint64_t data, uint64_t offset, uint64_t size);
     ggml_tensor * deserialize_tensor(struct ggml_context * ctx, const rpc_tensor * tensor);
     ggml_tensor * create_node(uint64_t id,
                               struct ggml_context * ctx,
@@ -899,9 +1272,15 @@ private:
                               std::unordered_map<uint64_t, struct ggml_tensor*> & tensor_map);
 
 
+    struct cached_graph {
+        ggml_context_ptr ctx;
+        ggml_cgraph    * graph = nullptr;
+    };
+
     ggml_backend_t backend;
     const char * cache_dir;
     std::unordered_set<ggml_backend_buffer_t> buffers;
+    std::vector<cached_graph> graphs;
 };
 
 void rpc_server::hello(rpc_msg_hello_rsp & response) {
@@ -991,6 +1370,10 @@ bool rpc_server::free_buffer(const rpc_msg_free_buffer_req & request) {
     }
     ggml_backend_buffer_free(buffer);
     buffers.erase(buffer);
+    // the cached graphs may reference the buffer, the client drops them too
+    for (auto & g : graphs) {
+        g = {};
+    }
     return true;
 }
 
@@ -1091,43 +1474,58 @@ bool rpc_server::set_tensor(const std::vector<uint8_t> & input) {
         uint64_t hash = fnv_hash((const uint8_t*)data, size);
         char hash_str[17];
         snprintf(hash_str, sizeof(hash_str), "%016" PRIx64, hash);
-        // save to cache_dir/hash_str
+        // save to cache_dir/hash_str, the files are named by their content so an existing file is not written again
         fs::path cache_file = fs::path(cache_dir) / hash_str;
-        std::ofstream ofs(cache_file, std::ios::binary);
-        ofs.write((const char *)data, size);
-        printf("[%s] saved to '%s'\n", __func__, cache_file.c_str());
+        std::error_code ec;
+        if (!fs::exists(cache_file, ec)) {
+            // write to a temporary file first so that a partial file is never mapped
+            // the name is unique to the process, as several servers may share cache_dir
+            fs::path tmp_file = cache_file;
+            tmp_file += ".tmp." + std::to_string(rpc_get_pid());
+            bool written;
+            {
+                std::ofstream ofs(tmp_file, std::ios::binary);
+                ofs.write((const char *)data, size);
+                ofs.close();
+                written = !ofs.fail();
+            }
+            if (written) {
+                fs::rename(tmp_file, cache_file, ec);
+            }
+            if (!written || ec) {
+                fprintf(stderr, "[%s] failed to save to '%s'\n", __func__, cache_file.string().c_str());
+                fs::remove(tmp_file, ec);
+            } else {
+                printf("[%s] saved to '%s'\n", __func__, cache_file.string().c_str());
+            }
+        }
     }
     ggml_backend_tensor_set(tensor, data, offset, size);
     return true;
 }
 
-bool rpc_server::get_cached_file(uint64_t hash, std::vector<uint8_t> & data) {
+std::unique_ptr<rpc_file_mapping> rpc_server::get_cached_file(uint64_t hash) {
     if (!cache_dir) {
-        return false;
+        return nullptr;
     }
     char hash_str[17];
     snprintf(hash_str, sizeof(hash_str), "%016" PRIx64, hash);
     fs::path cache_file = fs::path(cache_dir) / hash_str;
-    if (!fs::exists(cache_file)) {
-        return false;
+    std::unique_ptr<rpc_file_mapping> mapping(new rpc_file_mapping());
+    if (!mapping->map(cache_file)) {
+        return nullptr;
     }
-    std::ifstream ifs(cache_file, std::ios::binary);
-    ifs.seekg(0, std::ios::end);
-    size_t size = ifs.tellg();
-    ifs.seekg(0, std::ios::beg);
-    data.resize(size);
-    ifs.read((char *)data.data(), size);
-    return true;
+    return mapping;
 }
 
 bool rpc_server::set_tensor_hash(const rpc_msg_set_tensor_hash_req & request, rpc_msg_set_tensor_hash_rsp & response)
 {
-    std::vector<uint8_t> cached_file;
-    if (!get_cached_file(request.hash, cached_file)) {
+    auto cached_file = get_cached_file(request.hash);
+    if (!cached_file) {
         response.result = 0;
         return true;
     }
-    size_t size = cached_file.size();
+    size_t size = cached_file->size;
     struct ggml_init_params params {
         /*.mem_size   =*/ ggml_tensor_overhead(),
         /*.mem_buffer =*/ NULL,
@@ -1157,11 +1555,144 @@ bool rpc_server::set_tensor_hash(const rpc_msg_set_tensor_hash_req & request, rp
             return false;
         }
     }
-    ggml_backend_tensor_set(tensor, cached_file.data(), request.offset, size);
+    ggml_backend_tensor_set(tensor, cached_file->addr, request.offset, size);
     response.result = 1;
     return true;
 }
 
+bool rpc_server::check_region(const char * func, const ggml_tensor * tensor, uint64_t data, uint64_t offset, uint64_t size) {
+    const size_t p0 = (size_t) ggml_backend_buffer_get_base(tensor->buffer);
+    const size_t p1 = p0 + ggml_backend_buffer_get_size(tensor->buffer);
+
+    if (data + offset < p0 || data + offset >= p1 || size > (p1 - data - offset)) {
+        GGML_LOG_ERROR("[%s] tensor data region (data=0x%" PRIx64 ", offset=%" PRIu64 ", size=%" PRIu64 ") out of buffer bounds [0x%zx, 0x%zx)\n",
+                       func, data, offset, size, p0, p1);
+        return false;
+    }
+    return true;
+}
+
+bool rpc_server::set_tensors(const std::vector<uint8_t> & input) {
+    // serialization format: | n_tensors (4 bytes) | entries |
+    // entry: | rpc_tensor | offset (8 bytes) | size (8 bytes) | compressed_size (8 bytes) | data (compressed_size or size bytes) |
+    if (input.size() < sizeof(uint32_t)) {
+        return false;
+    }
+    uint32_t n_tensors;
+    memcpy(&n_tensors, input.data(), sizeof(n_tensors));
+
+    struct ggml_init_params params {
+        /*.mem_size   =*/ ggml_tensor_overhead(),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+
+    std::vector<uint8_t> decompressed;
+
+    size_t pos = sizeof(n_tensors);
+    for (uint32_t i = 0; i < n_tensors; i++) {
+        uint64_t entry[3];
+        if (input.size() - pos < sizeof(rpc_tensor) + sizeof(entry)) {
+            return false;
+        }
+        const rpc_tensor * in_tensor = (const rpc_tensor *)(input.data() + pos);
+        memcpy(entry, input.data() + pos + sizeof(rpc_tensor), sizeof(entry));
+        pos += sizeof(rpc_tensor) + sizeof(entry);
+
+        const uint64_t offset          = entry[0];
+        const uint64_t size            = entry[1];
+        const uint64_t compressed_size = entry[2];
+        const uint64_t data_size       = compressed_size ? compressed_size : size;
+        if (input.size() - pos < data_size) {
+            return false;
+        }
+
+        ggml_context_ptr ctx_ptr { ggml_init(params) };
+        GGML_ASSERT(ctx_ptr != nullptr);
+        ggml_tensor * tensor = deserialize_tensor(ctx_ptr.get(), in_tensor);
+        if (tensor == nullptr || tensor->buffer == nullptr) {
+            GGML_LOG_ERROR("[%s] error deserializing tensor\n", __func__);
+            return false;
+        }
+        if (!check_region(__func__, tensor, in_tensor->data, offset, size)) {
+            return false;
+        }
+
+        const uint8_t * data = input.data() + pos;
+        if (compressed_size) {
+            decompressed.resize(size);
+            if (!rpc_decompress(data, compressed_size, decompressed.data(), size)) {
+                GGML_LOG_ERROR("[%s] invalid compressed data\n", __func__);
+                return false;
+            }
+            data = decompressed.data();
+        }
+        ggml_backend_tensor_set(tensor, data, offset, size);
+        pos += data_size;
+    }
+    return true;
+}
+
+bool rpc_server::get_tensors(const std::vector<uint8_t> & input, std::vector<uint8_t> & response) {
+    // serialization format: | n_tensors (4 bytes) | compress (4 bytes) | rpc_msg_get_tensor_req entries |
+    // response: | entries |, entry: | compressed_size (8 bytes) | data (compressed_size or size bytes) |
+    if (input.size() < 2*sizeof(uint32_t)) {
+        return false;
+    }
+    uint32_t n_tensors;
+    uint32_t compress;
+    memcpy(&n_tensors, input.data(), sizeof(n_tensors));
+    memcpy(&compress, input.data() + sizeof(n_tensors), sizeof(compress));
+    if ((input.size() - 2*sizeof(uint32_t))/sizeof(rpc_msg_get_tensor_req) < n_tensors) {
+        return false;
+    }
+    const rpc_msg_get_tensor_req * requests = (const rpc_msg_get_tensor_req *)(input.data() + 2*sizeof(uint32_t));
+
+    struct ggml_init_params params {
+        /*.mem_size   =*/ ggml_tensor_overhead(),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+
+    std::vector<uint8_t> data;
+
+    response.clear();
+    for (uint32_t i = 0; i < n_tensors; i++) {
+        const rpc_msg_get_tensor_req & request = requests[i];
+
+        ggml_context_ptr ctx_ptr { ggml_init(params) };
+        GGML_ASSERT(ctx_ptr != nullptr);
+        ggml_tensor * tensor = deserialize_tensor(ctx_ptr.get(), &request.tensor);
+        if (tensor == nullptr || tensor->buffer == nullptr) {
+            GGML_LOG_ERROR("[%s] error deserializing tensor\n", __func__);
+            return false;
+        }
+        if (!check_region(__func__, tensor, request.tensor.data, request.offset, request.size)) {
+            return false;
+        }
+
+        const size_t pos = response.size();
+        uint64_t compressed_size = 0;
+        if (compress && request.size > COMPRESS_THRESHOLD) {
+            data.resize(request.size);
+            ggml_backend_tensor_get(tensor, data.data(), request.offset, request.size);
+            response.resize(pos + sizeof(compressed_size) + request.size - 1);
+            compressed_size = rpc_compress(data.data(), request.size, response.data() + pos + sizeof(compressed_size), request.size - 1);
+            if (compressed_size == 0) {
+                response.resize(pos + sizeof(compressed_size) + request.size);
+                memcpy(response.data() + pos + sizeof(compressed_size), data.data(), request.size);
+            } else {
+                response.resize(pos + sizeof(compressed_size) + compressed_size);
+            }
+        } else {
+            response.resize(pos + sizeof(compressed_size) + request.size);
+            ggml_backend_tensor_get(tensor, response.data() + pos + sizeof(compressed_size), request.offset, request.size);
+        }
+        memcpy(response.data() + pos, &compressed_size, sizeof(compressed_size));
+    }
+    return true;
+}
+
 bool rpc_server::init_tensor(const rpc_msg_init_tensor_req & request) {
     struct ggml_init_params params {
         /*.mem_size   =*/ ggml_tensor_overhead(),
@@ -1325,23 +1856,31 @@ ggml_tensor * rpc_server::create_node(uint64_t id,
 
 bool rpc_server::graph_compute(const std::vector<uint8_t> & input, rpc_msg_graph_compute_rsp & response) {
     // serialization format:
-    // | n_nodes (4 bytes) | nodes (n_nodes * sizeof(uint64_t) | n_tensors (4 bytes) | tensors (n_tensors * sizeof(rpc_tensor)) |
-    if (input.size() < sizeof(uint32_t)) {
+    // | slot (4 bytes) | n_nodes (4 bytes) | nodes (n_nodes * sizeof(uint64_t) | n_tensors (4 bytes) | tensors (n_tensors * sizeof(rpc_tensor)) |
+    if (input.size() < 2*sizeof(uint32_t)) {
+        return false;
+    }
+    uint32_t slot;
+    memcpy(&slot, input.data(), sizeof(slot));
+    if (slot >= graphs.size()) {
+        GGML_LOG_ERROR("[%s] invalid graph slot %u\n", __func__, slot);
         return false;
     }
+    const uint8_t * data = input.data() + sizeof(slot);
+    const size_t data_size = input.size() - sizeof(slot);
     uint32_t n_nodes;
-    memcpy(&n_nodes, input.data(), sizeof(n_nodes));
-    if (input.size() < sizeof(uint32_t) + n_nodes*sizeof(uint64_t) + sizeof(uint32_t)) {
+    memcpy(&n_nodes, data, sizeof(n_nodes));
+    if (data_size < sizeof(uint32_t) + n_nodes*sizeof(uint64_t) + sizeof(uint32_t)) {
         return false;
     }
-    const uint64_t * nodes = (const uint64_t *)(input.data() + sizeof(n_nodes));
+    const uint64_t * nodes = (const uint64_t *)(data + sizeof(n_nodes));
     uint32_t n_tensors;
-    memcpy(&n_tensors, input.data() + sizeof(n_nodes) + n_nodes*sizeof(uint64_t), sizeof(n_tensors));
-    if (input.size() < sizeof(uint32_t) + n_nodes*sizeof(uint64_t) + sizeof(uint32_t) + n_tensors*sizeof(rpc_tensor)) {
+    memcpy(&n_tensors, data + sizeof(n_nodes) + n_nodes*sizeof(uint64_t), sizeof(n_tensors));
+    if (data_size < sizeof(uint32_t) + n_nodes*sizeof(uint64_t) + sizeof(uint32_t) + n_tensors*sizeof(rpc_tensor)) {
         return false;
     }
-    const rpc_tensor * tensors = (const rpc_tensor *)(input.data() + sizeof(n_nodes) + n_nodes*sizeof(uint64_t) + sizeof(n_tensors));
-    GGML_PRINT_DEBUG("[%s] n_nodes: %u, n_tensors: %u\n", __func__, n_nodes, n_tensors);
+    const rpc_tensor * tensors = (const rpc_tensor *)(data + sizeof(n_nodes) + n_nodes*sizeof(uint64_t) + sizeof(n_tensors));
+    GGML_PRINT_DEBUG("[%s] slot: %u, n_nodes: %u, n_tensors: %u\n", __func__, slot, n_nodes, n_tensors);
 
     size_t buf_size = ggml_tensor_overhead()*(n_nodes + n_tensors) + ggml_graph_overhead_custom(n_nodes, false);
 
@@ -1373,11 +1912,24 @@ bool rpc_server::graph_compute(const std::vector<uint8_t> & input, rpc_msg_graph
             return false;
         }
     }
+    graphs[slot].ctx   = std::move(ctx_ptr);
+    graphs[slot].graph = graph;
+
     ggml_status status = ggml_backend_graph_compute(backend, graph);
     response.result = status;
     return true;
 }
 
+bool rpc_server::graph_recompute(const rpc_msg_graph_recompute_req & request, rpc_msg_graph_compute_rsp & response) {
+    if (request.slot >= graphs.size() || graphs[request.slot].graph == nullptr) {
+        GGML_LOG_ERROR("[%s] no graph cached in slot %u\n", __func__, request.slot);
+        return false;
+    }
+    ggml_status status = ggml_backend_graph_compute(backend, graphs[request.slot].graph);
+    response.result = status;
+    return true;
+}
+
 rpc_server::~rpc_server() {
     for (auto buffer : buffers) {
         ggml_backend_buffer_free(buffer);
@@ -1585,6 +2137,44 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
                 }
                 break;
             }
+            case RPC_CMD_GRAPH_RECOMPUTE: {
+                rpc_msg_graph_recompute_req request;
+                if (!recv_msg(sockfd, &request, sizeof(request))) {
+                    return;
+                }
+                rpc_msg_graph_compute_rsp response;
+                if (!server.graph_recompute(request, response)) {
+                    return;
+                }
+                if (!send_msg(sockfd, &response, sizeof(response))) {
+                    return;
+                }
+                break;
+            }
+            case RPC_CMD_SET_TENSORS: {
+                std::vector<uint8_t> input;
+                if (!recv_msg(sockfd, input)) {
+                    return;
+                }
+                if (!server.set_tensors(input)) {
+                    return;
+                }
+                break;
+            }
+            case RPC_CMD_GET_TENSORS: {
+                std::vector<uint8_t> input;
+                if (!recv_msg(sockfd, input)) {
+                    return;
+                }
+                std::vector<uint8_t> response;
+                if (!server.get_tensors(input, response)) {
+                    return;
+                }
+                if (!send_msg(sockfd, response.data(), response.size())) {
+                    return;
+                }
+                break;
+            }
             case RPC_CMD_GET_DEVICE_MEMORY: {
                 if (!recv_msg(sockfd, nullptr, 0)) {
                     return;
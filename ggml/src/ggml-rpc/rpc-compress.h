@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// LZ4-like compression of the data of the batched transfers
+// the compressed data is a list of sequences: | token | literals | offset (2 bytes) | match |
+// the high 4 bits of the token are the number of literals, the low 4 bits the length of the match minus RPC_MIN_MATCH,
+// a value of 15 is followed by bytes that are added to it until one of them is not 255
+// the last sequence has only literals
+static constexpr size_t RPC_MIN_MATCH = 4;
+static constexpr int    RPC_HASH_LOG  = 12;
+
+static uint8_t * rpc_put_len(uint8_t * op, const uint8_t * oend, size_t len) {
+    while (len >= 255) {
+        if (op >= oend) {
+            return nullptr;
+        }
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op >= oend) {
+        return nullptr;
+    }
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+// returns the compressed size, or 0 if the data does not compress to less than dst_size bytes
+static size_t rpc_compress(const uint8_t * src, size_t src_size, uint8_t * dst, size_t dst_size) {
+    if (src_size > UINT32_MAX) {
+        return 0;
+    }
+
+    uint32_t table[1 << RPC_HASH_LOG];
+    std::fill(table, table + (1 << RPC_HASH_LOG), UINT32_MAX);
+
+    const uint8_t * ip     = src;
+    const uint8_t * anchor = src;
+    const uint8_t * iend   = src + src_size;
+    // the matches end at least 5 bytes before the end of the data, the last sequence has only literals
+    const uint8_t * mlimit = src_size > 12 ? iend - 12 : src;
+
+    uint8_t * op = dst;
+    const uint8_t * oend = dst + dst_size;
+
+    auto put_sequence = [&](size_t n_lit, size_t offset, size_t n_match) -> bool {
+        if (oend - op < (ptrdiff_t)(1 + n_lit)) {
+            return false;
+        }
+        uint8_t * token = op++;
+        *token = (uint8_t) (std::min<size_t>(n_lit, 15) << 4);
+        if (n_lit >= 15 && !(op = rpc_put_len(op, oend, n_lit - 15))) {
+            return false;
+        }
+        if (oend - op < (ptrdiff_t)n_lit) {
+            return false;
+        }
+        memcpy(op, anchor, n_lit);
+        op += n_lit;
+        if (n_match == 0) {
+            return true;
+        }
+        if (oend - op < 2) {
+            return false;
+        }
+        *op++ = (uint8_t) (offset & 0xff);
+        *op++ = (uint8_t) (offset >> 8);
+        n_match -= RPC_MIN_MATCH;
+        *token |= (uint8_t) std::min<size_t>(n_match, 15);
+        if (n_match >= 15 && !(op = rpc_put_len(op, oend, n_match - 15))) {
+            return false;
+        }
+        return true;
+    };
+
+    // skip faster through the data that does not compress
+    size_t n_miss = 0;
+
+    while (ip < mlimit) {
+        uint32_t seq;
+        memcpy(&seq, ip, sizeof(seq));
+        const uint32_t h = (seq * 2654435761u) >> (32 - RPC_HASH_LOG);
+        const uint32_t ref = table[h];
+        table[h] = (uint32_t) (ip - src);
+
+        if (ref == UINT32_MAX || (size_t)(ip - src) - ref > 65535 || memcmp(src + ref, ip, RPC_MIN_MATCH) != 0) {
+            ip += 1 + (n_miss++ >> 6);
+            continue;
+        }
+        n_miss = 0;
+
+        const uint8_t * match = src + ref;
+        size_t n_match = RPC_MIN_MATCH;
+        while (ip + n_match < iend - 5 && match[n_match] == ip[n_match]) {
+            n_match++;
+        }
+
+        if (!put_sequence(ip - anchor, ip - match, n_match)) {
+            return 0;
+        }
+        ip += n_match;
+        anchor = ip;
+    }
+
+    if (!put_sequence(iend - anchor, 0, 0)) {
+        return 0;
+    }
+
+    return op - dst;
+}
+
+static bool rpc_decompress(const uint8_t * src, size_t src_size, uint8_t * dst, size_t dst_size) {
+    const uint8_t * ip   = src;
+    const uint8_t * iend = src + src_size;
+    uint8_t * op = dst;
+    uint8_t * oend = dst + dst_size;
+
+    auto get_len = [&](size_t & len) -> bool {
+        uint8_t b;
+        do {
+            if (ip >= iend) {
+                return false;
+            }
+            b = *ip++;
+            len += b;
+        } while (b == 255);
+        return true;
+    };
+
+    while (ip < iend) {
+        const uint8_t token = *ip++;
+
+        size_t n_lit = token >> 4;
+        if (n_lit == 15 && !get_len(n_lit)) {
+            return false;
+        }
+        if (n_lit > (size_t)(iend - ip) || n_lit > (size_t)(oend - op)) {
+            return false;
+        }
+        memcpy(op, ip, n_lit);
+        ip += n_lit;
+        op += n_lit;
+
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return false;
+        }
+        const size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        size_t n_match = token & 15;
+        if (n_match == 15 && !get_len(n_match)) {
+            return false;
+        }
+        n_match += RPC_MIN_MATCH;
+
+        if (offset == 0 || offset > (size_t)(op - dst) || n_match > (size_t)(oend - op)) {
+            return false;
+        }
+        const uint8_t * match = op - offset;
+        if (offset >= n_match) {
+            memcpy(op, match, n_match);
+        } else {
+            // the match overlaps the output
+            for (size_t i = 0; i < n_match; i++) {
+                op[i] = match[i];
+            }
+        }
+        op += n_match;
+    }
+
+    return op == oend;
+}
@@ -3,6 +3,7 @@
 #include "ggml-impl.h"
 #include "gguf.h"
 
+#include <algorithm>
 #include <cinttypes>
 #include <cstddef>
 #include <cstdint>
@@ -10,11 +11,30 @@
 #include <cstdlib>
 #include <cstring>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <new>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+    #include <io.h>
+#elif defined(__has_include)
+    #if __has_include(<unistd.h>)
+        #include <unistd.h>
+        #if defined(_POSIX_MAPPED_FILES)
+            #include <sys/mman.h>
+            #include <sys/stat.h>
+        #endif
+    #endif
+#endif
+
 template <typename T>
 struct type_to_gguf_type;
 
@@ -117,6 +137,123 @@ size_t gguf_type_size(enum gguf_type type) {
     return it == GGUF_TYPE_SIZE.end() ? 0 : it->second;
 }
 
+// the bytes of a GGUF file as seen by gguf_reader
+// the file is mapped if possible, otherwise its beginning is buffered and the buffer grows as it is read
+// the string arrays read from the file are views into these bytes, so they are kept alive by the KV pairs
+struct gguf_file_buf {
+    const uint8_t * data = nullptr; // bytes of the file starting at offset `base`
+    size_t          base = 0;
+    size_t          size = 0;
+
+    void * addr = nullptr; // mapping of the whole file, if any
+    size_t addr_size = 0;
+#if defined(_WIN32)
+    HANDLE hmap = NULL;
+#endif
+
+    std::vector<uint8_t> buf; // if the file is not mapped
+
+    gguf_file_buf() = default;
+    gguf_file_buf(const gguf_file_buf &) = delete;
+    gguf_file_buf & operator=(const gguf_file_buf &) = delete;
+
+    ~gguf_file_buf() {
+        if (addr == nullptr) {
+            return;
+        }
+#if defined(_WIN32)
+        UnmapViewOfFile(addr);
+        CloseHandle(hmap);
+#elif defined(_POSIX_MAPPED_FILES)
+        munmap(addr, addr_size);
+#endif
+    }
+
+    // map the whole file read-only, returns false if that is not possible (pipes, 32 bit address space, ...)
+    bool map(FILE * file) {
+#if defined(_WIN32)
+        HANDLE hfile = (HANDLE) _get_osfhandle(_fileno(file));
+        if (hfile == INVALID_HANDLE_VALUE || GetFileType(hfile) != FILE_TYPE_DISK) {
+            return false;
+        }
+        LARGE_INTEGER fsize;
+        if (!GetFileSizeEx(hfile, &fsize) || fsize.QuadPart <= 0 || uint64_t(fsize.QuadPart) > SIZE_MAX) {
+            return false;
+        }
+        hmap = CreateFileMappingA(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (hmap == NULL) {
+            return false;
+        }
+        addr = MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
+        if (addr == nullptr) {
+            CloseHandle(hmap);
+            hmap = NULL;
+            return false;
+        }
+        addr_size = size_t(fsize.QuadPart);
+#elif defined(_POSIX_MAPPED_FILES)
+        struct stat st;
+        if (fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 || uint64_t(st.st_size) > SIZE_MAX) {
+            return false;
+        }
+        void * ptr = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fileno(file), 0);
+        if (ptr == MAP_FAILED) {
+            return false;
+        }
+        addr      = ptr;
+        addr_size = size_t(st.st_size);
+#else
+        GGML_UNUSED(file);
+        return false;
+#endif
+        data = (const uint8_t *) addr;
+        base = 0;
+        size = addr_size;
+        return true;
+    }
+
+    bool is_mapped() const {
+        return addr != nullptr;
+    }
+
+    const uint8_t * at(size_t offset) const {
+        return data + (offset - base);
+    }
+};
+
+// string array read from a file, the strings stay in the file until they are needed as NUL-terminated C strings
+struct gguf_str_array {
+    std::shared_ptr<const gguf_file_buf> file_buf;
+    std::vector<size_t> offs; // file offset of the length of each string
+
+    std::once_flag           once;
+    std::vector<std::string> strs; // created on the first request
+
+    size_t n() const {
+        return offs.size();
+    }
+
+    const char * view(size_t i, size_t * len) const {
+        const uint8_t * p = file_buf->at(offs[i]);
+        uint64_t n;
+        memcpy(&n, p, sizeof(n));
+        *len = size_t(n);
+        return (const char *) p + sizeof(n);
+    }
+
+    const std::vector<std::string> & get() {
+        std::call_once(once, [this] {
+            strs.resize(offs.size());
+            for (size_t i = 0; i < offs.size(); ++i) {
+                size_t len;
+                const char * s = view(i, &len);
+                strs[i].assign(s, len);
+            }
+        });
+        return strs;
+    }
+};
+
 struct gguf_kv {
     std::string key;
 
@@ -126,6 +263,8 @@ struct gguf_kv {
     std::vector<int8_t>      data;
     std::vector<std::string> data_string;
 
+    std::shared_ptr<gguf_str_array> data_str_array; // string array read from a file, instead of data_string
+
     template <typename T>
     gguf_kv(const std::string & key, const T value)
             : key(key), is_array(false), type(type_to_gguf_type<T>::value) {
@@ -157,6 +296,11 @@ struct gguf_kv {
         data_string = value;
     }
 
+    gguf_kv(const std::string & key, std::shared_ptr<gguf_str_array> value)
+            : key(key), is_array(true), type(GGUF_TYPE_STRING), data_str_array(std::move(value)) {
+        GGML_ASSERT(!key.empty());
+    }
+
     const std::string & get_key() const {
         return key;
     }
@@ -167,7 +311,7 @@ struct gguf_kv {
 
     size_t get_ne() const {
         if (type == GGUF_TYPE_STRING) {
-            const size_t ne = data_string.size();
+            const size_t ne = data_str_array ? data_str_array->n() : data_string.size();
             GGML_ASSERT(is_array || ne == 1);
             return ne;
         }
@@ -182,8 +326,9 @@ struct gguf_kv {
     const T & get_val(const size_t i = 0) const {
         GGML_ASSERT(type_to_gguf_type<T>::value == type);
         if constexpr (std::is_same<T, std::string>::value) {
-            GGML_ASSERT(data_string.size() >= i+1);
-            return data_string[i];
+            const std::vector<std::string> & strs = data_str_array ? data_str_array->get() : data_string;
+            GGML_ASSERT(strs.size() >= i+1);
+            return strs[i];
         }
         const size_t type_size = gguf_type_size(type);
         GGML_ASSERT(data.size() % type_size == 0);
@@ -191,6 +336,18 @@ struct gguf_kv {
         return reinterpret_cast<const T *>(data.data())[i];
     }
 
+    // string without copying it, not NUL-terminated
+    const char * get_str_view(const size_t i, size_t * len) const {
+        GGML_ASSERT(type == GGUF_TYPE_STRING);
+        if (data_str_array) {
+            GGML_ASSERT(i < data_str_array->n());
+            return data_str_array->view(i, len);
+        }
+        GGML_ASSERT(i < data_string.size());
+        *len = data_string[i].length();
+        return data_string[i].data();
+    }
+
     void cast(const enum gguf_type new_type) {
         const size_t new_type_size = gguf_type_size(new_type);
         GGML_ASSERT(data.size() % new_type_size == 0);
@@ -219,15 +376,79 @@ struct gguf_context {
 struct gguf_reader {
     FILE * file;
 
-    gguf_reader(FILE * file) : file(file) {}
+    std::shared_ptr<gguf_file_buf> fb;
+
+    mutable size_t pos; // file offset of the next byte to read
+    size_t file_size;   // SIZE_MAX if unknown
+
+    gguf_reader(FILE * file) : file(file), fb(std::make_shared<gguf_file_buf>()), pos(0), file_size(SIZE_MAX) {
+        const long start = ftell(file);
+
+        if (start >= 0 && fb->map(file)) {
+            pos       = size_t(start);
+            file_size = fb->addr_size;
+            return;
+        }
+
+        if (start >= 0) {
+            pos      = size_t(start);
+            fb->base = pos;
+            if (fseek(file, 0, SEEK_END) == 0) {
+                const long end = ftell(file);
+                if (end >= start) {
+                    file_size = size_t(end);
+                }
+            }
+            fseek(file, start, SEEK_SET);
+        }
+    }
+
+    // make n bytes available at pos
+    bool fetch(const size_t n) const {
+        if (pos > file_size || n > file_size - pos) {
+            return false;
+        }
+        const size_t end = fb->base + fb->size;
+        if (pos >= fb->base && pos <= end && n <= end - pos) {
+            return true;
+        }
+        if (fb->is_mapped() || pos < fb->base) {
+            return false;
+        }
+
+        // read more of the file, growing the buffer geometrically to keep the number of reads small
+        const size_t need = pos + n - end;
+        size_t chunk = std::max(need, std::min<size_t>(std::max<size_t>(fb->buf.size(), 64*1024), 16*1024*1024));
+        if (file_size != SIZE_MAX) {
+            chunk = std::min(chunk, file_size - end);
+        }
+        const size_t old   = fb->buf.size();
+        fb->buf.resize(old + chunk);
+        const size_t nread = fread(fb->buf.data() + old, 1, chunk, file);
+        fb->buf.resize(old + nread);
+        fb->data = fb->buf.data();
+        fb->size = fb->buf.size();
+        return nread >= need;
+    }
 
     template <typename T>
     bool read(T & dst) const {
-        return fread(&dst, 1, sizeof(dst), file) == sizeof(dst);
+        if (!fetch(sizeof(dst))) {
+            return false;
+        }
+        memcpy(&dst, fb->at(pos), sizeof(dst));
+        pos += sizeof(dst);
+        return true;
     }
 
     template <typename T>
     bool read(std::vector<T> & dst, const size_t n) const {
+        if constexpr (std::is_arithmetic<T>::value) {
+            // all elements are in the file, fail before allocating for a bogus n
+            if (n > SIZE_MAX/sizeof(T) || !fetch(n*sizeof(T))) {
+                return false;
+            }
+        }
         dst.resize(n);
         for (size_t i = 0; i < dst.size(); ++i) {
             if constexpr (std::is_same<T, bool>::value) {
@@ -277,12 +498,63 @@ struct gguf_reader {
         if (!read(size)) {
             return false;
         }
-        dst.resize(size);
-        return fread(dst.data(), 1, dst.length(), file) == dst.length();
+        if (size > SIZE_MAX || !fetch(size)) {
+            return false;
+        }
+        dst.assign((const char *) fb->at(pos), size);
+        pos += size;
+        return true;
+    }
+
+    // array of n strings, only their offsets are stored
+    bool read(gguf_str_array & dst, const size_t n) const {
+        // each string takes at least the 8 bytes of its length
+        if (pos > file_size || n > (file_size - pos)/sizeof(uint64_t)) {
+            return false;
+        }
+        dst.file_buf = fb;
+        dst.offs.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            dst.offs[i] = pos;
+            uint64_t size = -1;
+            if (!read(size)) {
+                return false;
+            }
+            if (size > SIZE_MAX || !fetch(size)) {
+                return false;
+            }
+            pos += size;
+        }
+        return true;
     }
 
     bool read(void * dst, const size_t size) const {
-        return fread(dst, 1, size, file) == size;
+        if (fb->is_mapped()) {
+            if (!fetch(size)) {
+                return false;
+            }
+            memcpy(dst, fb->at(pos), size);
+            pos += size;
+            return true;
+        }
+
+        // copy what is buffered, read the rest directly into dst
+        const size_t end = fb->base + fb->size;
+        const size_t n0  = pos >= fb->base && pos < end ? std::min(size, end - pos) : 0;
+        if (n0 > 0) {
+            memcpy(dst, fb->at(pos), n0);
+        }
+        if (n0 < size) {
+            if (pos + n0 != end && fseek(file, long(pos + n0), SEEK_SET) != 0) {
+                return false;
+            }
+            // this moves the file position past the buffer, the blob must be the last thing read
+            if (fread((char *) dst + n0, 1, size - n0, file) != size - n0) {
+                return false;
+            }
+        }
+        pos += size;
+        return true;
     }
 };
 
@@ -316,6 +588,42 @@ bool gguf_read_emplace_helper(const struct gguf_reader & gr, std::vector<struct
     return true;
 }
 
+// string arrays are not copied, the KV pair references the strings in the file
+template<>
+bool gguf_read_emplace_helper<std::string>(const struct gguf_reader & gr, std::vector<struct gguf_kv> & kv, const std::string & key, const bool is_array, const size_t n) {
+    if (!is_array) {
+        std::string value;
+        try {
+            if (!gr.read(value)) {
+                return false;
+            }
+        } catch (std::length_error &) {
+            GGML_LOG_ERROR("%s: encountered length_error while reading value for key '%s'\n", __func__, key.c_str());
+            return false;
+        } catch (std::bad_alloc &) {
+            GGML_LOG_ERROR("%s: encountered bad_alloc error while reading value for key '%s'\n", __func__, key.c_str());
+            return false;
+        }
+        kv.emplace_back(key, value);
+        return true;
+    }
+
+    auto value = std::make_shared<gguf_str_array>();
+    try {
+        if (!gr.read(*value, n)) {
+            return false;
+        }
+    } catch (std::length_error &) {
+        GGML_LOG_ERROR("%s: encountered length_error while reading value for key '%s'\n", __func__, key.c_str());
+        return false;
+    } catch (std::bad_alloc &) {
+        GGML_LOG_ERROR("%s: encountered bad_alloc error while reading value for key '%s'\n", __func__, key.c_str());
+        return false;
+    }
+    kv.emplace_back(key, std::move(value));
+    return true;
+}
+
 struct gguf_context * gguf_init_from_file_impl(FILE * file, struct gguf_init_params params) {
     const struct gguf_reader gr(file);
     struct gguf_context * ctx = new gguf_context;
@@ -610,14 +918,10 @@ struct gguf_context * gguf_init_from_file_impl(FILE * file, struct gguf_init_par
     GGML_ASSERT(int64_t(ctx->info.size()) == n_tensors);
 
     // we require the data section to be aligned, so take into account any padding
-    if (fseek(file, GGML_PAD(ftell(file), ctx->alignment), SEEK_SET) != 0) {
-        GGML_LOG_ERROR("%s: failed to seek to beginning of data section\n", __func__);
-        gguf_free(ctx);
-        return nullptr;
-    }
+    gr.pos = GGML_PAD(gr.pos, ctx->alignment);
 
     // store the current file offset - this is where the data section starts
-    ctx->offset = ftell(file);
+    ctx->offset = gr.pos;
 
     // compute the total size of the data section, taking into account the alignment
     {
@@ -812,14 +1116,20 @@ const void * gguf_get_arr_data(const struct gguf_context * ctx, int64_t key_id)
 const char * gguf_get_arr_str(const struct gguf_context * ctx, int64_t key_id, size_t i) {
     GGML_ASSERT(key_id >= 0 && key_id < gguf_get_n_kv(ctx));
     GGML_ASSERT(ctx->kv[key_id].get_type() == GGUF_TYPE_STRING);
-    return ctx->kv[key_id].data_string[i].c_str();
+    return ctx->kv[key_id].get_val<std::string>(i).c_str();
+}
+
+const char * gguf_get_arr_str_view(const struct gguf_context * ctx, int64_t key_id, size_t i, size_t * len) {
+    GGML_ASSERT(key_id >= 0 && key_id < gguf_get_n_kv(ctx));
+    GGML_ASSERT(ctx->kv[key_id].get_type() == GGUF_TYPE_STRING);
+    return ctx->kv[key_id].get_str_view(i, len);
 }
 
 size_t gguf_get_arr_n(const struct gguf_context * ctx, int64_t key_id) {
     GGML_ASSERT(key_id >= 0 && key_id < gguf_get_n_kv(ctx));
 
     if (ctx->kv[key_id].type == GGUF_TYPE_STRING) {
-        return ctx->kv[key_id].data_string.size();
+        return ctx->kv[key_id].get_ne();
     }
 
     const size_t type_size = gguf_type_size(ctx->kv[key_id].type);
@@ -1107,7 +1417,7 @@ void gguf_set_kv(struct gguf_context * ctx, const struct gguf_context * src) {
             case GGUF_TYPE_STRING: {
                 std::vector<const char *> tmp(ne);
                 for (size_t j = 0; j < ne; ++j) {
-                    tmp[j] = kv.data_string[j].c_str();
+                    tmp[j] = kv.get_val<std::string>(j).c_str();
                 }
                 gguf_set_arr_str(ctx, kv.get_key().c_str(), tmp.data(), ne);
             } break;
@@ -1242,7 +1552,10 @@ struct gguf_writer {
             } break;
             case GGUF_TYPE_STRING: {
                 for (size_t i = 0; i < ne; ++i) {
-                    write(kv.get_val<std::string>(i));
+                    size_t len;
+                    const char * str = kv.get_str_view(i, &len);
+                    write(uint64_t(len));
+                    buf.insert(buf.end(), str, str + len);
                 }
             } break;
             case GGUF_TYPE_ARRAY:
@@ -45,7 +45,7 @@
 #define LLAMA_SESSION_VERSION 9
 
 #define LLAMA_STATE_SEQ_MAGIC   LLAMA_FILE_MAGIC_GGSQ
-#define LLAMA_STATE_SEQ_VERSION 2
+#define LLAMA_STATE_SEQ_VERSION 3
 
 #ifdef __cplusplus
 extern "C" {
@@ -284,6 +284,9 @@ extern "C" {
         // override key-value pairs of the model meta data
         const struct llama_model_kv_override * kv_overrides;
 
+        // directory of the cache of the weights repacked for the CPU, NULL to repack them at every load
+        const char * repack_cache;
+
         // Keep the booleans together to avoid misalignment during copy-by-value.
         bool vocab_only;      // only load the vocabulary, no weights
         bool use_mmap;        // use mmap if possible
@@ -315,6 +318,8 @@ extern "C" {
         float    yarn_beta_slow;   // YaRN high correction dim
         uint32_t yarn_orig_ctx;    // YaRN original context size
         float    defrag_thold;     // defragment the KV cache if holes/size > thold, <= 0 disabled (default)
+        uint32_t n_logits_top;     // if > 0, only the top n logits of each output are copied to the host [EXPERIMENTAL]
+                                   // see llama_get_logits_top_ith()
 
         ggml_backend_sched_eval_callback cb_eval;
         void * cb_eval_user_data;
@@ -340,6 +345,7 @@ extern "C" {
         bool kv_unified;  // use a unified buffer across the input sequences when computing the attention
                           // try to disable when n_seq_max > 1 for improved performance when the sequences do not share a large prefix
                           // ref: https://github.com/ggml-org/llama.cpp/pull/14363
+        bool auto_threads;  // adapt the number of threads of each ubatch, up to n_threads/n_threads_batch, to the fastest measured [EXPERIMENTAL]
     };
 
     // model quantization parameters
@@ -457,6 +463,7 @@ extern "C" {
     LLAMA_API uint32_t llama_n_batch    (const struct llama_context * ctx);
     LLAMA_API uint32_t llama_n_ubatch   (const struct llama_context * ctx);
     LLAMA_API uint32_t llama_n_seq_max  (const struct llama_context * ctx);
+    LLAMA_API uint32_t llama_n_logits_top(const struct llama_context * ctx);
 
     DEPRECATED(LLAMA_API int32_t llama_n_ctx_train(const struct llama_model * model), "use llama_model_n_ctx_train instead");
     DEPRECATED(LLAMA_API int32_t llama_n_embd     (const struct llama_model * model), "use llama_model_n_embd instead");
@@ -871,6 +878,8 @@ extern "C" {
                           size_t * n_token_count_out);
 
 #define LLAMA_STATE_SEQ_FLAGS_SWA_ONLY 1
+// restore the state on top of the cells of the sequence before its first position (see llama_state_seq_get_data_from)
+#define LLAMA_STATE_SEQ_FLAGS_PARTIAL  2
 
     typedef uint32_t llama_state_seq_flags;
 
@@ -893,6 +902,36 @@ extern "C" {
                     llama_seq_id   dest_seq_id,
            llama_state_seq_flags   flags);
 
+    // Incremental snapshots: same as llama_state_seq_get_*_ext, but only the cells of the sequence at positions >= p0
+    // The result is restored with LLAMA_STATE_SEQ_FLAGS_PARTIAL on top of the cells at positions < p0
+    // Recurrent states and the SWA part of the KV cache are always saved whole and replaced on restore
+    LLAMA_API size_t llama_state_seq_get_size_from(
+            struct llama_context * ctx,
+                    llama_seq_id   seq_id,
+                       llama_pos   p0,
+           llama_state_seq_flags   flags);
+
+    LLAMA_API size_t llama_state_seq_get_data_from(
+            struct llama_context * ctx,
+                         uint8_t * dst,
+                          size_t   size,
+                    llama_seq_id   seq_id,
+                       llama_pos   p0,
+           llama_state_seq_flags   flags);
+
+    // Write a sequence state copied with llama_state_seq_get_data_from to a sequence state file
+    // The file is a list of chunks, with append the state is added as a new chunk and the tokens are the ones of its cells
+    // llama_state_seq_load_file maps the file and restores the chunks in order
+    // Does not use a context, can be called from a background thread while the sequence keeps being decoded
+    // Returns the number of bytes written, zero on failure
+    LLAMA_API size_t llama_state_seq_save_file_data(
+                      const char * filepath,
+                   const uint8_t * src,
+                          size_t   size,
+               const llama_token * tokens,
+                          size_t   n_token_count,
+                            bool   append);
+
     //
     // Decoding
     //
@@ -959,10 +998,19 @@ extern "C" {
     // Get the number of threads used for prompt and batch processing (multiple token).
     LLAMA_API int32_t llama_n_threads_batch(struct llama_context * ctx);
 
+    // Get the number of threads currently used for ubatches of n_tokens tokens
+    // With auto_threads, this is the fastest number of threads measured so far, otherwise n_threads or n_threads_batch
+    LLAMA_API int32_t llama_n_threads_auto(struct llama_context * ctx, int32_t n_tokens);
+
     // Set whether the context outputs embeddings or not
     // TODO: rename to avoid confusion with llama_get_embeddings()
     LLAMA_API void llama_set_embeddings(struct llama_context * ctx, bool embeddings);
 
+    // Set whether the top logits are selected on the backend, when llama_context_params.n_logits_top > 0
+    // Sampling with a grammar, a logit bias or more than n_logits_top probabilities needs the full logits,
+    // in this case disable it for the next calls to llama_decode() (llama_n_logits_top() returns 0 while disabled)
+    LLAMA_API void llama_set_logits_top(struct llama_context * ctx, bool logits_top);
+
     // Set whether to use causal attention or not
     // If set to true, the model will only attend to the past tokens
     LLAMA_API void llama_set_causal_attn(struct llama_context * ctx, bool causal_attn);
@@ -993,6 +1041,14 @@ extern "C" {
     // returns NULL for invalid ids.
     LLAMA_API float * llama_get_logits_ith(struct llama_context * ctx, int32_t i);
 
+    // Logits for the ith token when llama_n_logits_top() > 0
+    // The top llama_n_logits_top() logits are selected on the backend and only they are copied to the host,
+    // in descending order. The full logits are not available in this mode (llama_get_logits() returns NULL).
+    // llama_get_logits_top_ids_ith() returns the token ids of the corresponding logits.
+    // returns NULL for invalid ids.
+    LLAMA_API float       * llama_get_logits_top_ith    (struct llama_context * ctx, int32_t i);
+    LLAMA_API llama_token * llama_get_logits_top_ids_ith(struct llama_context * ctx, int32_t i);
+
     // Get all output token embeddings.
     // when pooling_type == LLAMA_POOLING_TYPE_NONE or when using a generative model,
     // the embeddings for which llama_batch.logits[i] != 0 are stored contiguously
@@ -1099,6 +1155,26 @@ extern "C" {
                             bool   add_special,
                             bool   parse_special);
 
+    /// @details Convert several texts into tokens, using a pool of worker threads owned by the vocab.
+    /// The texts are split at the special tokens and, for BPE vocabs, at the pre-tokenizer word boundaries,
+    /// and the parts are tokenized in parallel. The result is identical to calling llama_tokenize() for each text.
+    /// @param tokens Per text, a buffer of n_tokens_max[i] tokens.
+    /// @param n_tokens Per text, receives the number of tokens, or a negative number if the buffer is too small -
+    ///                 the number of tokens that would have been returned (INT32_MIN on overflow).
+    /// @param n_threads Number of threads to use, including the calling thread. <= 0 to use all hardware threads.
+    /// @return Returns 0 on success, or the number of texts for which n_tokens[i] is negative.
+    LLAMA_API int32_t llama_tokenize_batch(
+        const struct llama_vocab * vocab,
+               const char * const * texts,
+                  const int32_t * text_lens,
+                         int32_t   n_texts,
+                    llama_token ** tokens,
+                  const int32_t * n_tokens_max,
+                        int32_t * n_tokens,
+                            bool   add_special,
+                            bool   parse_special,
+                         int32_t   n_threads);
+
     // Token Id -> Piece.
     // Uses the vocabulary in the provided context.
     // Does not write null terminator to the buffer.
@@ -1437,6 +1513,16 @@ extern "C" {
     LLAMA_API void                           llama_perf_context_print(const struct llama_context * ctx);
     LLAMA_API void                           llama_perf_context_reset(      struct llama_context * ctx);
 
+    // Per-op profiling of the graph computations, disabled by default (see ggml_backend_sched_set_profiling)
+    // the profile is printed by llama_perf_context_print and cleared by llama_perf_context_reset
+    LLAMA_API void                           llama_perf_ops_enable   (      struct llama_context * ctx, bool enable);
+    LLAMA_API void                           llama_perf_ops_reset    (      struct llama_context * ctx);
+    // Write the profile to buf like snprintf and return the length of the full output
+    // summary: markdown table of the time, GFLOP/s and GB/s per backend, op, types and shapes
+    // trace: Chrome trace event JSON, one event per node and thread
+    LLAMA_API size_t                         llama_perf_ops_summary  (const struct llama_context * ctx, char * buf, size_t buf_size);
+    LLAMA_API size_t                         llama_perf_ops_trace    (const struct llama_context * ctx, char * buf, size_t buf_size);
+
     // NOTE: the following work only with samplers constructed via llama_sampler_chain_init
     LLAMA_API struct llama_perf_sampler_data llama_perf_sampler      (const struct llama_sampler * chain);
     LLAMA_API void                           llama_perf_sampler_print(const struct llama_sampler * chain);
@@ -40,6 +40,8 @@ llama_context::llama_context(
     cparams.yarn_beta_fast   = params.yarn_beta_fast;
     cparams.yarn_beta_slow   = params.yarn_beta_slow;
     cparams.defrag_thold     = params.defrag_thold;
+    cparams.n_logits_top     = std::min<uint32_t>(params.n_logits_top, model.vocab.n_tokens());
+    cparams.logits_top       = cparams.n_logits_top > 0;
     cparams.embeddings       = params.embeddings;
     cparams.offload_kqv      = params.offload_kqv;
     cparams.flash_attn       = params.flash_attn;
@@ -132,6 +134,9 @@ llama_context::llama_context(
     LLAMA_LOG_INFO("%s: causal_attn   = %d\n",   __func__, cparams.causal_attn);
     LLAMA_LOG_INFO("%s: flash_attn    = %d\n",   __func__, cparams.flash_attn);
     LLAMA_LOG_INFO("%s: kv_unified    = %s\n",   __func__, cparams.kv_unified ? "true" : "false");
+    if (cparams.n_logits_top > 0) {
+        LLAMA_LOG_INFO("%s: n_logits_top  = %u\n",   __func__, cparams.n_logits_top);
+    }
     LLAMA_LOG_INFO("%s: freq_base     = %.1f\n", __func__, cparams.rope_freq_base);
     LLAMA_LOG_INFO("%s: freq_scale    = %g\n",   __func__, cparams.rope_freq_scale);
 
@@ -193,6 +198,10 @@ llama_context::llama_context(
 
         llama_set_abort_callback(this, params.abort_callback, params.abort_callback_data);
 
+        if (params.auto_threads) {
+            thread_tuner = std::make_unique<llama_thread_tuner>(cparams.n_threads, cparams.n_threads_batch);
+        }
+
         // graph outputs buffer
         {
             // resized during inference when a batch uses more outputs
@@ -367,6 +376,12 @@ llama_context::llama_context(
 }
 
 llama_context::~llama_context() {
+    // the scheduler uses the backends, so it is freed before them
+    if (sched) {
+        ggml_backend_sched_set_profiling(sched.get(), false);
+    }
+    sched.reset();
+
     ggml_opt_free(opt_ctx);
 }
 
@@ -432,6 +447,10 @@ uint32_t llama_context::n_seq_max() const {
     return cparams.n_seq_max;
 }
 
+uint32_t llama_context::n_logits_top() const {
+    return cparams.logits_top ? cparams.n_logits_top : 0;
+}
+
 uint32_t llama_context::n_threads() const {
     return cparams.n_threads;
 }
@@ -440,6 +459,14 @@ uint32_t llama_context::n_threads_batch() const {
     return cparams.n_threads_batch;
 }
 
+int32_t llama_context::n_threads_auto(uint32_t n_tokens) const {
+    if (thread_tuner) {
+        return thread_tuner->best(n_tokens);
+    }
+
+    return n_tokens > 1 ? cparams.n_threads_batch : cparams.n_threads;
+}
+
 llama_memory_t llama_context::get_memory() const {
     return memory.get();
 }
@@ -562,6 +589,56 @@ float * llama_context::get_logits_ith(int32_t i) {
     }
 }
 
+float * llama_context::get_logits_top_ith(int32_t i) {
+    int64_t j = -1;
+
+    output_reorder();
+
+    try {
+        if (logits_top == nullptr) {
+            throw std::runtime_error("no top logits");
+        }
+
+        if (i < 0) {
+            j = n_outputs + i;
+            if (j < 0) {
+                throw std::runtime_error(format("negative index out of range [0, %d)", n_outputs));
+            }
+        } else if ((size_t) i >= output_ids.size()) {
+            throw std::runtime_error(format("out of range [0, %zu)", output_ids.size()));
+        } else {
+            j = output_ids[i];
+        }
+
+        if (j < 0) {
+            throw std::runtime_error(format("batch.logits[%d] != true", i));
+        }
+        if (j >= n_outputs) {
+            // This should not happen
+            throw std::runtime_error(format("corrupt output buffer (j=%" PRId64 ", n_outputs=%d)", j, n_outputs));
+        }
+
+        return logits_top + j*cparams.n_logits_top;
+    } catch (const std::exception & err) {
+        LLAMA_LOG_ERROR("%s: invalid logits id %d, reason: %s\n", __func__, i, err.what());
+#ifndef NDEBUG
+        GGML_ABORT("fatal error");
+#else
+        return nullptr;
+#endif
+    }
+}
+
+llama_token * llama_context::get_logits_top_ids_ith(int32_t i) {
+    float * res = get_logits_top_ith(i);
+    if (res == nullptr) {
+        return nullptr;
+    }
+
+    // the ids are stored at the same offset as the logits
+    return logits_top_ids + (res - logits_top);
+}
+
 float * llama_context::get_embeddings() {
     output_reorder();
 
@@ -638,6 +715,10 @@ void llama_context::set_n_threads(int32_t n_threads, int32_t n_threads_batch) {
 
     cparams.n_threads       = n_threads;
     cparams.n_threads_batch = n_threads_batch;
+
+    if (thread_tuner) {
+        thread_tuner = std::make_unique<llama_thread_tuner>(n_threads, n_threads_batch);
+    }
 }
 
 void llama_context::set_abort_callback(bool (*abort_callback)(void * data), void * abort_callback_data) {
@@ -661,6 +742,12 @@ void llama_context::set_embeddings(bool value) {
     cparams.embeddings = value;
 }
 
+void llama_context::set_logits_top(bool value) {
+    LLAMA_LOG_DEBUG("%s: value = %d\n", __func__, value);
+
+    cparams.logits_top = value && cparams.n_logits_top > 0;
+}
+
 void llama_context::set_causal_attn(bool value) {
     LLAMA_LOG_DEBUG("%s: value = %d\n", __func__, value);
 
@@ -763,7 +850,7 @@ llm_graph_result * llama_context::process_ubatch(const llama_ubatch & ubatch, ll
         //LLAMA_LOG_INFO("graph set inputs time: %.3f ms\n", (ggml_time_us() - t_start_us)/1000.0);
     }
 
-    const auto status = graph_compute(res->get_gf(), ubatch.n_tokens > 1);
+    const auto status = graph_compute(res->get_gf(), ubatch.n_tokens > 1, ubatch.n_tokens);
     if (status != GGML_STATUS_SUCCESS) {
         LLAMA_LOG_ERROR("%s: failed to compute graph, compute status: %d\n", __func__, status);
         ret = status;
@@ -1118,6 +1205,14 @@ int llama_context::decode(const llama_batch & batch_inp) {
             t_embd = res->get_embd_pooled();
         }
 
+        auto * t_logits_top     = res->get_logits_top();
+        auto * t_logits_top_ids = res->get_logits_top_ids();
+
+        // when only the top logits are needed, the full logits stay on the backend
+        if (t_logits_top) {
+            t_logits = nullptr;
+        }
+
         // extract logits
         if (t_logits && n_outputs > 0) {
             ggml_backend_t backend_res = ggml_backend_sched_get_tensor_backend(sched.get(), t_logits);
@@ -1133,6 +1228,24 @@ int llama_context::decode(const llama_batch & batch_inp) {
             }
         }
 
+        // extract the top logits
+        if (t_logits_top && n_outputs > 0) {
+            ggml_backend_t backend_top = ggml_backend_sched_get_tensor_backend(sched.get(), t_logits_top);
+            GGML_ASSERT(backend_top != nullptr);
+            GGML_ASSERT(logits_top != nullptr);
+
+            ggml_backend_t backend_top_ids = ggml_backend_sched_get_tensor_backend(sched.get(), t_logits_top_ids);
+            GGML_ASSERT(backend_top_ids != nullptr);
+
+            const int64_t n_top = cparams.n_logits_top;
+
+            GGML_ASSERT( n_outputs_prev + n_outputs <= n_outputs_all);
+            GGML_ASSERT((n_outputs_prev + n_outputs)*n_top <= (int64_t) logits_top_size);
+
+            ggml_backend_tensor_get_async(backend_top,     t_logits_top,     logits_top     + n_outputs_prev*n_top, 0, n_outputs*n_top*sizeof(float));
+            ggml_backend_tensor_get_async(backend_top_ids, t_logits_top_ids, logits_top_ids + n_outputs_prev*n_top, 0, n_outputs*n_top*sizeof(llama_token));
+        }
+
         // extract embeddings
         if (t_embd && n_outputs > 0) {
             ggml_backend_t backend_embd = ggml_backend_sched_get_tensor_backend(sched.get(), t_embd);
@@ -1267,7 +1380,7 @@ uint32_t llama_context::output_reserve(int32_t n_outputs) {
     const auto n_vocab = vocab.n_tokens();
     const auto n_embd  = hparams.n_embd;
 
-    bool has_logits = true;
+    bool has_logits = !cparams.logits_top;
     bool has_embd   = cparams.embeddings;
 
     // TODO: hacky enc-dec support
@@ -1276,8 +1389,9 @@ uint32_t llama_context::output_reserve(int32_t n_outputs) {
         has_embd   = true;
     }
 
-    logits_size = has_logits ? n_vocab*n_outputs_max : 0;
-    embd_size   = has_embd   ?  n_embd*n_outputs_max : 0;
+    logits_size     = has_logits ? n_vocab*n_outputs_max : 0;
+    embd_size       = has_embd   ?  n_embd*n_outputs_max : 0;
+    logits_top_size = cparams.logits_top ? cparams.n_logits_top*n_outputs_max : 0;
 
     if (output_ids.empty()) {
         // init, never resized afterwards
@@ -1285,7 +1399,9 @@ uint32_t llama_context::output_reserve(int32_t n_outputs) {
     }
 
     const size_t prev_size = buf_output ? ggml_backend_buffer_get_size(buf_output.get()) : 0;
-    const size_t new_size  = (logits_size + embd_size) * sizeof(float);
+    const size_t new_size  = (logits_size + embd_size + 2*logits_top_size) * sizeof(float);
+
+    static_assert(sizeof(llama_token) == sizeof(float), "the top logit ids are stored in the float output buffer");
 
     // alloc only when more than the current capacity is required
     // TODO: also consider shrinking the buffer
@@ -1298,6 +1414,8 @@ uint32_t llama_context::output_reserve(int32_t n_outputs) {
             buf_output = nullptr;
             logits = nullptr;
             embd = nullptr;
+            logits_top = nullptr;
+            logits_top_ids = nullptr;
         }
 
         auto * buft = ggml_backend_cpu_buffer_type();
@@ -1319,6 +1437,9 @@ uint32_t llama_context::output_reserve(int32_t n_outputs) {
     logits = has_logits ? output_base               : nullptr;
     embd   = has_embd   ? output_base + logits_size : nullptr;
 
+    logits_top     = logits_top_size > 0 ?                 output_base + logits_size + embd_size                    : nullptr;
+    logits_top_ids = logits_top_size > 0 ? (llama_token *) (output_base + logits_size + embd_size + logits_top_size) : nullptr;
+
     // set all ids as invalid (negative)
     std::fill(output_ids.begin(), output_ids.end(), -1);
 
@@ -1330,6 +1451,7 @@ uint32_t llama_context::output_reserve(int32_t n_outputs) {
 void llama_context::output_reorder() {
     const uint64_t n_vocab = model.vocab.n_tokens();
     const uint64_t n_embd  = model.hparams.n_embd;
+    const uint64_t n_top   = cparams.n_logits_top;
 
     for (size_t s = 0; s < output_swaps.size(); ++s) {
         const uint64_t i0 = output_swaps[s].i0;
@@ -1346,6 +1468,13 @@ void llama_context::output_reorder() {
                 std::swap(embd[i0*n_embd + k], embd[i1*n_embd + k]);
             }
         }
+
+        if (logits_top_size > 0) {
+            for (uint64_t k = 0; k < n_top; k++) {
+                std::swap(logits_top    [i0*n_top + k], logits_top    [i1*n_top + k]);
+                std::swap(logits_top_ids[i0*n_top + k], logits_top_ids[i1*n_top + k]);
+            }
+        }
     }
 
     output_swaps.clear();
@@ -1431,10 +1560,17 @@ llm_graph_params llama_context::graph_params(
 
 ggml_status llama_context::graph_compute(
             ggml_cgraph * gf,
-                   bool   batched) {
+                   bool   batched,
+               uint32_t   n_tokens) {
     int n_threads        = batched ? cparams.n_threads_batch : cparams.n_threads;
     ggml_threadpool_t tp = batched ? threadpool_batch        : threadpool;
 
+    // the warmup ubatch is not representative
+    const bool tune = thread_tuner && n_tokens > 0 && !cparams.warmup;
+    if (tune) {
+        n_threads = thread_tuner->get(n_tokens);
+    }
+
     if (backend_cpu != nullptr) {
         auto * reg = ggml_backend_dev_backend_reg(ggml_backend_get_device(backend_cpu));
         auto * set_threadpool_fn = (decltype(ggml_backend_cpu_set_threadpool) *) ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_set_threadpool");
@@ -1446,9 +1582,15 @@ ggml_status llama_context::graph_compute(
         set_n_threads_fn.second(set_n_threads_fn.first, n_threads);
     }
 
+    const int64_t t_start_us = tune ? ggml_time_us() : 0;
+
     auto status = ggml_backend_sched_graph_compute_async(sched.get(), gf);
     if (status != GGML_STATUS_SUCCESS) {
         LLAMA_LOG_ERROR("%s: ggml_backend_sched_graph_compute_async failed with error %d\n", __func__, status);
+    } else if (tune) {
+        ggml_backend_sched_synchronize(sched.get());
+
+        thread_tuner->record(n_tokens, n_threads, ggml_time_us() - t_start_us);
     }
 
     // fprintf(stderr, "splits: %d\n", ggml_backend_sched_get_n_splits(sched));
@@ -1627,6 +1769,54 @@ private:
     std::vector<uint8_t> temp_buffer;
 };
 
+// sequence state files are a header followed by chunks, each chunk holds the tokens and the state of the cells
+// appended to the sequence since the previous chunk
+// the state of each chunk is aligned so that it can be restored from a mapping of the file
+#define LLAMA_STATE_SEQ_ALIGNMENT 64
+
+struct llama_state_seq_chunk {
+    uint32_t n_token_count;
+    uint32_t reserved;
+    uint64_t state_size;
+};
+
+static size_t llama_state_seq_header_size() {
+    return GGML_PAD(2*sizeof(uint32_t), LLAMA_STATE_SEQ_ALIGNMENT);
+}
+
+static void llama_state_seq_pad(const llama_file & file) {
+    static const uint8_t zeros[LLAMA_STATE_SEQ_ALIGNMENT] = {};
+
+    const size_t offs = file.tell();
+    file.write_raw(zeros, GGML_PAD(offs, LLAMA_STATE_SEQ_ALIGNMENT) - offs);
+}
+
+static void llama_state_seq_write_header(const llama_file & file) {
+    file.write_u32(LLAMA_STATE_SEQ_MAGIC);
+    file.write_u32(LLAMA_STATE_SEQ_VERSION);
+    llama_state_seq_pad(file);
+}
+
+static void llama_state_seq_write_chunk_header(const llama_file & file, const llama_token * tokens, size_t n_token_count, size_t state_size) {
+    const llama_state_seq_chunk chunk = { (uint32_t) n_token_count, 0, (uint64_t) state_size };
+
+    file.write_raw(&chunk, sizeof(chunk));
+    file.write_raw(tokens, sizeof(llama_token) * n_token_count);
+    llama_state_seq_pad(file);
+}
+
+// offsets of the state and of the end of the chunk at offs, returns false if the chunk does not fit in the file
+static bool llama_state_seq_chunk_offsets(const llama_state_seq_chunk & chunk, size_t offs, size_t file_size, size_t & offs_state, size_t & offs_end) {
+    offs_state = GGML_PAD(offs + sizeof(chunk) + sizeof(llama_token) * chunk.n_token_count, LLAMA_STATE_SEQ_ALIGNMENT);
+    if (chunk.state_size > file_size || offs_state > file_size - chunk.state_size) {
+        return false;
+    }
+
+    offs_end = GGML_PAD(offs_state + chunk.state_size, LLAMA_STATE_SEQ_ALIGNMENT);
+
+    return offs_end <= file_size;
+}
+
 size_t llama_context::state_get_size() {
     llama_io_write_dummy io;
     try {
@@ -1657,20 +1847,20 @@ size_t llama_context::state_set_data(const uint8_t * src, size_t size) {
     }
 }
 
-size_t llama_context::state_seq_get_size(llama_seq_id seq_id, llama_state_seq_flags flags) {
+size_t llama_context::state_seq_get_size(llama_seq_id seq_id, llama_state_seq_flags flags, llama_pos p0) {
     llama_io_write_dummy io;
     try {
-        return state_seq_write_data(io, seq_id, flags);
+        return state_seq_write_data(io, seq_id, flags, p0);
     } catch (const std::exception & err) {
         LLAMA_LOG_ERROR("%s: error getting state size: %s\n", __func__, err.what());
         return 0;
     }
 }
 
-size_t llama_context::state_seq_get_data(llama_seq_id seq_id, uint8_t * dst, size_t size, llama_state_seq_flags flags) {
+size_t llama_context::state_seq_get_data(llama_seq_id seq_id, uint8_t * dst, size_t size, llama_state_seq_flags flags, llama_pos p0) {
     llama_io_write_buffer io(dst, size);
     try {
-        return state_seq_write_data(io, seq_id, flags);
+        return state_seq_write_data(io, seq_id, flags, p0);
     } catch (const std::exception & err) {
         LLAMA_LOG_ERROR("%s: error saving state: %s\n", __func__, err.what());
         return 0;
@@ -1761,53 +1951,89 @@ size_t llama_context::state_seq_load_file(llama_seq_id seq_id, const char * file
         }
     }
 
-    // load the prompt
-    {
-        const uint32_t n_token_count = file.read_u32();
+    const size_t file_size = file.size();
 
-        if (n_token_count > n_token_capacity) {
-            LLAMA_LOG_ERROR("%s: token count in sequence state file exceeded capacity! %u > %zu\n", __func__, n_token_count, n_token_capacity);
+    // restore the state directly from a mapping of the file
+    std::unique_ptr<llama_mmap> mapping;
+    std::vector<uint8_t> read_buf;
+
+    const uint8_t * base = nullptr;
+    if (llama_mmap::SUPPORTED) {
+        mapping = std::make_unique<llama_mmap>(&file);
+        base = (const uint8_t *) mapping->addr();
+    } else {
+        read_buf.resize(file_size);
+        file.seek(0, SEEK_SET);
+        file.read_raw(read_buf.data(), file_size);
+        base = read_buf.data();
+    }
+
+    size_t n_token_count = 0;
+    size_t n_chunks      = 0;
+
+    size_t offs = llama_state_seq_header_size();
+    while (offs < file_size) {
+        llama_state_seq_chunk chunk;
+        size_t offs_state = 0;
+        size_t offs_end   = 0;
+        if (offs + sizeof(chunk) <= file_size) {
+            memcpy(&chunk, base + offs, sizeof(chunk));
+        }
+        if (offs + sizeof(chunk) > file_size || !llama_state_seq_chunk_offsets(chunk, offs, file_size, offs_state, offs_end)) {
+            // the last chunk was not written completely, restore the previous ones
+            LLAMA_LOG_WARN("%s: ignoring a truncated chunk at the end of %s\n", __func__, filepath);
+            break;
+        }
+
+        // load the prompt
+        if (n_token_count + chunk.n_token_count > n_token_capacity) {
+            LLAMA_LOG_ERROR("%s: token count in sequence state file exceeded capacity! %zu > %zu\n", __func__, n_token_count + chunk.n_token_count, n_token_capacity);
             return 0;
         }
 
-        file.read_raw(tokens_out, sizeof(llama_token) * n_token_count);
-        *n_token_count_out = n_token_count;
-    }
+        memcpy(tokens_out + n_token_count, base + offs + sizeof(chunk), sizeof(llama_token) * chunk.n_token_count);
+        n_token_count += chunk.n_token_count;
 
-    // restore the context state
-    {
-        const size_t state_size = file.size() - file.tell();
-        llama_io_read_file io(&file);
-        const size_t nread = state_seq_read_data(io, seq_id, 0);
-        if (!nread) {
+        // restore the context state, the chunks after the first one are on top of the previous ones
+        llama_io_read_buffer io(base + offs_state, chunk.state_size);
+        const size_t nread = state_seq_read_data(io, seq_id, n_chunks == 0 ? 0 : LLAMA_STATE_SEQ_FLAGS_PARTIAL);
+        if (nread != chunk.state_size) {
             LLAMA_LOG_ERROR("%s: failed to restore sequence state\n", __func__);
             return 0;
         }
-        GGML_ASSERT(nread <= state_size);
-        GGML_ASSERT(nread + sizeof(uint32_t) * 3 + sizeof(llama_token) * *n_token_count_out == file.tell());
+
+        n_chunks++;
+        offs = offs_end;
     }
 
-    return file.tell();
+    if (n_chunks == 0) {
+        LLAMA_LOG_ERROR("%s: no sequence state in %s\n", __func__, filepath);
+        return 0;
+    }
+
+    *n_token_count_out = n_token_count;
+
+    return offs;
 }
 
 size_t llama_context::state_seq_save_file(llama_seq_id seq_id, const char * filepath, const llama_token * tokens, size_t n_token_count) {
     llama_file file(filepath, "wb");
 
-    file.write_u32(LLAMA_STATE_SEQ_MAGIC);
-    file.write_u32(LLAMA_STATE_SEQ_VERSION);
+    llama_state_seq_write_header(file);
 
-    // save the prompt
-    file.write_u32((uint32_t) n_token_count);
-    file.write_raw(tokens, sizeof(llama_token) * n_token_count);
+    llama_io_write_dummy io_size;
+    const size_t state_size = state_seq_write_data(io_size, seq_id, 0);
+
+    llama_state_seq_write_chunk_header(file, tokens, n_token_count, state_size);
 
     // save the context state using stream saving
     llama_io_write_file io(&file);
     state_seq_write_data(io, seq_id, 0);
+    GGML_ASSERT(io.n_bytes() == state_size);
 
-    const size_t res = file.tell();
-    GGML_ASSERT(res == sizeof(uint32_t) * 3 + sizeof(llama_token) * n_token_count + io.n_bytes());
+    llama_state_seq_pad(file);
 
-    return res;
+    return file.tell();
 }
 
 size_t llama_context::state_write_data(llama_io_write_i & io) {
@@ -1971,11 +2197,11 @@ size_t llama_context::state_read_data(llama_io_read_i & io) {
     return io.n_bytes();
 }
 
-size_t llama_context::state_seq_write_data(llama_io_write_i & io, llama_seq_id seq_id, llama_state_seq_flags flags) {
+size_t llama_context::state_seq_write_data(llama_io_write_i & io, llama_seq_id seq_id, llama_state_seq_flags flags, llama_pos p0) {
     GGML_UNUSED(seq_id);
 
     if (memory) {
-        memory->state_write(io, seq_id, flags);
+        memory->state_write(io, seq_id, flags, p0);
     }
 
     return io.n_bytes();
@@ -2014,6 +2240,8 @@ void llama_context::perf_reset() {
     t_eval_us   = n_eval = 0;
     t_p_eval_us = n_p_eval = 0;
     n_reused    = 0;
+
+    ggml_backend_sched_profile_reset(sched.get());
 }
 
 //
@@ -2256,6 +2484,7 @@ llama_context_params llama_context_default_params() {
         /*.yarn_beta_slow              =*/ 1.0f,
         /*.yarn_orig_ctx               =*/ 0,
         /*.defrag_thold                =*/ -1.0f,
+        /*.n_logits_top                =*/ 0,
         /*.cb_eval                     =*/ nullptr,
         /*.cb_eval_user_data           =*/ nullptr,
         /*.type_k                      =*/ GGML_TYPE_F16,
@@ -2269,6 +2498,7 @@ llama_context_params llama_context_default_params() {
         /*.op_offload                  =*/ true,
         /*.swa_full                    =*/ true,
         /*.kv_unified                  =*/ false,
+        /*.auto_threads                =*/ false,
     };
 
     return result;
@@ -2339,6 +2569,10 @@ uint32_t llama_n_seq_max(const llama_context * ctx) {
     return ctx->n_seq_max();
 }
 
+uint32_t llama_n_logits_top(const llama_context * ctx) {
+    return ctx->n_logits_top();
+}
+
 const llama_model * llama_get_model(const llama_context * ctx) {
     return &ctx->get_model();
 }
@@ -2380,6 +2614,10 @@ int32_t llama_n_threads_batch(llama_context * ctx) {
     return ctx->n_threads_batch();
 }
 
+int32_t llama_n_threads_auto(llama_context * ctx, int32_t n_tokens) {
+    return ctx->n_threads_auto(std::max(1, n_tokens));
+}
+
 void llama_set_abort_callback(llama_context * ctx, bool (*abort_callback)(void * data), void * abort_callback_data) {
     ctx->set_abort_callback(abort_callback, abort_callback_data);
 }
@@ -2388,6 +2626,10 @@ void llama_set_embeddings(llama_context * ctx, bool embeddings) {
     ctx->set_embeddings(embeddings);
 }
 
+void llama_set_logits_top(llama_context * ctx, bool logits_top) {
+    ctx->set_logits_top(logits_top);
+}
+
 void llama_set_causal_attn(llama_context * ctx, bool causal_attn) {
     ctx->set_causal_attn(causal_attn);
 }
@@ -2412,6 +2654,18 @@ float * llama_get_logits_ith(llama_context * ctx, int32_t i) {
     return ctx->get_logits_ith(i);
 }
 
+float * llama_get_logits_top_ith(llama_context * ctx, int32_t i) {
+    ctx->synchronize();
+
+    return ctx->get_logits_top_ith(i);
+}
+
+llama_token * llama_get_logits_top_ids_ith(llama_context * ctx, int32_t i) {
+    ctx->synchronize();
+
+    return ctx->get_logits_top_ids_ith(i);
+}
+
 float * llama_get_embeddings(llama_context * ctx) {
     ctx->synchronize();
 
@@ -2839,6 +3093,75 @@ size_t llama_state_seq_save_file(llama_context * ctx, const char * filepath, lla
     }
 }
 
+size_t llama_state_seq_get_size_from(llama_context * ctx, llama_seq_id seq_id, llama_pos p0, llama_state_seq_flags flags) {
+    return ctx->state_seq_get_size(seq_id, flags, p0);
+}
+
+size_t llama_state_seq_get_data_from(llama_context * ctx, uint8_t * dst, size_t size, llama_seq_id seq_id, llama_pos p0, llama_state_seq_flags flags) {
+    ctx->synchronize();
+
+    return ctx->state_seq_get_data(seq_id, dst, size, flags, p0);
+}
+
+size_t llama_state_seq_save_file_data(const char * filepath, const uint8_t * src, size_t size, const llama_token * tokens, size_t n_token_count, bool append) {
+    try {
+        std::unique_ptr<llama_file> file;
+
+        size_t offs = 0;
+
+        if (append) {
+            file = std::make_unique<llama_file>(filepath, "r+b");
+
+            const uint32_t magic   = file->read_u32();
+            const uint32_t version = file->read_u32();
+
+            if (magic != LLAMA_STATE_SEQ_MAGIC || version != LLAMA_STATE_SEQ_VERSION) {
+                LLAMA_LOG_ERROR("%s: unknown (magic, version) for sequence state file: %08x, %08x\n", __func__, magic, version);
+                return 0;
+            }
+
+            // the new chunk goes after the last complete one
+            const size_t file_size = file->size();
+
+            offs = llama_state_seq_header_size();
+            while (offs < file_size) {
+                llama_state_seq_chunk chunk;
+                size_t offs_state = 0;
+                size_t offs_end   = 0;
+                if (offs + sizeof(chunk) > file_size) {
+                    break;
+                }
+                file->seek(offs, SEEK_SET);
+                file->read_raw(&chunk, sizeof(chunk));
+                if (!llama_state_seq_chunk_offsets(chunk, offs, file_size, offs_state, offs_end)) {
+                    break;
+                }
+                offs = offs_end;
+            }
+
+            if (offs != file_size) {
+                LLAMA_LOG_ERROR("%s: the last chunk of %s is truncated, the state must be saved whole\n", __func__, filepath);
+                return 0;
+            }
+
+            file->seek(offs, SEEK_SET);
+        } else {
+            file = std::make_unique<llama_file>(filepath, "wb");
+
+            llama_state_seq_write_header(*file);
+        }
+
+        llama_state_seq_write_chunk_header(*file, tokens, n_token_count, size);
+        file->write_raw(src, size);
+        llama_state_seq_pad(*file);
+
+        return file->tell() - offs;
+    } catch (const std::exception & err) {
+        LLAMA_LOG_ERROR("%s: error saving sequence state file: %s\n", __func__, err.what());
+        return 0;
+    }
+}
+
 size_t llama_state_seq_load_file(llama_context * ctx, const char * filepath, llama_seq_id dest_seq_id, llama_token * tokens_out, size_t n_token_capacity, size_t * n_token_count_out) {
     ctx->synchronize();
 
@@ -2902,12 +3225,34 @@ void llama_perf_context_print(const llama_context * ctx) {
             __func__, data.t_eval_ms, data.n_eval, data.t_eval_ms / data.n_eval, 1e3 / data.t_eval_ms * data.n_eval);
     LLAMA_LOG_INFO("%s:       total time = %10.2f ms / %5d tokens\n", __func__, (t_end_ms - data.t_start_ms), (data.n_p_eval + data.n_eval));
     LLAMA_LOG_INFO("%s:    graphs reused = %10d\n", __func__, data.n_reused);
+
+    if (ctx && ggml_backend_sched_get_profiling(ctx->get_sched())) {
+        std::string summary(llama_perf_ops_summary(ctx, nullptr, 0) + 1, '\0');
+        llama_perf_ops_summary(ctx, summary.data(), summary.size());
+        LLAMA_LOG_INFO("%s: ops profile:\n%s\n", __func__, summary.c_str());
+    }
 }
 
 void llama_perf_context_reset(llama_context * ctx) {
     ctx->perf_reset();
 }
 
+void llama_perf_ops_enable(llama_context * ctx, bool enable) {
+    ggml_backend_sched_set_profiling(ctx->get_sched(), enable);
+}
+
+void llama_perf_ops_reset(llama_context * ctx) {
+    ggml_backend_sched_profile_reset(ctx->get_sched());
+}
+
+size_t llama_perf_ops_summary(const llama_context * ctx, char * buf, size_t buf_size) {
+    return ggml_backend_sched_profile_summary(ctx->get_sched(), buf, buf_size);
+}
+
+size_t llama_perf_ops_trace(const llama_context * ctx, char * buf, size_t buf_size) {
+    return ggml_backend_sched_profile_trace(ctx->get_sched(), buf, buf_size);
+}
+
 //
 // training
 //
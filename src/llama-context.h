@@ -4,6 +4,7 @@
 #include "llama-cparams.h"
 #include "llama-graph.h"
 #include "llama-adapter.h"
+#include "llama-thread-tuner.h"
 
 #include "ggml-cpp.h"
 #include "ggml-opt.h"
@@ -41,9 +42,14 @@ struct llama_context {
     uint32_t n_ubatch()      const;
     uint32_t n_seq_max()     const;
 
+    uint32_t n_logits_top()  const;
+
     uint32_t n_threads()       const;
     uint32_t n_threads_batch() const;
 
+    // number of threads currently used for ubatches of n_tokens
+    int32_t n_threads_auto(uint32_t n_tokens) const;
+
     llama_memory_t get_memory() const;
 
     // return true of the KV cache was updated
@@ -56,6 +62,9 @@ struct llama_context {
     float * get_logits();
     float * get_logits_ith(int32_t i);
 
+    float       * get_logits_top_ith(int32_t i);
+    llama_token * get_logits_top_ids_ith(int32_t i);
+
     float * get_embeddings();
     float * get_embeddings_ith(int32_t i);
     float * get_embeddings_seq(llama_seq_id seq_id);
@@ -71,6 +80,7 @@ struct llama_context {
     void set_abort_callback(bool (*abort_callback)(void * data), void * abort_callback_data);
 
     void set_embeddings (bool value);
+    void set_logits_top (bool value);
     void set_causal_attn(bool value);
     void set_warmup(bool value);
 
@@ -111,8 +121,8 @@ struct llama_context {
     size_t state_get_data(      uint8_t * dst, size_t size);
     size_t state_set_data(const uint8_t * src, size_t size);
 
-    size_t state_seq_get_size(llama_seq_id seq_id, llama_state_seq_flags flags);
-    size_t state_seq_get_data(llama_seq_id seq_id,       uint8_t * dst, size_t size, llama_state_seq_flags flags);
+    size_t state_seq_get_size(llama_seq_id seq_id, llama_state_seq_flags flags, llama_pos p0 = 0);
+    size_t state_seq_get_data(llama_seq_id seq_id,       uint8_t * dst, size_t size, llama_state_seq_flags flags, llama_pos p0 = 0);
     size_t state_seq_set_data(llama_seq_id seq_id, const uint8_t * src, size_t size, llama_state_seq_flags flags);
 
     bool state_load_file(
@@ -195,7 +205,8 @@ public:
     llm_graph_result * get_gf_res_reserve() const;
 
     // returns the result of ggml_backend_sched_graph_compute_async execution
-    ggml_status graph_compute(ggml_cgraph * gf, bool batched);
+    // n_tokens is the number of tokens of the ubatch of the graph, 0 for the graphs that do not compute a ubatch
+    ggml_status graph_compute(ggml_cgraph * gf, bool batched, uint32_t n_tokens = 0);
 
     // reserve a graph with a dummy ubatch of the specified size
     ggml_cgraph * graph_reserve(uint32_t n_tokens, uint32_t n_seqs, uint32_t n_outputs, const llama_memory_context_i * mctx);
@@ -213,7 +224,7 @@ private:
     size_t state_write_data(llama_io_write_i & io);
     size_t state_read_data (llama_io_read_i  & io);
 
-    size_t state_seq_write_data(llama_io_write_i & io, llama_seq_id seq_id, llama_state_seq_flags flags);
+    size_t state_seq_write_data(llama_io_write_i & io, llama_seq_id seq_id, llama_state_seq_flags flags, llama_pos p0 = 0);
     size_t state_seq_read_data (llama_io_read_i  & io, llama_seq_id seq_id, llama_state_seq_flags flags);
 
     //
@@ -237,6 +248,12 @@ private:
     size_t  logits_size = 0; // capacity (of floats) for logits
     float * logits      = nullptr;
 
+    // top logits output (2-dimensional arrays: [n_outputs][n_logits_top])
+    // populated instead of the logits when n_logits_top > 0
+    size_t        logits_top_size = 0; // capacity (of floats) for the top logits and their token ids
+    float       * logits_top      = nullptr;
+    llama_token * logits_top_ids  = nullptr;
+
     // embeddings output (2-dimensional array: [n_outputs][n_embd])
     // populated only when pooling_type == LLAMA_POOLING_TYPE_NONE
     size_t  embd_size = 0; // capacity (of floats) for embeddings
@@ -276,6 +293,9 @@ private:
 
     std::vector<std::pair<ggml_backend_t, ggml_backend_set_n_threads_t>> set_n_threads_fns;
 
+    // adaptive number of threads, null if disabled
+    std::unique_ptr<llama_thread_tuner> thread_tuner;
+
     // buffer types used for the compute buffer of each backend
     std::vector<ggml_backend_t>             backend_ptrs;
     std::vector<ggml_backend_buffer_type_t> backend_buft;
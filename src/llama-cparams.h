@@ -26,6 +26,9 @@ struct llama_cparams {
     float yarn_beta_slow;
     float defrag_thold;
 
+    uint32_t n_logits_top; // if > 0, select the top logits on the backend
+
+    bool logits_top; // the top logits are selected on the backend (n_logits_top > 0), can be toggled at runtime
     bool embeddings;
     bool causal_attn;
     bool offload_kqv;
@@ -1130,24 +1130,31 @@ void llama_grammar_apply_impl(const struct llama_grammar & grammar, llama_token_
         }
     }
 
+    // without a pending partial UTF-8 sequence, the pieces decode the same as the vocab's precomputed table
+    const bool use_piece_table = grammar.partial_utf8.n_remain <= 0;
+
     std::vector<std::pair<std::vector<uint32_t>, llama_partial_utf8>> candidates_decoded;
-    candidates_decoded.reserve(cur_p->size);
+    if (!use_piece_table) {
+        candidates_decoded.reserve(cur_p->size);
+    }
 
     llama_grammar_candidates candidates_grammar;
     candidates_grammar.reserve(cur_p->size);
 
     for (size_t i = 0; i < cur_p->size; ++i) {
-        const llama_token id      = cur_p->data[i].id;
-        const std::string & piece = grammar.vocab->token_to_piece(id);
+        const llama_token id = cur_p->data[i].id;
+        const auto piece     = grammar.vocab->token_get_piece(id);
 
-        if (grammar.vocab->is_eog(id)) {
+        if (piece.flags & llama_vocab::PIECE_FLAG_EOG) {
             if (!allow_eog) {
                 cur_p->data[i].logit = -INFINITY;
             }
-        } else if (piece.empty() || piece[0] == 0) {
+        } else if (piece.flags & llama_vocab::PIECE_FLAG_EMPTY) {
             cur_p->data[i].logit = -INFINITY;
+        } else if (use_piece_table) {
+            candidates_grammar.push_back({ i, piece.cpts, { piece.partial_value, piece.partial_n_remain } });
         } else {
-            candidates_decoded.push_back(decode_utf8(piece, grammar.partial_utf8));
+            candidates_decoded.push_back(decode_utf8(grammar.vocab->token_to_piece(id), grammar.partial_utf8));
             candidates_grammar.push_back({ i, candidates_decoded.back().first.data(), candidates_decoded.back().second });
         }
     }
@@ -1210,6 +1217,20 @@ void llama_grammar_accept_impl(struct llama_grammar & grammar, llama_token token
         GGML_ABORT("fatal error");
     }
 
+    if (grammar.partial_utf8.n_remain <= 0) {
+        const auto decoded = grammar.vocab->token_get_piece(token);
+
+        for (uint32_t i = 0; i < decoded.n_cpts; ++i) {
+            llama_grammar_accept(&grammar, decoded.cpts[i]);
+        }
+
+        grammar.partial_utf8 = { decoded.partial_value, decoded.partial_n_remain };
+        if (grammar.stacks.empty()) {
+            throw std::runtime_error("Unexpected empty grammar stack after accepting piece: " + piece);
+        }
+        return;
+    }
+
     llama_grammar_accept_str(grammar, piece);
 }
 
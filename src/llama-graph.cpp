@@ -417,6 +417,9 @@ void llm_graph_result::reset() {
     t_embd        = nullptr;
     t_embd_pooled = nullptr;
 
+    t_logits_top     = nullptr;
+    t_logits_top_ids = nullptr;
+
     params = {};
 
     inputs.clear();
@@ -1885,6 +1888,35 @@ void llm_graph_context::build_pooling(
     ggml_build_forward_expand(gf, cur);
 }
 
+void llm_graph_context::build_logits_top() const {
+    ggml_tensor * logits = res->t_logits;
+
+    if (!cparams.logits_top || logits == nullptr) {
+        return;
+    }
+
+    const int64_t n_top   = cparams.n_logits_top;
+    const int64_t n_vocab = logits->ne[0];
+    const int64_t n_out   = logits->ne[1];
+
+    ggml_tensor * ids = ggml_argsort_top_k(ctx0, logits, n_top);
+    cb(ids, "result_logits_top_ids", -1);
+
+    ggml_tensor * cur = ggml_get_rows(ctx0, ggml_reshape_3d(ctx0, logits, 1, n_vocab, n_out), ids);
+    cur = ggml_reshape_2d(ctx0, cur, n_top, n_out);
+    cb(cur, "result_logits_top", -1);
+
+    // the ids are an input of the get_rows, so they must not be overwritten by the allocator
+    ggml_set_output(ids);
+    ggml_set_output(cur);
+
+    res->t_logits_top     = cur;
+    res->t_logits_top_ids = ids;
+
+    ggml_build_forward_expand(gf, ids);
+    ggml_build_forward_expand(gf, cur);
+}
+
 int32_t llama_relative_position_bucket(llama_pos x, llama_pos y, uint64_t n_buckets, bool bidirectional) {
     // TODO move to hparams if a T5 variant appears that uses a different value
     const int64_t max_distance = 128;
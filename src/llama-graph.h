@@ -444,6 +444,7 @@ struct llm_graph_params {
 
         return
             cparams.embeddings  == other.cparams.embeddings  &&
+            cparams.logits_top  == other.cparams.logits_top  &&
             cparams.causal_attn == other.cparams.causal_attn &&
             arch      == other.arch  &&
             gtype     == other.gtype &&
@@ -465,6 +466,9 @@ public:
     ggml_tensor * get_embd()        const { return t_embd; }
     ggml_tensor * get_embd_pooled() const { return t_embd_pooled; }
 
+    ggml_tensor * get_logits_top()     const { return t_logits_top; }
+    ggml_tensor * get_logits_top_ids() const { return t_logits_top_ids; }
+
     ggml_cgraph  * get_gf()  const { return gf; }
     ggml_context * get_ctx() const { return ctx_compute.get(); }
 
@@ -491,6 +495,9 @@ public:
     ggml_tensor * t_embd        = nullptr;
     ggml_tensor * t_embd_pooled = nullptr;
 
+    ggml_tensor * t_logits_top     = nullptr;
+    ggml_tensor * t_logits_top_ids = nullptr;
+
     std::vector<llm_graph_input_ptr> inputs;
 
     ggml_context_ptr ctx_compute;
@@ -814,6 +821,13 @@ struct llm_graph_context {
             ggml_tensor * cls_b,
             ggml_tensor * cls_out,
             ggml_tensor * cls_out_b) const;
+
+    //
+    // logits
+    //
+
+    // select the top cparams.n_logits_top logits of each output on the backend
+    void build_logits_top() const;
 };
 
 // TODO: better name
@@ -194,12 +194,13 @@ bool llama_kv_cache_unified_iswa::get_can_shift() const {
     return kv_base->get_size() == kv_swa->get_size();
 }
 
-void llama_kv_cache_unified_iswa::state_write(llama_io_write_i & io, llama_seq_id seq_id, llama_state_seq_flags flags) const {
+void llama_kv_cache_unified_iswa::state_write(llama_io_write_i & io, llama_seq_id seq_id, llama_state_seq_flags flags, llama_pos p0) const {
     if ((flags & LLAMA_STATE_SEQ_FLAGS_SWA_ONLY) == 0) {
-        kv_base->state_write(io, seq_id, flags);
+        kv_base->state_write(io, seq_id, flags, p0);
     }
 
-    kv_swa->state_write(io, seq_id, flags);
+    // the SWA cache only holds the last n_swa positions, so it is always saved whole
+    kv_swa->state_write(io, seq_id, flags, 0);
 }
 
 void llama_kv_cache_unified_iswa::state_read(llama_io_read_i & io, llama_seq_id seq_id, llama_state_seq_flags flags) {
@@ -207,7 +208,8 @@ void llama_kv_cache_unified_iswa::state_read(llama_io_read_i & io, llama_seq_id
         kv_base->state_read(io, seq_id, flags);
     }
 
-    kv_swa->state_read(io, seq_id, flags);
+    // saved whole: replaces the cells of the sequence instead of appending to them
+    kv_swa->state_read(io, seq_id, flags & ~LLAMA_STATE_SEQ_FLAGS_PARTIAL);
 }
 
 llama_kv_cache_unified * llama_kv_cache_unified_iswa::get_base() const {
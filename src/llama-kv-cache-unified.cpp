@@ -1828,7 +1828,7 @@ bool llama_kv_cache_unified::is_masked_swa(llama_pos p0, llama_pos p1) const {
     return false;
 }
 
-void llama_kv_cache_unified::state_write(llama_io_write_i & io, llama_seq_id seq_id, llama_state_seq_flags flags) const {
+void llama_kv_cache_unified::state_write(llama_io_write_i & io, llama_seq_id seq_id, llama_state_seq_flags flags, llama_pos p0) const {
     GGML_UNUSED(flags);
 
     io.write(&n_stream, sizeof(n_stream));
@@ -1841,11 +1841,11 @@ void llama_kv_cache_unified::state_write(llama_io_write_i & io, llama_seq_id seq
         const auto & cells = v_cells[s];
 
         // Count the number of cells with the specified seq_id
-        // Find all the ranges of cells with this seq id (or all, when -1)
+        // Find all the ranges of cells with this seq id (or all, when -1) at positions >= p0
         uint32_t cell_range_begin = cells.size();
 
         for (uint32_t i = 0; i < cells.size(); ++i) {
-            if (!cells.is_empty(i) && (seq_id == -1 || cells.seq_has(i, seq_id))) {
+            if (!cells.is_empty(i) && (seq_id == -1 || cells.seq_has(i, seq_id)) && cells.pos_get(i) >= p0) {
                 ++cell_count;
                 if (cell_range_begin == cells.size()) {
                     cell_range_begin = i;
@@ -1882,8 +1882,6 @@ void llama_kv_cache_unified::state_write(llama_io_write_i & io, llama_seq_id seq
 }
 
 void llama_kv_cache_unified::state_read(llama_io_read_i & io, llama_seq_id seq_id, llama_state_seq_flags flags) {
-    GGML_UNUSED(flags);
-
     GGML_ASSERT(seq_id == -1 || (seq_id >= 0 && (size_t) seq_id < seq_to_stream.size()));
 
     uint32_t n_stream_cur;
@@ -1903,7 +1901,7 @@ void llama_kv_cache_unified::state_read(llama_io_read_i & io, llama_seq_id seq_i
         const uint32_t strm = seq_id == -1 ? s : seq_to_stream[seq_id];
 
         bool res = true;
-        res = res && state_read_meta(io, strm, cell_count, seq_id);
+        res = res && state_read_meta(io, strm, cell_count, seq_id, flags & LLAMA_STATE_SEQ_FLAGS_PARTIAL);
         res = res && state_read_data(io, strm, cell_count);
 
         if (!res) {
@@ -2040,14 +2038,12 @@ void llama_kv_cache_unified::state_write_data(llama_io_write_i & io, const cell_
     }
 }
 
-bool llama_kv_cache_unified::state_read_meta(llama_io_read_i & io, uint32_t strm, uint32_t cell_count, llama_seq_id dest_seq_id) {
+bool llama_kv_cache_unified::state_read_meta(llama_io_read_i & io, uint32_t strm, uint32_t cell_count, llama_seq_id dest_seq_id, bool partial) {
     auto & cells = v_cells[strm];
     auto & head  = v_heads[strm];
 
     if (dest_seq_id != -1) {
         // single sequence
-        seq_rm(dest_seq_id, -1, -1);
-
         llama_batch_allocr balloc(hparams.n_pos_per_embd());
 
         llama_ubatch ubatch = balloc.ubatch_reserve(cell_count, 1);
@@ -2077,6 +2073,14 @@ bool llama_kv_cache_unified::state_read_meta(llama_io_read_i & io, uint32_t strm
             ubatch.seq_id[i]   = &dest_seq_id;
         }
 
+        // a partial state is restored on top of the cells of the sequence before its first position
+        llama_pos p0 = -1;
+        if (partial) {
+            p0 = *std::min_element(ubatch.pos, ubatch.pos + cell_count);
+        }
+
+        seq_rm(dest_seq_id, p0, -1);
+
         const auto sinfo = find_slot(ubatch, true);
         if (sinfo.empty()) {
             LLAMA_LOG_ERROR("%s: failed to find available cells in kv cache\n", __func__);
@@ -165,18 +165,16 @@ llama_pos llama_memory_hybrid::seq_pos_max(llama_seq_id seq_id) const {
     return std::min(mem_attn->seq_pos_max(seq_id), mem_recr->seq_pos_max(seq_id));
 }
 
-void llama_memory_hybrid::state_write(llama_io_write_i & io, llama_seq_id seq_id, llama_state_seq_flags flags) const {
+void llama_memory_hybrid::state_write(llama_io_write_i & io, llama_seq_id seq_id, llama_state_seq_flags flags, llama_pos p0) const {
     GGML_UNUSED(flags);
 
-    mem_attn->state_write(io, seq_id);
-    mem_recr->state_write(io, seq_id);
+    mem_attn->state_write(io, seq_id, 0, p0);
+    mem_recr->state_write(io, seq_id, 0, p0);
 }
 
 void llama_memory_hybrid::state_read(llama_io_read_i & io, llama_seq_id seq_id, llama_state_seq_flags flags) {
-    GGML_UNUSED(flags);
-
-    mem_attn->state_read(io, seq_id);
-    mem_recr->state_read(io, seq_id);
+    mem_attn->state_read(io, seq_id, flags & LLAMA_STATE_SEQ_FLAGS_PARTIAL);
+    mem_recr->state_read(io, seq_id, flags & LLAMA_STATE_SEQ_FLAGS_PARTIAL);
 }
 
 llama_kv_cache_unified * llama_memory_hybrid::get_mem_attn() const {
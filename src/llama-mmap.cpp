@@ -9,6 +9,7 @@
 #include <stdexcept>
 #include <cerrno>
 #include <algorithm>
+#include <mutex>
 
 #ifdef __has_include
     #if __has_include(<unistd.h>)
@@ -132,6 +133,26 @@ struct llama_file::impl {
         return val;
     }
 
+    void read_raw_at(void * ptr, size_t len, size_t offset) const {
+        size_t bytes_read = 0;
+        while (bytes_read < len) {
+            size_t chunk_size = std::min<size_t>(len - bytes_read, 64*1024*1024);
+            OVERLAPPED ov = {};
+            ov.Offset     = (DWORD) ((offset + bytes_read) & 0xFFFFFFFF);
+            ov.OffsetHigh = (DWORD) ((offset + bytes_read) >> 32);
+            DWORD chunk_read = 0;
+            BOOL result = ReadFile(fp_win32, reinterpret_cast<char*>(ptr) + bytes_read, chunk_size, &chunk_read, &ov);
+            if (!result) {
+                throw std::runtime_error(format("read error: %s", GetErrorMessageWin32(GetLastError()).c_str()));
+            }
+            if (chunk_read < chunk_size || chunk_read == 0) {
+                throw std::runtime_error("unexpectedly reached end of file");
+            }
+
+            bytes_read += chunk_read;
+        }
+    }
+
     void write_raw(const void * ptr, size_t len) const {
         size_t bytes_written = 0;
         while (bytes_written < len) {
@@ -215,6 +236,31 @@ struct llama_file::impl {
         return ret;
     }
 
+    void read_raw_at(void * ptr, size_t len, size_t offset) const {
+#if defined(_POSIX_MAPPED_FILES)
+        const int fd = fileno(fp);
+        size_t bytes_read = 0;
+        while (bytes_read < len) {
+            const ssize_t ret = pread(fd, (char *) ptr + bytes_read, len - bytes_read, (off_t) (offset + bytes_read));
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(format("read error: %s", strerror(errno)));
+            }
+            if (ret == 0) {
+                throw std::runtime_error("unexpectedly reached end of file");
+            }
+            bytes_read += ret;
+        }
+#else
+        // no positional reads, serialize the reads through the file position
+        std::lock_guard<std::mutex> lock(mtx);
+        seek(offset, SEEK_SET);
+        read_raw(ptr, len);
+#endif
+    }
+
     void write_raw(const void * ptr, size_t len) const {
         if (len == 0) {
             return;
@@ -239,6 +285,10 @@ struct llama_file::impl {
 
     FILE * fp;
     size_t size;
+
+#if !defined(_WIN32) && !defined(_POSIX_MAPPED_FILES)
+    mutable std::mutex mtx;
+#endif
 };
 
 llama_file::llama_file(const char * fname, const char * mode) : pimpl(std::make_unique<impl>(fname, mode)) {}
@@ -261,6 +311,7 @@ int llama_file::file_id() const {
 
 void llama_file::seek(size_t offset, int whence) const { pimpl->seek(offset, whence); }
 void llama_file::read_raw(void * ptr, size_t len) const { pimpl->read_raw(ptr, len); }
+void llama_file::read_raw_at(void * ptr, size_t len, size_t offset) const { pimpl->read_raw_at(ptr, len, offset); }
 
 uint32_t llama_file::read_u32() const { return pimpl->read_u32(); }
 
@@ -26,6 +26,9 @@ struct llama_file {
     void read_raw(void * ptr, size_t len) const;
     uint32_t read_u32() const;
 
+    // read at an offset without using the file position, can be called from several threads at once
+    void read_raw_at(void * ptr, size_t len, size_t offset) const;
+
     void write_raw(const void * ptr, size_t len) const;
     void write_u32(uint32_t val) const;
 
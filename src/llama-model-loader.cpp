@@ -2,10 +2,16 @@
 
 #include "ggml.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <cinttypes>
+#include <condition_variable>
 #include <cstring>
 #include <future>
+#include <mutex>
+#include <thread>
 
 static const size_t kiB = 1024;
 static const size_t MiB = 1024*kiB;
@@ -916,6 +922,146 @@ void llama_model_loader::load_data_for(struct ggml_tensor * cur) const {
     }
 }
 
+bool llama_model_loader::load_host_tensors(
+        const std::vector<host_tensor_read> & reads,
+        llama_progress_callback progress_callback,
+        void * progress_callback_user_data,
+        bool & validation_failed) {
+    // the reads are split in chunks so that a few large tensors keep all the threads busy
+    // 16 MiB is large enough for sequential throughput per request
+    constexpr size_t chunk_size = 16*MiB;
+
+    struct chunk {
+        size_t idx;  // index in reads
+        size_t offs; // offset in the tensor
+        size_t size;
+    };
+
+    std::vector<chunk> chunks;
+    std::vector<std::atomic<size_t>> n_left(reads.size()); // bytes left to read per tensor
+    std::vector<uint8_t> valid(reads.size(), 1);
+
+    for (size_t i = 0; i < reads.size(); ++i) {
+        for (size_t offs = 0; offs < reads[i].size; offs += chunk_size) {
+            chunks.push_back({ i, offs, std::min(chunk_size, reads[i].size - offs) });
+        }
+        n_left[i].store(reads[i].size);
+    }
+
+    if (chunks.empty()) {
+        return true;
+    }
+
+    // the threads mostly wait for the storage, a few of them are enough to keep the queues of NVMe drives full
+    const int n_threads = (int) std::min<size_t>(chunks.size(), std::clamp(std::thread::hardware_concurrency(), 1u, 8u));
+
+    std::atomic<size_t> next_chunk = 0;
+    std::atomic<size_t> size_read  = 0;
+    std::atomic<bool>   stop       = false;
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+    int                     n_running = n_threads;
+    std::string             error;
+
+    auto worker = [&]() {
+        try {
+            while (!stop) {
+                const size_t c = next_chunk++;
+                if (c >= chunks.size()) {
+                    break;
+                }
+
+                const auto & ch = chunks[c];
+                const auto & rd = reads[ch.idx];
+
+                rd.file->read_raw_at((uint8_t *) rd.tensor->data + ch.offs, ch.size, rd.offs + ch.offs);
+                size_read += ch.size;
+
+                // the thread that reads the last chunk of a tensor validates it
+                if (n_left[ch.idx].fetch_sub(ch.size) == ch.size && check_tensors) {
+                    valid[ch.idx] = ggml_validate_row_data(rd.tensor->type, rd.tensor->data, rd.size);
+                }
+            }
+        } catch (const std::exception & e) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (error.empty()) {
+                error = e.what();
+            }
+            stop = true;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            n_running--;
+        }
+        cv.notify_one();
+    };
+
+    const int64_t t_start_us = ggml_time_us();
+
+    std::vector<std::thread> workers;
+    workers.reserve(n_threads);
+    for (int i = 0; i < n_threads; ++i) {
+        workers.emplace_back(worker);
+    }
+
+    // the progress is reported from this thread, the callback does not have to be thread-safe
+    bool    cancelled   = false;
+    int64_t t_report_us = t_start_us;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (n_running > 0) {
+            cv.wait_for(lock, std::chrono::milliseconds(100));
+
+            lock.unlock();
+
+            const int64_t t_now_us = ggml_time_us();
+            if (t_now_us - t_report_us >= 1000000) {
+                LLAMA_LOG_DEBUG("%s: read %.2f of %.2f MiB (%.2f MiB/s)\n", __func__,
+                        size_read/1024.0/1024.0, size_data/1024.0/1024.0, size_read/1024.0/1024.0/((t_now_us - t_start_us)/1e6));
+                t_report_us = t_now_us;
+            }
+
+            if (progress_callback && !cancelled) {
+                if (!progress_callback((float) (size_done + size_read) / size_data, progress_callback_user_data)) {
+                    cancelled = true;
+                    stop      = true;
+                }
+            }
+
+            lock.lock();
+        }
+    }
+
+    for (auto & w : workers) {
+        w.join();
+    }
+
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+
+    size_done += size_read;
+
+    if (cancelled) {
+        return false;
+    }
+
+    const double t_s = std::max<int64_t>(ggml_time_us() - t_start_us, 1)/1e6;
+    LLAMA_LOG_INFO("%s: read %.2f MiB in %.2f s with %d threads (%.2f MiB/s)\n", __func__,
+            size_read/1024.0/1024.0, t_s, n_threads, size_read/1024.0/1024.0/t_s);
+
+    for (size_t i = 0; i < reads.size(); ++i) {
+        if (!valid[i]) {
+            LLAMA_LOG_ERROR("%s: tensor '%s' has invalid data\n", __func__, ggml_get_name(reads[i].tensor));
+            validation_failed = true;
+        }
+    }
+
+    return true;
+}
+
 bool llama_model_loader::load_all_data(
         struct ggml_context * ctx,
         llama_buf_map & bufs,
@@ -927,6 +1073,9 @@ bool llama_model_loader::load_all_data(
     std::vector<no_init<uint8_t>> read_buf;
     std::vector<std::future<std::pair<ggml_tensor *, bool>>> validation_result;
 
+    // tensors of host buffers, read in parallel after the others
+    std::vector<host_tensor_read> host_reads;
+
     // 4 staging buffers for async uploads, each sized 1MB seems to be a good default for single NVMe drives.
     // NVMe raid configurations might require more / larger buffers.
     constexpr size_t n_buffers = 4;
@@ -1062,13 +1211,8 @@ bool llama_model_loader::load_all_data(
         } else {
             const auto & file = files.at(weight->idx);
             if (ggml_backend_buffer_is_host(cur->buffer)) {
-                file->seek(weight->offs, SEEK_SET);
-                file->read_raw(cur->data, n_size);
-                if (check_tensors) {
-                    validation_result.emplace_back(std::async(std::launch::async, [cur, n_size] {
-                        return std::make_pair(cur, ggml_validate_row_data(cur->type, cur->data, n_size));
-                    }));
-                }
+                host_reads.push_back({ cur, file.get(), weight->offs, n_size });
+                continue;
             } else {
                 // If upload_backend is valid load the tensor in chunks to pinned memory and upload the buffers asynchronously to the GPU.
                 if (upload_backend) {
@@ -1103,6 +1247,10 @@ bool llama_model_loader::load_all_data(
         size_done += n_size;
     }
 
+    bool validation_failed = false;
+
+    const bool host_ok = load_host_tensors(host_reads, progress_callback, progress_callback_user_data, validation_failed);
+
     // free temporary resources used for async uploads
     for (auto * event : events) {
         ggml_backend_event_synchronize(event);
@@ -1113,8 +1261,11 @@ bool llama_model_loader::load_all_data(
     }
     ggml_backend_free(upload_backend);
 
+    if (!host_ok) {
+        return false;
+    }
+
     // check validation results
-    bool validation_failed = false;
     for (auto & future : validation_result) {
         auto result = future.get();
         if (!result.second) {
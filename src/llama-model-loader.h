@@ -164,6 +164,22 @@ struct llama_model_loader {
             llama_progress_callback progress_callback,
             void * progress_callback_user_data);
 
+    // tensor of a host buffer read without mmap
+    struct host_tensor_read {
+        ggml_tensor      * tensor;
+        const llama_file * file;
+        size_t             offs;
+        size_t             size;
+    };
+
+    // read the tensors with positional reads from several threads, overlapped with their validation
+    // Returns false if cancelled by progress_callback
+    bool load_host_tensors(
+            const std::vector<host_tensor_read> & reads,
+            llama_progress_callback progress_callback,
+            void * progress_callback_user_data,
+            bool & validation_failed);
+
     std::string ftype_name() const;
 
     void print_info() const;
@@ -5,6 +5,7 @@
 #include "llama-batch.h"
 #include "llama-cparams.h"
 #include "llama-model-loader.h"
+#include "llama-repack-cache.h"
 
 #include "llama-kv-cache-unified.h"
 #include "llama-kv-cache-unified-iswa.h"
@@ -24,6 +25,7 @@
 #include <regex>
 #include <sstream>
 #include <stdexcept>
+#include <tuple>
 
 const char * llm_type_name(llm_type type) {
     switch (type) {
@@ -5560,6 +5562,9 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
     const size_t n_max_backend_buffer = ctx_map.size() * ml.files.size();
     pimpl->bufs.reserve(n_max_backend_buffer);
 
+    // contexts of repacked weights to save in the repack cache after loading
+    std::vector<std::tuple<ggml_context *, ggml_backend_buffer_type_t, std::string>> repack_cache_save;
+
     for (auto & it : ctx_map) {
         ggml_backend_buffer_type_t buft = it.first;
         ggml_context * ctx              = it.second;
@@ -5586,6 +5591,26 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
         bool buffer_from_host_ptr_supported = props.caps.buffer_from_host_ptr;
         bool is_default_buft = buft == ggml_backend_dev_buffer_type(dev);
 
+        // weights repacked by the CPU backend: map them from the cache if it has them, otherwise save them after loading
+        if (params.repack_cache && !is_default_buft) {
+            const std::string path = llama_repack_cache_path(params.repack_cache, ml, ctx, buft);
+            if (!path.empty()) {
+                ggml_backend_buffer_t buf = llama_repack_cache_load(path, ctx, buft, pimpl->mappings);
+                if (buf != nullptr) {
+                    LLAMA_LOG_INFO("%s: using repack cache %s for buffer type %s\n", __func__, path.c_str(), ggml_backend_buft_name(buft));
+
+                    ggml_backend_buffer_set_usage(buf, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+                    pimpl->bufs.emplace_back(buf);
+
+                    for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != nullptr; t = ggml_get_next_tensor(ctx, t)) {
+                        ml.size_done += ggml_nbytes(t);
+                    }
+                    continue;
+                }
+                repack_cache_save.emplace_back(ctx, buft, path);
+            }
+        }
+
         if (ml.use_mmap && use_mmap_buffer && buffer_from_host_ptr_supported && is_default_buft) {
             for (uint32_t idx = 0; idx < ml.files.size(); idx++) {
                 // only the mmap region containing the tensors in the model is mapped to the backend buffer
@@ -5671,6 +5696,10 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
         }
     }
 
+    for (const auto & [ctx, buft, path] : repack_cache_save) {
+        llama_repack_cache_save(path, ctx, buft);
+    }
+
     if (use_mmap_buffer) {
         for (auto & mapping : ml.mappings) {
             pimpl->mappings.emplace_back(std::move(mapping));
@@ -18507,6 +18536,9 @@ ggml_cgraph * llama_model::build_graph(const llm_graph_params & params) const {
     // add on pooling layer
     llm->build_pooling(cls, cls_b, cls_out, cls_out_b);
 
+    // select the top logits on the backend
+    llm->build_logits_top();
+
     return llm->res->get_gf();
 }
 
@@ -18525,6 +18557,7 @@ llama_model_params llama_model_default_params() {
         /*.progress_callback           =*/ nullptr,
         /*.progress_callback_user_data =*/ nullptr,
         /*.kv_overrides                =*/ nullptr,
+        /*.repack_cache                =*/ nullptr,
         /*.vocab_only                  =*/ false,
         /*.use_mmap                    =*/ true,
         /*.use_mlock                   =*/ false,
@@ -5,8 +5,10 @@
 
 #include <algorithm>
 #include <cmath>
+#include <condition_variable>
 #include <cstring>
 #include <cinttypes>
+#include <exception>
 #include <fstream>
 #include <mutex>
 #include <regex>
@@ -530,6 +532,77 @@ static size_t llama_tensor_quantize_impl(enum ggml_type new_type, const float *
     return new_size;
 }
 
+// memory of the tensors in flight in addition to the largest tensor
+#define LLAMA_QUANTIZE_PIPELINE_MEM (1024ull*1024*1024)
+
+static const int64_t quantize_min_chunk_size = 32 * 512;
+
+enum quantize_job_state {
+    QUANTIZE_JOB_PENDING,
+    QUANTIZE_JOB_LOADED,
+    QUANTIZE_JOB_CONVERTED,
+};
+
+struct quantize_job {
+    const llama_model_loader::llama_tensor_weight * weight = nullptr;
+
+    bool      quantize = false;
+    ggml_type new_type = GGML_TYPE_COUNT;
+
+    const float * imatrix = nullptr;
+
+    int    nthread  = 0; // threads used to convert the tensor
+    size_t new_size = 0;
+    size_t mem      = 0; // memory held while the tensor is in flight
+
+    quantize_job_state state = QUANTIZE_JOB_PENDING;
+
+    std::vector<no_init<uint8_t>> read_data;
+    std::vector<no_init<float>>   f32_data;
+    std::vector<no_init<uint8_t>> new_data;
+};
+
+static void llama_tensor_convert_impl(quantize_job & job) {
+    ggml_tensor * tensor = job.weight->tensor;
+
+    const int64_t nelements = ggml_nelements(tensor);
+
+    std::vector<std::thread> workers;
+    workers.reserve(job.nthread);
+
+    const float * f32_data;
+
+    if (tensor->type == GGML_TYPE_F32) {
+        f32_data = (const float *) tensor->data;
+    } else {
+        llama_tensor_dequantize_impl(tensor, job.f32_data, workers, nelements, job.nthread);
+        f32_data = (const float *) job.f32_data.data();
+    }
+
+    job.new_data.resize(job.new_size);
+
+    const ggml_type new_type = job.new_type;
+
+    const int64_t n_per_row = tensor->ne[0];
+    const int64_t nrows = tensor->ne[1];
+
+    const int64_t chunk_size = (n_per_row >= quantize_min_chunk_size ? n_per_row : n_per_row * ((quantize_min_chunk_size + n_per_row - 1)/n_per_row));
+
+    const int64_t nelements_matrix = tensor->ne[0] * tensor->ne[1];
+
+    // quantize each expert separately since they have different importance matrices
+    size_t new_size = 0;
+    for (int64_t i03 = 0; i03 < tensor->ne[2]; ++i03) {
+        const float * f32_data_03 = f32_data + i03 * nelements_matrix;
+        void * new_data_03 = (char *)job.new_data.data() + ggml_row_size(new_type, n_per_row) * i03 * nrows;
+        const float * imatrix_03 = job.imatrix ? job.imatrix + i03 * n_per_row : nullptr;
+
+        new_size += llama_tensor_quantize_impl(new_type, f32_data_03, new_data_03, chunk_size, nrows, n_per_row, imatrix_03, workers, job.nthread);
+    }
+
+    GGML_ASSERT(new_size == job.new_size);
+}
+
 static void llama_model_quantize_impl(const std::string & fname_inp, const std::string & fname_out, const llama_model_quantize_params * params) {
     ggml_type default_type;
     llama_ftype ftype = params->ftype;
@@ -733,15 +806,6 @@ static void llama_model_quantize_impl(const std::string & fname_inp, const std::
     size_t total_size_org = 0;
     size_t total_size_new = 0;
 
-    std::vector<std::thread> workers;
-    workers.reserve(nthread);
-
-    int idx = 0;
-
-    std::vector<no_init<uint8_t>> read_data;
-    std::vector<no_init<uint8_t>> work;
-    std::vector<no_init<float>> f32_conv_buf;
-
     uint16_t n_split = 1;
 
     // Assume split index is continuous
@@ -802,30 +866,21 @@ static void llama_model_quantize_impl(const std::string & fname_inp, const std::
     };
 
     const auto tn = LLM_TN(model.arch);
-    new_ofstream(0);
-    for (const auto * it : tensors) {
-        const auto & weight = *it;
-        ggml_tensor * tensor = weight.tensor;
-        if (weight.idx != cur_split && params->keep_split) {
-            close_ofstream();
-            new_ofstream(weight.idx);
-        }
 
-        const std::string name = ggml_get_name(tensor);
+    std::vector<quantize_job> jobs(tensors.size());
 
-        if (!ml.use_mmap) {
-            if (read_data.size() < ggml_nbytes(tensor)) {
-                read_data.resize(ggml_nbytes(tensor));
-            }
-            tensor->data = read_data.data();
-        }
-        ml.load_data_for(tensor);
+    const int n_conv = std::max(1, nthread);
 
-        LLAMA_LOG_INFO("[%4d/%4d] %36s - [%s], type = %6s, ",
-               ++idx, ml.n_tensors,
-               ggml_get_name(tensor),
-               llama_format_tensor_shape(tensor).c_str(),
-               ggml_type_name(tensor->type));
+    size_t mem_job_max = 0;
+
+    // the types are chosen before any data is read since llama_tensor_get_type depends on the order of the tensors
+    for (size_t i = 0; i < tensors.size(); ++i) {
+        auto & job = jobs[i];
+        job.weight = tensors[i];
+
+        ggml_tensor * tensor = job.weight->tensor;
+
+        const std::string name = ggml_get_name(tensor);
 
         // This used to be a regex, but <regex> has an extreme cost to compile times.
         bool quantize = name.rfind("weight") == name.size() - 6; // ends with 'weight'?
@@ -880,8 +935,6 @@ static void llama_model_quantize_impl(const std::string & fname_inp, const std::
         quantize &= name.find("attn_rel_b.weight") == std::string::npos;
 
         ggml_type new_type;
-        void * new_data;
-        size_t new_size;
 
         if (quantize) {
             new_type = default_type;
@@ -916,24 +969,19 @@ static void llama_model_quantize_impl(const std::string & fname_inp, const std::
             quantize = tensor->type != new_type;
         }
 
-        if (!quantize) {
-            new_type = tensor->type;
-            new_data = tensor->data;
-            new_size = ggml_nbytes(tensor);
-            LLAMA_LOG_INFO("size = %8.3f MB\n", ggml_nbytes(tensor)/1024.0/1024.0);
-        } else {
-            const int64_t nelements = ggml_nelements(tensor);
+        const int64_t nelements = ggml_nelements(tensor);
 
+        if (quantize) {
             const float * imatrix = nullptr;
             if (imatrix_data) {
                 auto it = imatrix_data->find(remap_imatrix(tensor->name, mapped));
                 if (it == imatrix_data->end()) {
-                    LLAMA_LOG_INFO("\n====== %s: did not find weights for %s\n", __func__, tensor->name);
+                    LLAMA_LOG_INFO("====== %s: did not find weights for %s\n", __func__, tensor->name);
                 } else {
                     if (it->second.size() == (size_t)tensor->ne[0]*tensor->ne[2]) {
                         imatrix = it->second.data();
                     } else {
-                        LLAMA_LOG_INFO("\n====== %s: imatrix size %d is different from tensor size %d for %s\n", __func__,
+                        LLAMA_LOG_INFO("====== %s: imatrix size %d is different from tensor size %d for %s\n", __func__,
                                 int(it->second.size()), int(tensor->ne[0]*tensor->ne[2]), tensor->name);
 
                         // this can happen when quantizing an old mixtral model with split tensors with a new incompatible imatrix
@@ -960,81 +1008,207 @@ static void llama_model_quantize_impl(const std::string & fname_inp, const std::
                 throw std::runtime_error(format("Missing importance matrix for tensor %s in a very low-bit quantization", tensor->name));
             }
 
-            float * f32_data;
-
-            if (tensor->type == GGML_TYPE_F32) {
-                f32_data = (float *) tensor->data;
-            } else if (ggml_is_quantized(tensor->type) && !params->allow_requantize) {
+            if (ggml_is_quantized(tensor->type) && !params->allow_requantize) {
                 throw std::runtime_error(format("requantizing from type %s is disabled", ggml_type_name(tensor->type)));
-            } else {
-                llama_tensor_dequantize_impl(tensor, f32_conv_buf, workers, nelements, nthread);
-                f32_data = (float *) f32_conv_buf.data();
             }
 
-            LLAMA_LOG_INFO("converting to %s .. ", ggml_type_name(new_type));
-            fflush(stdout);
+            const int64_t n_per_row = tensor->ne[0];
+            const int64_t nrows     = nelements/n_per_row;
+
+            const int64_t chunk_size = n_per_row >= quantize_min_chunk_size ? n_per_row : n_per_row*((quantize_min_chunk_size + n_per_row - 1)/n_per_row);
+
+            const int64_t nelements_matrix = tensor->ne[0]*tensor->ne[1];
+            const int64_t nchunk = (nelements_matrix + chunk_size - 1)/chunk_size;
+
+            job.imatrix  = imatrix;
+            job.nthread  = n_conv > 1 ? (int) std::min((int64_t) n_conv, nchunk) : 1;
+            job.new_size = ggml_row_size(new_type, n_per_row)*nrows;
 
-            if (work.size() < (size_t)nelements * 4) {
-                work.resize(nelements * 4); // upper bound on size
+            job.mem += job.new_size;
+            if (tensor->type != GGML_TYPE_F32) {
+                job.mem += nelements*sizeof(float);
             }
-            new_data = work.data();
+        } else {
+            new_type = tensor->type;
+        }
 
-            const int64_t n_per_row = tensor->ne[0];
-            const int64_t nrows = tensor->ne[1];
+        job.quantize = quantize;
+        job.new_type = new_type;
 
-            static const int64_t min_chunk_size = 32 * 512;
-            const int64_t chunk_size = (n_per_row >= min_chunk_size ? n_per_row : n_per_row * ((min_chunk_size + n_per_row - 1)/n_per_row));
+        if (!ml.use_mmap) {
+            job.mem += ggml_nbytes(tensor);
+        }
 
-            const int64_t nelements_matrix = tensor->ne[0] * tensor->ne[1];
-            const int64_t nchunk = (nelements_matrix + chunk_size - 1)/chunk_size;
-            const int64_t nthread_use = nthread > 1 ? std::max((int64_t)1, std::min((int64_t)nthread, nchunk)) : 1;
-
-            // quantize each expert separately since they have different importance matrices
-            new_size = 0;
-            for (int64_t i03 = 0; i03 < tensor->ne[2]; ++i03) {
-                const float * f32_data_03 = f32_data + i03 * nelements_matrix;
-                void * new_data_03 = (char *)new_data + ggml_row_size(new_type, n_per_row) * i03 * nrows;
-                const float * imatrix_03 = imatrix ? imatrix + i03 * n_per_row : nullptr;
-
-                new_size += llama_tensor_quantize_impl(new_type, f32_data_03, new_data_03, chunk_size, nrows, n_per_row, imatrix_03, workers, nthread_use);
-
-                // TODO: temporary sanity check that the F16 -> MXFP4 is lossless
-#if 0
-                if (new_type == GGML_TYPE_MXFP4) {
-                    auto * x = f32_data_03;
-
-                    //LLAMA_LOG_INFO("nrows = %d, n_per_row = %d\n", nrows, n_per_row);
-                    std::vector<float> deq(nrows*n_per_row);
-                    const ggml_type_traits * qtype = ggml_get_type_traits(new_type);
-                    qtype->to_float(new_data_03, deq.data(), deq.size());
-
-                    double err = 0.0f;
-                    for (int i = 0; i < (int) deq.size(); ++i) {
-                        err += fabsf(deq[i] - x[i]);
-                        //if (fabsf(deq[i] - x[i]) > 0.00001 && i < 256) {
-                        if (deq[i] != x[i]) {
-                            LLAMA_LOG_INFO("deq[%d] = %f, x[%d] = %f\n", i, deq[i], i, x[i]);
-                        }
+        mem_job_max = std::max(mem_job_max, job.mem);
+    }
+
+    // the tensors go through three stages that overlap:
+    //  - a reader thread loads the tensors in order, as long as the memory of the tensors in flight allows it
+    //  - a pool of n_conv threads converts the loaded tensors, small tensors in parallel and large ones with several threads each
+    //  - this thread writes the converted tensors in order
+    // the output does not depend on the number of threads used for each tensor
+    const size_t mem_max = mem_job_max + LLAMA_QUANTIZE_PIPELINE_MEM;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::exception_ptr error;
+
+    size_t mem_used = 0;
+    size_t i_next   = 0; // next job to convert
+    int    n_free   = n_conv;
+
+    auto set_error = [&](std::exception_ptr err) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = err;
+            }
+        }
+        cv.notify_all();
+    };
+
+    std::thread reader([&]() {
+        try {
+            for (auto & job : jobs) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&] { return error || mem_used + job.mem <= mem_max; });
+                    if (error) {
+                        return;
                     }
-                    //LLAMA_LOG_INFO("err = %f\n", err);
-                    GGML_ASSERT(err == 0.00000);
+                    mem_used += job.mem;
                 }
-#endif
+
+                ggml_tensor * tensor = job.weight->tensor;
+
+                if (!ml.use_mmap) {
+                    job.read_data.resize(ggml_nbytes(tensor));
+                    tensor->data = job.read_data.data();
+                }
+                ml.load_data_for(tensor);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    job.state = QUANTIZE_JOB_LOADED;
+                }
+                cv.notify_all();
+            }
+        } catch (...) {
+            set_error(std::current_exception());
+        }
+    });
+
+    std::vector<std::thread> converters;
+    converters.reserve(n_conv);
+    for (int i = 0; i < n_conv; ++i) {
+        converters.emplace_back([&]() {
+            while (true) {
+                quantize_job * job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&] {
+                        return error || i_next == jobs.size() ||
+                            (jobs[i_next].state == QUANTIZE_JOB_LOADED && jobs[i_next].nthread <= n_free);
+                    });
+                    if (error || i_next == jobs.size()) {
+                        return;
+                    }
+                    job = &jobs[i_next++];
+                    n_free -= job->nthread;
+                }
+
+                if (job->quantize) {
+                    try {
+                        llama_tensor_convert_impl(*job);
+                    } catch (...) {
+                        set_error(std::current_exception());
+                        return;
+                    }
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    n_free += job->nthread;
+                    job->state = QUANTIZE_JOB_CONVERTED;
+                }
+                cv.notify_all();
+            }
+        });
+    }
+
+    try {
+        new_ofstream(0);
+
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            auto & job = jobs[i];
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return error || job.state == QUANTIZE_JOB_CONVERTED; });
+                if (error) {
+                    break;
+                }
+            }
+
+            const auto & weight = *job.weight;
+            ggml_tensor * tensor = weight.tensor;
+            if (weight.idx != cur_split && params->keep_split) {
+                close_ofstream();
+                new_ofstream(weight.idx);
+            }
+
+            const std::string name = ggml_get_name(tensor);
+
+            const void * new_data = job.quantize ? (const void *) job.new_data.data() : tensor->data;
+            const size_t new_size = job.quantize ? job.new_size : ggml_nbytes(tensor);
+
+            if (job.quantize) {
+                LLAMA_LOG_INFO("[%4d/%4d] %36s - [%s], type = %6s, converting to %s .. size = %8.2f MiB -> %8.2f MiB\n",
+                        int(i + 1), ml.n_tensors, name.c_str(), llama_format_tensor_shape(tensor).c_str(), ggml_type_name(tensor->type),
+                        ggml_type_name(job.new_type), ggml_nbytes(tensor)/1024.0/1024.0, new_size/1024.0/1024.0);
+            } else {
+                LLAMA_LOG_INFO("[%4d/%4d] %36s - [%s], type = %6s, size = %8.3f MB\n",
+                        int(i + 1), ml.n_tensors, name.c_str(), llama_format_tensor_shape(tensor).c_str(), ggml_type_name(tensor->type),
+                        ggml_nbytes(tensor)/1024.0/1024.0);
+            }
+
+            total_size_org += ggml_nbytes(tensor);
+            total_size_new += new_size;
+
+            // update the gguf meta data as we go
+            gguf_set_tensor_type(ctx_outs[cur_split].get(), name.c_str(), job.new_type);
+            GGML_ASSERT(gguf_get_tensor_size(ctx_outs[cur_split].get(), gguf_find_tensor(ctx_outs[cur_split].get(), name.c_str())) == new_size);
+            gguf_set_tensor_data(ctx_outs[cur_split].get(), name.c_str(), new_data);
+
+            // write tensor data + padding
+            fout.write((const char *) new_data, new_size);
+            zeros(fout, GGML_PAD(new_size, align) - new_size);
+
+            job.read_data = {};
+            job.f32_data  = {};
+            job.new_data  = {};
+            if (!ml.use_mmap) {
+                tensor->data = nullptr;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                mem_used -= job.mem;
             }
-            LLAMA_LOG_INFO("size = %8.2f MiB -> %8.2f MiB\n", ggml_nbytes(tensor)/1024.0/1024.0, new_size/1024.0/1024.0);
+            cv.notify_all();
         }
-        total_size_org += ggml_nbytes(tensor);
-        total_size_new += new_size;
+    } catch (...) {
+        set_error(std::current_exception());
+    }
 
-        // update the gguf meta data as we go
-        gguf_set_tensor_type(ctx_outs[cur_split].get(), name.c_str(), new_type);
-        GGML_ASSERT(gguf_get_tensor_size(ctx_outs[cur_split].get(), gguf_find_tensor(ctx_outs[cur_split].get(), name.c_str())) == new_size);
-        gguf_set_tensor_data(ctx_outs[cur_split].get(), name.c_str(), new_data);
+    reader.join();
+    for (auto & t : converters) {
+        t.join();
+    }
 
-        // write tensor data + padding
-        fout.write((const char *) new_data, new_size);
-        zeros(fout, GGML_PAD(new_size, align) - new_size);
+    if (error) {
+        std::rethrow_exception(error);
     }
+
     close_ofstream();
 
     LLAMA_LOG_INFO("%s: model size  = %8.2f MB\n", __func__, total_size_org/1024.0/1024.0);
@@ -0,0 +1,245 @@
+#include "llama-repack-cache.h"
+
+#include "llama-impl.h"
+#include "llama-model-loader.h"
+
+#include "ggml-cpp.h"
+#include "gguf.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <vector>
+
+// bytes of data hashed at the beginning and at the end of each tensor
+// hashing all the data would cost about as much as repacking it
+#define LLAMA_REPACK_CACHE_SAMPLE 4096
+
+static void fnv1a(uint64_t & h, const void * data, size_t size) {
+    const uint8_t * p = (const uint8_t *) data;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+}
+
+static void fnv1a(uint64_t & h, const char * str) {
+    fnv1a(h, str, strlen(str) + 1);
+}
+
+static ggml_backend_dev_extra_buffer_from_ptr_t llama_repack_cache_from_ptr_fn(ggml_backend_buffer_type_t buft) {
+    ggml_backend_dev_t dev = ggml_backend_buft_get_device(buft);
+    if (dev == nullptr || ggml_backend_dev_type(dev) != GGML_BACKEND_DEVICE_TYPE_CPU) {
+        return nullptr;
+    }
+
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+
+    return (ggml_backend_dev_extra_buffer_from_ptr_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_dev_extra_buffer_from_ptr");
+}
+
+std::string llama_repack_cache_path(
+        const std::string & dir,
+        const llama_model_loader & ml,
+        ggml_context * ctx,
+        ggml_backend_buffer_type_t buft) {
+    auto from_ptr = llama_repack_cache_from_ptr_fn(buft);
+    if (from_ptr == nullptr) {
+        return "";
+    }
+
+    // check with an empty buffer that the buffer type can be created from the cache
+    {
+        ggml_backend_buffer_ptr buf(from_ptr(buft, nullptr, 0));
+        if (!buf) {
+            return "";
+        }
+    }
+
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    // the layouts depend on the build and on the CPU
+    fnv1a(h, ggml_commit());
+    fnv1a(h, ggml_backend_buft_name(buft));
+
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(ggml_backend_buft_get_device(buft));
+    auto get_features = (ggml_backend_get_features_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_get_features");
+    if (get_features) {
+        for (ggml_backend_feature * f = get_features(reg); f->name; ++f) {
+            fnv1a(h, f->name);
+            fnv1a(h, f->value);
+        }
+    }
+
+    std::vector<uint8_t> sample;
+
+    for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != nullptr; t = ggml_get_next_tensor(ctx, t)) {
+        fnv1a(h, ggml_get_name(t));
+        fnv1a(h, &t->type, sizeof(t->type));
+        fnv1a(h, t->ne, sizeof(t->ne));
+
+        const auto * w = ml.get_weight(ggml_get_name(t));
+        if (w == nullptr) {
+            continue;
+        }
+
+        const auto & file = ml.files.at(w->idx);
+        const size_t size = file->size();
+        fnv1a(h, &size, sizeof(size));
+        fnv1a(h, &w->offs, sizeof(w->offs));
+
+        const size_t nbytes = ggml_nbytes(t);
+        const size_t n      = std::min<size_t>(nbytes, LLAMA_REPACK_CACHE_SAMPLE);
+
+        sample.resize(n);
+        file->read_raw_at(sample.data(), n, w->offs);
+        fnv1a(h, sample.data(), n);
+        file->read_raw_at(sample.data(), n, w->offs + nbytes - n);
+        fnv1a(h, sample.data(), n);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "llama-repack-%016" PRIx64 ".gguf", h);
+
+    std::string path = dir;
+    if (!path.empty() && path.back() != '/' && path.back() != '\\') {
+        path += '/';
+    }
+
+    return path + name;
+}
+
+ggml_backend_buffer_t llama_repack_cache_load(
+        const std::string & path,
+        ggml_context * ctx,
+        ggml_backend_buffer_type_t buft,
+        llama_mmaps & mappings) {
+    if (!llama_mmap::SUPPORTED) {
+        return nullptr;
+    }
+
+    {
+        std::ifstream f(path, std::ios::binary);
+        if (!f.good()) {
+            return nullptr;
+        }
+    }
+
+    gguf_init_params params = {
+        /*.no_alloc =*/ true,
+        /*.ctx      =*/ nullptr,
+    };
+
+    gguf_context_ptr meta(gguf_init_from_file(path.c_str(), params));
+    if (!meta) {
+        LLAMA_LOG_WARN("%s: failed to read repack cache %s\n", __func__, path.c_str());
+        return nullptr;
+    }
+
+    try {
+        std::unique_ptr<llama_file> file(new llama_file(path.c_str(), "rb"));
+
+        const size_t offs = gguf_get_data_offset(meta.get());
+        const size_t size = file->size();
+
+        int64_t n_tensors = 0;
+        for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != nullptr; t = ggml_get_next_tensor(ctx, t)) {
+            const int64_t id = gguf_find_tensor(meta.get(), ggml_get_name(t));
+            const size_t alloc_size = ggml_backend_buft_get_alloc_size(buft, t);
+            if (id < 0 || gguf_get_tensor_size(meta.get(), id) != alloc_size ||
+                    offs + gguf_get_tensor_offset(meta.get(), id) + alloc_size > size) {
+                LLAMA_LOG_WARN("%s: repack cache %s does not match tensor '%s'\n", __func__, path.c_str(), ggml_get_name(t));
+                return nullptr;
+            }
+            n_tensors++;
+        }
+        if (n_tensors != gguf_get_n_tensors(meta.get())) {
+            LLAMA_LOG_WARN("%s: repack cache %s does not match the tensors\n", __func__, path.c_str());
+            return nullptr;
+        }
+
+        std::unique_ptr<llama_mmap> mapping(new llama_mmap(file.get()));
+
+        uint8_t * base = (uint8_t *) mapping->addr() + offs;
+
+        auto from_ptr = llama_repack_cache_from_ptr_fn(buft);
+
+        ggml_backend_buffer_t buf = from_ptr ? from_ptr(buft, base, size - offs) : nullptr;
+        if (buf == nullptr) {
+            return nullptr;
+        }
+
+        for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != nullptr; t = ggml_get_next_tensor(ctx, t)) {
+            const int64_t id = gguf_find_tensor(meta.get(), ggml_get_name(t));
+            ggml_backend_tensor_alloc(buf, t, base + gguf_get_tensor_offset(meta.get(), id));
+        }
+
+        mappings.emplace_back(std::move(mapping));
+
+        return buf;
+    } catch (const std::exception & err) {
+        LLAMA_LOG_WARN("%s: failed to map repack cache %s: %s\n", __func__, path.c_str(), err.what());
+        return nullptr;
+    }
+}
+
+void llama_repack_cache_save(const std::string & path, ggml_context * ctx, ggml_backend_buffer_type_t buft) {
+    gguf_context_ptr meta(gguf_init_empty());
+
+    size_t n_tensors = 0;
+    for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != nullptr; t = ggml_get_next_tensor(ctx, t)) {
+        n_tensors++;
+    }
+
+    // the converted tensors can be larger than the original ones, they are stored as arrays of bytes
+    ggml_init_params params = {
+        /*.mem_size   =*/ ggml_tensor_overhead()*n_tensors,
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+    ggml_context_ptr ctx_meta(ggml_init(params));
+
+    for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != nullptr; t = ggml_get_next_tensor(ctx, t)) {
+        ggml_tensor * bytes = ggml_new_tensor_1d(ctx_meta.get(), GGML_TYPE_I8, ggml_backend_buft_get_alloc_size(buft, t));
+        ggml_set_name(bytes, ggml_get_name(t));
+        gguf_add_tensor(meta.get(), bytes);
+    }
+
+    // write to a temporary file, other processes may be writing the same cache
+    std::string tmp = path + ".tmp" + std::to_string(std::random_device{}());
+
+    try {
+        std::ofstream fout(tmp, std::ios::binary);
+        fout.exceptions(std::ofstream::failbit);
+
+        std::vector<uint8_t> data(gguf_get_meta_size(meta.get()));
+        gguf_get_meta_data(meta.get(), data.data());
+        fout.write((const char *) data.data(), data.size());
+
+        const std::vector<char> zeros(GGUF_DEFAULT_ALIGNMENT, 0);
+
+        // the data of the repacked tensors is in host memory
+        for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != nullptr; t = ggml_get_next_tensor(ctx, t)) {
+            const size_t nbytes = ggml_backend_buft_get_alloc_size(buft, t);
+            fout.write((const char *) t->data, nbytes);
+            fout.write(zeros.data(), GGML_PAD(nbytes, GGUF_DEFAULT_ALIGNMENT) - nbytes);
+        }
+
+        fout.close();
+    } catch (const std::exception & err) {
+        LLAMA_LOG_WARN("%s: failed to write repack cache %s: %s\n", __func__, tmp.c_str(), err.what());
+        std::remove(tmp.c_str());
+        return;
+    }
+
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        LLAMA_LOG_WARN("%s: failed to rename %s to %s\n", __func__, tmp.c_str(), path.c_str());
+        std::remove(tmp.c_str());
+        return;
+    }
+
+    LLAMA_LOG_INFO("%s: wrote repack cache %s\n", __func__, path.c_str());
+}
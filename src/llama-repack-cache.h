@@ -0,0 +1,39 @@
+#pragma once
+
+#include "llama-mmap.h"
+
+#include "ggml-backend.h"
+
+#include <string>
+
+struct llama_model_loader;
+
+//
+// llama_repack_cache
+//
+
+// cache of the weights converted by the CPU backend for its extra buffer types (interleaved layouts, AMX)
+//
+// the first load of a model repacks the weights as usual and writes them to a GGUF file in the cache directory
+// the following loads map that file read-only instead of repacking, so the processes that load the same model on a
+// host share the pages of the repacked weights
+// the name of the file is a hash of the tensors, of their data and of the CPU features, so that a different model,
+// CPU or build uses a different file
+
+// path of the cache file for the tensors of ctx, empty if buft does not support the cache
+std::string llama_repack_cache_path(
+        const std::string & dir,
+        const llama_model_loader & ml,
+        ggml_context * ctx,
+        ggml_backend_buffer_type_t buft);
+
+// map the cache file and allocate the tensors of ctx in it
+// returns nullptr if there is no cache file or if it does not match the tensors
+ggml_backend_buffer_t llama_repack_cache_load(
+        const std::string & path,
+        ggml_context * ctx,
+        ggml_backend_buffer_type_t buft,
+        llama_mmaps & mappings);
+
+// write the repacked tensors of ctx to the cache file
+void llama_repack_cache_save(const std::string & path, ggml_context * ctx, ggml_backend_buffer_type_t buft);
@@ -237,10 +237,10 @@ static void llama_sampler_top_k_impl(llama_token_data_array * cur_p, int32_t k)
 
     k = std::min(k, (int) cur_p->size);
 
-    // Sort scores in descending order
+    // Sort scores in descending order, equal scores by token id so that the selection does not depend on the sort
     if (!cur_p->sorted) {
         auto comp = [](const llama_token_data & a, const llama_token_data & b) {
-            return a.logit > b.logit;
+            return a.logit > b.logit || (a.logit == b.logit && a.id < b.id);
         };
         if (k <= 128) {
             std::partial_sort(cur_p->data, cur_p->data + k, cur_p->data + cur_p->size, comp);
@@ -0,0 +1,151 @@
+#include "llama-thread-tuner.h"
+
+#include "llama-impl.h"
+
+#include <algorithm>
+#include <cmath>
+
+// buckets of ubatches by number of tokens: [1, 1], [2, 3], [4, 7], ...
+#define LLAMA_THREAD_TUNER_N_BUCKETS 16
+
+// samples of a thread count per probe
+#define LLAMA_THREAD_TUNER_N_PROBE 2
+
+// ubatches between the probes
+#define LLAMA_THREAD_TUNER_PERIOD_MIN 8
+#define LLAMA_THREAD_TUNER_PERIOD_MAX 256
+
+// weight of a new sample in the moving average of the time per token
+static const double tuner_alpha = 0.25;
+
+// a probed thread count has to be at least this much faster than the best one to replace it
+static const double tuner_margin = 0.03;
+
+// relative change of the time per token of the best thread count that restarts the probes
+static const double tuner_drift = 0.15;
+
+llama_thread_tuner::llama_thread_tuner(int32_t n_threads, int32_t n_threads_batch) {
+    buckets.resize(LLAMA_THREAD_TUNER_N_BUCKETS);
+
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        auto & b = buckets[i];
+
+        b.n_max  = std::max(1, i == 0 ? n_threads : n_threads_batch);
+        b.n_best = b.n_max;
+        b.period = LLAMA_THREAD_TUNER_PERIOD_MIN;
+    }
+}
+
+size_t llama_thread_tuner::bucket_idx(uint32_t n_tokens) {
+    size_t idx = 0;
+    while (n_tokens > 1 && idx + 1 < LLAMA_THREAD_TUNER_N_BUCKETS) {
+        n_tokens >>= 1;
+        idx++;
+    }
+
+    return idx;
+}
+
+int32_t llama_thread_tuner::get(uint32_t n_tokens) {
+    auto & b = buckets[bucket_idx(n_tokens)];
+
+    if (b.n_probe > 0) {
+        return b.n_probe;
+    }
+
+    if (b.n_max == 1 || b.n_since < b.period || b.timings[b.n_best].n < LLAMA_THREAD_TUNER_N_PROBE) {
+        return b.n_best;
+    }
+
+    // probe the next thread count in the current direction, or in the other one at the limits
+    const int32_t step = std::max(1, b.n_max/8);
+
+    int32_t n = std::clamp(b.n_best + b.dir*step, 1, b.n_max);
+    if (n == b.n_best) {
+        b.dir = -b.dir;
+        n = std::clamp(b.n_best + b.dir*step, 1, b.n_max);
+    }
+
+    // the previous samples of the thread count may have been taken under a different load
+    b.timings[n] = {};
+
+    b.n_probe = n;
+    b.n_left  = LLAMA_THREAD_TUNER_N_PROBE;
+    b.n_since = 0;
+
+    return n;
+}
+
+void llama_thread_tuner::record(uint32_t n_tokens, int32_t n_threads, int64_t t_us) {
+    const size_t idx = bucket_idx(n_tokens);
+
+    auto & b = buckets[idx];
+
+    const double t = (double) t_us/std::max(1u, n_tokens);
+
+    auto & s = b.timings[n_threads];
+    s.t_us = s.n == 0 ? t : s.t_us + tuner_alpha*(t - s.t_us);
+    s.n++;
+
+    if (b.n_probe > 0 && n_threads == b.n_probe) {
+        if (--b.n_left > 0) {
+            return;
+        }
+
+        b.n_probe = 0;
+
+        const auto & s_best = b.timings[b.n_best];
+
+        if (s.t_us < s_best.t_us*(1.0 - tuner_margin)) {
+            LLAMA_LOG_INFO("%s: ubatches of %u-%u tokens: %d -> %d threads (%.1f -> %.1f us/token, %d of %d threads free)\n", __func__,
+                    1u << idx, (2u << idx) - 1, b.n_best, n_threads, s_best.t_us, s.t_us, b.n_max - n_threads, b.n_max);
+
+            // keep going in the same direction
+            b.n_best  = n_threads;
+            b.n_fail  = 0;
+            b.period  = LLAMA_THREAD_TUNER_PERIOD_MIN;
+            b.n_since = b.period;
+            b.t_ref   = s.t_us;
+        } else {
+            b.dir = -b.dir;
+
+            // both neighbours are slower
+            if (++b.n_fail >= 2) {
+                b.n_fail = 0;
+                b.period = std::min(2*b.period, LLAMA_THREAD_TUNER_PERIOD_MAX);
+            }
+        }
+
+        return;
+    }
+
+    if (n_threads != b.n_best) {
+        return;
+    }
+
+    b.n_since++;
+
+    if (b.t_ref == 0.0) {
+        if (s.n >= LLAMA_THREAD_TUNER_N_PROBE) {
+            b.t_ref = s.t_us;
+        }
+        return;
+    }
+
+    if (std::fabs(s.t_us - b.t_ref) > tuner_drift*b.t_ref) {
+        LLAMA_LOG_DEBUG("%s: ubatches of %u-%u tokens: time with %d threads changed from %.1f to %.1f us/token, probing again\n", __func__,
+                1u << idx, (2u << idx) - 1, b.n_best, b.t_ref, s.t_us);
+
+        b.t_ref  = s.t_us;
+        b.n_fail = 0;
+        b.period = LLAMA_THREAD_TUNER_PERIOD_MIN;
+    }
+}
+
+int32_t llama_thread_tuner::best(uint32_t n_tokens) const {
+    return buckets[bucket_idx(n_tokens)].n_best;
+}
+
+int32_t llama_thread_tuner::max(uint32_t n_tokens) const {
+    return buckets[bucket_idx(n_tokens)].n_max;
+}
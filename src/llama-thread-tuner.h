@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+//
+// llama_thread_tuner
+//
+
+// online selection of the number of threads used to compute a ubatch
+//
+// the ubatches are grouped in buckets by their number of tokens (single token decode, 2-3 tokens, 4-7 tokens, ...)
+// each bucket starts with the configured number of threads and from time to time probes a thread count next to its
+// current best one, moving to it when it is faster (hill climbing)
+// the probes become less frequent while they fail, and frequent again when the latency of the best thread count
+// changes, e.g. when other processes start or stop competing for the cores
+struct llama_thread_tuner {
+    llama_thread_tuner(int32_t n_threads, int32_t n_threads_batch);
+
+    // number of threads to use for the next ubatch of n_tokens
+    int32_t get(uint32_t n_tokens);
+
+    // record the compute time of a ubatch of n_tokens computed with n_threads
+    void record(uint32_t n_tokens, int32_t n_threads, int64_t t_us);
+
+    // current best number of threads for ubatches of n_tokens
+    int32_t best(uint32_t n_tokens) const;
+
+    // maximum number of threads for ubatches of n_tokens
+    int32_t max(uint32_t n_tokens) const;
+
+private:
+    struct timing {
+        double  t_us = 0.0; // moving average of the time per token
+        int32_t n    = 0;   // number of samples
+    };
+
+    struct bucket {
+        int32_t n_max;
+        int32_t n_best;
+
+        int32_t n_probe = 0; // thread count being probed, 0 if none
+        int32_t n_left  = 0; // samples left for the probe
+        int32_t n_since = 0; // ubatches since the last probe
+        int32_t n_fail  = 0; // consecutive failed probes
+        int32_t period;      // ubatches between the probes
+        int32_t dir     = -1;
+
+        double t_ref = 0.0; // time per token of n_best when it was selected
+
+        std::map<int32_t, timing> timings; // by number of threads
+    };
+
+    static size_t bucket_idx(uint32_t n_tokens);
+
+    std::vector<bucket> buckets;
+};
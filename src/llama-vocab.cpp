@@ -8,17 +8,24 @@
 #include "unicode.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
 #include <cfloat>
 #include <cmath>
+#include <condition_variable>
 #include <cstdarg>
 #include <cstring>
 #include <forward_list>
+#include <functional>
 #include <limits>
+#include <list>
 #include <map>
+#include <mutex>
 #include <queue>
 #include <set>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 
 //
@@ -68,6 +75,111 @@ struct naive_trie {
     llama_token value;
 };
 
+// runs the independent parts of llama_vocab::tokenize_batch
+// the workers are started on first use and shared by all callers - if the pool is busy, the caller runs the work itself
+struct llm_tokenizer_pool {
+    llm_tokenizer_pool(int32_t n_workers) {
+        workers.reserve(n_workers);
+        for (int32_t i = 0; i < n_workers; ++i) {
+            workers.emplace_back([this, i]() { worker(i); });
+        }
+    }
+
+    ~llm_tokenizer_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv_work.notify_all();
+        for (auto & w : workers) {
+            w.join();
+        }
+    }
+
+    int32_t n_threads_max() const {
+        return (int32_t) workers.size() + 1;
+    }
+
+    // calls fn(i) for i in [0, n) on up to n_threads threads, including the calling thread
+    void parallel_for(int32_t n, int32_t n_threads, const std::function<void(int32_t)> & fn) {
+        n_threads = std::min(std::min(n_threads, n), n_threads_max());
+
+        std::unique_lock<std::mutex> lock_busy(mutex_busy, std::try_to_lock);
+        if (n_threads <= 1 || !lock_busy.owns_lock()) {
+            for (int32_t i = 0; i < n; ++i) {
+                fn(i);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job       = &fn;
+            n_jobs    = n;
+            n_active  = n_threads - 1;
+            n_pending = n_threads - 1;
+            next.store(0, std::memory_order_relaxed);
+            generation++;
+        }
+        cv_work.notify_all();
+
+        run(fn);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cv_done.wait(lock, [this]() { return n_pending == 0; });
+        job = nullptr;
+    }
+
+private:
+    void run(const std::function<void(int32_t)> & fn) {
+        for (int32_t i = next.fetch_add(1); i < n_jobs; i = next.fetch_add(1)) {
+            fn(i);
+        }
+    }
+
+    void worker(int32_t id) {
+        uint64_t seen = 0;
+        while (true) {
+            const std::function<void(int32_t)> * fn;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv_work.wait(lock, [&]() { return stop || (generation != seen && id < n_active); });
+                if (stop) {
+                    return;
+                }
+                seen = generation;
+                fn   = job;
+            }
+
+            run(*fn);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--n_pending == 0) {
+                    cv_done.notify_one();
+                }
+            }
+        }
+    }
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex_busy; // held for the duration of a parallel_for
+    std::mutex mutex;
+    std::condition_variable cv_work;
+    std::condition_variable cv_done;
+
+    const std::function<void(int32_t)> * job = nullptr;
+
+    int32_t  n_jobs     = 0;
+    int32_t  n_active   = 0;
+    int32_t  n_pending  = 0;
+    uint64_t generation = 0;
+    bool     stop       = false;
+
+    std::atomic<int32_t> next { 0 };
+};
+
 //
 // tokenizers
 //
@@ -258,8 +370,25 @@ public:
     }
 
     void pop() =  delete;
+
+    // keeps the capacity of the underlying container
+    void clear() {
+        this->c.clear();
+    }
 };
 
+// symbols are identified by their BPE symbol id instead of their text, see llama_vocab::find_bpe_symbol
+struct llm_symbol_bpe {
+    using index = int;
+    index prev;
+    index next;
+    const char * text;
+    size_t n;
+    int32_t id;
+};
+
+static_assert(std::is_trivially_copyable<llm_symbol_bpe>::value, "llm_symbol_bpe is not trivially copyable");
+
 struct llm_bigram_bpe {
     struct comparator {
         bool operator()(const llm_bigram_bpe & l, const llm_bigram_bpe & r) const {
@@ -269,11 +398,77 @@ struct llm_bigram_bpe {
 
     using queue_storage = std::vector<llm_bigram_bpe>;
     using queue = llama_priority_queue<llm_bigram_bpe, queue_storage, comparator>;
-    llm_symbol::index left;
-    llm_symbol::index right;
-    std::string text;
+    llm_symbol_bpe::index left;
+    llm_symbol_bpe::index right;
+    int32_t id_left;  // symbol ids when the bigram was queued - the bigram is outdated if they changed
+    int32_t id_right;
+    int32_t id;       // symbol id of the merged pair
     int rank;
-    size_t size;
+};
+
+// LRU cache of the tokens of the pre-tokenized words, shared by all sessions of a tokenizer
+// split into shards with separate locks, so that concurrent tokenizations rarely contend
+struct llm_tokenizer_bpe_cache {
+    static constexpr size_t n_shards      = 16;
+    static constexpr size_t n_entries_max = 32768;   // in total
+    static constexpr size_t word_len_max  = 128;     // longer words are not cached
+
+    // appends the cached tokens of the word to the output, returns false if the word is not cached
+    bool get(const std::string & word, std::vector<llama_token> & output) {
+        if (word.size() > word_len_max) {
+            return false;
+        }
+
+        auto & shard = shards[std::hash<std::string>{}(word) % n_shards];
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.map.find(word);
+        if (it == shard.map.end()) {
+            return false;
+        }
+
+        // move to the front of the LRU list
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+
+        const auto & tokens = it->second->second;
+        output.insert(output.end(), tokens.begin(), tokens.end());
+
+        return true;
+    }
+
+    void put(const std::string & word, const llama_token * tokens, size_t n_tokens) {
+        if (word.size() > word_len_max) {
+            return;
+        }
+
+        auto & shard = shards[std::hash<std::string>{}(word) % n_shards];
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        if (shard.map.find(word) != shard.map.end()) {
+            return;
+        }
+
+        if (shard.lru.size() >= n_entries_max/n_shards) {
+            shard.map.erase(shard.lru.back().first);
+            shard.lru.pop_back();
+        }
+
+        shard.lru.emplace_front(word, std::vector<llama_token>(tokens, tokens + n_tokens));
+        shard.map.emplace(word, shard.lru.begin());
+    }
+
+private:
+    using entry = std::pair<std::string, std::vector<llama_token>>;
+
+    struct shard {
+        std::mutex mutex;
+        std::list<entry> lru;
+        std::unordered_map<std::string, std::list<entry>::iterator> map;
+    };
+
+    shard shards[n_shards];
 };
 
 struct llm_tokenizer_bpe : llm_tokenizer {
@@ -444,9 +639,16 @@ struct llm_tokenizer_bpe : llm_tokenizer {
                 };
                 break;
         }
+
+        regex_splitter = std::make_unique<unicode_regex_splitter>(regex_exprs);
     }
 
     std::vector<std::string> regex_exprs;
+
+    // compiled once, shared by all sessions
+    std::unique_ptr<unicode_regex_splitter> regex_splitter;
+
+    mutable llm_tokenizer_bpe_cache cache;
 };
 
 struct llm_tokenizer_bpe_session {
@@ -489,134 +691,135 @@ struct llm_tokenizer_bpe_session {
         }
     }
 
-    void tokenize(const std::string & text, std::vector<llama_token> & output) {
-        int final_prev_index = -1;
-        const auto word_collection = unicode_regex_split(text, tokenizer.regex_exprs);
+    // the words are tokenized independently of each other
+    std::vector<std::string> split(const std::string & text) const {
+        return tokenizer.regex_splitter->split(text);
+    }
 
-        symbols_final.clear();
+    void tokenize(const std::string & text, std::vector<llama_token> & output) {
+        const auto word_collection = split(text);
 
-        for (const auto & word : word_collection) {
-            work_queue = llm_bigram_bpe::queue();
-            symbols.clear();
+        tokenize(word_collection.data(), word_collection.size(), output);
+    }
 
-            int index = 0;
-            size_t offset = 0;
+    void tokenize(const std::string * words, size_t n_words, std::vector<llama_token> & output) {
+        for (size_t i = 0; i < n_words; ++i) {
+            const auto & word = words[i];
 
-            //if (vocab.tokenizer_ignore_merges && vocab.token_to_id.find(word) != vocab.token_to_id.end()) {
-            if (vocab.get_ignore_merges() && vocab.text_to_token(word) != LLAMA_TOKEN_NULL) {
-                symbols.emplace_back(llm_symbol{-1, -1, word.c_str(), word.size()});
-                offset = word.size();
+            if (tokenizer.cache.get(word, output)) {
+                continue;
             }
 
-            while (offset < word.size()) {
-                llm_symbol sym;
-                size_t char_len = std::min(word.size() - offset, (size_t) unicode_len_utf8(word[offset]));
-                sym.text = word.c_str() + offset;
-                sym.n = char_len;
-                offset += sym.n;
-                sym.prev = index - 1;
-                sym.next = offset == word.size() ? -1 : index + 1;
-                index++;
-                symbols.emplace_back(sym);
-            }
-            for (int i = 1; i < (int) symbols.size(); ++i) {
-                add_new_bigram(i - 1, i);
-            }
+            const size_t n_prev = output.size();
 
-            // build token(s)
-            while (!work_queue.empty()) {
-                auto bigram = work_queue.pop_move();
+            tokenize_word(word, output);
 
-                auto & left_symbol = symbols[bigram.left];
-                auto & right_symbol = symbols[bigram.right];
+            tokenizer.cache.put(word, output.data() + n_prev, output.size() - n_prev);
+        }
+    }
 
-                if (left_symbol.n == 0 || right_symbol.n == 0) {
-                    continue;
-                }
-                std::string left_token = std::string(left_symbol.text, left_symbol.n);
-                std::string right_token = std::string(right_symbol.text, right_symbol.n);
-                if (left_token + right_token != bigram.text) {
-                    continue;  // Skip this bigram if it's outdated
-                }
+private:
+    void tokenize_word(const std::string & word, std::vector<llama_token> & output) {
+        //if (vocab.tokenizer_ignore_merges && vocab.token_to_id.find(word) != vocab.token_to_id.end()) {
+        if (vocab.get_ignore_merges()) {
+            const llama_token token = vocab.text_to_token(word);
+            if (token != LLAMA_TOKEN_NULL) {
+                output.push_back(token);
+                return;
+            }
+        }
 
-                // merge the right sym into the left one
-                left_symbol.n += right_symbol.n;
-                right_symbol.n = 0;
+        work_queue.clear();
+        symbols.clear();
 
-                // remove the right sym from the chain
-                left_symbol.next = right_symbol.next;
-                if (right_symbol.next >= 0) {
-                    symbols[right_symbol.next].prev = bigram.left;
-                }
+        int index = 0;
+        size_t offset = 0;
+
+        while (offset < word.size()) {
+            llm_symbol_bpe sym;
+            size_t char_len = std::min(word.size() - offset, (size_t) unicode_len_utf8(word[offset]));
+            sym.text = word.c_str() + offset;
+            sym.n = char_len;
+            sym.id = vocab.find_bpe_symbol(std::string(sym.text, sym.n));
+            offset += sym.n;
+            sym.prev = index - 1;
+            sym.next = offset == word.size() ? -1 : index + 1;
+            index++;
+            symbols.emplace_back(sym);
+        }
+        for (int i = 1; i < (int) symbols.size(); ++i) {
+            add_new_bigram(i - 1, i);
+        }
 
-                add_new_bigram(left_symbol.prev, bigram.left);  // left side of current symbol
-                add_new_bigram(bigram.left, left_symbol.next);  // right side of current symbol
+        // build token(s)
+        while (!work_queue.empty()) {
+            const auto bigram = work_queue.pop_move();
+
+            auto & left_symbol = symbols[bigram.left];
+            auto & right_symbol = symbols[bigram.right];
+
+            if (left_symbol.n == 0 || right_symbol.n == 0) {
+                continue;
+            }
+            if (left_symbol.id != bigram.id_left || right_symbol.id != bigram.id_right) {
+                continue;  // Skip this bigram if it's outdated
             }
 
-            // add the finished tokens to the final list keeping correct order for next and prev
-            for (auto & sym : symbols) {
-                if (sym.n > 0) {
-                    sym.prev = final_prev_index;
-                    sym.next = -1;
-                    if (final_prev_index != -1) {
-                        symbols_final[final_prev_index].next = symbols_final.size();
-                    }
-                    symbols_final.emplace_back(sym);
-                    final_prev_index = symbols_final.size() - 1;
-                }
+            // merge the right sym into the left one
+            left_symbol.n += right_symbol.n;
+            left_symbol.id = bigram.id;
+            right_symbol.n = 0;
+
+            // remove the right sym from the chain
+            left_symbol.next = right_symbol.next;
+            if (right_symbol.next >= 0) {
+                symbols[right_symbol.next].prev = bigram.left;
             }
+
+            add_new_bigram(left_symbol.prev, bigram.left);  // left side of current symbol
+            add_new_bigram(bigram.left, left_symbol.next);  // right side of current symbol
         }
 
-        symbols = symbols_final;
+        const int32_t n_tokens = vocab.n_tokens();
 
-        if (!symbols.empty()) {
-            for (int i = 0; i != -1; i = symbols[i].next) {
-                auto & symbol = symbols[i];
-                if (symbol.n == 0) {
-                    continue;
-                }
+        for (const auto & symbol : symbols) {
+            if (symbol.n == 0) {
+                continue;
+            }
 
-                const std::string str = std::string(symbol.text, symbol.n);
-                const auto token = vocab.text_to_token(str);
+            if (symbol.id >= 0 && symbol.id < n_tokens) {
+                output.push_back(symbol.id);
+                continue;
+            }
 
-                if (token == LLAMA_TOKEN_NULL) {
-                    for (auto j = str.begin(); j != str.end(); ++j) {
-                        std::string byte_str(1, *j);
-                        auto token_multibyte = vocab.text_to_token(byte_str);
-                        if (token_multibyte != LLAMA_TOKEN_NULL) {
-                            output.push_back(token_multibyte);
-                        }
-                    }
-                } else {
-                    output.push_back(token);
+            // not a token - fallback to the individual bytes
+            for (size_t j = 0; j < symbol.n; ++j) {
+                std::string byte_str(1, symbol.text[j]);
+                auto token_multibyte = vocab.text_to_token(byte_str);
+                if (token_multibyte != LLAMA_TOKEN_NULL) {
+                    output.push_back(token_multibyte);
                 }
             }
         }
     }
 
-private:
     void add_new_bigram(int left, int right) {
         if (left == -1 || right == -1) {
             return;
         }
-        std::string left_token  = std::string(symbols[left].text,  symbols[left].n);
-        std::string right_token = std::string(symbols[right].text, symbols[right].n);
 
-        int rank_found = -1;
+        llm_bigram_bpe bigram;
 
-        rank_found = vocab.find_bpe_rank(left_token, right_token);
+        bigram.rank = vocab.find_bpe_merge(symbols[left].id, symbols[right].id, bigram.id);
 
-        if (rank_found < 0) {
+        if (bigram.rank < 0) {
             return;
         }
 
-        llm_bigram_bpe bigram;
-
-        bigram.left  = left;
-        bigram.right = right;
-        bigram.text  = left_token + right_token;
-        bigram.size  = left_token.size() + right_token.size();
-        bigram.rank  = rank_found;
+        bigram.left     = left;
+        bigram.right    = right;
+        bigram.id_left  = symbols[left].id;
+        bigram.id_right = symbols[right].id;
 
         work_queue.push(bigram);
     }
@@ -624,8 +827,8 @@ private:
     const llama_vocab & vocab;
     const llm_tokenizer_bpe & tokenizer;
 
-    std::vector<llm_symbol> symbols;
-    std::vector<llm_symbol> symbols_final;
+    // reused across words, so that tokenizing a word does not allocate
+    std::vector<llm_symbol_bpe> symbols;
     llm_bigram_bpe::queue work_queue;
 };
 
@@ -1568,7 +1771,22 @@ struct llama_vocab::impl {
     std::vector<token_data>                      id_to_token;
 
     std::vector<llama_token> cache_special_tokens;
+    naive_trie               cache_special_trie; // value: first index in cache_special_tokens with the given text
+    std::vector<int32_t>     cache_special_next; // next index in cache_special_tokens with the same text, or -1
     std::vector<std::string> cache_token_to_piece; // llama_token_to_piece(special = true);
+
+    // cache_token_to_piece decoded to code points
+    struct piece_entry {
+        uint32_t offset;  // into cache_piece_cpts
+        uint32_t n_cpts;
+        uint32_t partial_value;
+        int16_t  partial_n_remain;
+        uint16_t flags;
+    };
+    static_assert(sizeof(piece_entry) == 16, "piece_entry should pack 4 per cache line");
+
+    std::vector<piece_entry> cache_piece_table;
+    std::vector<uint32_t>    cache_piece_cpts;  // 0-terminated code points of all pieces
     struct pair_hash {
         size_t operator()(const std::pair<std::string, std::string> & p) const {
             return std::hash<std::string>{}(p.first) ^  //create some hash for pair
@@ -1577,11 +1795,23 @@ struct llama_vocab::impl {
     };
     std::unordered_map<std::pair<std::string, std::string>, int, pair_hash> bpe_ranks;
 
+    // bpe_ranks over symbol ids, see llama_vocab::find_bpe_symbol
+    struct bpe_merge {
+        int32_t rank;
+        int32_t id; // symbol id of the merged pair
+    };
+    std::unordered_map<uint64_t, bpe_merge>  bpe_merges;        // key: (left << 32) | right
+    std::unordered_map<std::string, int32_t> bpe_symbols_extra; // merge parts that are not tokens
+
     // set of all tokens that cause "end of generation"
     std::set<llama_token> special_eog_ids;
 
     std::unique_ptr<llm_tokenizer> tokenizer;
 
+    // created on first use by tokenize_batch()
+    mutable std::mutex                          tokenizer_pool_mutex;
+    mutable std::unique_ptr<llm_tokenizer_pool> tokenizer_pool;
+
     std::vector<char> precompiled_charsmap;
 
     impl(const llama_vocab & vocab) : vocab(vocab) {
@@ -1621,6 +1851,21 @@ struct llama_vocab::impl {
                          bool   add_special,
                          bool   parse_special = false) const;
 
+    // the parts of tokenize() that are shared with tokenize_batch()
+    void tokenize_begin(std::vector<llama_token> & output, bool add_special) const;
+    void tokenize_end  (std::vector<llama_token> & output, bool add_special) const;
+
+    // is_prev_special: the fragment is at the start of the text or follows a special token
+    void tokenize_fragment(const std::string & fragment, bool is_prev_special, std::vector<llama_token> & output) const;
+
+    std::vector<std::vector<llama_token>> tokenize_batch(
+            const std::vector<std::string> & texts,
+                                      bool   add_special,
+                                      bool   parse_special,
+                                   int32_t   n_threads) const;
+
+    llm_tokenizer_pool & get_tokenizer_pool() const;
+
     int32_t tokenize(
                    const char * text,
                       int32_t   text_len,
@@ -1640,6 +1885,12 @@ struct llama_vocab::impl {
     // use cached data
     const std::string & token_to_piece(llama_token token) const;
 
+    token_piece token_get_piece(llama_token token) const;
+
+    void build_piece_table();
+
+    void build_bpe_merges();
+
     int32_t detokenize(
             const llama_token * tokens,
                       int32_t   n_tokens,
@@ -1723,7 +1974,9 @@ void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
 
             const int n_merges = gguf_get_arr_n(ctx, merges_keyidx);
             for (int i = 0; i < n_merges; i++) {
-                const std::string word = gguf_get_arr_str(ctx, merges_keyidx, i);
+                size_t len;
+                const char * str = gguf_get_arr_str_view(ctx, merges_keyidx, i, &len);
+                const std::string_view word(str, len);
                 //GGML_ASSERT(unicode_cpts_from_utf8(word).size() > 0);
 
                 std::string first;
@@ -1731,7 +1984,7 @@ void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
 
                 const size_t pos = word.find(' ', 1);
 
-                if (pos != std::string::npos) {
+                if (pos != std::string_view::npos) {
                     first  = word.substr(0, pos);
                     second = word.substr(pos + 1);
                 }
@@ -2029,7 +2282,10 @@ void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
     id_to_token.resize(n_tokens);
 
     for (uint32_t i = 0; i < n_tokens; i++) {
-        std::string word = gguf_get_arr_str(ctx, token_idx, i);
+        size_t len;
+        const char * str = gguf_get_arr_str_view(ctx, token_idx, i, &len);
+
+        std::string word(str, len);
         if (word.empty()) {
             LLAMA_LOG_WARN("%s: empty token at index %u\n", __func__, i);
             word = "[EMPTY_" + std::to_string(i) + "]";
@@ -2408,6 +2664,26 @@ void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
             }
         );
 
+        // used by tokenizer_st_partition to find all special tokens in a single pass over the text
+        std::unordered_map<std::string, int32_t> last_idx;
+
+        cache_special_next.assign(cache_special_tokens.size(), -1);
+        for (int32_t i = 0; i < (int32_t) cache_special_tokens.size(); ++i) {
+            const auto & text = id_to_token[cache_special_tokens[i]].text;
+            if (text.empty()) {
+                continue;
+            }
+
+            auto it = last_idx.find(text);
+            if (it != last_idx.end()) {
+                cache_special_next[it->second] = i;
+                it->second = i;
+            } else {
+                last_idx.emplace(text, i);
+                cache_special_trie.insert(text.data(), text.size(), i);
+            }
+        }
+
         LLAMA_LOG_INFO("%s: special tokens cache size = %u\n", __func__, (uint32_t) cache_special_tokens.size());
     }
 
@@ -2489,6 +2765,13 @@ void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
             }
         }
     }
+
+    // build decoded piece table - needs the final EOG set and attributes
+    build_piece_table();
+
+    if (type == LLAMA_VOCAB_TYPE_BPE) {
+        build_bpe_merges();
+    }
 }
 
 enum llama_vocab_type llama_vocab::impl::get_type() const {
@@ -2602,120 +2885,168 @@ void llama_vocab::impl::init_tokenizer(enum llama_vocab_type type) {
 // #define PRETOKENIZERDEBUG
 
 void llama_vocab::impl::tokenizer_st_partition(std::forward_list<fragment_buffer_variant> & buffer, bool parse_special) const {
-    // for each special token
-    for (const llama_token special_id : cache_special_tokens) {
-        const auto & data = vocab.get_token_data(special_id);
-        const auto & text = data.text;
+    // the special tokens are processed in the order of cache_special_tokens, each one splitting the text that is left
+    // over by the previous ones. instead of searching the text once for each special token, all occurrences of all
+    // special tokens are found in a single pass over the text and only the tokens that actually occur are processed
+
+    struct occurrence {
+        int32_t  idx; // index in cache_special_tokens
+        uint64_t pos;
+    };
+
+    struct piece {
+        llama_token token; // LLAMA_TOKEN_NULL for text
+        uint64_t    offset;
+        uint64_t    length;
+    };
+
+    std::vector<occurrence> occurrences;
+    std::vector<piece> cur;
+    std::vector<piece> next;
 
-        if (!parse_special && (data.attr & (LLAMA_TOKEN_ATTR_CONTROL | LLAMA_TOKEN_ATTR_UNKNOWN))) {
-            // Ignore control and unknown tokens when parse_special == false
+    auto it_prev = buffer.before_begin();
+    for (auto it = buffer.begin(); it != buffer.end(); it_prev = it, ++it) {
+        // if a fragment is text ( not yet processed )
+        if (it->type != FRAGMENT_BUFFER_VARIANT_TYPE_RAW_TEXT) {
             continue;
-            // User-defined tokens are still pre-tokenized before everything else
-            // ref: https://github.com/huggingface/tokenizers/blob/fdd26ba9a3f0c133427aab0423888cbde91362d7/tokenizers/src/tokenizer/mod.rs#L726
-            // This is mostly relevant for neox-style tokenizers (mpt, olmo, stablelm, etc.)
         }
 
-        // for each text fragment
-        std::forward_list<fragment_buffer_variant>::iterator it = buffer.begin();
-        while (it != buffer.end()) {
-            auto & fragment = (*it);
+        const auto & raw_text = it->raw_text;
 
-            // if a fragment is text ( not yet processed )
-            if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_RAW_TEXT) {
-                const auto & raw_text = fragment.raw_text;
+        const uint64_t raw_text_end = it->offset + it->length;
 
-                auto raw_text_base_offset = fragment.offset;
-                auto raw_text_base_length = fragment.length;
+        occurrences.clear();
+        for (uint64_t pos = it->offset; pos < raw_text_end; ++pos) {
+            const naive_trie * node = &cache_special_trie;
+            for (uint64_t i = pos; i < raw_text_end; ++i) {
+                node = node->traverse(raw_text[i]);
+                if (node == nullptr) {
+                    break;
+                }
+                if (!node->has_value) {
+                    continue;
+                }
+                for (int32_t idx = node->value; idx >= 0; idx = cache_special_next[idx]) {
+                    const auto & data = id_to_token[cache_special_tokens[idx]];
+
+                    if (!parse_special && (data.attr & (LLAMA_TOKEN_ATTR_CONTROL | LLAMA_TOKEN_ATTR_UNKNOWN))) {
+                        // Ignore control and unknown tokens when parse_special == false
+                        continue;
+                        // User-defined tokens are still pre-tokenized before everything else
+                        // ref: https://github.com/huggingface/tokenizers/blob/fdd26ba9a3f0c133427aab0423888cbde91362d7/tokenizers/src/tokenizer/mod.rs#L726
+                        // This is mostly relevant for neox-style tokenizers (mpt, olmo, stablelm, etc.)
+                    }
+
+                    occurrences.push_back({ idx, pos });
+                }
+            }
+        }
+
+        if (occurrences.empty()) {
+            continue;
+        }
+
+        std::sort(occurrences.begin(), occurrences.end(), [](const occurrence & a, const occurrence & b) {
+            return a.idx != b.idx ? a.idx < b.idx : a.pos < b.pos;
+        });
+
+        cur.assign(1, { LLAMA_TOKEN_NULL, it->offset, it->length });
+
+        // for each special token that occurs in the text
+        for (size_t i0 = 0, i1 = 0; i0 < occurrences.size(); i0 = i1) {
+            while (i1 < occurrences.size() && occurrences[i1].idx == occurrences[i0].idx) {
+                ++i1;
+            }
+
+            const llama_token special_id = cache_special_tokens[occurrences[i0].idx];
+
+            const auto & data = id_to_token[special_id];
+            const uint64_t text_length = data.text.size();
+
+            next.clear();
+
+            // the pieces and the occurrences are both sorted by position
+            size_t k = i0;
+            for (const auto & p : cur) {
+                if (p.token != LLAMA_TOKEN_NULL) {
+                    next.push_back(p);
+                    continue;
+                }
+
+                uint64_t raw_text_base_offset = p.offset;
+
+                const uint64_t raw_text_base_end = p.offset + p.length;
 
                 // loop over the text
                 while (true) {
-                    // find the first occurrence of a given special token in this fragment
-                    //  passing offset argument only limit the "search area" but match coordinates
-                    //  are still relative to the source full raw_text
-                    //  string_view begins at pos 0 for the same reason
-                    auto match = std::string_view(raw_text.data(), raw_text_base_offset + raw_text_base_length).find(text, raw_text_base_offset);
+                    // find the first occurrence of the special token in the rest of this piece
+                    while (k < i1 && occurrences[k].pos < raw_text_base_offset) {
+                        ++k;
+                    }
 
-                    // no occurrences found, stop processing this fragment for a given special token
-                    if (match == std::string::npos) break;
+                    if (k == i1 || occurrences[k].pos + text_length > raw_text_base_end) {
+                        break;
+                    }
 
-#ifdef PRETOKENIZERDEBUG
-                    LLAMA_LOG_WARN("FF: (%ld %ld %ld) '%s'\n", raw_text->length(), raw_text_base_offset, raw_text_base_length, raw_text->substr(raw_text_base_offset, raw_text_base_length).c_str());
-#endif
-                    auto source = std::distance(buffer.begin(), it);
+                    const uint64_t match = occurrences[k].pos;
 
-                    // if match is further than base offset
-                    //  then we have some text to the left of it
+                    // left
                     if (match > raw_text_base_offset) {
-                        // left
-                        const int64_t left_reminder_offset = raw_text_base_offset + 0;
-                        int64_t left_reminder_length = match - raw_text_base_offset;
+                        uint64_t left_reminder_length = match - raw_text_base_offset;
 
                         if (data.attr & LLAMA_TOKEN_ATTR_LSTRIP) {
-                            while (left_reminder_length > 0 && isspace(raw_text[left_reminder_offset + left_reminder_length - 1])) {
+                            while (left_reminder_length > 0 && isspace(raw_text[raw_text_base_offset + left_reminder_length - 1])) {
                                 left_reminder_length--;
                             }
                         }
 
                         if (left_reminder_length > 0) {
-                            buffer.emplace_after(it, raw_text, left_reminder_offset, left_reminder_length);
-                            it++;
+                            next.push_back({ LLAMA_TOKEN_NULL, raw_text_base_offset, left_reminder_length });
                         }
-
-#ifdef PRETOKENIZERDEBUG
-                        LLAMA_LOG_WARN("FL: (%ld %ld) '%s'\n", left_reminder_offset, left_reminder_length, raw_text->substr(left_reminder_offset, left_reminder_length).c_str());
-#endif
                     }
 
                     // special token
-                    buffer.emplace_after(it, special_id);
-                    it++;
-
-                    // right
-                    if (match + text.length() < raw_text_base_offset + raw_text_base_length) {
-                        int64_t right_reminder_offset = match + text.length();
-                        int64_t right_reminder_length = raw_text_base_length - ((match - raw_text_base_offset) + text.length());
-
-                        if (data.attr & LLAMA_TOKEN_ATTR_RSTRIP) {
-                            while (right_reminder_length > 0 && isspace(raw_text[right_reminder_offset])) {
-                                right_reminder_offset++;
-                                right_reminder_length--;
-                            }
-                        }
-
-                        if (right_reminder_length > 0) {
-                            buffer.emplace_after(it, raw_text, right_reminder_offset, right_reminder_length);
-                            it++;
-                        }
+                    next.push_back({ special_id, 0, 0 });
 
-#ifdef PRETOKENIZERDEBUG
-                        LLAMA_LOG_WARN("FR: (%ld %ld) '%s'\n", right_reminder_offset, right_reminder_length, raw_text->substr(right_reminder_offset, right_reminder_length).c_str());
-#endif
+                    // right - repeat for the right side
+                    raw_text_base_offset = match + text_length;
 
-                        if (source == 0) {
-                            buffer.erase_after(buffer.before_begin());
-                        } else {
-                            buffer.erase_after(std::next(buffer.begin(), (source - 1)));
+                    if (data.attr & LLAMA_TOKEN_ATTR_RSTRIP) {
+                        while (raw_text_base_offset < raw_text_base_end && isspace(raw_text[raw_text_base_offset])) {
+                            raw_text_base_offset++;
                         }
+                    }
+                }
 
-                        // repeat for the right side
-                        raw_text_base_offset = right_reminder_offset;
-                        raw_text_base_length = right_reminder_length;
+                if (raw_text_base_offset < raw_text_base_end) {
+                    next.push_back({ LLAMA_TOKEN_NULL, raw_text_base_offset, raw_text_base_end - raw_text_base_offset });
+                }
+            }
+
+            cur.swap(next);
+        }
 
 #ifdef PRETOKENIZERDEBUG
-                        LLAMA_LOG_WARN("RR: (%ld %ld) '%s'\n", raw_text_base_offset, raw_text_base_length, raw_text->substr(raw_text_base_offset, raw_text_base_length).c_str());
+        for (const auto & p : cur) {
+            if (p.token == LLAMA_TOKEN_NULL) {
+                LLAMA_LOG_WARN("FT: (%ld %ld) '%s'\n", p.offset, p.length, raw_text.substr(p.offset, p.length).c_str());
+            } else {
+                LLAMA_LOG_WARN("FS: %d\n", p.token);
+            }
+        }
 #endif
-                    } else {
-                        if (source == 0) {
-                            buffer.erase_after(buffer.before_begin());
-                        } else {
-                            buffer.erase_after(std::next(buffer.begin(), (source - 1)));
-                        }
-                        break;
-                    }
-                }
+
+        // replace the fragment with the pieces
+        auto it_last = it_prev;
+        for (const auto & p : cur) {
+            if (p.token == LLAMA_TOKEN_NULL) {
+                it_last = buffer.emplace_after(it_last, raw_text, p.offset, p.length);
+            } else {
+                it_last = buffer.emplace_after(it_last, p.token);
             }
-            it++;
         }
+        buffer.erase_after(it_last);
+        it = it_last;
     }
 }
 
@@ -2778,46 +3109,72 @@ std::vector<llama_token> llama_vocab::impl::tokenize(
         tokenizer_st_partition(fragment_buffer, parse_special);
     }
 
+    tokenize_begin(output, add_special);
+
+    bool is_prev_special = true;  // prefix with space if first token
+
+    for (const auto & fragment : fragment_buffer) {
+        if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_RAW_TEXT) {
+            std::string text = fragment.raw_text.substr(fragment.offset, fragment.length);
+
+#ifdef PRETOKENIZERDEBUG
+            LLAMA_LOG_WARN("TT: (%ld %ld %ld) '%s'\n", text.length(), fragment.offset, fragment.length, text.c_str());
+#endif
+            tokenize_fragment(text, is_prev_special, output);
+            is_prev_special = false;
+        } else { // if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_TOKEN)
+            output.push_back(fragment.token);
+            is_prev_special = true;
+        }
+    }
+
+    tokenize_end(output, add_special);
+
+    return output;
+}
+
+void llama_vocab::impl::tokenize_begin(std::vector<llama_token> & output, bool add_special) const {
     switch (get_type()) {
         case LLAMA_VOCAB_TYPE_SPM:
+        case LLAMA_VOCAB_TYPE_UGM:
             {
                 // OG tokenizer behavior:
                 //
                 // tokenizer.encode('', add_special_tokens=True)  returns [1]
                 // tokenizer.encode('', add_special_tokens=False) returns []
 
-                bool is_prev_special = true;  // prefix with space if first token
-
                 if (add_special && add_bos) {
                     GGML_ASSERT(special_bos_id != LLAMA_TOKEN_NULL);
                     output.push_back(special_bos_id);
-                    is_prev_special = true;
                 }
-
-                for (const auto & fragment : fragment_buffer) {
-                    if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_RAW_TEXT) {
-                        std::string text;
-
-                        // prefix with space if previous is special
-                        if (add_space_prefix && is_prev_special) {
-                            text = ' ';
-                        }
-
-                        text += fragment.raw_text.substr(fragment.offset, fragment.length);
-
-#ifdef PRETOKENIZERDEBUG
-                        LLAMA_LOG_WARN("TT: (%ld %ld %ld) '%s'\n", text.length(), fragment.offset, fragment.length, text.c_str());
-#endif
-                        llama_escape_whitespace(text);
-                        llm_tokenizer_spm_session session(vocab);
-                        session.tokenize(text, output);
-                        is_prev_special = false;
-                    } else { // if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_TOKEN)
-                        output.push_back(fragment.token);
-                        is_prev_special = true;
-                    }
+            } break;
+        case LLAMA_VOCAB_TYPE_BPE:
+            {
+                llm_tokenizer_bpe_session session(vocab, *static_cast<const llm_tokenizer_bpe *>(tokenizer.get()));
+                if (add_special) {
+                    session.append_bos(output);
+                }
+            } break;
+        case LLAMA_VOCAB_TYPE_WPM:
+            {
+                if (add_special) {
+                    GGML_ASSERT(special_bos_id != LLAMA_TOKEN_NULL);
+                    output.push_back(special_bos_id);
                 }
+            } break;
+        case LLAMA_VOCAB_TYPE_RWKV:
+        case LLAMA_VOCAB_TYPE_PLAMO2:
+            break;
+        case LLAMA_VOCAB_TYPE_NONE:
+            GGML_ABORT("fatal error");
+    }
+}
 
+void llama_vocab::impl::tokenize_end(std::vector<llama_token> & output, bool add_special) const {
+    switch (get_type()) {
+        case LLAMA_VOCAB_TYPE_SPM:
+        case LLAMA_VOCAB_TYPE_UGM:
+            {
                 if (add_special && add_bos && output.size() >= 2 && output[1] == special_bos_id) {
                     LLAMA_LOG_WARN(
                         "%s: Added a BOS token to the prompt as specified by the model but the prompt "
@@ -2833,24 +3190,6 @@ std::vector<llama_token> llama_vocab::impl::tokenize(
         case LLAMA_VOCAB_TYPE_BPE:
             {
                 llm_tokenizer_bpe_session session(vocab, *static_cast<const llm_tokenizer_bpe *>(tokenizer.get()));
-                // it calls some other methods that are not exist in llm_tokenizer,
-                // here just cast it to bpe tokenizer object
-                if (add_special) {
-                    session.append_bos(output);
-                }
-                for (const auto & fragment : fragment_buffer) {
-                    if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_RAW_TEXT) {
-                        std::string text = fragment.raw_text.substr(fragment.offset, fragment.length);
-
-#ifdef PRETOKENIZERDEBUG
-                        LLAMA_LOG_WARN("TT: (%ld %ld %ld) '%s'\n", text.length(), fragment.offset, fragment.length, text.c_str());
-#endif
-                        session.tokenize(text, output);
-                    } else { // if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_TOKEN)
-                        session.append(fragment.token, output);
-                    }
-                }
-
                 if (add_special) {
                     session.append_eos(output);
                     session.check_double_bos_eos(output);
@@ -2858,102 +3197,204 @@ std::vector<llama_token> llama_vocab::impl::tokenize(
             } break;
         case LLAMA_VOCAB_TYPE_WPM:
             {
-                if (add_special) {
-                    GGML_ASSERT(special_bos_id != LLAMA_TOKEN_NULL);
-                    output.push_back(special_bos_id);
-                }
-
-                llm_tokenizer_wpm_session session(vocab);
-
-                for (const auto & fragment : fragment_buffer) {
-                    if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_RAW_TEXT) {
-                        std::string text = fragment.raw_text.substr(fragment.offset, fragment.length);
-
-#ifdef PRETOKENIZERDEBUG
-                        LLAMA_LOG_WARN("TT: (%ld %ld %ld) '%s'\n", text.length(), fragment.offset, fragment.length, text.c_str());
-#endif
-                        session.tokenize(text, output);
-                    } else { // if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_TOKEN)
-                        output.push_back(fragment.token);
-                    }
-                }
-
                 if (add_special) {
                     GGML_ASSERT(special_sep_id != LLAMA_TOKEN_NULL);
                     output.push_back(special_sep_id);
                 }
             } break;
-        case LLAMA_VOCAB_TYPE_UGM:
+        case LLAMA_VOCAB_TYPE_RWKV:
+        case LLAMA_VOCAB_TYPE_PLAMO2:
+            break;
+        case LLAMA_VOCAB_TYPE_NONE:
+            GGML_ABORT("fatal error");
+    }
+}
+
+void llama_vocab::impl::tokenize_fragment(const std::string & fragment, bool is_prev_special, std::vector<llama_token> & output) const {
+    switch (get_type()) {
+        case LLAMA_VOCAB_TYPE_SPM:
             {
-                if (add_special && add_bos) {
-                    GGML_ASSERT(special_bos_id != LLAMA_TOKEN_NULL);
-                    output.push_back(special_bos_id);
-                }
-                llm_tokenizer_ugm_session session(vocab, *static_cast<const llm_tokenizer_ugm *>(tokenizer.get()));
+                std::string text;
 
-                for (const auto & fragment : fragment_buffer) {
-                    if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_RAW_TEXT) {
-                        std::string text = fragment.raw_text.substr(fragment.offset, fragment.length);
-#ifdef PRETOKENIZERDEBUG
-                        LLAMA_LOG_WARN("TT: (%ld %ld %ld) '%s'\n", text.length(), fragment.offset, fragment.length, text.c_str());
-#endif
-                        session.tokenize(text, output);
-                    } else { // if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_TOKEN)
-                        output.push_back(fragment.token);
-                    }
+                // prefix with space if previous is special
+                if (add_space_prefix && is_prev_special) {
+                    text = ' ';
                 }
 
-                if (add_special && add_bos && output.size() >= 2 && output[1] == special_bos_id) {
-                    LLAMA_LOG_WARN(
-                        "%s: Added a BOS token to the prompt as specified by the model but the prompt "
-                        "also starts with a BOS token. So now the final prompt starts with 2 BOS tokens. "
-                        "Are you sure this is what you want?\n", __FUNCTION__);
-                }
+                text += fragment;
 
-                if (add_special && add_eos) {
-                    GGML_ASSERT(special_eos_id != LLAMA_TOKEN_NULL);
-                    output.push_back(special_eos_id);
-                }
+                llama_escape_whitespace(text);
+                llm_tokenizer_spm_session session(vocab);
+                session.tokenize(text, output);
+            } break;
+        case LLAMA_VOCAB_TYPE_BPE:
+            {
+                // it calls some other methods that are not exist in llm_tokenizer,
+                // here just cast it to bpe tokenizer object
+                llm_tokenizer_bpe_session session(vocab, *static_cast<const llm_tokenizer_bpe *>(tokenizer.get()));
+                session.tokenize(fragment, output);
+            } break;
+        case LLAMA_VOCAB_TYPE_WPM:
+            {
+                llm_tokenizer_wpm_session session(vocab);
+                session.tokenize(fragment, output);
+            } break;
+        case LLAMA_VOCAB_TYPE_UGM:
+            {
+                llm_tokenizer_ugm_session session(vocab, *static_cast<const llm_tokenizer_ugm *>(tokenizer.get()));
+                session.tokenize(fragment, output);
             } break;
         case LLAMA_VOCAB_TYPE_RWKV:
             {
                 llm_tokenizer_rwkv_session session(vocab, *static_cast<const llm_tokenizer_rwkv *>(tokenizer.get()));
-                for (const auto & fragment : fragment_buffer) {
-                    if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_RAW_TEXT) {
-                        std::string text = fragment.raw_text.substr(fragment.offset, fragment.length);
-
-#ifdef PRETOKENIZERDEBUG
-                        LLAMA_LOG_WARN("TT: (%ld %ld %ld) '%s'\n", text.length(), fragment.offset, fragment.length, text.c_str());
-#endif
-
-                        session.tokenize(text, output);
-                    } else { // if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_TOKEN)
-                        output.push_back(fragment.token);
-                    }
-                }
+                session.tokenize(fragment, output);
             } break;
         case LLAMA_VOCAB_TYPE_PLAMO2:
             {
                 llm_tokenizer_plamo2_session session(*static_cast<const llm_tokenizer_plamo2 *>(tokenizer.get()));
-                for (const auto & fragment : fragment_buffer) {
-                    if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_RAW_TEXT) {
-                        std::string text = fragment.raw_text.substr(fragment.offset, fragment.length);
-
-#ifdef PRETOKENIZERDEBUG
-                        LLAMA_LOG_WARN("TT: (%ld %ld %ld) '%s'\n", text.length(), fragment.offset, fragment.length, text.c_str());
-#endif
-
-                        session.tokenize(text, output);
-                    } else { // if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_TOKEN)
-                        output.push_back(fragment.token);
-                    }
-                }
+                session.tokenize(fragment, output);
             } break;
         case LLAMA_VOCAB_TYPE_NONE:
             GGML_ABORT("fatal error");
     }
+}
 
-    return output;
+std::vector<std::vector<llama_token>> llama_vocab::impl::tokenize_batch(
+        const std::vector<std::string> & texts,
+        bool add_special,
+        bool parse_special,
+        int32_t n_threads) const {
+    GGML_ASSERT(tokenizer && "Tokenizer not initialized. Call llama_vocab::init_tokenizer() first.");
+
+    // BPE fragments with more words than this are split into chunks of words that are tokenized in parallel
+    constexpr size_t n_words_chunk = 1024;
+
+    llm_tokenizer_pool & pool = get_tokenizer_pool();
+
+    if (n_threads <= 0) {
+        n_threads = pool.n_threads_max();
+    }
+
+    const int32_t n_texts = texts.size();
+
+    // split the texts at the special tokens
+    std::vector<std::forward_list<fragment_buffer_variant>> fragment_buffers(n_texts);
+
+    pool.parallel_for(n_texts, n_threads, [&](int32_t i) {
+        if (!texts[i].empty()) {
+            fragment_buffers[i].emplace_front(texts[i], 0, texts[i].length());
+            tokenizer_st_partition(fragment_buffers[i], parse_special);
+        }
+    });
+
+    // the text fragments of all texts
+    struct fragment_work {
+        const fragment_buffer_variant * fragment;
+
+        bool is_prev_special;
+
+        std::vector<std::string> words;  // BPE only
+        std::vector<llama_token> tokens;
+    };
+
+    std::vector<fragment_work> fragments;
+
+    for (const auto & fragment_buffer : fragment_buffers) {
+        bool is_prev_special = true;
+        for (const auto & fragment : fragment_buffer) {
+            if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_RAW_TEXT) {
+                fragments.push_back({ &fragment, is_prev_special, {}, {} });
+            }
+            is_prev_special = fragment.type != FRAGMENT_BUFFER_VARIANT_TYPE_RAW_TEXT;
+        }
+    }
+
+    // tokenize the fragments - for BPE, only split the large ones into pre-tokenizer words
+    pool.parallel_for(fragments.size(), n_threads, [&](int32_t i) {
+        auto & work = fragments[i];
+
+        const std::string text = work.fragment->raw_text.substr(work.fragment->offset, work.fragment->length);
+
+        if (get_type() == LLAMA_VOCAB_TYPE_BPE) {
+            llm_tokenizer_bpe_session session(vocab, *static_cast<const llm_tokenizer_bpe *>(tokenizer.get()));
+
+            work.words = session.split(text);
+            if (work.words.size() <= n_words_chunk) {
+                session.tokenize(work.words.data(), work.words.size(), work.tokens);
+                work.words.clear();
+            }
+        } else {
+            tokenize_fragment(text, work.is_prev_special, work.tokens);
+        }
+    });
+
+    // tokenize the chunks of words - the words are independent, so the result is the same as for the whole fragment
+    struct chunk_work {
+        const fragment_work * fragment;
+
+        size_t i0;
+        size_t i1;
+
+        std::vector<llama_token> tokens;
+    };
+
+    std::vector<chunk_work> chunks;
+    std::vector<size_t>     chunks_begin(fragments.size() + 1);
+
+    for (size_t i = 0; i < fragments.size(); ++i) {
+        chunks_begin[i] = chunks.size();
+        for (size_t i0 = 0; i0 < fragments[i].words.size(); i0 += n_words_chunk) {
+            chunks.push_back({ &fragments[i], i0, std::min(i0 + n_words_chunk, fragments[i].words.size()), {} });
+        }
+    }
+    chunks_begin[fragments.size()] = chunks.size();
+
+    pool.parallel_for(chunks.size(), n_threads, [&](int32_t i) {
+        auto & work = chunks[i];
+
+        llm_tokenizer_bpe_session session(vocab, *static_cast<const llm_tokenizer_bpe *>(tokenizer.get()));
+        session.tokenize(work.fragment->words.data() + work.i0, work.i1 - work.i0, work.tokens);
+    });
+
+    // put the pieces together
+    std::vector<std::vector<llama_token>> res(n_texts);
+
+    size_t i_fragment = 0;
+    for (int32_t i = 0; i < n_texts; ++i) {
+        auto & output = res[i];
+
+        tokenize_begin(output, add_special);
+
+        for (const auto & fragment : fragment_buffers[i]) {
+            if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_RAW_TEXT) {
+                const auto & work = fragments[i_fragment];
+
+                output.insert(output.end(), work.tokens.begin(), work.tokens.end());
+                for (size_t j = chunks_begin[i_fragment]; j < chunks_begin[i_fragment + 1]; ++j) {
+                    output.insert(output.end(), chunks[j].tokens.begin(), chunks[j].tokens.end());
+                }
+
+                i_fragment++;
+            } else { // if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_TOKEN)
+                output.push_back(fragment.token);
+            }
+        }
+
+        tokenize_end(output, add_special);
+    }
+
+    return res;
+}
+
+llm_tokenizer_pool & llama_vocab::impl::get_tokenizer_pool() const {
+    std::lock_guard<std::mutex> lock(tokenizer_pool_mutex);
+
+    if (!tokenizer_pool) {
+        const int32_t n_workers = std::max<int32_t>(1, std::thread::hardware_concurrency()) - 1;
+        tokenizer_pool = std::make_unique<llm_tokenizer_pool>(n_workers);
+    }
+
+    return *tokenizer_pool;
 }
 
 int32_t llama_vocab::impl::token_to_piece(llama_token token, char * buf, int32_t length, int32_t lstrip, bool special) const {
@@ -3067,6 +3508,138 @@ const std::string & llama_vocab::impl::token_to_piece(llama_token token) const {
     return cache_token_to_piece.at(token);
 }
 
+llama_vocab::token_piece llama_vocab::impl::token_get_piece(llama_token token) const {
+    const auto & e = cache_piece_table.at(token);
+
+    return {
+        /* .cpts             = */ cache_piece_cpts.data() + e.offset,
+        /* .n_cpts           = */ e.n_cpts,
+        /* .partial_value    = */ e.partial_value,
+        /* .partial_n_remain = */ e.partial_n_remain,
+        /* .flags            = */ e.flags,
+    };
+}
+
+// the merge parts that are not tokens get symbol ids after the tokens, so that merges through them still work
+// the same way as with the merges over the strings
+void llama_vocab::impl::build_bpe_merges() {
+    const int32_t n_tokens = (int32_t) id_to_token.size();
+
+    bpe_merges.clear();
+    bpe_symbols_extra.clear();
+
+    bpe_merges.reserve(bpe_ranks.size());
+
+    auto get_symbol = [&](const std::string & text) -> int32_t {
+        const auto it = token_to_id.find(text);
+        if (it != token_to_id.end()) {
+            return it->second;
+        }
+
+        return bpe_symbols_extra.emplace(text, n_tokens + (int32_t) bpe_symbols_extra.size()).first->second;
+    };
+
+    for (const auto & it : bpe_ranks) {
+        const int32_t left   = get_symbol(it.first.first);
+        const int32_t right  = get_symbol(it.first.second);
+        const int32_t merged = get_symbol(it.first.first + it.first.second);
+
+        bpe_merges.emplace(((uint64_t) left << 32) | (uint32_t) right, bpe_merge{ it.second, merged });
+    }
+
+    if (!bpe_symbols_extra.empty()) {
+        LLAMA_LOG_DEBUG("%s: %zu merge parts are not tokens\n", __func__, bpe_symbols_extra.size());
+    }
+}
+
+// decodes the cached pieces the same way the grammar decodes a piece that starts on a code point boundary:
+//  - decoding stops at the first 0 byte
+//  - an invalid sequence yields no code points and n_remain = -1
+//  - a trailing incomplete sequence is reported through partial_value/partial_n_remain
+void llama_vocab::impl::build_piece_table() {
+    static const int lookup[] = { 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 2, 2, 3, 4 };
+
+    const uint32_t n_tokens = (uint32_t) id_to_token.size();
+
+    size_t n_bytes = 0;
+    for (const auto & piece : cache_token_to_piece) {
+        n_bytes += piece.size();
+    }
+
+    std::vector<piece_entry> table(n_tokens);
+    std::vector<uint32_t>    cpts;
+
+    // upper bound: one code point per byte + the terminating 0
+    cpts.reserve(n_bytes + n_tokens);
+
+    for (uint32_t id = 0; id < n_tokens; ++id) {
+        const std::string & piece = cache_token_to_piece[id];
+
+        auto & e = table[id];
+
+        e.offset = (uint32_t) cpts.size();
+        e.flags  = 0;
+
+        if (id_to_token[id].attr & (LLAMA_TOKEN_ATTR_CONTROL | LLAMA_TOKEN_ATTR_USER_DEFINED | LLAMA_TOKEN_ATTR_UNKNOWN)) {
+            e.flags |= PIECE_FLAG_SPECIAL;
+        }
+        if (is_eog(id)) {
+            e.flags |= PIECE_FLAG_EOG;
+        }
+        if (piece.empty() || piece[0] == 0) {
+            e.flags |= PIECE_FLAG_EMPTY;
+        }
+        if (!piece.empty() && piece[0] == ' ') {
+            e.flags |= PIECE_FLAG_SPACE_PREFIX;
+        }
+
+        uint32_t value    = 0;
+        int      n_remain = 0;
+
+        for (size_t pos = 0; pos < piece.size() && piece[pos] != 0; ) {
+            const uint8_t first_byte = static_cast<uint8_t>(piece[pos]);
+            n_remain = lookup[first_byte >> 4] - 1;
+
+            if (n_remain < 0) {
+                cpts.resize(e.offset);
+                value = 0;
+                e.flags |= PIECE_FLAG_INVALID_UTF8;
+                break;
+            }
+
+            value = first_byte & ((1 << (7 - n_remain)) - 1);
+
+            ++pos;
+            while (pos < piece.size() && piece[pos] != 0 && n_remain > 0) {
+                value = (value << 6) + (static_cast<uint8_t>(piece[pos]) & 0x3F);
+                ++pos;
+                --n_remain;
+            }
+            if (n_remain == 0) {
+                cpts.push_back(value);
+            }
+        }
+
+        if (n_remain > 0) {
+            e.flags |= PIECE_FLAG_PARTIAL_UTF8;
+        }
+
+        e.n_cpts           = (uint32_t) cpts.size() - e.offset;
+        e.partial_value    = value;
+        e.partial_n_remain = (int16_t) n_remain;
+
+        cpts.push_back(0);
+    }
+
+    cpts.shrink_to_fit();
+
+    std::swap(cache_piece_table, table);
+    std::swap(cache_piece_cpts,  cpts);
+
+    LLAMA_LOG_INFO("%s: token piece table size = %.4f MB\n", __func__,
+            (cache_piece_table.size()*sizeof(piece_entry) + cache_piece_cpts.size()*sizeof(uint32_t)) / 1024.0 / 1024.0);
+}
+
 int32_t llama_vocab::impl::detokenize(
                const llama_token * tokens,
                          int32_t   n_tokens,
@@ -3464,6 +4037,35 @@ int llama_vocab::find_bpe_rank(const std::string & token_left, const std::string
     return it->second;
 }
 
+int32_t llama_vocab::find_bpe_symbol(const std::string & text) const {
+    const auto it = pimpl->token_to_id.find(text);
+    if (it != pimpl->token_to_id.end()) {
+        return it->second;
+    }
+
+    const auto it_extra = pimpl->bpe_symbols_extra.find(text);
+    if (it_extra != pimpl->bpe_symbols_extra.end()) {
+        return it_extra->second;
+    }
+
+    return -1;
+}
+
+int32_t llama_vocab::find_bpe_merge(int32_t symbol_left, int32_t symbol_right, int32_t & symbol_merged) const {
+    if (symbol_left < 0 || symbol_right < 0) {
+        return -1;
+    }
+
+    const auto it = pimpl->bpe_merges.find(((uint64_t) symbol_left << 32) | (uint32_t) symbol_right);
+    if (it == pimpl->bpe_merges.end()) {
+        return -1;
+    }
+
+    symbol_merged = it->second.id;
+
+    return it->second.rank;
+}
+
 std::vector<std::string> llama_vocab::get_bpe_merges() const {
     std::vector<std::string> result(pimpl->bpe_ranks.size());
 
@@ -3510,10 +4112,22 @@ std::vector<llama_token> llama_vocab::tokenize(
     return pimpl->tokenize(raw_text, add_special, parse_special);
 }
 
+std::vector<std::vector<llama_token>> llama_vocab::tokenize_batch(
+        const std::vector<std::string> & texts,
+        bool add_special,
+        bool parse_special,
+        int32_t n_threads) const {
+    return pimpl->tokenize_batch(texts, add_special, parse_special, n_threads);
+}
+
 const std::string & llama_vocab::token_to_piece(llama_token token) const {
     return pimpl->token_to_piece(token);
 }
 
+llama_vocab::token_piece llama_vocab::token_get_piece(llama_token token) const {
+    return pimpl->token_get_piece(token);
+}
+
 int32_t llama_vocab::token_to_piece(llama_token token, char * buf, int32_t length, int32_t lstrip, bool special) const {
     return pimpl->token_to_piece(token, buf, length, lstrip, special);
 }
@@ -3770,6 +4384,47 @@ int32_t llama_tokenize(
     return vocab->tokenize(text, text_len, tokens, n_tokens_max, add_special, parse_special);
 }
 
+int32_t llama_tokenize_batch(
+    const struct llama_vocab * vocab,
+           const char * const * texts,
+              const int32_t * text_lens,
+                     int32_t   n_texts,
+                llama_token ** tokens,
+              const int32_t * n_tokens_max,
+                    int32_t * n_tokens,
+                        bool   add_special,
+                        bool   parse_special,
+                     int32_t   n_threads) {
+    std::vector<std::string> texts_str(n_texts);
+    for (int32_t i = 0; i < n_texts; ++i) {
+        texts_str[i].assign(texts[i], text_lens[i]);
+    }
+
+    const auto res = vocab->tokenize_batch(texts_str, add_special, parse_special, n_threads);
+
+    int32_t n_failed = 0;
+
+    for (int32_t i = 0; i < n_texts; ++i) {
+        if (res[i].size() >= static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+            LLAMA_LOG_ERROR("%s: tokenization result size %zu exceeds int32_t limit\n", __func__, res[i].size());
+            n_tokens[i] = std::numeric_limits<int32_t>::min();
+            n_failed++;
+            continue;
+        }
+
+        if (n_tokens_max[i] < (int32_t) res[i].size()) {
+            n_tokens[i] = -((int32_t) res[i].size());
+            n_failed++;
+            continue;
+        }
+
+        std::copy(res[i].begin(), res[i].end(), tokens[i]);
+        n_tokens[i] = res[i].size();
+    }
+
+    return n_failed;
+}
+
 int32_t llama_token_to_piece(
     const struct llama_vocab * vocab,
                  llama_token   token,
@@ -59,6 +59,25 @@ struct llama_vocab {
         llama_token_attr attr;
     };
 
+    enum piece_flags : uint16_t {
+        PIECE_FLAG_SPECIAL        = 1 << 0, // control, user-defined or unknown token
+        PIECE_FLAG_EOG            = 1 << 1,
+        PIECE_FLAG_EMPTY          = 1 << 2, // empty piece or piece starting with a 0 byte
+        PIECE_FLAG_SPACE_PREFIX   = 1 << 3, // piece starts with ' '
+        PIECE_FLAG_PARTIAL_UTF8   = 1 << 4, // piece ends with an incomplete UTF-8 sequence
+        PIECE_FLAG_INVALID_UTF8   = 1 << 5,
+    };
+
+    // piece of a token (special = true) decoded to code points, precomputed at load time
+    // the code points are 0-terminated and point into a single arena shared by all tokens
+    struct token_piece {
+        const uint32_t * cpts;
+        uint32_t         n_cpts;        // excluding the terminating 0
+        uint32_t         partial_value; // state of the trailing incomplete UTF-8 sequence
+        int32_t          partial_n_remain;
+        uint16_t         flags;
+    };
+
     llama_vocab();
     ~llama_vocab();
 
@@ -130,6 +149,12 @@ struct llama_vocab {
     int find_bpe_rank(const std::string & token_left, const std::string & token_right) const;
     std::vector<std::string> get_bpe_merges() const;
 
+    // BPE merges over integer symbol ids - the token ids, followed by ids >= n_tokens() for merge parts that are not tokens
+    // returns -1 if the text is neither a token nor part of a merge
+    int32_t find_bpe_symbol(const std::string & text) const;
+    // returns the rank of the merge of two symbols and sets the symbol id of the result, or -1 if they do not merge
+    int32_t find_bpe_merge(int32_t symbol_left, int32_t symbol_right, int32_t & symbol_merged) const;
+
     std::vector<char> get_precompiled_charsmap() const;
 
     int32_t tokenize(
@@ -145,6 +170,13 @@ struct llama_vocab {
                          bool   add_special,
                          bool   parse_special = false) const;
 
+    // tokenizes the texts on a worker pool, the result is identical to tokenize() of each text
+    std::vector<std::vector<llama_token>> tokenize_batch(
+            const std::vector<std::string> & texts,
+                                      bool   add_special,
+                                      bool   parse_special,
+                                   int32_t   n_threads) const;
+
     // does not write null-terminator to buf
     int32_t token_to_piece(
                   llama_token   token,
@@ -156,6 +188,9 @@ struct llama_vocab {
     // use cached data
     const std::string & token_to_piece(llama_token token) const;
 
+    // use cached data, no allocations
+    token_piece token_get_piece(llama_token token) const;
+
     int32_t detokenize(
             const llama_token * tokens,
                       int32_t   n_tokens,
@@ -7,11 +7,13 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cctype>
 #include <codecvt>
 #include <cstddef>
 #include <cstdint>
 #include <locale>
 #include <map>
+#include <memory>
 #include <regex>
 #include <stdexcept>
 #include <string>
@@ -498,8 +500,7 @@ static std::vector<size_t> unicode_regex_split_custom_llama3(const std::string &
 }
 
 // use std::wregex to split the text
-static std::vector<size_t> unicode_regex_split_stl(const std::wstring & wtext, const std::wstring & regex_expr, const std::vector<size_t> & offsets) {
-    std::wregex expr(regex_expr);
+static std::vector<size_t> unicode_regex_split_stl(const std::wstring & wtext, const std::wregex & expr, const std::vector<size_t> & offsets) {
     std::vector<size_t> bpe_offsets; // store the offset of each word
     bpe_offsets.reserve(offsets.size()); // Reserve memory for the approximate size
     size_t start = 0;
@@ -528,8 +529,7 @@ static std::vector<size_t> unicode_regex_split_stl(const std::wstring & wtext, c
 }
 
 // use std::regex to split the text
-static std::vector<size_t> unicode_regex_split_stl(const std::string & text, const std::string & regex_expr, const std::vector<size_t> & offsets) {
-    std::regex expr(regex_expr);
+static std::vector<size_t> unicode_regex_split_stl(const std::string & text, const std::regex & expr, const std::vector<size_t> & offsets) {
     std::vector<size_t> bpe_offsets; // store the offset of each word
     bpe_offsets.reserve(offsets.size()); // Reserve memory for the approximate size
     size_t start = 0;
@@ -729,19 +729,831 @@ static std::vector<size_t> unicode_regex_split_custom_kimi_k2(const std::string
     return bpe_offsets;
 }
 
+using unicode_regex_split_custom_t = std::vector<size_t> (*)(const std::string & text, const std::vector<size_t> & offsets);
+
+// the regex expressions with an efficient custom implementation
+static const std::map<std::string, unicode_regex_split_custom_t> k_regex_custom = {
+    { "'s|'t|'re|'ve|'m|'ll|'d| ?\\p{L}+| ?\\p{N}+| ?[^\\s\\p{L}\\p{N}]+|\\s+(?!\\S)", unicode_regex_split_custom_gpt2 },
+    { "(?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}{1,3}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+", unicode_regex_split_custom_llama3 },
+    { "(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}{1,3}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+", unicode_regex_split_custom_llama3 },
+    // K2's first pattern - handle all K2 patterns together
+    { "\\p{Han}+", unicode_regex_split_custom_kimi_k2 },
+};
+
 static std::vector<size_t> unicode_regex_split_custom(const std::string & text, const std::string & regex_expr, const std::vector<size_t> & offsets) {
-    std::vector<size_t> bpe_offsets;
+    const auto it = k_regex_custom.find(regex_expr);
+    if (it == k_regex_custom.end()) {
+        return {};
+    }
+
+    return it->second(text, offsets);
+}
+
+//
+// compiled regex engine for the pre-tokenizer patterns
+//
+// supports the subset of the ECMAScript syntax that is used by the pre-tokenizers and follows the std::regex
+// (ECMAScript) matching semantics - the alternatives are tried in order and the quantifiers are greedy unless lazy
+// the patterns are matched against the same code points that std::regex sees (see unicode_regex_splitter::split)
+// so the splits are identical to the std::regex fallback, which is still used for the unsupported patterns
+//
+
+struct unicode_regex_class {
+    uint64_t bits[4] = {};                             // code points < 256, the negation is already applied
+    std::vector<std::pair<uint32_t, uint32_t>> ranges; // code points >= 256, inclusive
+    bool high_any = false;                             // all code points >= 256 (\S, \D)
+    bool negate   = false;
+
+    void add(uint32_t lo, uint32_t hi) {
+        for (uint32_t c = lo; c <= hi && c < 256; ++c) {
+            bits[c >> 6] |= 1ull << (c & 63);
+        }
+        if (hi >= 256) {
+            ranges.emplace_back(std::max<uint32_t>(lo, 256), hi);
+        }
+    }
+
+    void finalize() {
+        if (negate) {
+            for (auto & b : bits) {
+                b = ~b;
+            }
+        }
+    }
+
+    bool test(uint32_t c) const {
+        if (c < 256) {
+            return (bits[c >> 6] >> (c & 63)) & 1;
+        }
+        bool res = high_any;
+        for (size_t i = 0; !res && i < ranges.size(); ++i) {
+            res = ranges[i].first <= c && c <= ranges[i].second;
+        }
+        return res != negate;
+    }
+};
+
+struct unicode_regex_inst {
+    enum type : uint8_t {
+        CLASS,    // x: class index
+        SPLIT,    // x: preferred branch, y: other branch
+        JMP,      // x: target
+        SAVE,     // x: slot - remember the position at the start of a loop iteration
+        PROGRESS, // x: slot - fail if the loop iteration did not consume anything
+        LOOK,     // y: continuation, the sub-program starts at the next instruction
+        LOOK_NOT, // y: continuation, the sub-program starts at the next instruction
+        BOL,
+        EOL,
+        MATCH,
+    };
+
+    type    op;
+    int32_t x;
+    int32_t y;
+};
+
+struct unicode_regex_compiled {
+    std::vector<unicode_regex_inst>  prog;
+    std::vector<unicode_regex_class> classes;
+
+    int32_t n_slots = 0;
+
+    // classes that can match the first code point of a match, empty if unknown
+    std::vector<int32_t> first;
+
+    // returns nullptr if the pattern uses syntax that is not supported
+    static std::unique_ptr<unicode_regex_compiled> compile(const std::vector<uint32_t> & pattern);
+
+    // same as unicode_regex_split_stl, over the effective code points of the text
+    std::vector<size_t> split(const std::vector<uint32_t> & text, const std::vector<size_t> & offsets) const;
+
+private:
+    struct backtrack {
+        int32_t pc;   // -1: restore slot
+        int32_t slot;
+        size_t  pos;
+    };
+
+    struct state {
+        const uint32_t * text;
+        size_t begin;
+        size_t end;
+        size_t start;   // start of the match, used with not_null
+        bool   not_null;
+        bool   bol;
+
+        std::vector<backtrack> stack;
+        std::vector<size_t>    slots;
+    };
+
+    static constexpr size_t npos = (size_t) -1;
+
+    size_t run(int32_t pc, size_t pos, state & st) const;
+    bool   search(size_t from, bool continuous, state & st, size_t & m_begin, size_t & m_end) const;
+};
+
+// thrown by the parser for the syntax that is not supported
+struct unicode_regex_unsupported {};
+
+struct unicode_regex_parser {
+    struct node {
+        enum type_t { EMPTY, CLASS, CONCAT, ALT, REPEAT, LOOK, LOOK_NOT, BOL, EOL } type;
+        int32_t cls = -1;
+        std::vector<int32_t> children;
+        int32_t min = 0;
+        int32_t max = 0; // -1: unbounded
+        bool greedy = true;
+    };
+
+    const std::vector<uint32_t> & pat;
+    size_t i = 0;
+
+    std::vector<node> nodes;
+    std::vector<unicode_regex_class> & classes;
+
+    unicode_regex_parser(const std::vector<uint32_t> & pat, std::vector<unicode_regex_class> & classes) : pat(pat), classes(classes) {}
+
+    bool eof() const { return i >= pat.size(); }
+    uint32_t peek() const { return pat[i]; }
+
+    int32_t add(node n) {
+        nodes.push_back(std::move(n));
+        return (int32_t) nodes.size() - 1;
+    }
+
+    int32_t add_class(unicode_regex_class c) {
+        c.finalize();
+        classes.push_back(std::move(c));
+        node n;
+        n.type = node::CLASS;
+        n.cls  = (int32_t) classes.size() - 1;
+        return add(std::move(n));
+    }
+
+    static void add_space(unicode_regex_class & c, bool negate) {
+        // \s of std::regex in the "C" locale - the non-ASCII whitespace is replaced by 0x0B in the text
+        if (!negate) {
+            c.add(0x09, 0x0D);
+            c.add(0x20, 0x20);
+        } else {
+            c.add(0x00, 0x08);
+            c.add(0x0E, 0x1F);
+            c.add(0x21, 0xFF);
+            c.high_any = true;
+        }
+    }
+
+    static void add_digit(unicode_regex_class & c, bool negate) {
+        if (!negate) {
+            c.add('0', '9');
+        } else {
+            c.add(0x00, '0' - 1);
+            c.add('9' + 1, 0xFF);
+            c.high_any = true;
+        }
+    }
+
+    uint32_t parse_hex(int n) {
+        uint32_t res = 0;
+        for (int k = 0; k < n; ++k) {
+            if (eof()) {
+                throw unicode_regex_unsupported();
+            }
+            const uint32_t c = pat[i++];
+            res <<= 4;
+            if (c >= '0' && c <= '9') {
+                res |= c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                res |= c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                res |= c - 'A' + 10;
+            } else {
+                throw unicode_regex_unsupported();
+            }
+        }
+        return res;
+    }
+
+    // parses the escape after '\', returns true and sets c if it is a single code point, otherwise adds the class to cls
+    bool parse_escape(bool in_class, uint32_t & c, unicode_regex_class & cls) {
+        if (eof()) {
+            throw unicode_regex_unsupported();
+        }
+        const uint32_t e = pat[i++];
+        switch (e) {
+            case 'd': add_digit(cls, false); return false;
+            case 'D': add_digit(cls, true);  return false;
+            case 's': add_space(cls, false); return false;
+            case 'S': add_space(cls, true);  return false;
+            case 'f': c = '\f'; return true;
+            case 'n': c = '\n'; return true;
+            case 'r': c = '\r'; return true;
+            case 't': c = '\t'; return true;
+            case 'v': c = '\v'; return true;
+            case 'x': c = parse_hex(2); return true;
+            case 'u': c = parse_hex(4); return true;
+            case '0':
+                if (!eof() && peek() >= '0' && peek() <= '9') {
+                    throw unicode_regex_unsupported();
+                }
+                c = 0;
+                return true;
+            case 'b':
+                if (in_class) {
+                    c = '\b';
+                    return true;
+                }
+                throw unicode_regex_unsupported();
+            default:
+                break;
+        }
+        // word classes, boundaries, back-references, control escapes, ...
+        if (e < 128 && isalnum((int) e)) {
+            throw unicode_regex_unsupported();
+        }
+        c = e;
+        return true;
+    }
+
+    int32_t parse_class() {
+        unicode_regex_class cls;
+        if (!eof() && peek() == '^') {
+            cls.negate = true;
+            ++i;
+        }
+        if (!eof() && peek() == ']') {
+            throw unicode_regex_unsupported();
+        }
+        while (true) {
+            if (eof()) {
+                throw unicode_regex_unsupported();
+            }
+            if (peek() == ']') {
+                ++i;
+                break;
+            }
+
+            uint32_t lo = 0;
+            if (peek() == '\\') {
+                ++i;
+                if (!parse_escape(true, lo, cls)) {
+                    continue;
+                }
+            } else {
+                lo = pat[i++];
+            }
+
+            uint32_t hi = lo;
+            if (i + 1 < pat.size() && peek() == '-' && pat[i + 1] != ']') {
+                ++i;
+                if (peek() == '\\') {
+                    ++i;
+                    unicode_regex_class tmp;
+                    if (!parse_escape(true, hi, tmp)) {
+                        throw unicode_regex_unsupported();
+                    }
+                } else {
+                    hi = pat[i++];
+                }
+                if (hi < lo) {
+                    throw unicode_regex_unsupported();
+                }
+            }
+
+            cls.add(lo, hi);
+        }
+
+        return add_class(std::move(cls));
+    }
+
+    int32_t parse_atom() {
+        const uint32_t c = pat[i++];
+        switch (c) {
+            case '(':
+                {
+                    node::type_t type = node::CONCAT;
+                    if (!eof() && peek() == '?') {
+                        ++i;
+                        if (eof()) {
+                            throw unicode_regex_unsupported();
+                        }
+                        switch (pat[i++]) {
+                            case ':': type = node::CONCAT;   break;
+                            case '=': type = node::LOOK;     break;
+                            case '!': type = node::LOOK_NOT; break;
+                            default: throw unicode_regex_unsupported();
+                        }
+                    }
+                    const int32_t sub = parse_alt();
+                    if (eof() || peek() != ')') {
+                        throw unicode_regex_unsupported();
+                    }
+                    ++i;
+                    if (type == node::CONCAT) {
+                        return sub;
+                    }
+                    node n;
+                    n.type = type;
+                    n.children = { sub };
+                    return add(std::move(n));
+                }
+            case '[':
+                return parse_class();
+            case '.':
+                {
+                    unicode_regex_class cls;
+                    cls.negate = true;
+                    cls.add('\n', '\n');
+                    cls.add('\r', '\r');
+                    cls.add(0x2028, 0x2029);
+                    return add_class(std::move(cls));
+                }
+            case '^':
+                {
+                    node n;
+                    n.type = node::BOL;
+                    return add(std::move(n));
+                }
+            case '$':
+                {
+                    node n;
+                    n.type = node::EOL;
+                    return add(std::move(n));
+                }
+            case '\\':
+                {
+                    unicode_regex_class cls;
+                    uint32_t ch;
+                    if (parse_escape(false, ch, cls)) {
+                        cls.add(ch, ch);
+                    }
+                    return add_class(std::move(cls));
+                }
+            case '*':
+            case '+':
+            case '?':
+            case '{':
+            case ')':
+            case '|':
+                throw unicode_regex_unsupported();
+            default:
+                {
+                    unicode_regex_class cls;
+                    cls.add(c, c);
+                    return add_class(std::move(cls));
+                }
+        }
+    }
+
+    int32_t parse_number() {
+        int32_t res = 0;
+        bool any = false;
+        while (!eof() && peek() >= '0' && peek() <= '9') {
+            res = res*10 + (int32_t) (pat[i++] - '0');
+            if (res > 1000) {
+                throw unicode_regex_unsupported();
+            }
+            any = true;
+        }
+        if (!any) {
+            throw unicode_regex_unsupported();
+        }
+        return res;
+    }
+
+    int32_t parse_repeat() {
+        int32_t atom = parse_atom();
+
+        while (!eof()) {
+            int32_t min;
+            int32_t max;
+            switch (peek()) {
+                case '*': min = 0; max = -1; ++i; break;
+                case '+': min = 1; max = -1; ++i; break;
+                case '?': min = 0; max =  1; ++i; break;
+                case '{':
+                    {
+                        ++i;
+                        min = parse_number();
+                        max = min;
+                        if (!eof() && peek() == ',') {
+                            ++i;
+                            max = (!eof() && peek() == '}') ? -1 : parse_number();
+                        }
+                        if (eof() || peek() != '}' || (max >= 0 && max < min)) {
+                            throw unicode_regex_unsupported();
+                        }
+                        ++i;
+                    } break;
+                default:
+                    return atom;
+            }
+
+            const auto type = nodes[atom].type;
+            if (type == node::LOOK || type == node::LOOK_NOT || type == node::BOL || type == node::EOL) {
+                throw unicode_regex_unsupported();
+            }
+
+            node n;
+            n.type     = node::REPEAT;
+            n.children = { atom };
+            n.min      = min;
+            n.max      = max;
+            if (!eof() && peek() == '?') {
+                n.greedy = false;
+                ++i;
+            }
+            atom = add(std::move(n));
+        }
+
+        return atom;
+    }
+
+    int32_t parse_concat() {
+        node n;
+        n.type = node::CONCAT;
+        while (!eof() && peek() != '|' && peek() != ')') {
+            n.children.push_back(parse_repeat());
+        }
+        if (n.children.empty()) {
+            n.type = node::EMPTY;
+        }
+        return add(std::move(n));
+    }
+
+    int32_t parse_alt() {
+        node n;
+        n.type = node::ALT;
+        n.children.push_back(parse_concat());
+        while (!eof() && peek() == '|') {
+            ++i;
+            n.children.push_back(parse_concat());
+        }
+        if (n.children.size() == 1) {
+            return n.children[0];
+        }
+        return add(std::move(n));
+    }
+
+    bool nullable(int32_t id) const {
+        const node & n = nodes[id];
+        switch (n.type) {
+            case node::CLASS:
+                return false;
+            case node::CONCAT:
+                for (auto c : n.children) {
+                    if (!nullable(c)) {
+                        return false;
+                    }
+                }
+                return true;
+            case node::ALT:
+                for (auto c : n.children) {
+                    if (nullable(c)) {
+                        return true;
+                    }
+                }
+                return false;
+            case node::REPEAT:
+                return n.min == 0 || nullable(n.children[0]);
+            default:
+                return true;
+        }
+    }
+};
+
+struct unicode_regex_emitter {
+    const std::vector<unicode_regex_parser::node> & nodes;
+    const unicode_regex_parser & parser;
+
+    std::vector<unicode_regex_inst> & prog;
+    int32_t n_slots = 0;
+
+    int32_t emit(unicode_regex_inst::type op, int32_t x = 0, int32_t y = 0) {
+        prog.push_back({ op, x, y });
+        return (int32_t) prog.size() - 1;
+    }
+
+    int32_t pc() const {
+        return (int32_t) prog.size();
+    }
+
+    // one optional iteration of a loop body - the returned SPLIT must be patched to jump past the iteration
+    int32_t emit_iteration(int32_t body, bool greedy, bool check_progress) {
+        const int32_t split = emit(unicode_regex_inst::SPLIT);
+        const int32_t start = pc();
+        if (check_progress) {
+            const int32_t slot = n_slots++;
+            emit(unicode_regex_inst::SAVE, slot);
+            emit_node(body);
+            emit(unicode_regex_inst::PROGRESS, slot);
+        } else {
+            emit_node(body);
+        }
+        prog[split].x = greedy ? start : -1;
+        prog[split].y = greedy ? -1    : start;
+        return split;
+    }
+
+    void patch_split(int32_t split, int32_t target) {
+        if (prog[split].x < 0) {
+            prog[split].x = target;
+        } else {
+            prog[split].y = target;
+        }
+    }
+
+    void emit_node(int32_t id) {
+        const auto & n = nodes[id];
+        switch (n.type) {
+            case unicode_regex_parser::node::EMPTY:
+                break;
+            case unicode_regex_parser::node::CLASS:
+                emit(unicode_regex_inst::CLASS, n.cls);
+                break;
+            case unicode_regex_parser::node::CONCAT:
+                for (auto c : n.children) {
+                    emit_node(c);
+                }
+                break;
+            case unicode_regex_parser::node::ALT:
+                {
+                    std::vector<int32_t> jumps;
+                    for (size_t k = 0; k + 1 < n.children.size(); ++k) {
+                        const int32_t split = emit(unicode_regex_inst::SPLIT, 0, 0);
+                        prog[split].x = pc();
+                        emit_node(n.children[k]);
+                        jumps.push_back(emit(unicode_regex_inst::JMP));
+                        prog[split].y = pc();
+                    }
+                    emit_node(n.children.back());
+                    for (auto j : jumps) {
+                        prog[j].x = pc();
+                    }
+                } break;
+            case unicode_regex_parser::node::REPEAT:
+                {
+                    const int32_t body = n.children[0];
+                    const bool check_progress = parser.nullable(body);
+
+                    for (int32_t k = 0; k < n.min; ++k) {
+                        emit_node(body);
+                    }
+
+                    if (n.max < 0) {
+                        const int32_t loop  = pc();
+                        const int32_t split = emit_iteration(body, n.greedy, check_progress);
+                        emit(unicode_regex_inst::JMP, loop);
+                        patch_split(split, pc());
+                    } else {
+                        std::vector<int32_t> splits;
+                        for (int32_t k = n.min; k < n.max; ++k) {
+                            splits.push_back(emit_iteration(body, n.greedy, check_progress));
+                        }
+                        for (auto split : splits) {
+                            patch_split(split, pc());
+                        }
+                    }
+                } break;
+            case unicode_regex_parser::node::LOOK:
+            case unicode_regex_parser::node::LOOK_NOT:
+                {
+                    const int32_t look = emit(n.type == unicode_regex_parser::node::LOOK ? unicode_regex_inst::LOOK : unicode_regex_inst::LOOK_NOT);
+                    emit_node(n.children[0]);
+                    emit(unicode_regex_inst::MATCH);
+                    prog[look].y = pc();
+                } break;
+            case unicode_regex_parser::node::BOL:
+                emit(unicode_regex_inst::BOL);
+                break;
+            case unicode_regex_parser::node::EOL:
+                emit(unicode_regex_inst::EOL);
+                break;
+        }
+    }
+};
+
+std::unique_ptr<unicode_regex_compiled> unicode_regex_compiled::compile(const std::vector<uint32_t> & pattern) {
+    auto res = std::make_unique<unicode_regex_compiled>();
 
-    if (regex_expr == "'s|'t|'re|'ve|'m|'ll|'d| ?\\p{L}+| ?\\p{N}+| ?[^\\s\\p{L}\\p{N}]+|\\s+(?!\\S)") {
-        bpe_offsets = unicode_regex_split_custom_gpt2(text, offsets);
-    } else if (
-            regex_expr == "(?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}{1,3}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+" ||
-            regex_expr == "(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}{1,3}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+") {
+    try {
+        unicode_regex_parser parser(pattern, res->classes);
 
-        bpe_offsets = unicode_regex_split_custom_llama3(text, offsets);
-    } else if (regex_expr == "\\p{Han}+") {
-        // K2's first pattern - handle all K2 patterns together
-        bpe_offsets = unicode_regex_split_custom_kimi_k2(text, offsets);
+        const int32_t root = parser.parse_alt();
+        if (!parser.eof()) {
+            return nullptr; // unbalanced ')'
+        }
+
+        unicode_regex_emitter emitter { parser.nodes, parser, res->prog };
+        emitter.emit_node(root);
+        emitter.emit(unicode_regex_inst::MATCH);
+
+        res->n_slots = emitter.n_slots;
+    } catch (const unicode_regex_unsupported &) {
+        return nullptr;
+    }
+
+    // collect the classes that can start a match, by following the branches from the start of the program
+    {
+        std::vector<bool> visited(res->prog.size(), false);
+        std::vector<int32_t> todo = { 0 };
+        bool known = true;
+        while (known && !todo.empty()) {
+            const int32_t pc = todo.back();
+            todo.pop_back();
+            if (visited[pc]) {
+                continue;
+            }
+            visited[pc] = true;
+            const auto & inst = res->prog[pc];
+            switch (inst.op) {
+                case unicode_regex_inst::CLASS:    res->first.push_back(inst.x);              break;
+                case unicode_regex_inst::SPLIT:    todo.push_back(inst.x); todo.push_back(inst.y); break;
+                case unicode_regex_inst::JMP:      todo.push_back(inst.x);                     break;
+                case unicode_regex_inst::SAVE:     todo.push_back(pc + 1);                     break;
+                default:                           known = false;                              break;
+            }
+        }
+        if (!known) {
+            res->first.clear();
+        }
+    }
+
+    return res;
+}
+
+size_t unicode_regex_compiled::run(int32_t pc, size_t pos, state & st) const {
+    const size_t base = st.stack.size();
+
+    while (true) {
+        const auto & inst = prog[pc];
+
+        bool ok = true;
+
+        switch (inst.op) {
+            case unicode_regex_inst::CLASS:
+                if (pos < st.end && classes[inst.x].test(st.text[pos])) {
+                    ++pos;
+                    ++pc;
+                } else {
+                    ok = false;
+                }
+                break;
+            case unicode_regex_inst::SPLIT:
+                st.stack.push_back({ inst.y, 0, pos });
+                pc = inst.x;
+                break;
+            case unicode_regex_inst::JMP:
+                pc = inst.x;
+                break;
+            case unicode_regex_inst::SAVE:
+                st.stack.push_back({ -1, inst.x, st.slots[inst.x] });
+                st.slots[inst.x] = pos;
+                ++pc;
+                break;
+            case unicode_regex_inst::PROGRESS:
+                ok = st.slots[inst.x] != pos;
+                ++pc;
+                break;
+            case unicode_regex_inst::LOOK:
+            case unicode_regex_inst::LOOK_NOT:
+                {
+                    const size_t start    = st.start;
+                    const bool   not_null = st.not_null;
+
+                    st.not_null = false;
+                    const bool found = run(pc + 1, pos, st) != npos;
+                    st.start    = start;
+                    st.not_null = not_null;
+
+                    ok = found == (inst.op == unicode_regex_inst::LOOK);
+                    pc = inst.y;
+                } break;
+            case unicode_regex_inst::BOL:
+                ok = st.bol && pos == st.begin;
+                ++pc;
+                break;
+            case unicode_regex_inst::EOL:
+                ok = pos == st.end;
+                ++pc;
+                break;
+            case unicode_regex_inst::MATCH:
+                if (st.not_null && pos == st.start) {
+                    ok = false;
+                    break;
+                }
+                // drop the remaining alternatives, but keep the slots of this match
+                st.stack.resize(base);
+                return pos;
+        }
+
+        if (ok) {
+            continue;
+        }
+
+        // backtrack
+        while (true) {
+            if (st.stack.size() == base) {
+                return npos;
+            }
+            const backtrack bt = st.stack.back();
+            st.stack.pop_back();
+            if (bt.pc < 0) {
+                st.slots[bt.slot] = bt.pos;
+                continue;
+            }
+            pc  = bt.pc;
+            pos = bt.pos;
+            break;
+        }
+    }
+}
+
+bool unicode_regex_compiled::search(size_t from, bool continuous, state & st, size_t & m_begin, size_t & m_end) const {
+    for (size_t s = from; s <= st.end; ++s) {
+        if (!first.empty() && !continuous) {
+            // skip the positions where no match can start
+            if (s == st.end) {
+                break;
+            }
+            bool can_start = false;
+            for (size_t k = 0; !can_start && k < first.size(); ++k) {
+                can_start = classes[first[k]].test(st.text[s]);
+            }
+            if (!can_start) {
+                continue;
+            }
+        }
+
+        st.start = s;
+
+        const size_t res = run(0, s, st);
+        if (res != npos) {
+            m_begin = s;
+            m_end   = res;
+            return true;
+        }
+
+        if (continuous) {
+            break;
+        }
+    }
+
+    return false;
+}
+
+std::vector<size_t> unicode_regex_compiled::split(const std::vector<uint32_t> & text, const std::vector<size_t> & offsets) const {
+    std::vector<size_t> bpe_offsets; // store the offset of each word
+    bpe_offsets.reserve(offsets.size()); // Reserve memory for the approximate size
+
+    state st;
+    st.text = text.data();
+    st.slots.resize(n_slots, npos);
+
+    size_t start = 0;
+    for (auto offset : offsets) {
+        st.begin = start;
+        st.end   = start + offset;
+
+        // same iteration as std::regex_iterator
+        st.bol      = true;
+        st.not_null = false;
+
+        size_t m_begin = 0;
+        size_t m_end   = 0;
+
+        bool found = search(st.begin, false, st, m_begin, m_end);
+
+        size_t start_idx = st.begin;
+        while (found) {
+            if (m_begin > start_idx) {
+                bpe_offsets.emplace_back(m_begin - start_idx);
+            }
+            bpe_offsets.emplace_back(m_end - m_begin);
+            start_idx = m_end;
+
+            st.bol = false;
+
+            size_t from = m_end;
+            if (m_begin == m_end) {
+                if (m_end == st.end) {
+                    break;
+                }
+                st.not_null = true;
+                found = search(from, true, st, m_begin, m_end);
+                st.not_null = false;
+                if (found) {
+                    continue;
+                }
+                ++from;
+            }
+            found = search(from, false, st, m_begin, m_end);
+        }
+
+        if (start_idx < st.end) {
+            bpe_offsets.emplace_back(st.end - start_idx);
+        }
+        start += offset;
     }
 
     return bpe_offsets;
@@ -879,170 +1691,246 @@ bool unicode_cpt_is_han(uint32_t cpt) {
     return false;
 }
 
-std::vector<std::string> unicode_regex_split(const std::string & text, const std::vector<std::string> & regex_exprs) {
-    // unicode categories
-    static const std::map<std::string, int> k_ucat_enum = {
-        { "\\p{N}", unicode_cpt_flags::NUMBER },
-        { "\\p{L}", unicode_cpt_flags::LETTER },
-        { "\\p{P}", unicode_cpt_flags::PUNCTUATION },
-        { "\\p{M}", unicode_cpt_flags::ACCENT_MARK },
-        { "\\p{S}", unicode_cpt_flags::SYMBOL },
-    };
-
-    static const std::map<int, int> k_ucat_cpt = {
-        { unicode_cpt_flags::NUMBER,      0xD1 },
-        { unicode_cpt_flags::LETTER,      0xD2 },
-        { unicode_cpt_flags::PUNCTUATION, 0xD3 },
-        { unicode_cpt_flags::ACCENT_MARK, 0xD4 },
-        { unicode_cpt_flags::SYMBOL,      0xD5 },
-    };
+// unicode categories
+static const std::map<std::string, int> k_ucat_enum = {
+    { "\\p{N}", unicode_cpt_flags::NUMBER },
+    { "\\p{L}", unicode_cpt_flags::LETTER },
+    { "\\p{P}", unicode_cpt_flags::PUNCTUATION },
+    { "\\p{M}", unicode_cpt_flags::ACCENT_MARK },
+    { "\\p{S}", unicode_cpt_flags::SYMBOL },
+};
+
+static const std::map<int, int> k_ucat_cpt = {
+    { unicode_cpt_flags::NUMBER,      0xD1 },
+    { unicode_cpt_flags::LETTER,      0xD2 },
+    { unicode_cpt_flags::PUNCTUATION, 0xD3 },
+    { unicode_cpt_flags::ACCENT_MARK, 0xD4 },
+    { unicode_cpt_flags::SYMBOL,      0xD5 },
+};
+
+static const std::map<int, std::string> k_ucat_map = {
+    { unicode_cpt_flags::NUMBER,      "\x30-\x39" }, // 0-9
+    { unicode_cpt_flags::LETTER,      "\x41-\x5A\x61-\x7A" }, // A-Za-z
+    { unicode_cpt_flags::PUNCTUATION, "\x21-\x23\x25-\x2A\x2C-\x2F\x3A-\x3B\x3F-\x40\\\x5B-\\\x5D\x5F\\\x7B\\\x7D" }, // !-#%-*,-/:-;?-@\[-\]_\{\}
+    { unicode_cpt_flags::ACCENT_MARK, "" }, // no sub-128 codepoints
+    { unicode_cpt_flags::SYMBOL,      "\\\x24\\\x2B\x3C-\x3E\x5E\x60\\\x7C" }, // $+<=>^`|
+};
+
+static bool unicode_regex_uses_ucat(const std::string & regex_expr) {
+    for (const auto & ucat : k_ucat_enum) {
+        if (std::string::npos != regex_expr.find(ucat.first)) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    static const std::map<int, std::string> k_ucat_map = {
-        { unicode_cpt_flags::NUMBER,      "\x30-\x39" }, // 0-9
-        { unicode_cpt_flags::LETTER,      "\x41-\x5A\x61-\x7A" }, // A-Za-z
-        { unicode_cpt_flags::PUNCTUATION, "\x21-\x23\x25-\x2A\x2C-\x2F\x3A-\x3B\x3F-\x40\\\x5B-\\\x5D\x5F\\\x7B\\\x7D" }, // !-#%-*,-/:-;?-@\[-\]_\{\}
-        { unicode_cpt_flags::ACCENT_MARK, "" }, // no sub-128 codepoints
-        { unicode_cpt_flags::SYMBOL,      "\\\x24\\\x2B\x3C-\x3E\x5E\x60\\\x7C" }, // $+<=>^`|
-    };
+static bool unicode_regex_has_custom(const std::string & regex_expr) {
+    return k_regex_custom.find(regex_expr) != k_regex_custom.end();
+}
 
-    // compute collapsed codepoints only if needed by at least one regex
-    bool need_collapse = false;
-    for (const auto & regex_expr : regex_exprs) {
-        // search for unicode categories
-        for (const auto & ucat : k_ucat_enum) {
-            if (std::string::npos != regex_expr.find(ucat.first)) {
-                need_collapse = true;
-                break;
-            }
+// generate a collapsed representation of the regex, where the unicode categories are replaced by their collapsed codepoints
+// ref: https://github.com/ggml-org/llama.cpp/pull/6920#issuecomment-2081479935
+static std::string unicode_regex_collapse(const std::string & regex_expr) {
+    // sanity-check that the original regex does not contain any non-ASCII characters
+    const auto cpts_regex = unicode_cpts_from_utf8(regex_expr);
+    for (size_t i = 0; i < cpts_regex.size(); ++i) {
+        if (cpts_regex[i] >= 128) {
+            throw std::runtime_error("Regex includes both unicode categories and non-ASCII characters - not supported");
         }
     }
 
-    const auto cpts = unicode_cpts_from_utf8(text);
+    std::string regex_expr_collapsed;
 
-    // generate a "collapsed" representation of the text, where all codepoints are replaced by a single byte
-    // ref: https://github.com/ggml-org/llama.cpp/pull/6920#issuecomment-2081479935
-    std::string text_collapsed;
-    if (need_collapse) {
-        // collapse all unicode categories
-        text_collapsed.resize(cpts.size());
-
-        for (size_t i = 0; i < cpts.size(); ++i) {
-            // keep single-byte codepoints as is
-            if (cpts[i] < 128) {
-                text_collapsed[i] = cpts[i];
-                continue;
-            }
+    // track if we are inside [], because nested [] are not allowed
+    bool inside = false;
+    for (size_t i = 0; i < regex_expr.size(); ++i) {
+        if (regex_expr[i] == '[' && (i == 0 || regex_expr[i - 1] != '\\')) {
+            regex_expr_collapsed += '[';
+            inside = true;
+            continue;
+        }
 
-            const auto flags = unicode_cpt_flags_from_cpt(cpts[i]);
+        if (inside && regex_expr[i] == ']' && regex_expr[i - 1] != '\\') {
+            regex_expr_collapsed += ']';
+            inside = false;
+            continue;
+        }
 
-            if (flags.is_whitespace) {
-                //NOTE: C++ std::regex \s does not mach 0x85, Rust and Python regex does.
-                //text_collapsed[i] = (char) 0x85;  // <Next Line> as whitespace fallback
-                text_collapsed[i] = (char) 0x0B;    // <vertical tab> as whitespace fallback
-            } else if (k_ucat_cpt.find(flags.category_flag()) != k_ucat_cpt.end()) {
-                text_collapsed[i] = k_ucat_cpt.at(flags.category_flag());
-            } else {
-                text_collapsed[i] = (char) 0xD0; // fallback
+        if (regex_expr[i + 0] == '\\' && i + 4 < regex_expr.size() &&
+            regex_expr[i + 1] == 'p' &&
+            regex_expr[i + 2] == '{' &&
+            regex_expr[i + 4] == '}') {
+            const std::string pat = regex_expr.substr(i, 5);
+            if (k_ucat_enum.find(pat) != k_ucat_enum.end()) {
+                if (!inside) {
+                    regex_expr_collapsed += '[';
+                }
+                regex_expr_collapsed += k_ucat_cpt.at(k_ucat_enum.at(pat));
+                regex_expr_collapsed += k_ucat_map.at(k_ucat_enum.at(pat));
+                if (!inside) {
+                    regex_expr_collapsed += ']';
+                }
+                i += 4;
+                continue;
             }
         }
+
+        regex_expr_collapsed += regex_expr[i];
     }
 
-    std::vector<size_t> bpe_offsets = { cpts.size() };
+    return regex_expr_collapsed;
+}
+
+struct unicode_regex_splitter::expr {
+    std::string regex_expr;
+
+    bool custom        = false; // efficient custom implementation, see unicode_regex_split_custom
+    bool use_collapsed = false; // a unicode category is used - match the collapsed text
+
+    std::unique_ptr<unicode_regex_compiled> compiled;
+
+    // fallback to general-purpose std::regex / std::wregex
+    std::unique_ptr<std::regex>  regex;
+    std::unique_ptr<std::wregex> wregex;
 
+    // deferred until the expression is used, same as before the expressions were compiled upfront
+    std::string error;
+    bool        regex_error = false;
+};
+
+unicode_regex_splitter::unicode_regex_splitter(const std::vector<std::string> & regex_exprs, unicode_regex_engine engine) {
     for (const auto & regex_expr : regex_exprs) {
-        // first, see if we have an efficient custom regex implementation
-        auto tmp = unicode_regex_split_custom(text, regex_expr, bpe_offsets);
+        auto e = std::make_unique<expr>();
 
-        if (!tmp.empty()) {
-            bpe_offsets = std::move(tmp);
-            continue;
-        }
+        e->regex_expr = regex_expr;
+        e->custom     = engine == UNICODE_REGEX_ENGINE_CUSTOM && unicode_regex_has_custom(regex_expr);
 
-        // fallback to general-purpose std::regex / std::wregex
-        try {
-            // if a unicode category is used in the regex, we use the collapsed text and replace the unicode category
-            // with the corresponding collapsed representation
-            bool use_collapsed = false;
-            for (const auto & ucat : k_ucat_enum) {
-                if (std::string::npos != regex_expr.find(ucat.first)) {
-                    use_collapsed = true;
-                    break;
-                }
-            }
+        // the compiled regex is null if the engine is not used
+        const auto compile = [engine](const std::vector<uint32_t> & pattern) {
+            return engine == UNICODE_REGEX_ENGINE_STD ? nullptr : unicode_regex_compiled::compile(pattern);
+        };
 
-            if (use_collapsed) {
-                // sanity-check that the original regex does not contain any non-ASCII characters
-                const auto cpts_regex = unicode_cpts_from_utf8(regex_expr);
-                for (size_t i = 0; i < cpts_regex.size(); ++i) {
-                    if (cpts_regex[i] >= 128) {
-                        throw std::runtime_error("Regex includes both unicode categories and non-ASCII characters - not supported");
-                    }
-                }
+        if (!e->custom) {
+            e->use_collapsed = unicode_regex_uses_ucat(regex_expr);
 
-                // generate a collapsed representation of the regex
-                std::string regex_expr_collapsed;
+            try {
+                if (e->use_collapsed) {
+                    const std::string regex_expr_collapsed = unicode_regex_collapse(regex_expr);
 
-                // track if we are inside [], because nested [] are not allowed
-                bool inside = false;
-                for (size_t i = 0; i < regex_expr.size(); ++i) {
-                    if (regex_expr[i] == '[' && (i == 0 || regex_expr[i - 1] != '\\')) {
-                        regex_expr_collapsed += '[';
-                        inside = true;
-                        continue;
+                    std::vector<uint32_t> pattern(regex_expr_collapsed.begin(), regex_expr_collapsed.end());
+                    for (auto & c : pattern) {
+                        c &= 0xFF;
                     }
 
-                    if (inside && regex_expr[i] == ']' && regex_expr[i - 1] != '\\') {
-                        regex_expr_collapsed += ']';
-                        inside = false;
-                        continue;
+                    e->compiled = compile(pattern);
+                    if (!e->compiled) {
+                        e->regex = std::make_unique<std::regex>(regex_expr_collapsed);
                     }
-
-                    if (regex_expr[i + 0] == '\\' && i + 4 < regex_expr.size() &&
-                        regex_expr[i + 1] == 'p' &&
-                        regex_expr[i + 2] == '{' &&
-                        regex_expr[i + 4] == '}') {
-                        const std::string pat = regex_expr.substr(i, 5);
-                        if (k_ucat_enum.find(pat) != k_ucat_enum.end()) {
-                            if (!inside) {
-                                regex_expr_collapsed += '[';
-                            }
-                            regex_expr_collapsed += k_ucat_cpt.at(k_ucat_enum.at(pat));
-                            regex_expr_collapsed += k_ucat_map.at(k_ucat_enum.at(pat));
-                            if (!inside) {
-                                regex_expr_collapsed += ']';
-                            }
-                            i += 4;
-                            continue;
-                        }
+                } else {
+                    e->compiled = compile(unicode_cpts_from_utf8(regex_expr));
+                    if (!e->compiled) {
+                        e->wregex = std::make_unique<std::wregex>(unicode_wstring_from_utf8(regex_expr));
                     }
+                }
+            } catch (std::regex_error & err) {
+                e->error       = err.what();
+                e->regex_error = true;
+            } catch (std::exception & err) {
+                e->error = err.what();
+            }
+        }
+
+        exprs.push_back(std::move(e));
+    }
+}
+
+unicode_regex_splitter::~unicode_regex_splitter() = default;
+
+size_t unicode_regex_splitter::n_compiled() const {
+    size_t n = 0;
+    for (const auto & e : exprs) {
+        n += e->compiled != nullptr;
+    }
+    return n;
+}
+
+std::vector<std::string> unicode_regex_splitter::split(const std::string & text) const {
+    const auto cpts = unicode_cpts_from_utf8(text);
+
+    // the code points as seen by the regex - computed only if needed by at least one regex
+    std::vector<uint32_t> cpts_collapsed;
+    std::vector<uint32_t> cpts_wide;
+
+    for (const auto & e : exprs) {
+        if (e->custom) {
+            continue;
+        }
+
+        if (e->use_collapsed && cpts_collapsed.empty()) {
+            // generate a "collapsed" representation of the text, where all codepoints are replaced by a single byte
+            cpts_collapsed.resize(cpts.size());
 
-                    regex_expr_collapsed += regex_expr[i];
+            for (size_t i = 0; i < cpts.size(); ++i) {
+                // keep single-byte codepoints as is
+                if (cpts[i] < 128) {
+                    cpts_collapsed[i] = cpts[i];
+                    continue;
                 }
 
-                //printf("text_collapsed: %s\n", text_collapsed.c_str());
-                //printf("regex_expr_collapsed: %s\n", regex_expr_collapsed.c_str());
-                bpe_offsets = unicode_regex_split_stl(text_collapsed, regex_expr_collapsed, bpe_offsets);
-            } else {
-                // no unicode category used, we can use std::wregex directly
-                const std::wstring wregex_expr = unicode_wstring_from_utf8(regex_expr);
-
-                // std::wregex \s does not mach non-ASCII whitespaces, using 0x0B as fallback
-                std::wstring wtext(cpts.begin(), cpts.end());
-                for (size_t i = 0; i < wtext.size(); ++i) {
-                    if (wtext[i] > 0x7F && unicode_cpt_flags_from_cpt(wtext[i]).is_whitespace) {
-                        wtext[i] = 0x0B;
-                    }
+                const auto flags = unicode_cpt_flags_from_cpt(cpts[i]);
+
+                if (flags.is_whitespace) {
+                    //NOTE: C++ std::regex \s does not mach 0x85, Rust and Python regex does.
+                    //cpts_collapsed[i] = 0x85;  // <Next Line> as whitespace fallback
+                    cpts_collapsed[i] = 0x0B;    // <vertical tab> as whitespace fallback
+                } else if (k_ucat_cpt.find(flags.category_flag()) != k_ucat_cpt.end()) {
+                    cpts_collapsed[i] = k_ucat_cpt.at(flags.category_flag());
+                } else {
+                    cpts_collapsed[i] = 0xD0; // fallback
+                }
+            }
+        }
+
+        if (!e->use_collapsed && cpts_wide.empty()) {
+            // std::wregex \s does not mach non-ASCII whitespaces, using 0x0B as fallback
+            cpts_wide = cpts;
+            for (size_t i = 0; i < cpts_wide.size(); ++i) {
+                if (cpts_wide[i] > 0x7F && unicode_cpt_flags_from_cpt(cpts_wide[i]).is_whitespace) {
+                    cpts_wide[i] = 0x0B;
                 }
+            }
+        }
+    }
+
+    std::vector<size_t> bpe_offsets = { cpts.size() };
 
-                //printf("text: %s\n", text.c_str());
-                //printf("regex_expr: %s\n", regex_expr.c_str());
-                bpe_offsets = unicode_regex_split_stl(wtext, wregex_expr, bpe_offsets);
+    for (const auto & e : exprs) {
+        if (e->custom) {
+            bpe_offsets = unicode_regex_split_custom(text, e->regex_expr, bpe_offsets);
+            continue;
+        }
+
+        if (!e->error.empty()) {
+            if (!e->regex_error) {
+                throw std::runtime_error(e->error);
             }
-        } catch (std::regex_error & e) {
-            fprintf(stderr, "Failed to process regex: '%s'\n", regex_expr.c_str());
-            fprintf(stderr, "Regex error: %s\n", e.what());
+            fprintf(stderr, "Failed to process regex: '%s'\n", e->regex_expr.c_str());
+            fprintf(stderr, "Regex error: %s\n", e->error.c_str());
             throw std::runtime_error("Failed to process regex");
         }
+
+        const auto & cpts_regex = e->use_collapsed ? cpts_collapsed : cpts_wide;
+
+        if (e->compiled) {
+            bpe_offsets = e->compiled->split(cpts_regex, bpe_offsets);
+        } else if (e->use_collapsed) {
+            const std::string text_collapsed(cpts_regex.begin(), cpts_regex.end());
+            bpe_offsets = unicode_regex_split_stl(text_collapsed, *e->regex, bpe_offsets);
+        } else {
+            const std::wstring wtext(cpts_regex.begin(), cpts_regex.end());
+            bpe_offsets = unicode_regex_split_stl(wtext, *e->wregex, bpe_offsets);
+        }
     }
 
     std::vector<std::string> bpe_words;
@@ -1059,3 +1947,7 @@ std::vector<std::string> unicode_regex_split(const std::string & text, const std
 
     return unicode_byte_encoding_process(bpe_words);
 }
+
+std::vector<std::string> unicode_regex_split(const std::string & text, const std::vector<std::string> & regex_exprs) {
+    return unicode_regex_splitter(regex_exprs).split(text);
+}
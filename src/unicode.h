@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -65,4 +66,30 @@ uint32_t unicode_tolower(uint32_t cpt);
 
 bool unicode_cpt_is_han(uint32_t cpt);
 
+// the engines used to match an expression, each one falls back to the next if it does not support the expression
+enum unicode_regex_engine {
+    UNICODE_REGEX_ENGINE_CUSTOM,   // custom implementation of the expression
+    UNICODE_REGEX_ENGINE_COMPILED, // compiled regex engine
+    UNICODE_REGEX_ENGINE_STD,      // std::regex / std::wregex
+};
+
+// the regex expressions of a pre-tokenizer, compiled once
+// split() does not modify the splitter, so it can be used by multiple threads at the same time
+class unicode_regex_splitter {
+public:
+    // engine: the first engine to try, the others are only used for testing
+    explicit unicode_regex_splitter(const std::vector<std::string> & regex_exprs, unicode_regex_engine engine = UNICODE_REGEX_ENGINE_CUSTOM);
+    ~unicode_regex_splitter();
+
+    std::vector<std::string> split(const std::string & text) const;
+
+    // number of expressions matched by the compiled regex engine
+    size_t n_compiled() const;
+
+private:
+    struct expr;
+
+    std::vector<std::unique_ptr<expr>> exprs;
+};
+
 std::vector<std::string> unicode_regex_split(const std::string & text, const std::vector<std::string> & regex_exprs);
@@ -0,0 +1,101 @@
+// tests GGML_OP_ARGSORT_TOP_K on the CPU backend against ggml_argsort + view
+// (test-backend-ops compares the other backends with the CPU, so it does not cover the CPU implementation)
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static void ggml_graph_compute_helper(std::vector<uint8_t> & buf, ggml_cgraph * graph, int n_threads) {
+    struct ggml_cplan plan = ggml_graph_plan(graph, n_threads, nullptr);
+
+    if (plan.work_size > 0) {
+        buf.resize(plan.work_size);
+        plan.work_data = buf.data();
+    }
+
+    ggml_graph_compute(graph, &plan);
+}
+
+// with ties, the order of the equal values is not defined, so the selected values are compared instead of the ids
+static bool test_argsort_top_k(std::array<int64_t, 4> ne, int k, bool ties, int n_threads) {
+    std::mt19937 rng(42);
+
+    struct ggml_init_params params = {
+        /* .mem_size   = */ (size_t) ne[0]*ne[1]*ne[2]*ne[3]*3*sizeof(float) + 16*ggml_tensor_overhead() + ggml_graph_overhead() + 1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    struct ggml_context * ctx = ggml_init(params);
+
+    struct ggml_tensor * a = ggml_new_tensor(ctx, GGML_TYPE_F32, 4, ne.data());
+
+    const int64_t n_rows = ggml_nrows(a);
+
+    std::vector<float> row(ne[0]);
+    for (int64_t r = 0; r < n_rows; r++) {
+        for (int64_t i = 0; i < ne[0]; i++) {
+            row[i] = ties ? (float) (rng() % 16) : (float) i;
+        }
+        std::shuffle(row.begin(), row.end(), rng);
+        std::copy(row.begin(), row.end(), (float *) a->data + r*ne[0]);
+    }
+
+    struct ggml_tensor * ids = ggml_argsort_top_k(ctx, a, k);
+    struct ggml_tensor * ref = ggml_argsort(ctx, a, GGML_SORT_ORDER_DESC);
+    ref = ggml_view_4d(ctx, ref, k, ne[1], ne[2], ne[3], ref->nb[1], ref->nb[2], ref->nb[3], 0);
+    ref = ggml_cont(ctx, ref);
+
+    struct ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, ids);
+    ggml_build_forward_expand(gf, ref);
+
+    std::vector<uint8_t> work_buffer;
+    ggml_graph_compute_helper(work_buffer, gf, n_threads);
+
+    bool ok = ggml_are_same_shape(ids, ref);
+
+    for (int64_t r = 0; ok && r < n_rows; r++) {
+        const float   * x      = (const float   *) a->data   + r*ne[0];
+        const int32_t * ids_r  = (const int32_t *) ids->data + r*k;
+        const int32_t * ref_r  = (const int32_t *) ref->data + r*k;
+
+        for (int i = 0; i < k; i++) {
+            if (ids_r[i] < 0 || ids_r[i] >= ne[0] || (ties ? x[ids_r[i]] != x[ref_r[i]] : ids_r[i] != ref_r[i])) {
+                fprintf(stderr, "%s: ne = [%d, %d, %d, %d], k = %d, ties = %d: row %d, index %d: got %d, expected %d\n", __func__,
+                        (int) ne[0], (int) ne[1], (int) ne[2], (int) ne[3], k, ties, (int) r, i, ids_r[i], ref_r[i]);
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    ggml_free(ctx);
+
+    return ok;
+}
+
+int main(int /*argc*/, const char ** /*argv*/) {
+    bool ok = true;
+
+    for (bool ties : { false, true }) {
+        for (int n_threads : { 1, 4 }) {
+            ok &= test_argsort_top_k({     16, 10, 10, 10 },   4, ties, n_threads);
+            ok &= test_argsort_top_k({   1000,  4,  1,  1 },   1, ties, n_threads);
+            ok &= test_argsort_top_k({   1000,  4,  1,  1 },  40, ties, n_threads);
+            ok &= test_argsort_top_k({   1000,  4,  1,  1 }, 1000, ties, n_threads);
+            ok &= test_argsort_top_k({  32000,  2,  1,  1 }, 500, ties, n_threads);
+            ok &= test_argsort_top_k({ 128000,  4,  1,  1 },  40, ties, n_threads);
+        }
+    }
+
+    printf("%s: %s\n", __func__, ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
@@ -66,6 +66,7 @@ int main(int argc, char *argv[]) {
               << "\n n_threads: " << n_threads
               << "\n   n_nodes: " << n_nodes
               << "\n  n_rounds: " << n_rounds
+              << "\n  barriers: " << ggml_graph_n_barriers(gf, &cplan)
               << "\n";
     // ggml_graph_print(gf);
 
@@ -87,6 +88,75 @@ int main(int argc, char *argv[]) {
               << "\n " << (float) nsec / (n_rounds * n_nodes) << " nsec per-node"
               << "\n";
 
+    // Lots of small, independent ops that only need a few barriers
+    {
+        struct ggml_cgraph * gf_par = ggml_new_graph_custom(ctx, 4*GGML_DEFAULT_GRAPH_SIZE, false);
+
+        const int n_par = 1000;
+
+        std::vector<struct ggml_tensor *> a(n_par);
+        std::vector<struct ggml_tensor *> b(n_par);
+        std::vector<struct ggml_tensor *> c(n_par);
+
+        for (int i = 0; i < n_par; i++) {
+            a[i] = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 64);
+            b[i] = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 64);
+            for (int j = 0; j < 64; j++) {
+                ggml_set_f32_1d(a[i], j, (float) (i + j));
+                ggml_set_f32_1d(b[i], j, (float) (i - j));
+            }
+        }
+
+        // all additions before all scales: each scale only depends on an addition computed before the previous barriers
+        for (int i = 0; i < n_par; i++) {
+            c[i] = ggml_add(ctx, a[i], b[i]);
+            ggml_build_forward_expand(gf_par, c[i]);
+        }
+        for (int i = 0; i < n_par; i++) {
+            c[i] = ggml_scale(ctx, c[i], 0.5f);
+            ggml_build_forward_expand(gf_par, c[i]);
+        }
+
+        struct ggml_cplan cplan_par = ggml_graph_plan(gf_par, n_threads, threadpool);
+
+        std::vector<uint8_t> work_data_par(cplan_par.work_size);
+        cplan_par.work_data = work_data_par.data();
+
+        const int n_barriers = ggml_graph_n_barriers(gf_par, &cplan_par);
+
+        std::cerr << "graph-compute with independent nodes"
+                  << "\n   n_nodes: " << ggml_graph_n_nodes(gf_par)
+                  << "\n  barriers: " << n_barriers
+                  << "\n";
+
+        if (n_barriers >= ggml_graph_n_nodes(gf_par)/8) {
+            fprintf(stderr, "too many barriers for independent nodes: %d\n", n_barriers);
+            exit(1);
+        }
+
+        auto t0 = std::chrono::high_resolution_clock::now();
+
+        for (int i = 0; i < n_rounds; i++) {
+            ggml_graph_compute(gf_par, &cplan_par);
+        }
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        for (int i = 0; i < n_par; i++) {
+            for (int j = 0; j < 64; j++) {
+                if (ggml_get_f32_1d(c[i], j) != (float) i) {
+                    fprintf(stderr, "wrong result for node %d, element %d: %f\n", i, j, ggml_get_f32_1d(c[i], j));
+                    exit(1);
+                }
+            }
+        }
+
+        auto usec = std::chrono::duration_cast<std::chrono::microseconds>(t1-t0).count();
+        std::cerr << "graph-compute took " << usec << " usec "
+                  << "\n " << (float) usec / n_rounds << " usec per-iter"
+                  << "\n";
+    }
+
     ggml_threadpool_free(threadpool);
     ggml_free(ctx);
 
@@ -0,0 +1,246 @@
+// tests the compression of the RPC transfers and the order of the batched asynchronous transfers
+
+#include "ggml.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+#include "ggml-rpc.h"
+#include "rpc-compress.h"
+
+#ifdef _WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  ifndef NOMINMAX
+#     define NOMINMAX
+#  endif
+#  include <winsock2.h>
+#  include <ws2tcpip.h>
+#else
+#  include <arpa/inet.h>
+#  include <netinet/in.h>
+#  include <sys/socket.h>
+#  include <unistd.h>
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+typedef SOCKET sockfd_t;
+#else
+typedef int sockfd_t;
+#define INVALID_SOCKET -1
+#define closesocket close
+#endif
+
+// a port that is free at the time of the call, chosen by the system, 0 on error
+// the tests can run in parallel, so a fixed port could be in use
+static int find_free_port() {
+#ifdef _WIN32
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+        return 0;
+    }
+#endif
+    sockfd_t sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd == INVALID_SOCKET) {
+        return 0;
+    }
+
+    struct sockaddr_in addr = {};
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = 0;
+
+    socklen_t addr_len = sizeof(addr);
+
+    int port = 0;
+    if (bind(sockfd, (struct sockaddr *) &addr, sizeof(addr)) == 0 &&
+        getsockname(sockfd, (struct sockaddr *) &addr, &addr_len) == 0) {
+        port = ntohs(addr.sin_port);
+    }
+
+    closesocket(sockfd);
+
+    return port;
+}
+
+static bool test_compress_roundtrip(const char * name, const std::vector<uint8_t> & src, bool compressible) {
+    std::vector<uint8_t> dst(src.size());
+    const size_t compressed_size = src.empty() ? 0 : rpc_compress(src.data(), src.size(), dst.data(), src.size() - 1);
+
+    if (compressible && compressed_size == 0) {
+        fprintf(stderr, "%s: %s: the data was not compressed\n", __func__, name);
+        return false;
+    }
+    if (compressed_size == 0) {
+        return true;
+    }
+    if (compressed_size >= src.size()) {
+        fprintf(stderr, "%s: %s: compressed size %zu >= %zu\n", __func__, name, compressed_size, src.size());
+        return false;
+    }
+
+    std::vector<uint8_t> out(src.size());
+    if (!rpc_decompress(dst.data(), compressed_size, out.data(), out.size()) || out != src) {
+        fprintf(stderr, "%s: %s: the decompressed data differs\n", __func__, name);
+        return false;
+    }
+
+    // a truncated input or a too small output is an error
+    if (rpc_decompress(dst.data(), compressed_size - 1, out.data(), out.size()) ||
+        rpc_decompress(dst.data(), compressed_size, out.data(), out.size() - 1)) {
+        fprintf(stderr, "%s: %s: invalid data was decompressed\n", __func__, name);
+        return false;
+    }
+
+    return true;
+}
+
+static bool test_compress() {
+    std::mt19937 rng(42);
+
+    bool ok = true;
+
+    for (size_t size : { (size_t) 1, (size_t) 17, (size_t) 4096, (size_t) 100000 }) {
+        std::vector<uint8_t> zeros(size, 0);
+        ok &= test_compress_roundtrip("zeros", zeros, size > 16);
+
+        std::vector<uint8_t> random(size);
+        for (auto & v : random) {
+            v = (uint8_t) rng();
+        }
+        ok &= test_compress_roundtrip("random", random, false);
+
+        // long runs and repeated sequences, with matches that overlap the output
+        std::vector<uint8_t> pattern(size);
+        for (size_t i = 0; i < size; i++) {
+            pattern[i] = (uint8_t) ((i / 300) % 2 ? i % 7 : (i * 31) % 251);
+        }
+        ok &= test_compress_roundtrip("pattern", pattern, size > 4096);
+
+        // f32 values with few distinct values, as in the activations of a small model
+        std::vector<float> values(size / sizeof(float));
+        for (auto & v : values) {
+            v = (float) (rng() % 16) * 0.25f;
+        }
+        std::vector<uint8_t> bytes((const uint8_t *) values.data(), (const uint8_t *) (values.data() + values.size()));
+        ok &= test_compress_roundtrip("f32", bytes, false);
+    }
+
+    // repetitions far apart are not matched, but must be correct
+    std::vector<uint8_t> far(200000);
+    for (size_t i = 0; i < far.size(); i++) {
+        far[i] = (uint8_t) ((i % 70000) * 2654435761u >> 24);
+    }
+    ok &= test_compress_roundtrip("far", far, false);
+
+    return ok;
+}
+
+// the writes and the reads are queued and sent in batches, the reads must see the writes queued before them
+static bool test_async_order() {
+    const int port = find_free_port();
+    if (port == 0) {
+        fprintf(stderr, "%s: failed to find a free port\n", __func__);
+        return false;
+    }
+
+    const std::string endpoint = "127.0.0.1:" + std::to_string(port);
+
+    ggml_backend_t backend_cpu = ggml_backend_cpu_init();
+
+    std::thread server([backend_cpu, endpoint] {
+        ggml_backend_rpc_start_server(backend_cpu, endpoint.c_str(), nullptr, 1ull << 30, 1ull << 30);
+    });
+    // the server runs until the end of the process
+    server.detach();
+
+    ggml_backend_buffer_type_t buft = nullptr;
+    for (int i = 0; i < 100 && buft == nullptr; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        buft = ggml_backend_rpc_buffer_type(endpoint.c_str());
+    }
+    if (buft == nullptr) {
+        fprintf(stderr, "%s: failed to connect to the RPC server at %s\n", __func__, endpoint.c_str());
+        return false;
+    }
+
+    ggml_backend_t backend = ggml_backend_rpc_init(endpoint.c_str());
+
+    ggml_init_params params = {
+        /* .mem_size   = */ 2*ggml_tensor_overhead(),
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ true,
+    };
+    ggml_context * ctx = ggml_init(params);
+
+    // large enough to be compressed when GGML_RPC_COMPRESS is set
+    const int64_t n = 16*1024;
+
+    ggml_tensor * a = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n);
+    ggml_tensor * b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n);
+
+    ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors_from_buft(ctx, buft);
+    ggml_backend_buffer_set_usage(buf, GGML_BACKEND_BUFFER_USAGE_COMPUTE);
+
+    std::vector<float> data0(n), data1(n), data2(n);
+    for (int64_t i = 0; i < n; i++) {
+        data0[i] = (float) (i % 8);
+        data1[i] = (float) (i % 16) + 0.5f;
+        data2[i] = (float) i;
+    }
+
+    std::vector<float> out0(n), out1(n), out2(n), out3(n);
+
+    // write then read
+    ggml_backend_tensor_set_async(backend, a, data0.data(), 0, ggml_nbytes(a));
+    ggml_backend_tensor_set_async(backend, b, data2.data(), 0, ggml_nbytes(b));
+    ggml_backend_tensor_get_async(backend, a, out0.data(), 0, ggml_nbytes(a));
+
+    // read then write, the read sees the previous data
+    ggml_backend_tensor_get_async(backend, a, out1.data(), 0, ggml_nbytes(a));
+    ggml_backend_tensor_set_async(backend, a, data1.data(), 0, ggml_nbytes(a));
+    ggml_backend_tensor_get_async(backend, a, out2.data(), 0, ggml_nbytes(a));
+    ggml_backend_tensor_get_async(backend, b, out3.data(), 0, ggml_nbytes(b));
+
+    ggml_backend_synchronize(backend);
+
+    bool ok = true;
+    if (out0 != data0) {
+        fprintf(stderr, "%s: the read after a write returned the wrong data\n", __func__);
+        ok = false;
+    }
+    if (out1 != data0) {
+        fprintf(stderr, "%s: the read before a write returned the wrong data\n", __func__);
+        ok = false;
+    }
+    if (out2 != data1 || out3 != data2) {
+        fprintf(stderr, "%s: the reads after the writes returned the wrong data\n", __func__);
+        ok = false;
+    }
+
+    ggml_backend_buffer_free(buf);
+    ggml_free(ctx);
+    ggml_backend_free(backend);
+
+    return ok;
+}
+
+int main(void) {
+    bool ok = true;
+
+    printf("%s: compression\n", __func__);
+    ok &= test_compress();
+
+    printf("%s: asynchronous transfers\n", __func__);
+    ok &= test_async_order();
+
+    printf("%s: %s\n", __func__, ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
@@ -1,5 +1,6 @@
 #include "ggml.h"
 #include "llama.h"
+#include "sampling.h"
 
 #ifdef NDEBUG
 #undef NDEBUG
@@ -287,6 +288,79 @@ static void bench(llama_sampler * cnstr, const char * cnstr_name, const std::vec
 
 #define BENCH(__cnstr, __data, __n_iter) bench((__cnstr), #__cnstr, (__data), (__n_iter))
 
+// with ties, the logits take only a few distinct values and many of them are equal at the k-th position
+static void test_prefilter_top_k(const int n_vocab, const int k, const bool ties = false) {
+    std::vector<float> logits(n_vocab);
+    for (int i = 0; i < n_vocab; i++) {
+        logits[i] = 20.0f*((double)(rand())/RAND_MAX - 0.5);
+        if (ties) {
+            logits[i] = std::round(logits[i]);
+        }
+    }
+
+    std::vector<llama_token_data> cur(n_vocab);
+    for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
+        cur[token_id] = llama_token_data{token_id, logits[token_id], 0.0f};
+    }
+    llama_token_data_array cur_p = { cur.data(), cur.size(), -1, false };
+
+    auto * top_k = llama_sampler_init_top_k(k);
+    llama_sampler_apply(top_k, &cur_p);
+    llama_sampler_free(top_k);
+
+    std::vector<llama_token_data> cur_pf;
+    common_sampler_prefilter_top_k(logits.data(), n_vocab, k, cur_pf);
+
+    GGML_ASSERT(cur_pf.size() == cur_p.size);
+    for (size_t i = 0; i < cur_p.size; i++) {
+        GGML_ASSERT(cur_pf[i].logit == cur_p.data[i].logit);
+        GGML_ASSERT(cur_pf[i].id    == cur_p.data[i].id);
+    }
+
+    printf("Prefilter top-k OK with n_vocab=%06d k=%05d%s\n", n_vocab, k, ties ? " (ties)" : "");
+}
+
+// the common chain (top-k -> top-p -> min-p -> temp -> dist) on the full vocab vs on the prefiltered candidates
+static void bench_chain(const int n_vocab, const int n_iter) {
+    std::vector<float> logits(n_vocab);
+    for (int i = 0; i < n_vocab; i++) {
+        logits[i] = 20.0f*((double)(rand())/RAND_MAX - 0.5);
+    }
+
+    auto * chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(chain, llama_sampler_init_top_k(40));
+    llama_sampler_chain_add(chain, llama_sampler_init_top_p(0.95f, 1));
+    llama_sampler_chain_add(chain, llama_sampler_init_min_p(0.05f, 1));
+    llama_sampler_chain_add(chain, llama_sampler_init_temp (0.8f));
+    llama_sampler_chain_add(chain, llama_sampler_init_dist (0));
+
+    std::vector<llama_token_data> cur;
+
+    int64_t t_start = ggml_time_us();
+    for (int i = 0; i < n_iter; i++) {
+        cur.resize(n_vocab);
+        for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
+            cur[token_id] = llama_token_data{token_id, logits[token_id], 0.0f};
+        }
+        llama_token_data_array cur_p = { cur.data(), cur.size(), -1, false };
+        llama_sampler_apply(chain, &cur_p);
+    }
+    const int64_t t_generic = ggml_time_us() - t_start;
+
+    t_start = ggml_time_us();
+    for (int i = 0; i < n_iter; i++) {
+        common_sampler_prefilter_top_k(logits.data(), n_vocab, 40, cur);
+        llama_token_data_array cur_p = { cur.data(), cur.size(), -1, true };
+        llama_sampler_apply(chain, &cur_p);
+    }
+    const int64_t t_prefilter = ggml_time_us() - t_start;
+
+    llama_sampler_free(chain);
+
+    printf("chain k=40 p=0.95 m=0.05 t=0.8, n_vocab = %6d: generic %8.3f us/iter, prefilter %8.3f us/iter\n",
+            n_vocab, t_generic / (float) n_iter, t_prefilter / (float) n_iter);
+}
+
 static void test_perf() {
     const int n_vocab = 1 << 17;
 
@@ -303,6 +377,10 @@ static void test_perf() {
     BENCH(llama_sampler_init_min_p  (0.2f, 1),                data, 32);
     BENCH(llama_sampler_init_typical(0.5f, 1),                data, 32);
     BENCH(llama_sampler_init_xtc    (1.0f, 0.1f, 1, 1),       data, 32);
+
+    for (int n : { 32000, 128000, 256000 }) {
+        bench_chain(n, 32);
+    }
 }
 
 int main(void) {
@@ -392,6 +470,15 @@ int main(void) {
     test_sampler_queue(10000, "mkp", 100, 0.8f, 0.1f);
     test_sampler_queue(10000, "mpk", 100, 0.8f, 0.1f);
 
+    test_prefilter_top_k(32000,      1);
+    test_prefilter_top_k(32000,     40);
+    test_prefilter_top_k(128000,   500);
+    test_prefilter_top_k(256000, 10000);
+    test_prefilter_top_k(32000,      1, true);
+    test_prefilter_top_k(32000,     40, true);
+    test_prefilter_top_k(128000,   500, true);
+    test_prefilter_top_k(256000, 10000, true);
+
     printf("OK\n");
 
     test_perf();
@@ -0,0 +1,125 @@
+// tests the online selection of the number of threads (llama_thread_tuner) with synthetic timings
+
+#include "../src/llama-thread-tuner.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+
+// time of a ubatch per token with n threads: the compute scales with the threads, the synchronization does not
+using cost_fn = std::function<double(int32_t n)>;
+
+static cost_fn make_cost(double t_compute, double t_sync) {
+    return [=](int32_t n) { return t_compute/n + t_sync*n; };
+}
+
+// the thread count of the grid explored by the tuner (n_max, n_max - step, ..., 1) with the lowest cost
+static int32_t best_reachable(int32_t n_max, const cost_fn & cost) {
+    const int32_t step = std::max(1, n_max/8);
+
+    int32_t best = n_max;
+    for (int32_t n = n_max; ; n = std::max(1, n - step)) {
+        if (cost(n) < cost(best)) {
+            best = n;
+        }
+        if (n == 1) {
+            break;
+        }
+    }
+
+    return best;
+}
+
+// runs n_ubatch ubatches, returns false if a thread count out of [1, n_max] is used
+static bool run(llama_thread_tuner & tuner, uint32_t n_tokens, int n_ubatch, const cost_fn & cost, std::mt19937 & rng) {
+    std::uniform_real_distribution<double> noise(0.99, 1.01);
+
+    const int32_t n_max = tuner.max(n_tokens);
+
+    for (int i = 0; i < n_ubatch; ++i) {
+        const int32_t n = tuner.get(n_tokens);
+        if (n < 1 || n > n_max) {
+            fprintf(stderr, "%s: n_tokens = %u: %d threads out of [1, %d]\n", __func__, n_tokens, n, n_max);
+            return false;
+        }
+
+        tuner.record(n_tokens, n, (int64_t) (cost(n)*n_tokens*noise(rng)));
+    }
+
+    return true;
+}
+
+static bool check_best(const llama_thread_tuner & tuner, uint32_t n_tokens, const cost_fn & cost, const char * name) {
+    const int32_t n_max    = tuner.max(n_tokens);
+    const int32_t expected = best_reachable(n_max, cost);
+    const int32_t best     = tuner.best(n_tokens);
+
+    // within the margin of the tuner, a neighbour of the optimum can be kept
+    if (best != expected && cost(best) > cost(expected)*1.05) {
+        fprintf(stderr, "%s: %s: n_tokens = %u: best = %d threads (%.1f us/token), expected %d threads (%.1f us/token)\n", __func__,
+                name, n_tokens, best, cost(best), expected, cost(expected));
+        return false;
+    }
+
+    return true;
+}
+
+int main(void) {
+    std::mt19937 rng(42);
+
+    bool ok = true;
+
+    // converges down from the configured number of threads, then follows the changes of the load
+    {
+        llama_thread_tuner tuner(16, 8);
+
+        const cost_fn cost_low  = make_cost(1000.0, 20.0);  // optimum at ~7 threads
+        const cost_fn cost_high = make_cost(1000.0, 100.0); // optimum at ~3 threads
+        const cost_fn cost_none = make_cost(1000.0, 0.1);   // optimum at all the threads
+
+        ok &= run(tuner, 1, 2000, cost_low, rng) && check_best(tuner, 1, cost_low, "low load");
+        ok &= run(tuner, 1, 4000, cost_high, rng) && check_best(tuner, 1, cost_high, "high load");
+        ok &= run(tuner, 1, 4000, cost_none, rng) && check_best(tuner, 1, cost_none, "no load");
+
+        // the other buckets are not affected
+        if (tuner.best(64) != 8 || tuner.max(64) != 8) {
+            fprintf(stderr, "%s: the batch bucket changed: best = %d, max = %d\n", __func__, tuner.best(64), tuner.max(64));
+            ok = false;
+        }
+    }
+
+    // the batch buckets use n_threads_batch, step of a single thread
+    {
+        llama_thread_tuner tuner(4, 8);
+
+        const cost_fn cost = make_cost(500.0, 30.0); // optimum at ~4 threads
+
+        ok &= run(tuner, 64, 2000, cost, rng) && check_best(tuner, 64, cost, "batch");
+        ok &= tuner.max(64) == 8 && tuner.max(1) == 4;
+    }
+
+    // the lower limit: one thread is the fastest
+    {
+        llama_thread_tuner tuner(12, 12);
+
+        const cost_fn cost = make_cost(10.0, 50.0);
+
+        ok &= run(tuner, 1, 4000, cost, rng) && check_best(tuner, 1, cost, "single thread");
+        ok &= tuner.best(1) == 1;
+    }
+
+    // a single thread is never changed
+    {
+        llama_thread_tuner tuner(1, 1);
+
+        ok &= run(tuner, 1, 1000, make_cost(1000.0, 0.0), rng);
+        ok &= tuner.best(1) == 1;
+    }
+
+    printf("%s: %s\n", __func__, ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
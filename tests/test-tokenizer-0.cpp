@@ -2,6 +2,7 @@
 #include "common.h"
 #include "console.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <string>
 #include <map>
@@ -195,61 +196,129 @@ int main(int argc, char **argv) {
 
     const bool add_special = false;
 
+    // the BPE tokenizer caches the tokens of the words - the tests are run on a cold cache (the vocab was just loaded),
+    // then on a warm cache and finally by several threads that share the cache
+    const auto check_test = [&](const std::string & text, const std::vector<llama_token> & expected, const char * mode) {
+        const std::vector<llama_token> res = common_tokenize(ctx, text, add_special, false);
+
+        if (res == expected) {
+            return true;
+        }
+
+        fprintf(stderr, "%s : failed test (%s): '%s'\n", __func__, mode, text.c_str());
+        fprintf(stderr, "%s : detokenized to: '%s' instead of '%s'\n", __func__,
+            common_detokenize(ctx, res).c_str(),
+            common_detokenize(ctx, expected).c_str());
+        fprintf(stderr, "%s : expected tokens: ", __func__);
+        for (const auto & t : expected) {
+            fprintf(stderr, "%6d '%s', ", t, common_token_to_piece(ctx, t).c_str());
+        }
+        fprintf(stderr, "\n");
+        fprintf(stderr, "%s : got tokens:      ", __func__);
+        for (const auto & t : res) {
+            fprintf(stderr, "%6d '%s', ", t, common_token_to_piece(ctx, t).c_str());
+        }
+        fprintf(stderr, "\n");
+
+        return false;
+    };
+
+    for (const char * mode : { "cold cache", "warm cache" }) {
+        for (const auto & test_kv : k_tests) {
+            success &= check_test(test_kv.first, test_kv.second, mode);
+        }
+    }
+
+    for (const auto & test_kv : k_tests) {
+        const std::vector<llama_token> res = common_tokenize(ctx, test_kv.first, add_special, false);
+
+        printf("\n");
+        printf("src: '%s'\n", test_kv.first.c_str());
+        printf("res: '%s'\n", common_detokenize(ctx, res).c_str());
+        printf("tok: ");
+        for (const auto & tok : res) {
+            printf("%d ", tok);
+        }
+        printf("\n");
+    }
+
     // multi-threaded tokenization
-    const int nthread = std::thread::hardware_concurrency();
-    std::vector<std::thread> threads(nthread);
+    // more distinct words than the cache can hold, so that the threads evict the entries that the others read
+    if (!k_tests.empty()) {
+        std::vector<std::string> words;
+        std::vector<std::vector<llama_token>> words_expected;
+        for (int i = 0; i < 40000; i++) {
+            words.push_back(" w" + std::to_string(i*7919 % 100003) + (i % 3 == 0 ? " x" : ""));
+            words_expected.push_back(common_tokenize(ctx, words.back(), add_special, false));
+        }
 
-    for (int i = 0; i < nthread; i++) {
-        threads[i] = std::thread([&, i]() {
-            for (const auto & test_kv : k_tests) {
-                const std::vector<llama_token> res = common_tokenize(ctx, test_kv.first, add_special, false);
+        const int nthread = std::max(4u, std::thread::hardware_concurrency());
+        std::vector<std::thread> threads(nthread);
+        std::vector<char> threads_success(nthread, 1);
 
-                // here only print the result of the first thread
-                // because the other threads are running the same tests
-                if (i != 0) {
-                    continue;
-                }
+        for (int i = 0; i < nthread; i++) {
+            threads[i] = std::thread([&, i]() {
+                bool ok = true;
 
-                printf("\n");
-                printf("src: '%s'\n", test_kv.first.c_str());
-                printf("res: '%s'\n", common_detokenize(ctx, res).c_str());
-                printf("tok: ");
-                for (const auto & tok : res) {
-                    printf("%d ", tok);
-                }
-                printf("\n");
+                // each thread starts at a different word
+                for (size_t j = 0; j < words.size(); j++) {
+                    const size_t k = (j + i*words.size()/nthread) % words.size();
 
-                bool correct = res.size() == test_kv.second.size();
-                for (int i = 0; i < (int) res.size() && correct; ++i) {
-                    if (test_kv.second[i] != res[i]) {
-                        correct = false;
+                    ok &= common_tokenize(ctx, words[k], add_special, false) == words_expected[k];
+
+                    if (j % 1000 == 0) {
+                        for (const auto & test_kv : k_tests) {
+                            ok &= check_test(test_kv.first, test_kv.second, "multi-threaded");
+                        }
                     }
                 }
 
-                if (!correct) {
-                    fprintf(stderr, "%s : failed test:    '%s'\n", __func__, test_kv.first.c_str());
-                    fprintf(stderr, "%s : detokenized to: '%s' instead of '%s'\n", __func__,
-                        common_detokenize(ctx, res).c_str(),
-                        common_detokenize(ctx, test_kv.second).c_str());
-                    fprintf(stderr, "%s : expected tokens: ", __func__);
-                    for (const auto & t : test_kv.second) {
-                        fprintf(stderr, "%6d '%s', ", t, common_token_to_piece(ctx, t).c_str());
-                    }
-                    fprintf(stderr, "\n");
-                    fprintf(stderr, "%s : got tokens:      ", __func__);
-                    for (const auto & t : res) {
-                        fprintf(stderr, "%6d '%s', ", t, common_token_to_piece(ctx, t).c_str());
-                    }
-                    fprintf(stderr, "\n");
+                threads_success[i] = ok;
+            });
+        }
 
-                    success = false;
-                }
+        for (int i = 0; i < nthread; i++) {
+            threads[i].join();
+            if (!threads_success[i]) {
+                fprintf(stderr, "%s : failed multi-threaded test in thread %d\n", __func__, i);
+                success = false;
             }
-        });
+        }
     }
 
-    for (int i = 0; i < nthread; i++) {
-        threads[i].join();
+    // batched tokenization - must produce the same tokens as the tests and as the serial tokenizer
+    if (!k_tests.empty()) {
+        const llama_vocab * vocab = llama_model_get_vocab(model);
+
+        std::vector<std::string> texts;
+        std::vector<std::vector<llama_token>> texts_expected;
+        for (const auto & test_kv : k_tests) {
+            texts.push_back(test_kv.first);
+            texts_expected.push_back(test_kv.second);
+        }
+
+        // a large text, split into chunks of pre-tokenizer words by the batched tokenizer
+        std::string text_all;
+        for (int i = 0; i < 64; i++) {
+            for (const auto & test_kv : k_tests) {
+                text_all += test_kv.first;
+            }
+        }
+        texts.push_back(text_all);
+
+        for (const bool parse_special : { false, true }) {
+            const auto res = common_tokenize_batch(vocab, texts, add_special, parse_special);
+
+            for (size_t i = 0; i < texts.size(); ++i) {
+                const auto expected = i < texts_expected.size() && !parse_special ? texts_expected[i] : common_tokenize(ctx, texts[i], add_special, parse_special);
+
+                if (res[i] != expected) {
+                    fprintf(stderr, "%s : failed batched test (parse_special = %d): '%s'\n", __func__, parse_special,
+                        texts[i].size() < 256 ? texts[i].c_str() : "<all tests>");
+                    success = false;
+                }
+            }
+        }
     }
 
     // single threaded tokenization
@@ -277,11 +346,46 @@ int main(int argc, char **argv) {
 
             const auto t_end = ggml_time_us();
 
-            fprintf(stderr, "%s : tokenized in %.3f ms (cpp)\n", __func__, (t_end - t_start) / 1000.0);
+            fprintf(stderr, "%s : tokenized in %.3f ms (cpp), %.2f MB/s\n", __func__, (t_end - t_start) / 1000.0,
+                text.size() / (double) (t_end - t_start));
         }
 
         fprintf(stderr, "%s : tokens: %zu\n", __func__, res.size());
 
+        // batched tokenization of the whole text and of the text split into documents
+        {
+            const llama_vocab * vocab = llama_model_get_vocab(model);
+
+            std::vector<std::string> docs;
+            for (size_t pos = 0; pos < text.size();) {
+                const size_t end = std::min(text.find('\n', pos + 4096), text.size());
+                docs.push_back(text.substr(pos, end - pos));
+                pos = end;
+            }
+
+            for (const auto & texts : { std::vector<std::string>{ text }, docs }) {
+                const auto t_start = ggml_time_us();
+
+                const auto res_batch = common_tokenize_batch(vocab, texts, add_special, false);
+
+                const auto t_end = ggml_time_us();
+
+                std::vector<llama_token> res_all;
+                for (const auto & r : res_batch) {
+                    res_all.insert(res_all.end(), r.begin(), r.end());
+                }
+
+                fprintf(stderr, "%s : tokenized %zu document(s) in %.3f ms (cpp, batch), %.2f MB/s\n", __func__, texts.size(),
+                    (t_end - t_start) / 1000.0, text.size() / (double) (t_end - t_start));
+
+                // splitting the text into documents can change the tokens at the document boundaries
+                if (texts.size() == 1 && res_all != res) {
+                    fprintf(stderr, "%s : error: batched tokenization differs from the serial tokenization\n", __func__);
+                    success = false;
+                }
+            }
+        }
+
         {
             const std::string fname_out = fname_text + ".tokcpp";
 
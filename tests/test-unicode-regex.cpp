@@ -0,0 +1,226 @@
+// tests the compiled regex engine of the pre-tokenizers against std::regex / std::wregex
+// and the custom implementations of the common expressions against both
+
+#include "../src/unicode.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+// the expressions of the pre-tokenizers in llama-vocab.cpp
+static const std::vector<std::vector<std::string>> k_pre_tokenizers = {
+    // llama3, dbrx, smaug, chatglm4
+    {
+        "(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}{1,3}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+",
+    },
+    // deepseek-llm
+    {
+        "[\r\n]",
+        "\\s?[A-Za-zµÀ-ÖØ-öø-ƺƼ-ƿǄ-ʓʕ-ʯͰ-ͳͶͷͻ-ͽͿΆΈ-ΊΌΎ-ΡΣ-ϵϷ-ҁҊ-ԯԱ-ՖႠ-ჅᎠ-Ᏽᏸ-ᏽᲐ-ᲺᲽ-Ჿᴀ-ᴫᵫ-ᵷᵹ-ᶚḀ-ἕἘ-Ἕἠ-ὅὈ-Ὅὐ-ὗὙὛὝὟ-ώᾀ-ᾴᾶ-ᾼιῂ-ῄῆ-ῌῐ-ΐῖ-Ίῠ-Ῥῲ-ῴῶ-ῼℂℇℊ-ℓℕℙ-ℝℤΩℨK-ℭℯ-ℴℹℼ-ℿⅅ-ⅉⅎↃↄⰀ-ⱻⱾ-ⳤⳫ-ⳮⳲⳳꙀ-ꙭꚀ-ꚛꜢ-ꝯꝱ-ꞇꞋ-ꞎꭰ-ꮿﬀ-ﬆﬓ-ﬗＡ-Ｚａ-ｚ𐐀-𐑏𐒰-𐓓𐓘-𐓻𐲀-𐲲𐳀-𐳲𑢠-𑣟𞤀-𞥃]+",
+        "\\s?[!-/:-~！-／：-～‘-‟　-。]+",
+        "\\s+$",
+        "[一-龥ࠀ-一가-퟿]+",
+        "\\p{N}+",
+    },
+    // deepseek3-llm, hunyuan-dense
+    {
+        "\\p{N}{1,3}",
+        "[一-龥぀-ゟ゠-ヿ]+",
+        "[!\"#$%&'()*+,\\-./:;<=>?@\\[\\\\\\]^_`{|}~][A-Za-z]+|[^\r\n\\p{L}\\p{P}\\p{S}]?[\\p{L}\\p{M}]+| ?[\\p{P}\\p{S}]+[\r\n]*|\\s*[\r\n]+|\\s+(?!\\S)|\\s+",
+    },
+    // deepseek-coder
+    {
+        "[\r\n]",
+        "\\s?\\p{L}+",
+        "\\s?\\p{P}+",
+        "[一-龥ࠀ-一가-퟿]+",
+        "\\p{N}",
+    },
+    // falcon
+    {
+        "[\\p{P}\\$\\+<=>\\^~\\|`]+",
+        "'s|'t|'re|'ve|'m|'ll|'d| ?\\p{L}+| ?\\p{N}+| ?[^\\s\\p{L}\\p{N}]+|\\s+(?!\\S)",
+        "[0-9][0-9][0-9]",
+    },
+    // starcoder, refact, command-r, smollm, codeshell, exaone, minerva
+    {
+        "\\p{N}",
+        "'s|'t|'re|'ve|'m|'ll|'d| ?\\p{L}+| ?\\p{N}+| ?[^\\s\\p{L}\\p{N}]+|\\s+(?!\\S)",
+    },
+    // gpt2, mpt, olmo, jais, trillion
+    {
+        "'s|'t|'re|'ve|'m|'ll|'d| ?\\p{L}+| ?\\p{N}+| ?[^\\s\\p{L}\\p{N}]+|\\s+(?!\\S)",
+    },
+    // stablelm2, qwen2, hunyuan
+    {
+        "(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+",
+    },
+    // poro, bloom, gpt3-finnish
+    {
+        " ?[^(\\s|.,!?…。，、।۔،)]+",
+    },
+    // viking
+    {
+        " ?[^(\\s|.,!?…。，、।۔،)]+",
+        "\\p{N}",
+    },
+    // tekken
+    {
+        "[^\\r\\n\\p{L}\\p{N}]?((?=[\\p{L}])([^a-z]))*((?=[\\p{L}])([^A-Z]))+|[^\\r\\n\\p{L}\\p{N}]?((?=[\\p{L}])([^a-z]))+((?=[\\p{L}])([^A-Z]))*|\\p{N}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n/]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+",
+    },
+    // chameleon
+    {
+        "<sentinel:[0-9]+>",
+        "(IMGIMG)((A|B|C|D|E|F|G|H|I){1,4})Z",
+        "([\\t\\n]|    |  )",
+        "\\p{N}",
+        "[\\p{P}!-/:-@\\[-`{-~]",
+        "'s|'t|'re|'ve|'m|'ll|'d| ?\\p{L}+| ?\\p{N}+| ?[^\\s\\p{L}\\p{N}]+|\\s+(?!\\S)",
+    },
+    // gpt4o
+    {
+        "[^\\r\\n\\p{L}\\p{N}]?((?=[\\p{L}])([^a-z]))*((?=[\\p{L}])([^A-Z]))+(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])?|[^\\r\\n\\p{L}\\p{N}]?((?=[\\p{L}])([^a-z]))+((?=[\\p{L}])([^A-Z]))*(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])?|\\p{N}{1,3}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n/]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+",
+    },
+    // superbpe - the second expression only has empty matches
+    {
+        "\\p{N}+",
+        "(?=(\\d{3})+(?!\\d))",
+    },
+    // bailingmoe
+    {
+        "'(?:[sSdDmMtT]|[lL][lL]|[vV][eE]|[rR][eE])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]|\\s+(?!\\S)|\\s+",
+    },
+    // seed-coder
+    {
+        "(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}{1}| ?[^\\s\\p{L}\\p{N}\\r\\n]+|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+",
+    },
+    // default
+    {
+        "[\\p{P}\\$\\+<=>\\^~\\|]+",
+        "'s|'t|'re|'ve|'m|'ll|'d| ?\\p{L}+| ?\\p{N}+| ?[^\\s\\p{L}\\p{N}]+|\\s+(?!\\S)",
+        "\\p{N}+",
+        "[0-9][0-9][0-9]",
+    },
+};
+
+// other syntax supported by the compiled regex engine: lazy quantifiers, anchors, empty matches
+static const std::vector<std::vector<std::string>> k_syntax = {
+    { "a*" },
+    { "\\s*" },
+    { "x?" },
+    { "^\\s+|\\s+$" },
+    { "[a-z]+?\\d" },
+    { "(ab|a)(c|bcd)" },
+    { "(?!\\d)\\S+" },
+    { "\\d{2,}" },
+    { "[^\\s]{1,2}" },
+};
+
+static const std::vector<std::string> k_texts = {
+    "",
+    " ",
+    "\n",
+    "\r\n\r\n",
+    "   \t  \n ",
+    "Hello world",
+    " Hello World!",
+    "I'm here, you're there, it's THEIR'S, we'LL see, he'd've",
+    "w048 7tuijk dsdfhu",
+    "12345678 1 22 333 4444 55555 666666 1,000,000",
+    "нещо на Български",
+    "កាន់តែពិសេសអាចខលចេញ",
+    "🚀 (normal) 😶‍🌫️ (multiple emojis concatenated) ✅ (only emoji that has its own token)",
+    "Hello, y'all! How are you 😁 ?我想在apple工作1314151天～",
+    "   Hello\n    Hello",
+    "<sentinel:12> IMGIMGABCZ IMGIMGABCDEFZ",
+    "CamelCaseWord lowercase UPPERCASE MiXeD aBc",
+    "e\u0301 a\u0300\u0301 \u0301",
+    "\u00a0non\u2003breaking\u3000spaces\u0085next",
+    "ＡＢＣａｂｃ！？１２３",
+    "한국어 텍스트 日本語のテキスト 中文文本",
+    "नमस्ते दुनिया। مرحبا بالعالم۔",
+    "math: x²+y²=z², ½ ⅓ ∑ ∞ ≤ ≥ €100 $5 ¥",
+    "tabs\tand\vvertical\fform feeds",
+    "code: if (a[i] >= 0) { return b->c; } // ok",
+};
+
+// random text from a pool of code points of all the categories
+static std::string random_text(std::mt19937 & rng) {
+    static const std::vector<uint32_t> pool = {
+        'a', 'b', 'x', 'z', 'A', 'B', 'S', 'T', 's', 't', 'l', 'd', 'I', 'M', 'G', 'Z',
+        '0', '1', '5', '9', ' ', ' ', ' ', '\t', '\n', '\r', '\'', '.', ',', '!', '?', '<', '>', '$', '+', '_', '(', ')', '/',
+        0x00B5, 0x00E9, 0x0301, 0x00A0, 0x0085, 0x00B2, 0x00BD, 0x0410, 0x0431, 0x0627, 0x06D4, 0x0915, 0x0964, 0x1780,
+        0x2003, 0x2018, 0x2026, 0x20AC, 0x3000, 0x3001, 0x3042, 0x30A2, 0x4E2D, 0x9FA5, 0xAC00, 0xFF21, 0xFF01, 0x1F680, 0x10400,
+    };
+
+    std::string text;
+
+    const int n = rng() % 48;
+    for (int i = 0; i < n; ++i) {
+        text += unicode_cpt_to_utf8(pool[rng() % pool.size()]);
+    }
+
+    return text;
+}
+
+// all the expressions must be supported by the compiled regex engine
+static bool test_exprs(const std::vector<std::string> & exprs, const std::vector<std::string> & texts) {
+    const unicode_regex_splitter splitter_std     (exprs, UNICODE_REGEX_ENGINE_STD);
+    const unicode_regex_splitter splitter_compiled(exprs, UNICODE_REGEX_ENGINE_COMPILED);
+    const unicode_regex_splitter splitter_custom  (exprs, UNICODE_REGEX_ENGINE_CUSTOM);
+
+    if (splitter_compiled.n_compiled() != exprs.size()) {
+        fprintf(stderr, "%s: '%s': %zu of %zu expressions are compiled\n", __func__, exprs[0].c_str(), splitter_compiled.n_compiled(), exprs.size());
+        return false;
+    }
+
+    for (const auto & text : texts) {
+        const auto res_std      = splitter_std.split(text);
+        const auto res_compiled = splitter_compiled.split(text);
+        const auto res_custom   = splitter_custom.split(text);
+
+        if (res_compiled != res_std || res_custom != res_std) {
+            fprintf(stderr, "%s: '%s': text '%s': %zu words (std::regex), %zu words (compiled), %zu words (custom)\n", __func__,
+                    exprs[0].c_str(), text.c_str(), res_std.size(), res_compiled.size(), res_custom.size());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(void) {
+    std::mt19937 rng(42);
+
+    std::vector<std::string> texts = k_texts;
+    for (int i = 0; i < 2000; ++i) {
+        texts.push_back(random_text(rng));
+    }
+
+    // all the texts at once, to cover long inputs
+    std::string text_all;
+    for (const auto & text : texts) {
+        text_all += text;
+    }
+    texts.push_back(text_all);
+
+    bool ok = true;
+
+    // each expression alone and all the expressions of a pre-tokenizer, which split the words of the previous ones
+    for (const auto & exprs : k_pre_tokenizers) {
+        for (const auto & expr : exprs) {
+            ok &= test_exprs({ expr }, texts);
+        }
+        ok &= test_exprs(exprs, texts);
+    }
+
+    for (const auto & exprs : k_syntax) {
+        ok &= test_exprs(exprs, texts);
+    }
+
+    printf("%s: %s\n", __func__, ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
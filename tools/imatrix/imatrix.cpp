@@ -5,8 +5,10 @@
 #include "gguf.h"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdio>
 #include <cstring>
 #include <ctime>
@@ -14,6 +16,8 @@
 #include <mutex>
 #include <vector>
 #include <fstream>
+#include <functional>
+#include <memory>
 #include <unordered_map>
 #include <map>
 #include <regex>
@@ -29,7 +33,7 @@ static void print_usage(int, char ** argv) {
             "       -m model.gguf -f some-text.txt [-o imatrix.gguf] [--output-format {gguf,dat}] [--no-ppl] \\\n"
             "       [--process-output] [--chunk 123] [--save-frequency 0] [--output-frequency 10] \\\n"
             "       [--in-file imatrix-prev-0.gguf --in-file imatrix-prev-1.gguf ...] [--parse-special] \\\n"
-            "       [--show-statistics] [...]\n" , argv[0]);
+            "       [--shard 0/4] [--show-statistics] [...]\n" , argv[0]);
     LOG("\n");
 }
 
@@ -57,6 +61,74 @@ struct tensor_statistics {
     float cossim       = 0.0f;
 };
 
+// persistent threads for accumulating the activations, the calling thread takes part in the work
+struct imatrix_worker_pool {
+    std::vector<std::thread> threads;
+
+    const std::function<void(int, int)> * task = nullptr;
+
+    uint64_t n_runs    = 0;
+    int      n_pending = 0;
+    bool     stop      = false;
+
+    std::mutex              mutex;
+    std::condition_variable cv_task;
+    std::condition_variable cv_done;
+
+    explicit imatrix_worker_pool(int n_threads) {
+        for (int ith = 1; ith < n_threads; ++ith) {
+            threads.emplace_back([this, ith, n_threads] {
+                uint64_t n_seen = 0;
+                while (true) {
+                    const std::function<void(int, int)> * cur;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        cv_task.wait(lock, [this, n_seen] { return stop || n_runs != n_seen; });
+                        if (stop) {
+                            return;
+                        }
+                        n_seen = n_runs;
+                        cur = task;
+                    }
+                    (*cur)(ith, n_threads);
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (--n_pending == 0) {
+                            cv_done.notify_one();
+                        }
+                    }
+                }
+            });
+        }
+    }
+
+    ~imatrix_worker_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv_task.notify_all();
+        for (auto & t : threads) {
+            t.join();
+        }
+    }
+
+    // call compute(ith, nth) on all the threads and wait for them to finish
+    void run(const std::function<void(int, int)> & compute) {
+        const int nth = (int) threads.size() + 1;
+        if (nth > 1) {
+            std::lock_guard<std::mutex> lock(mutex);
+            task      = &compute;
+            n_pending = nth - 1;
+            n_runs++;
+        }
+        cv_task.notify_all();
+        compute(0, nth);
+        std::unique_lock<std::mutex> lock(mutex);
+        cv_done.wait(lock, [this] { return n_pending == 0; });
+    }
+};
+
 class IMatrixCollector {
 public:
     IMatrixCollector() = default;
@@ -75,6 +147,12 @@ private:
     int32_t                                m_last_chunk = 0;
     std::vector<char>                      m_src1_data;
     std::vector<char>                      m_ids; // the expert ids from ggml_mul_mat_id
+
+    // the rows of the current ubatch and the offsets in Stats::values they are accumulated into
+    std::vector<std::pair<const float *, int64_t>> m_rows;
+    std::unique_ptr<imatrix_worker_pool>           m_pool;
+
+    void accumulate_rows(Stats & e, int64_t n_cols, const std::string & wname);
 };
 
 // remove any prefix and suffixes from the name
@@ -216,6 +294,60 @@ static void compute_cossim(std::vector<tensor_statistics> & tstats) {
     }
 }
 
+void IMatrixCollector::accumulate_rows(Stats & e, int64_t n_cols, const std::string & wname) {
+    // small ubatches are not worth waking up the threads for
+    const bool parallel = (int64_t) m_rows.size() * n_cols >= 256*1024 && m_params.cpuparams.n_threads > 1;
+
+    if (parallel && !m_pool) {
+        m_pool = std::make_unique<imatrix_worker_pool>(m_params.cpuparams.n_threads);
+    }
+
+    // only the rows of the experts used in this ubatch changed
+    std::vector<int64_t> offs_used;
+    offs_used.reserve(m_rows.size());
+    for (const auto & row : m_rows) {
+        offs_used.push_back(row.second);
+    }
+    std::sort(offs_used.begin(), offs_used.end());
+    offs_used.erase(std::unique(offs_used.begin(), offs_used.end()), offs_used.end());
+
+    std::atomic<int64_t> i_bad = -1;
+
+    // the columns are split between the threads, so every sum is accumulated in the same order as with a single thread
+    const std::function<void(int, int)> compute = [&](int ith, int nth) {
+        const int64_t j0 = n_cols*ith/nth;
+        const int64_t j1 = n_cols*(ith + 1)/nth;
+
+        for (const auto & [x, offs] : m_rows) {
+            float * values = e.values.data() + offs;
+            for (int64_t j = j0; j < j1; ++j) {
+                values[j] += x[j] * x[j];
+            }
+        }
+
+        for (const int64_t offs : offs_used) {
+            for (int64_t j = j0; j < j1; ++j) {
+                if (!std::isfinite(e.values[offs + j])) {
+                    i_bad = offs + j;
+                }
+            }
+        }
+    };
+
+    if (parallel) {
+        m_pool->run(compute);
+    } else {
+        compute(0, 1);
+    }
+
+    m_rows.clear();
+
+    if (i_bad >= 0) {
+        LOG_ERR("%f detected in %s\n", (float)e.values[i_bad], wname.c_str());
+        exit(1);
+    }
+}
+
 bool IMatrixCollector::collect_imatrix(struct ggml_tensor * t, bool ask, void * user_data) {
     GGML_UNUSED(user_data);
 
@@ -293,33 +425,27 @@ bool IMatrixCollector::collect_imatrix(struct ggml_tensor * t, bool ask, void *
             exit(1); //GGML_ABORT("fatal error");
         }
         LOG_DBGV(2, "%s[%d]: %32s, %s, %5d x %5d, %d\n", __func__, m_last_chunk, wname.c_str(), ggml_op_name(t->op), (int)src1->ne[0], (int)src1->ne[2], (int)src1->type);
-        // loop over all possible experts, regardless if they are used or not in the batch
-        for (int64_t ex = 0; ex < n_as; ++ex) {
-            size_t e_start = ex*src1->ne[0];
+        // gather the rows routed to each expert, then accumulate them all at once
+        for (int64_t idx = 0; idx < n_ids; ++idx) {
+            for (int64_t row = 0; row < src1->ne[2]; ++row) {
+                const int excur = *(const int32_t *) (m_ids.data() + row*ids->nb[1] + idx*ids->nb[0]);
 
-            for (int64_t idx = 0; idx < n_ids; ++idx) {
-                for (int64_t row = 0; row < src1->ne[2]; ++row) {
-                    const int excur = *(const int32_t *) (m_ids.data() + row*ids->nb[1] + idx*ids->nb[0]);
+                GGML_ASSERT(excur >= 0 && excur < n_as); // sanity check
 
-                    GGML_ASSERT(excur >= 0 && excur < n_as); // sanity check
+                const int64_t i11 = idx % src1->ne[1];
+                const int64_t i12 = row;
+                const float * x = (const float *)(data + i11*src1->nb[1] + i12*src1->nb[2]);
 
-                    if (excur != ex) continue;
+                e.counts[excur]++;
 
-                    const int64_t i11 = idx % src1->ne[1];
-                    const int64_t i12 = row;
-                    const float * x = (const float *)(data + i11*src1->nb[1] + i12*src1->nb[2]);
+                m_rows.emplace_back(x, excur*src1->ne[0]);
+            }
+        }
 
-                    e.counts[ex]++;
+        accumulate_rows(e, src1->ne[0], wname);
 
-                    for (int64_t j = 0; j < src1->ne[0]; ++j) {
-                        e.values[e_start + j] += x[j] * x[j];
-                        if (!std::isfinite((float)e.values[e_start + j])) {
-                            LOG_ERR("%f detected in %s\n", (float)e.values[e_start + j], wname.c_str());
-                            exit(1);
-                        }
-                    }
-                }
-            }
+        // loop over all possible experts, regardless if they are used or not in the batch
+        for (int64_t ex = 0; ex < n_as; ++ex) {
             const int32_t n_chunk = e.counts[ex] / chunk_size;
             if (n_chunk > m_last_chunk) {
                 const int32_t chunk_step = n_chunk - m_last_chunk;
@@ -368,16 +494,13 @@ bool IMatrixCollector::collect_imatrix(struct ggml_tensor * t, bool ask, void *
 
                 for (int64_t row = 0; row < src1->ne[1]; ++row) {
                     const float * x = (const float *) (data + row * src1->nb[1] + i2 * src1->nb[2] + i3 * src1->nb[3]);
-                    for (int64_t j = 0; j < src1->ne[0]; ++j) {
-                        e.values[mat_start + j] += x[j] * x[j];
-                        if (!std::isfinite((float)e.values[j])) {
-                            LOG_ERR("%f detected in %s\n", (float)e.values[j], wname.c_str());
-                            exit(1);
-                        }
-                    }
+                    m_rows.emplace_back(x, mat_start);
                 }
             }
         }
+
+        accumulate_rows(e, src1->ne[0], wname);
+
         // only 1 count in practice, except when a tensor is used for both MUL_MAT_ID and MUL_MAT
         for (size_t i = 0; i < e.counts.size(); ++i) {
             e.counts[i] += ggml_nrows(src1) / n_mat;
@@ -736,7 +859,11 @@ bool IMatrixCollector::load_imatrix(const char * file_name) {
         const int64_t n = gguf_get_arr_n(ctx_gguf, datasets_key);
         m_datasets.reserve(m_datasets.size() + n);
         for (int64_t i = 0; i < n; ++i) {
-            m_datasets.push_back(gguf_get_arr_str(ctx_gguf, datasets_key, i));
+            std::string dataset = gguf_get_arr_str(ctx_gguf, datasets_key, i);
+            // shards of the same dataset are listed only once
+            if (std::find(m_datasets.begin(), m_datasets.end(), dataset) == m_datasets.end()) {
+                m_datasets.push_back(std::move(dataset));
+            }
         }
     }
 
@@ -937,6 +1064,25 @@ static bool compute_imatrix(llama_context * ctx, const common_params & params, c
         return false;
     }
 
+    if (params.n_shards > 1) {
+        // --chunks limits the whole input, so that the merged shards cover the same chunks as a single run
+        if (params.n_chunks >= 0 && tokens.size() > (size_t) params.n_chunks*n_ctx) {
+            tokens.resize((size_t) params.n_chunks*n_ctx);
+        }
+
+        // keep only the chunks of this shard, the other processes collect the rest
+        std::vector<llama_token> shard;
+        for (size_t i = (size_t) params.i_shard*n_ctx; i + n_ctx <= tokens.size(); i += (size_t) params.n_shards*n_ctx) {
+            shard.insert(shard.end(), tokens.begin() + i, tokens.begin() + i + n_ctx);
+        }
+        if (shard.empty()) {
+            LOG_ERR("%s: there are no chunks left for shard %d/%d\n", __func__, params.i_shard, params.n_shards);
+            return false;
+        }
+        LOG_INF("%s: shard %d/%d, processing %zu of %zu chunks\n", __func__, params.i_shard, params.n_shards, shard.size()/n_ctx, tokens.size()/n_ctx);
+        tokens = std::move(shard);
+    }
+
     std::vector<float> logit_history;
     std::vector<float> prob_history;
 
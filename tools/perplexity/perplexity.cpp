@@ -8,16 +8,26 @@
 #include <array>
 #include <atomic>
 #include <cmath>
+#include <condition_variable>
 #include <cstdio>
 #include <cstring>
 #include <ctime>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <mutex>
 #include <random>
 #include <sstream>
 #include <thread>
 #include <vector>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #if defined(_MSC_VER)
 #pragma warning(disable: 4244 4267) // possible loss of data
 #endif
@@ -29,6 +39,185 @@ struct results_perplexity {
     std::vector<float>       probs;
 };
 
+// persistent threads for processing the logits
+// run() executes compute on all the threads and on the caller, compute fetches the work items itself
+// async() processes the logits of a batch of chunks in the background, while the next batch is decoded
+struct logits_worker_pool {
+    std::vector<std::thread>          threads;
+    std::deque<std::function<void()>> tasks;
+
+    std::thread           bg_thread;
+    std::function<void()> bg_task;
+    bool                  bg_busy = false;
+
+    bool stop = false;
+
+    std::mutex              mutex;
+    std::condition_variable cv_tasks;
+    std::condition_variable cv_done;
+    std::condition_variable cv_bg;
+
+    explicit logits_worker_pool(int n_threads) {
+        for (int i = 0; i < n_threads; ++i) {
+            threads.emplace_back([this] {
+                while (true) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        cv_tasks.wait(lock, [this] { return stop || !tasks.empty(); });
+                        if (tasks.empty()) {
+                            return;
+                        }
+                        task = std::move(tasks.front());
+                        tasks.pop_front();
+                    }
+                    task();
+                }
+            });
+        }
+
+        bg_thread = std::thread([this] {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv_bg.wait(lock, [this] { return stop || bg_task; });
+                    if (!bg_task) {
+                        return;
+                    }
+                    task = std::move(bg_task);
+                    bg_task = nullptr;
+                }
+                task();
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    bg_busy = false;
+                }
+                cv_bg.notify_all();
+            }
+        });
+    }
+
+    ~logits_worker_pool() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv_tasks.notify_all();
+        cv_bg.notify_all();
+        for (auto & t : threads) {
+            t.join();
+        }
+        bg_thread.join();
+    }
+
+    void run(const std::function<void()> & compute) {
+        size_t n_pending = threads.size();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < threads.size(); ++i) {
+                tasks.emplace_back([this, &compute, &n_pending] {
+                    compute();
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (--n_pending == 0) {
+                        cv_done.notify_all();
+                    }
+                });
+            }
+        }
+        cv_tasks.notify_all();
+
+        compute();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cv_done.wait(lock, [&n_pending] { return n_pending == 0; });
+    }
+
+    // start task once the previous one is done
+    void async(std::function<void()> task) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv_bg.wait(lock, [this] { return !bg_busy; });
+            bg_task = std::move(task);
+            bg_busy = true;
+        }
+        cv_bg.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv_bg.wait(lock, [this] { return !bg_busy; });
+    }
+};
+
+// read-only mapping of the file with the log-probs of the base model
+// on Windows, the file is read into memory
+struct logits_file_mapping {
+    void * addr = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    std::vector<uint8_t> data;
+#endif
+
+    logits_file_mapping() = default;
+    logits_file_mapping(const logits_file_mapping &) = delete;
+    logits_file_mapping & operator=(const logits_file_mapping &) = delete;
+
+    bool map(const std::string & path) {
+#ifdef _WIN32
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in) {
+            return false;
+        }
+        size = (size_t) in.tellg();
+        if (size == 0) {
+            return false;
+        }
+        data.resize(size);
+        in.seekg(0);
+        if (!in.read((char *) data.data(), size)) {
+            return false;
+        }
+        addr = data.data();
+        return true;
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        size = (size_t) st.st_size;
+        addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) {
+            addr = nullptr;
+            return false;
+        }
+        // the chunks are read once, in order
+        posix_madvise(addr, size, POSIX_MADV_SEQUENTIAL);
+        return true;
+#endif
+    }
+
+    ~logits_file_mapping() {
+#ifndef _WIN32
+        if (addr) {
+            munmap(addr, size);
+        }
+#endif
+    }
+};
+
+// threads for processing the logits, they run while the next batch is decoded on the -t threads
+static int logits_n_workers(const common_params & params) {
+    return std::max(1, (int) std::thread::hardware_concurrency() - params.cpuparams.n_threads);
+}
+
 struct results_log_softmax {
     double log_softmax;
     float  logit;
@@ -105,7 +294,7 @@ static double log_softmax(int n_vocab, const float * logits, uint16_t * log_prob
 }
 
 static void process_logits(
-    int n_vocab, const float * logits, const int * tokens, int n_token, std::vector<std::thread> & workers,
+    int n_vocab, const float * logits, const int * tokens, int n_token, logits_worker_pool & pool,
     double & nll, double & nll2, float * logit_history, float * prob_history
 ) {
     std::mutex mutex;
@@ -130,17 +319,11 @@ static void process_logits(
             prob_history[i]  = results.prob;
         }
     };
-    for (auto & w : workers) {
-        w = std::thread(compute);
-    }
-    compute();
-    for (auto & w : workers) {
-        w.join();
-    }
+    pool.run(compute);
 }
 
 static void process_logits(std::ostream& out, int n_vocab, const float * logits, const int * tokens, int n_token,
-        std::vector<std::thread> & workers, std::vector<uint16_t> & log_probs, double & nll, double & nll2) {
+        logits_worker_pool & pool, std::vector<uint16_t> & log_probs, double & nll, double & nll2) {
     std::mutex mutex;
     const int nv = 2*((n_vocab + 1)/2) + 4;
     int counter = 0;
@@ -160,13 +343,7 @@ static void process_logits(std::ostream& out, int n_vocab, const float * logits,
             local_nll2 += v*v;
         }
     };
-    for (auto & w : workers) {
-        w = std::thread(compute);
-    }
-    compute();
-    for (auto & w : workers) {
-        w.join();
-    }
+    pool.run(compute);
     out.write((const char *)log_probs.data(), n_token*nv*sizeof(uint16_t));
 }
 
@@ -250,12 +427,12 @@ static std::pair<double, float> log_softmax(int n_vocab, const float * logits, c
 }
 
 static void process_logits(int n_vocab, const float * logits, const int * tokens, int n_token,
-        std::vector<std::thread> & workers, const std::vector<uint16_t> & base_log_probs, kl_divergence_result & kld,
+        logits_worker_pool & pool, const uint16_t * base_log_probs, kl_divergence_result & kld,
         float * kld_values, float * p_diff_values) {
     std::mutex mutex;
     const int nv = 2*((n_vocab + 1)/2) + 4;
     int counter = 0;
-    auto compute = [&mutex, &counter, &base_log_probs, &kld, n_vocab, logits, tokens, n_token, nv, kld_values, p_diff_values] () {
+    auto compute = [&mutex, &counter, base_log_probs, &kld, n_vocab, logits, tokens, n_token, nv, kld_values, p_diff_values] () {
         kl_divergence_result local_kld;
         while (true) {
             std::unique_lock<std::mutex> lock(mutex);
@@ -277,18 +454,12 @@ static void process_logits(int n_vocab, const float * logits, const int * tokens
                 break;
             }
             lock.unlock();
-            std::pair<double, float> v = log_softmax(n_vocab, logits + size_t(i)*n_vocab, base_log_probs.data() + i*nv, tokens[i+1], local_kld);
+            std::pair<double, float> v = log_softmax(n_vocab, logits + size_t(i)*n_vocab, base_log_probs + size_t(i)*nv, tokens[i+1], local_kld);
             kld_values[i]    = (float)v.first;
             p_diff_values[i] = v.second;
         }
     };
-    for (auto & w : workers) {
-        w = std::thread(compute);
-    }
-    compute();
-    for (auto & w : workers) {
-        w.join();
-    }
+    pool.run(compute);
 }
 
 static results_perplexity perplexity_v2(llama_context * ctx, const common_params & params) {
@@ -506,14 +677,9 @@ static results_perplexity perplexity(llama_context * ctx, const common_params &
 
     llama_batch batch = llama_batch_init(std::min(n_batch, n_ctx*n_seq), 0, 1);
 
-    std::vector<float> logits;
-    if (num_batches > 1) {
-        logits.reserve(size_t(n_ctx) * n_vocab);
-    }
-
     LOG_INF("%s: calculating perplexity over %d chunks, n_ctx=%d, batch_size=%d, n_seq=%d\n", __func__, n_chunk, n_ctx, n_batch, n_seq);
 
-    std::vector<std::thread> workers(std::thread::hardware_concurrency() - 1);
+    logits_worker_pool pool(logits_n_workers(params));
 
     std::vector<uint16_t> log_probs;
     if (!params.logits_file.empty()) {
@@ -538,6 +704,15 @@ static results_perplexity perplexity(llama_context * ctx, const common_params &
     // process the entire prompt.
     const int first = n_ctx/2;
 
+    // the logits of a batch of chunks are processed in the background while the next batch is decoded
+    // the two buffers alternate between the batch being decoded and the batch being processed
+    const size_t n_logits_seq = size_t(n_ctx - first) * n_vocab;
+
+    std::array<std::vector<float>, 2> logits_buf;
+    for (auto & buf : logits_buf) {
+        buf.reserve(n_logits_seq * n_seq);
+    }
+
     for (int i = 0; i < n_chunk; i += n_seq) {
         const int start =     i * n_ctx;
         const int end   = start + n_ctx;
@@ -546,6 +721,10 @@ static results_perplexity perplexity(llama_context * ctx, const common_params &
 
         const auto t_start = std::chrono::high_resolution_clock::now();
 
+        // the processing of the batch that used this buffer is done, async() waits for it before starting the next one
+        std::vector<float> & logits = logits_buf[(i / n_seq) % 2];
+        logits.clear();
+
         // clear the KV cache
         llama_memory_clear(llama_get_memory(ctx), true);
 
@@ -585,6 +764,7 @@ static results_perplexity perplexity(llama_context * ctx, const common_params &
 
             if (llama_decode(ctx, batch)) {
                 LOG_INF("%s : failed to decode\n", __func__);
+                pool.wait();
                 return {tokens, -1, logit_history, prob_history};
             }
 
@@ -594,6 +774,13 @@ static results_perplexity perplexity(llama_context * ctx, const common_params &
             }
         }
 
+        if (num_batches == 1) {
+            for (int seq = 0; seq < n_seq_batch; seq++) {
+                const float * seq_logits = llama_get_logits_ith(ctx, seq*n_ctx + first);
+                logits.insert(logits.end(), seq_logits, seq_logits + n_logits_seq);
+            }
+        }
+
 
         if (i == 0) {
             llama_synchronize(ctx);
@@ -608,38 +795,39 @@ static results_perplexity perplexity(llama_context * ctx, const common_params &
             LOG("%.2f minutes\n", total_seconds / 60.0);
         }
 
-        for (int seq = 0; seq < n_seq_batch; seq++) {
-            const float * all_logits = num_batches > 1 ? logits.data() : llama_get_logits_ith(ctx, seq*n_ctx + first);
-
-            llama_token * tokens_data = tokens.data() + start + seq*n_ctx + first;
-            if (!params.logits_file.empty()) {
-                process_logits(logits_stream, n_vocab, all_logits,
-                        tokens_data, n_ctx - 1 - first,
-                        workers, log_probs, nll, nll2);
-            } else {
-                process_logits(n_vocab, all_logits,
-                        tokens_data, n_ctx - 1 - first,
-                        workers, nll, nll2,
-                        logit_history.data() + start + seq*n_ctx + first,
-                        prob_history.data()  + start + seq*n_ctx + first);
-            }
-            count += n_ctx - first - 1;
-
-            // perplexity is e^(average negative log-likelihood)
-            if (params.ppl_output_type == 0) {
-                LOG("[%d]%.4lf,", i + seq + 1, std::exp(nll / count));
-            } else {
-                double av = nll/count;
-                double av2 = nll2/count - av*av;
-                if (av2 > 0) {
-                    av2 = sqrt(av2/(count-1));
+        pool.async([&, i, start, n_seq_batch] {
+            for (int seq = 0; seq < n_seq_batch; seq++) {
+                const float * all_logits = logits.data() + seq*n_logits_seq;
+
+                llama_token * tokens_data = tokens.data() + start + seq*n_ctx + first;
+                if (!params.logits_file.empty()) {
+                    process_logits(logits_stream, n_vocab, all_logits,
+                            tokens_data, n_ctx - 1 - first,
+                            pool, log_probs, nll, nll2);
+                } else {
+                    process_logits(n_vocab, all_logits,
+                            tokens_data, n_ctx - 1 - first,
+                            pool, nll, nll2,
+                            logit_history.data() + start + seq*n_ctx + first,
+                            prob_history.data()  + start + seq*n_ctx + first);
+                }
+                count += n_ctx - first - 1;
+
+                // perplexity is e^(average negative log-likelihood)
+                if (params.ppl_output_type == 0) {
+                    LOG("[%d]%.4lf,", i + seq + 1, std::exp(nll / count));
+                } else {
+                    double av = nll/count;
+                    double av2 = nll2/count - av*av;
+                    if (av2 > 0) {
+                        av2 = sqrt(av2/(count-1));
+                    }
+                    LOG("%8d  %.4lf  %4lf  %4lf\n", i*n_ctx, std::exp(nll / count), av, av2);
                 }
-                LOG("%8d  %.4lf  %4lf  %4lf\n", i*n_ctx, std::exp(nll / count), av, av2);
             }
-        }
-
-        logits.clear();
+        });
     }
+    pool.wait();
     LOG("\n");
 
     nll2 /= count;
@@ -1697,32 +1885,40 @@ static void kl_divergence(llama_context * ctx, const common_params & params) {
         LOG_ERR("%s: you must provide a name of a file containing the log probabilities of the base model\n", __func__);
         return;
     }
-    std::ifstream in(params.logits_file.c_str(), std::ios::binary);
-    if (!in) {
+
+    // the log-probs are used in place from a mapping of the file
+    logits_file_mapping in;
+    if (!in.map(params.logits_file)) {
         LOG_ERR("%s: failed to open %s\n", __func__, params.logits_file.c_str());
         return;
     }
+
+    const uint8_t * in_data = (const uint8_t *) in.addr;
+    size_t          in_offs = 0;
+
+    auto in_read = [&](void * dst, size_t size) {
+        if (in_offs + size > in.size) {
+            return false;
+        }
+        memcpy(dst, in_data + in_offs, size);
+        in_offs += size;
+        return true;
+    };
+
     {
         char check[9]; check[8] = 0;
-        in.read(check, 8);
-        if (in.fail() || strncmp("_logits_", check, 8) != 0) {
+        if (!in_read(check, 8) || strncmp("_logits_", check, 8) != 0) {
             LOG_ERR("%s: %s does not look like a file containing log-probabilities\n", __func__, params.logits_file.c_str());
             return;
         }
     }
 
-    uint32_t n_ctx;
-    in.read((char *)&n_ctx, sizeof(n_ctx));
-    if (n_ctx > llama_n_ctx(ctx)) {
-        LOG_ERR("%s: %s has been computed with %u, while the current context is %d. Increase it with -c and retry\n",
-                __func__, params.logits_file.c_str(), n_ctx, params.n_ctx);
-    }
+    uint32_t n_ctx = 0;
+    in_read(&n_ctx, sizeof(n_ctx));
 
     int n_vocab;
     int n_chunk;
-    in.read((char *)&n_vocab, sizeof(n_vocab));
-    in.read((char *)&n_chunk, sizeof(n_chunk));
-    if (in.fail()) {
+    if (!in_read(&n_vocab, sizeof(n_vocab)) || !in_read(&n_chunk, sizeof(n_chunk))) {
         LOG_ERR("%s: failed reading n_vocab, n_chunk from %s\n", __func__, params.logits_file.c_str());
         return;
     }
@@ -1731,7 +1927,7 @@ static void kl_divergence(llama_context * ctx, const common_params & params) {
     }
 
     std::vector<llama_token> tokens(size_t(n_ctx) * n_chunk);
-    if (in.read((char *)tokens.data(), tokens.size()*sizeof(tokens[0])).fail()) {
+    if (!in_read(tokens.data(), tokens.size()*sizeof(tokens[0]))) {
         LOG_ERR("%s: failed reading evaluation tokens from %s\n", __func__, params.logits_file.c_str());
         return;
     }
@@ -1742,15 +1938,32 @@ static void kl_divergence(llama_context * ctx, const common_params & params) {
     const bool add_bos = llama_vocab_get_add_bos(vocab);
     GGML_ASSERT(!llama_vocab_get_add_eos(vocab));
 
-    std::vector<uint16_t> log_probs_uint16(size_t(n_ctx - 1 - n_ctx/2) * nv);
-    std::vector<float>    kld_values(size_t(n_ctx - 1 - n_ctx/2)*n_chunk);
-    std::vector<float> p_diff_values(size_t(n_ctx - 1 - n_ctx/2)*n_chunk);
-    std::vector<float> logits;
-    if (num_batches > 1) {
-        logits.reserve(size_t(n_ctx) * n_vocab);
+    // evaluate several chunks at once, as in perplexity()
+    const int n_seq = std::max(1, std::min((int) llama_n_seq_max(ctx), n_batch / (int) n_ctx));
+    if (n_ctx * n_seq > llama_n_ctx(ctx)) {
+        LOG_ERR("%s: %s has been computed with %u, while the current context is %d. Increase it with -c and retry\n",
+                __func__, params.logits_file.c_str(), n_ctx, llama_n_ctx(ctx) / n_seq);
+    }
+
+    const int first = n_ctx/2;
+
+    // the log-probs of a chunk, the file has one block per chunk after the tokens
+    const size_t n_log_probs_chunk = size_t(n_ctx - 1 - first) * nv;
+    const uint16_t * log_probs_base = (const uint16_t *) (in_data + in_offs);
+    const size_t n_chunk_file = (in.size - in_offs) / (n_log_probs_chunk * sizeof(uint16_t));
+
+    std::vector<float>    kld_values(size_t(n_ctx - 1 - first)*n_chunk);
+    std::vector<float> p_diff_values(size_t(n_ctx - 1 - first)*n_chunk);
+
+    // the logits of a batch of chunks are processed in the background while the next batch is decoded
+    const size_t n_logits_seq = size_t(n_ctx - first) * n_vocab;
+
+    std::array<std::vector<float>, 2> logits_buf;
+    for (auto & buf : logits_buf) {
+        buf.reserve(n_logits_seq * n_seq);
     }
 
-    std::vector<std::thread> workers(std::thread::hardware_concurrency() - 1);
+    logits_worker_pool pool(logits_n_workers(params));
 
     auto mean_and_uncertainty = [] (double sum, double sum2, size_t count) {
         if (count < 1) {
@@ -1774,107 +1987,134 @@ static void kl_divergence(llama_context * ctx, const common_params & params) {
     auto    kld_ptr =    kld_values.data();
     auto p_diff_ptr = p_diff_values.data();
 
-    for (int i = 0; i < n_chunk; ++i) {
+    llama_batch batch = llama_batch_init(std::min(n_batch, (int) n_ctx*n_seq), 0, 1);
+
+    for (int i = 0; i < n_chunk; i += n_seq) {
         const int start =     i * n_ctx;
         const int end   = start + n_ctx;
 
+        const int n_seq_batch = std::min(n_seq, n_chunk - i);
+
         const auto t_start = std::chrono::high_resolution_clock::now();
 
-        if (in.read((char *)log_probs_uint16.data(), log_probs_uint16.size()*sizeof(uint16_t)).fail()) {
-            LOG_ERR("%s: failed reading log-probs for chunk %d\n", __func__, i);
+        if (size_t(i + n_seq_batch) > n_chunk_file) {
+            LOG_ERR("%s: failed reading log-probs for chunk %d\n", __func__, (int) std::max<size_t>(i, n_chunk_file));
+            pool.wait();
+            llama_batch_free(batch);
             return;
         }
 
+        // the processing of the batch that used this buffer is done, async() waits for it before starting the next one
+        std::vector<float> & logits = logits_buf[(i / n_seq) % 2];
+        logits.clear();
+
         // clear the KV cache
         llama_memory_clear(llama_get_memory(ctx), true);
 
-        llama_batch batch = llama_batch_init(n_batch, 0, 1);
-
         for (int j = 0; j < num_batches; ++j) {
             const int batch_start = start + j * n_batch;
             const int batch_size  = std::min(end - batch_start, n_batch);
 
-            // save original token and restore it after eval
-            const auto token_org = tokens[batch_start];
-
-            // add BOS token for the first batch of each chunk
-            if (add_bos && j == 0) {
-                tokens[batch_start] = llama_vocab_bos(vocab);
-            }
+            int n_outputs = 0;
 
             common_batch_clear(batch);
-            for (int i = 0; i < batch_size; i++) {
-                common_batch_add(batch, tokens[batch_start + i], j*n_batch + i, {0}, true);
+            for (int seq = 0; seq < n_seq_batch; seq++) {
+                const int seq_start = batch_start + seq*n_ctx;
+
+                // save original token and restore it after eval
+                const auto token_org = tokens[seq_start];
+
+                // add BOS token for the first batch of each chunk
+                if (add_bos && j == 0) {
+                    tokens[seq_start] = llama_vocab_bos(vocab);
+                }
+
+                for (int k = 0; k < batch_size; ++k) {
+                    const int pos = j*n_batch + k;
+                    common_batch_add(batch, tokens[seq_start + k], pos, { seq }, pos >= first);
+                    n_outputs += pos >= first;
+                }
+
+                // restore the original token in case it was set to BOS
+                tokens[seq_start] = token_org;
             }
 
             if (llama_decode(ctx, batch)) {
                 LOG_ERR("%s : failed to eval\n", __func__);
+                pool.wait();
                 llama_batch_free(batch);
                 return;
             }
 
-            // restore the original token in case it was set to BOS
-            tokens[batch_start] = token_org;
-
-            if (num_batches > 1) {
+            if (num_batches > 1 && n_outputs > 0) {
                 const auto * batch_logits = llama_get_logits(ctx);
-                logits.insert(logits.end(), batch_logits, batch_logits + size_t(batch_size) * n_vocab);
+                logits.insert(logits.end(), batch_logits, batch_logits + size_t(n_outputs) * n_vocab);
             }
         }
 
-        llama_batch_free(batch);
-
-        const auto t_end = std::chrono::high_resolution_clock::now();
+        if (num_batches == 1) {
+            for (int seq = 0; seq < n_seq_batch; seq++) {
+                const float * seq_logits = llama_get_logits_ith(ctx, seq*n_ctx + first);
+                logits.insert(logits.end(), seq_logits, seq_logits + n_logits_seq);
+            }
+        }
 
         if (i == 0) {
+            llama_synchronize(ctx);
+            const auto t_end = std::chrono::high_resolution_clock::now();
             const float t_total = std::chrono::duration<float>(t_end - t_start).count();
             LOG_INF("%s: %.2f seconds per pass - ETA ", __func__, t_total);
-            int total_seconds = (int)(t_total * n_chunk);
+            int total_seconds = (int)(t_total * n_chunk / n_seq);
             if (total_seconds >= 60*60) {
                 LOG("%d hours ", total_seconds / (60*60));
                 total_seconds = total_seconds % (60*60);
             }
             LOG("%.2f minutes\n", total_seconds / 60.0);
         }
-        LOG("\n");
-        LOG("chunk             PPL               ln(PPL(Q)/PPL(base))          KL Divergence              Δp RMS            Same top p\n");
 
-        const int first = n_ctx/2;
-        const float * all_logits = num_batches > 1 ? logits.data() : llama_get_logits(ctx);
-        process_logits(n_vocab, all_logits + size_t(first)*n_vocab, tokens.data() + start + first, n_ctx - 1 - first,
-                workers, log_probs_uint16, kld, kld_ptr, p_diff_ptr);
-        p_diff_ptr += n_ctx - 1 - first;
-        kld_ptr    += n_ctx - 1 - first;
+        pool.async([&, i, start, n_seq_batch] {
+            for (int seq = 0; seq < n_seq_batch; seq++) {
+                process_logits(n_vocab, logits.data() + seq*n_logits_seq, tokens.data() + start + seq*n_ctx + first, n_ctx - 1 - first,
+                        pool, log_probs_base + (i + seq)*n_log_probs_chunk, kld, kld_ptr, p_diff_ptr);
+                p_diff_ptr += n_ctx - 1 - first;
+                kld_ptr    += n_ctx - 1 - first;
 
-        LOG("%4d", i+1);
+                LOG("\n");
+                LOG("chunk             PPL               ln(PPL(Q)/PPL(base))          KL Divergence              Δp RMS            Same top p\n");
 
-        auto log_ppl = mean_and_uncertainty(kld.sum_nll, kld.sum_nll2, kld.count);
-        const double ppl_val = exp(log_ppl.first);
-        const double ppl_unc = ppl_val * log_ppl.second; // ppl_unc = sqrt( (dexp(x) / dx) ** 2 * log_ppl.second ** 2 )
-        LOG("    %9.4lf ± %9.4lf", ppl_val, ppl_unc);
+                LOG("%4d", i + seq + 1);
 
-        auto log_ppl_base = mean_and_uncertainty(kld.sum_nll_base, kld.sum_nll_base2, kld.count);
-        const double log_ppl_cov = covariance(kld.sum_nll, kld.sum_nll_base, kld.sum_nll_nll_base, kld.count);
-        const double log_ppl_ratio_val = log_ppl.first - log_ppl_base.first;
-        const double log_ppl_ratio_unc = sqrt(log_ppl.second*log_ppl.second + log_ppl_base.second*log_ppl_base.second - 2.0*log_ppl_cov);
-        LOG("    %10.5lf ± %10.5lf", log_ppl_ratio_val, log_ppl_ratio_unc);
+                auto log_ppl = mean_and_uncertainty(kld.sum_nll, kld.sum_nll2, kld.count);
+                const double ppl_val = exp(log_ppl.first);
+                const double ppl_unc = ppl_val * log_ppl.second; // ppl_unc = sqrt( (dexp(x) / dx) ** 2 * log_ppl.second ** 2 )
+                LOG("    %9.4lf ± %9.4lf", ppl_val, ppl_unc);
 
-        auto kl_div = mean_and_uncertainty(kld.sum_kld, kld.sum_kld2, kld.count);
-        LOG("    %10.5lf ± %10.5lf", kl_div.first, kl_div.second);
+                auto log_ppl_base = mean_and_uncertainty(kld.sum_nll_base, kld.sum_nll_base2, kld.count);
+                const double log_ppl_cov = covariance(kld.sum_nll, kld.sum_nll_base, kld.sum_nll_nll_base, kld.count);
+                const double log_ppl_ratio_val = log_ppl.first - log_ppl_base.first;
+                const double log_ppl_ratio_unc = sqrt(log_ppl.second*log_ppl.second + log_ppl_base.second*log_ppl_base.second - 2.0*log_ppl_cov);
+                LOG("    %10.5lf ± %10.5lf", log_ppl_ratio_val, log_ppl_ratio_unc);
 
-        auto p_diff_mse   = mean_and_uncertainty(kld.sum_p_diff2, kld.sum_p_diff4, kld.count);
-        const double p_diff_rms_val = sqrt(p_diff_mse.first);
-        const double p_diff_rms_unc = 0.5/p_diff_rms_val * p_diff_mse.second;
-        LOG("    %6.3lf ± %6.3lf %%", 100.0*p_diff_rms_val, 100.0*p_diff_rms_unc);
+                auto kl_div = mean_and_uncertainty(kld.sum_kld, kld.sum_kld2, kld.count);
+                LOG("    %10.5lf ± %10.5lf", kl_div.first, kl_div.second);
 
-        double p_top_val = 1.*kld.n_same_top/kld.count;
-        double p_top_unc = sqrt(p_top_val*(1 - p_top_val)/(kld.count - 1));
-        LOG("    %6.3lf ± %6.3lf %%", 100.0*p_top_val, 100.0*p_top_unc);
+                auto p_diff_mse   = mean_and_uncertainty(kld.sum_p_diff2, kld.sum_p_diff4, kld.count);
+                const double p_diff_rms_val = sqrt(p_diff_mse.first);
+                const double p_diff_rms_unc = 0.5/p_diff_rms_val * p_diff_mse.second;
+                LOG("    %6.3lf ± %6.3lf %%", 100.0*p_diff_rms_val, 100.0*p_diff_rms_unc);
 
-        LOG("\n");
+                double p_top_val = 1.*kld.n_same_top/kld.count;
+                double p_top_unc = sqrt(p_top_val*(1 - p_top_val)/(kld.count - 1));
+                LOG("    %6.3lf ± %6.3lf %%", 100.0*p_top_val, 100.0*p_top_unc);
 
-        logits.clear();
+                LOG("\n");
+            }
+        });
     }
+    pool.wait();
+
+    llama_batch_free(batch);
+
     LOG("\n");
 
     if (kld.count < 100) return; // we do not wish to do statistics on so few values
@@ -1994,7 +2234,7 @@ int main(int argc, char ** argv) {
 
     const bool ppl = !params.hellaswag && !params.winogrande && !params.multiple_choice && !params.kl_divergence;
 
-    if (ppl) {
+    if (ppl || params.kl_divergence) {
         const int32_t n_seq = std::max(1, params.n_batch / n_ctx);
         const int32_t n_kv = n_seq * n_ctx;
 
@@ -2004,12 +2244,8 @@ int main(int argc, char ** argv) {
         params.n_batch = std::min(params.n_batch, n_kv);
     } else {
         params.n_batch = std::min(params.n_batch, params.n_ctx);
-        if (params.kl_divergence) {
-            params.n_parallel = 1;
-        } else {
-            // ensure there's at least enough seq_ids for HellaSwag
-            params.n_parallel = std::max(4, params.n_parallel);
-        }
+        // ensure there's at least enough seq_ids for HellaSwag
+        params.n_parallel = std::max(4, params.n_parallel);
     }
 
     if (params.ppl_stride > 0) {
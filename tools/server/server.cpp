@@ -1211,6 +1211,12 @@ struct server_task_result_metrics : server_task_result {
     uint64_t n_decode_total     = 0;
     uint64_t n_busy_slots_total = 0;
 
+    // number of threads of the decode batches (one token per processing slot) and of the prompt batches, see --threads-auto
+    int32_t n_threads_decode     = 0;
+    int32_t n_threads_decode_max = 0;
+    int32_t n_threads_prompt     = 0;
+    int32_t n_threads_prompt_max = 0;
+
     // while we can also use std::vector<server_slot> this requires copying the slot object which can be quite messy
     // therefore, we use json to temporarily store the slot.to_json() result
     json slots_data = json::array();
@@ -1235,6 +1241,11 @@ struct server_task_result_metrics : server_task_result {
             { "n_decode_total",                  n_decode_total },
             { "n_busy_slots_total",              n_busy_slots_total },
 
+            { "n_threads_decode",                n_threads_decode },
+            { "n_threads_decode_max",            n_threads_decode_max },
+            { "n_threads_prompt",                n_threads_prompt },
+            { "n_threads_prompt_max",            n_threads_prompt_max },
+
             { "slots",                           slots_data },
         };
     }
@@ -1929,6 +1940,176 @@ struct server_response {
     }
 };
 
+// writes the slot snapshots to their files in the background, in the order they were taken
+// the next snapshot of a slot to the same file only appends the cells added since the previous one
+// background writes of the slot save files, shared by the serving pools as they share --slot-save-path
+// a slot is identified by its context and its id
+struct server_slot_snapshots {
+    struct job {
+        server_response * queue_results; // of the pool of the slot
+
+        int id_task;
+        int id_slot;
+
+        const llama_context * ctx;
+
+        std::string filename;
+        std::string filepath;
+
+        std::vector<uint8_t> state; // copy of the cells taken on the main loop
+        llama_tokens tokens;        // tokens of the cells in state
+        llama_tokens tokens_all;    // tokens of the slot, that the file holds once the job is done
+
+        bool    append;
+        size_t  n_past;             // tokens already in the file when appending
+        size_t  n_tokens;
+        int64_t t_start_us;
+    };
+
+    // tokens of a snapshot of a slot in a file
+    struct snapshot {
+        const llama_context * ctx;
+        int id_slot;
+        llama_tokens tokens;
+    };
+
+    // the last snapshot written to or restored from each file
+    std::unordered_map<std::string, snapshot> files;
+
+    // the last snapshot posted to each file, that it holds once its pending jobs are done
+    std::unordered_map<std::string, snapshot> files_queued;
+    std::unordered_map<std::string, int>      n_pending;
+
+    std::deque<job> jobs;
+    std::thread     worker;
+    bool            running = true;
+
+    std::mutex              mutex;
+    std::condition_variable cond;
+
+    ~server_slot_snapshots() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            running = false;
+        }
+        cond.notify_all();
+
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    // number of leading tokens of the slot already in the file, the rest of the cells is appended
+    // a snapshot written by another slot, possibly of another pool, is not appended to
+    size_t n_saved(const std::string & filepath, const llama_context * ctx, int id_slot, const llama_tokens & tokens) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // a snapshot can be appended to one that is still being written, see run()
+        const auto & cur = n_pending[filepath] > 0 ? files_queued : files;
+
+        const auto it = cur.find(filepath);
+        if (it == cur.end() || it->second.ctx != ctx || it->second.id_slot != id_slot) {
+            return 0;
+        }
+
+        const llama_tokens & saved = it->second.tokens;
+        if (saved.size() > tokens.size() || !std::equal(saved.begin(), saved.end(), tokens.begin())) {
+            return 0;
+        }
+
+        return saved.size();
+    }
+
+    // the slot was restored from the file
+    void set(const std::string & filepath, const llama_context * ctx, int id_slot, const llama_tokens & tokens) {
+        std::unique_lock<std::mutex> lock(mutex);
+        files[filepath] = { ctx, id_slot, tokens };
+    }
+
+    // wait for the pending writes to the file
+    void wait(const std::string & filepath) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&] { return n_pending[filepath] == 0; });
+    }
+
+    void post(job && j) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        files_queued[j.filepath] = { j.ctx, j.id_slot, j.tokens_all };
+        n_pending[j.filepath]++;
+
+        jobs.push_back(std::move(j));
+
+        if (!worker.joinable()) {
+            worker = std::thread([this] { run(); });
+        }
+
+        cond.notify_all();
+    }
+
+    void run() {
+        while (true) {
+            job j;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&] { return !running || !jobs.empty(); });
+                if (jobs.empty()) {
+                    return;
+                }
+                j = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            bool base_ok = true;
+            if (j.append) {
+                // the append was based on the snapshot queued before it, which may have failed
+                std::unique_lock<std::mutex> lock(mutex);
+                const auto it = files.find(j.filepath);
+                base_ok = it != files.end() && it->second.ctx == j.ctx && it->second.id_slot == j.id_slot && it->second.tokens.size() == j.n_past;
+            }
+
+            const size_t nwrite = base_ok ? llama_state_seq_save_file_data(j.filepath.c_str(), j.state.data(), j.state.size(), j.tokens.data(), j.tokens.size(), j.append) : 0;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (nwrite == 0) {
+                    // the content of the file is unknown, the next snapshot is written whole
+                    files.erase(j.filepath);
+                    files_queued.erase(j.filepath);
+                } else {
+                    files[j.filepath] = { j.ctx, j.id_slot, std::move(j.tokens_all) };
+                }
+                n_pending[j.filepath]--;
+            }
+            cond.notify_all();
+
+            if (nwrite == 0) {
+                auto res = std::make_unique<server_task_result_error>();
+                res->id       = j.id_task;
+                res->err_type = ERROR_TYPE_SERVER;
+                res->err_msg  = base_ok ? "Unable to write the slot save file" : "Unable to append to the slot save file, the previous save failed";
+                j.queue_results->send(std::move(res));
+                continue;
+            }
+
+            const double t_save_ms = (ggml_time_us() - j.t_start_us) / 1000.0;
+
+            SRV_INF("saved %zu tokens of slot %d to %s, %zu bytes written (%s) in %.2f ms\n",
+                    j.n_tokens, j.id_slot, j.filename.c_str(), nwrite, j.append ? "appended" : "whole", t_save_ms);
+
+            auto res = std::make_unique<server_task_result_slot_save_load>();
+            res->id       = j.id_task;
+            res->id_slot  = j.id_slot;
+            res->filename = j.filename;
+            res->is_save  = true;
+            res->n_tokens = j.n_tokens;
+            res->n_bytes  = nwrite;
+            res->t_ms     = t_save_ms;
+            j.queue_results->send(std::move(res));
+        }
+    }
+};
+
 struct server_context {
     common_params params_base;
 
@@ -1939,6 +2120,10 @@ struct server_context {
     llama_model * model = nullptr;
     llama_context * ctx = nullptr;
 
+    // pinned threads of the context, when a CPU mask is given
+    ggml_threadpool * threadpool       = nullptr;
+    ggml_threadpool * threadpool_batch = nullptr;
+
     // multimodal
     mtmd_context * mctx = nullptr;
 
@@ -1951,6 +2136,9 @@ struct server_context {
 
     llama_batch batch {};
 
+    // threads for sampling the slots of a batch in parallel
+    common_sampler_pool * smpl_pool = nullptr;
+
     bool clean_kv_cache = true;
     bool add_bos_token  = true;
 
@@ -1963,6 +2151,9 @@ struct server_context {
     server_queue    queue_tasks;
     server_response queue_results;
 
+    // owned by main, shared by the pools
+    server_slot_snapshots * slot_snapshots = nullptr;
+
     server_metrics metrics;
 
     // Necessary similarity of prompt for slot selection
@@ -1992,30 +2183,60 @@ struct server_context {
         }
 
         llama_batch_free(batch);
+
+        common_sampler_pool_free(smpl_pool);
+
+        if (threadpool) {
+            llama_detach_threadpool(ctx);
+
+            auto * reg = ggml_backend_dev_backend_reg(ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU));
+            auto * ggml_threadpool_free_fn = (decltype(ggml_threadpool_free) *) ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_free");
+            ggml_threadpool_free_fn(threadpool);
+            ggml_threadpool_free_fn(threadpool_batch);
+        }
     }
 
-    bool load_model(const common_params & params) {
+    // when shared is set, its model (and draft model) is reused and only a new context is created
+    bool load_model(const common_params & params, const server_context * shared = nullptr) {
         SRV_INF("loading model '%s'\n", params.model.path.c_str());
 
         params_base = params;
 
-        llama_init = common_init_from_params(params_base);
+        if (shared) {
+            // the LoRA adapters are loaded once, with the model
+            params_base.lora_adapters = shared->params_base.lora_adapters;
+
+            llama_init = common_init_from_model(shared->model, params_base);
+
+            model = shared->model;
+        } else {
+            llama_init = common_init_from_params(params_base);
+
+            model = llama_init.model.get();
+        }
 
-        model = llama_init.model.get();
-        ctx   = llama_init.context.get();
+        ctx = llama_init.context.get();
 
-        if (model == nullptr) {
+        if (model == nullptr || ctx == nullptr) {
             SRV_ERR("failed to load model, '%s'\n", params_base.model.path.c_str());
             return false;
         }
 
+        if (params_base.cpuparams.mask_valid && !attach_threadpool()) {
+            return false;
+        }
+
         vocab = llama_model_get_vocab(model);
 
         n_ctx = llama_n_ctx(ctx);
 
         add_bos_token = llama_vocab_get_add_bos(vocab);
 
-        if (!params_base.speculative.model.path.empty() || !params_base.speculative.model.hf_repo.empty()) {
+        if (shared) {
+            model_dft            = shared->model_dft;
+            cparams_dft          = shared->cparams_dft;
+            vocab_dft_compatible = shared->vocab_dft_compatible;
+        } else if (!params_base.speculative.model.path.empty() || !params_base.speculative.model.hf_repo.empty()) {
             SRV_INF("loading draft model '%s'\n", params_base.speculative.model.path.c_str());
 
             auto params_dft = params_base;
@@ -2109,6 +2330,46 @@ struct server_context {
         return true;
     }
 
+    // pin the threads of the context to the CPUs of the mask
+    bool attach_threadpool() {
+        auto * cpu_dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+        if (!cpu_dev) {
+            SRV_ERR("%s", "no CPU backend found\n");
+            return false;
+        }
+        auto * reg = ggml_backend_dev_backend_reg(cpu_dev);
+        auto * ggml_threadpool_new_fn = (decltype(ggml_threadpool_new) *) ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_new");
+
+        struct ggml_threadpool_params tpp_batch = ggml_threadpool_params_from_cpu_params(params_base.cpuparams_batch);
+        struct ggml_threadpool_params tpp       = ggml_threadpool_params_from_cpu_params(params_base.cpuparams);
+
+        if (!ggml_threadpool_params_match(&tpp, &tpp_batch)) {
+            threadpool_batch = ggml_threadpool_new_fn(&tpp_batch);
+            if (!threadpool_batch) {
+                SRV_ERR("batch threadpool create failed : n_threads %d\n", tpp_batch.n_threads);
+                return false;
+            }
+
+            // start the non-batch threadpool in the paused state
+            tpp.paused = true;
+        }
+
+        threadpool = ggml_threadpool_new_fn(&tpp);
+        if (!threadpool) {
+            SRV_ERR("threadpool create failed : n_threads %d\n", tpp.n_threads);
+
+            auto * ggml_threadpool_free_fn = (decltype(ggml_threadpool_free) *) ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_free");
+            ggml_threadpool_free_fn(threadpool_batch);
+            threadpool_batch = nullptr;
+
+            return false;
+        }
+
+        llama_attach_threadpool(ctx, threadpool, threadpool_batch);
+
+        return true;
+    }
+
     void init() {
         const int32_t n_ctx_slot = n_ctx / params_base.n_parallel;
 
@@ -2166,6 +2427,9 @@ struct server_context {
             batch = llama_batch_init(std::max(n_batch, params_base.n_parallel), 0, 1);
         }
 
+        // at most one sampler per slot is used at a time
+        smpl_pool = common_sampler_pool_init(std::min(params_base.cpuparams.n_threads, params_base.n_parallel));
+
         metrics.init();
 
         oai_parser_opt = {
@@ -2467,7 +2731,6 @@ struct server_context {
 
     void populate_token_probs(const server_slot & slot, completion_token_output & result, bool post_sampling, bool special, int idx) {
         size_t n_probs = slot.params.sampling.n_probs;
-        size_t n_vocab = llama_vocab_n_tokens(vocab);
         if (post_sampling) {
             const auto * cur_p = common_sampler_get_candidates(slot.smpl);
             const size_t max_probs = cur_p->size;
@@ -2494,7 +2757,7 @@ struct server_context {
             std::vector<llama_token_data> cur = get_token_probabilities(ctx, idx);
 
             // set probability for sampled token
-            for (size_t i = 0; i < n_vocab; i++) {
+            for (size_t i = 0; i < cur.size(); i++) {
                 // set probability for sampled token
                 if (cur[i].id == result.tok) {
                     result.prob = cur[i].p;
@@ -2504,7 +2767,7 @@ struct server_context {
 
             // set probability for top n_probs tokens
             result.probs.reserve(n_probs);
-            for (size_t i = 0; i < std::min(n_vocab, n_probs); i++) {
+            for (size_t i = 0; i < std::min(cur.size(), n_probs); i++) {
                 result.probs.push_back({
                     cur[i].id,
                     common_token_to_piece(ctx, cur[i].id, special),
@@ -2887,6 +3150,13 @@ struct server_context {
                     res->n_decode_total          = metrics.n_decode_total;
                     res->n_busy_slots_total      = metrics.n_busy_slots_total;
 
+                    const int32_t n_tokens_decode = std::max(1, n_processing_slots);
+
+                    res->n_threads_decode     = llama_n_threads_auto(ctx, n_tokens_decode);
+                    res->n_threads_decode_max = n_tokens_decode > 1 ? llama_n_threads_batch(ctx) : llama_n_threads(ctx);
+                    res->n_threads_prompt     = llama_n_threads_auto(ctx, llama_n_ubatch(ctx));
+                    res->n_threads_prompt_max = llama_n_threads_batch(ctx);
+
                     if (task.metrics_reset_bucket) {
                         metrics.reset_bucket();
                     }
@@ -2918,20 +3188,35 @@ struct server_context {
                     std::string filepath = task.slot_action.filepath;
 
                     const llama_tokens & tokens = slot->cache_tokens.get_text_tokens();
-                    const size_t nwrite = llama_state_seq_save_file(ctx, filepath.c_str(), slot->id, tokens.data(), token_count);
 
-                    const int64_t t_end = ggml_time_us();
-                    const double t_save_ms = (t_end - t_start) / 1000.0;
+                    // only the cells after the previous snapshot of the slot to this file are copied
+                    const size_t n_past = slot_snapshots->n_saved(filepath, ctx, slot->id, tokens);
+
+                    // the file is written in the background from a copy of the cells, the slot can be used right away
+                    server_slot_snapshots::job job;
+                    job.queue_results = &queue_results;
+                    job.id_task       = task.id;
+                    job.id_slot       = id_slot;
+                    job.ctx           = ctx;
+                    job.filename      = filename;
+                    job.filepath      = filepath;
+                    job.tokens        = llama_tokens(tokens.begin() + n_past, tokens.end());
+                    job.tokens_all    = tokens;
+                    job.append        = n_past > 0;
+                    job.n_past        = n_past;
+                    job.n_tokens      = token_count;
+                    job.t_start_us    = t_start;
+
+                    job.state.resize(llama_state_seq_get_size_from(ctx, slot->id, n_past, 0));
+                    if (job.state.empty() || llama_state_seq_get_data_from(ctx, job.state.data(), job.state.size(), slot->id, n_past, 0) != job.state.size()) {
+                        send_error(task, "Unable to copy the slot state", ERROR_TYPE_SERVER);
+                        break;
+                    }
 
-                    auto res = std::make_unique<server_task_result_slot_save_load>();
-                    res->id       = task.id;
-                    res->id_slot  = id_slot;
-                    res->filename = filename;
-                    res->is_save  = true;
-                    res->n_tokens = token_count;
-                    res->n_bytes  = nwrite;
-                    res->t_ms     = t_save_ms;
-                    queue_results.send(std::move(res));
+                    SLT_DBG(*slot, "copied %zu bytes of state for %zu new tokens in %.2f ms\n",
+                            job.state.size(), job.tokens.size(), (ggml_time_us() - t_start) / 1000.0);
+
+                    slot_snapshots->post(std::move(job));
                 } break;
             case SERVER_TASK_TYPE_SLOT_RESTORE:
                 {
@@ -2954,6 +3239,9 @@ struct server_context {
                     std::string filename = task.slot_action.filename;
                     std::string filepath = task.slot_action.filepath;
 
+                    // a snapshot to this file may still be being written
+                    slot_snapshots->wait(filepath);
+
                     llama_tokens tokens;
                     tokens.resize(slot->n_ctx);
                     size_t token_count = 0;
@@ -2967,6 +3255,9 @@ struct server_context {
                     slot->cache_tokens.clear();
                     slot->cache_tokens.insert(tokens);
 
+                    // the next snapshot of the slot to this file can be appended
+                    slot_snapshots->set(filepath, ctx, slot->id, tokens);
+
                     const int64_t t_end = ggml_time_us();
                     const double t_restore_ms = (t_end - t_start) / 1000.0;
 
@@ -3494,6 +3785,19 @@ struct server_context {
             llama_set_embeddings(ctx, slot_batched->need_embd());
         }
 
+        if (params_base.n_logits_top > 0) {
+            // the top logits of the backend are used only if no slot needs to sample from the full logits
+            bool logits_top = true;
+            for (const auto & slot : slots) {
+                if (slot.is_processing() && common_sampler_need_logits_full(slot.params.sampling, params_base.n_logits_top)) {
+                    logits_top = false;
+                    break;
+                }
+            }
+
+            llama_set_logits_top(ctx, logits_top);
+        }
+
         int32_t i_next = 0;
 
         // process the created batch of tokens
@@ -3557,6 +3861,11 @@ struct server_context {
             // on successful decode, restore the original batch size
             n_batch = llama_n_batch(ctx);
 
+            // slots that sample a token from this batch view
+            std::vector<server_slot *>     slots_smpl;
+            std::vector<common_sampler *>  smpls;
+            std::vector<int>               tok_idxs;
+
             for (auto & slot : slots) {
                 if (slot.i_batch < (int) i || slot.i_batch >= (int) (i + n_tokens)) {
                     continue; // continue loop of slots
@@ -3617,9 +3926,20 @@ struct server_context {
                     continue; // continue loop of slots
                 }
 
-                const int tok_idx = slot.i_batch - i;
+                slots_smpl.push_back(&slot);
+                smpls.push_back(slot.smpl);
+                tok_idxs.push_back(slot.i_batch - i);
+            }
+
+            // sample all slots at once - the samplers of the slots run in parallel
+            const auto ids = common_sampler_sample_batch(smpls, ctx, tok_idxs, smpl_pool);
+
+            for (size_t s = 0; s < slots_smpl.size(); ++s) {
+                auto & slot = *slots_smpl[s];
 
-                llama_token id = common_sampler_sample(slot.smpl, ctx, tok_idx);
+                const int tok_idx = tok_idxs[s];
+
+                llama_token id = ids[s];
 
                 slot.i_batch = -1;
 
@@ -3815,6 +4135,20 @@ int main(int argc, char ** argv) {
     // struct that contains llama context and inference
     server_context ctx_server;
 
+    // additional serving pools, sharing the model of ctx_server
+    std::vector<std::unique_ptr<server_context>> ctx_pools;
+    std::vector<std::thread>                     ctx_pools_threads;
+
+    // the pools write to the same --slot-save-path
+    // declared after the contexts, so that its pending writes are done before the contexts are freed
+    server_slot_snapshots slot_snapshots;
+    ctx_server.slot_snapshots = &slot_snapshots;
+
+    // the keys of the pools are valid API keys too
+    for (const auto & pool : params.server_pools) {
+        params.api_keys.insert(params.api_keys.end(), pool.api_keys.begin(), pool.api_keys.end());
+    }
+
     llama_backend_init();
     llama_numa_init(params.numa);
 
@@ -3982,6 +4316,32 @@ int main(int argc, char ** argv) {
         return httplib::Server::HandlerResponse::Unhandled;
     });
 
+    // the pool serving a request: the one of its API key, then the one of the requested model, then the main one
+    const auto get_pool = [&params, &ctx_server, &ctx_pools](const httplib::Request & req, const json & body = json()) -> server_context & {
+        const std::string prefix = "Bearer ";
+        const std::string auth_header = req.get_header_value("Authorization");
+        if (auth_header.substr(0, prefix.size()) == prefix) {
+            const std::string api_key = auth_header.substr(prefix.size());
+            for (size_t i = 0; i < ctx_pools.size(); ++i) {
+                const auto & keys = params.server_pools[i].api_keys;
+                if (std::find(keys.begin(), keys.end(), api_key) != keys.end()) {
+                    return *ctx_pools[i];
+                }
+            }
+        }
+
+        const std::string model = body.is_object() ? json_value(body, "model", std::string()) : req.get_param_value("model");
+        if (!model.empty()) {
+            for (size_t i = 0; i < ctx_pools.size(); ++i) {
+                if (params.server_pools[i].alias == model) {
+                    return *ctx_pools[i];
+                }
+            }
+        }
+
+        return ctx_server;
+    };
+
     //
     // Route handlers (or controllers)
     //
@@ -3993,23 +4353,25 @@ int main(int argc, char ** argv) {
     };
 
     const auto handle_slots = [&](const httplib::Request & req, httplib::Response & res) {
+        server_context & ctx_pool = get_pool(req);
+
         if (!params.endpoint_slots) {
             res_error(res, format_error_response("This server does not support slots endpoint. Start it with `--slots`", ERROR_TYPE_NOT_SUPPORTED));
             return;
         }
 
         // request slots data using task queue
-        int task_id = ctx_server.queue_tasks.get_new_id();
+        int task_id = ctx_pool.queue_tasks.get_new_id();
         {
             server_task task(SERVER_TASK_TYPE_METRICS);
             task.id = task_id;
-            ctx_server.queue_results.add_waiting_task_id(task_id);
-            ctx_server.queue_tasks.post(std::move(task), true); // high-priority task
+            ctx_pool.queue_results.add_waiting_task_id(task_id);
+            ctx_pool.queue_tasks.post(std::move(task), true); // high-priority task
         }
 
         // get the result
-        server_task_result_ptr result = ctx_server.queue_results.recv(task_id);
-        ctx_server.queue_results.remove_waiting_task_id(task_id);
+        server_task_result_ptr result = ctx_pool.queue_results.recv(task_id);
+        ctx_pool.queue_results.remove_waiting_task_id(task_id);
 
         if (result->is_error()) {
             res_error(res, result->to_json());
@@ -4031,24 +4393,26 @@ int main(int argc, char ** argv) {
         res_ok(res, res_metrics->slots_data);
     };
 
-    const auto handle_metrics = [&](const httplib::Request &, httplib::Response & res) {
+    const auto handle_metrics = [&](const httplib::Request & req, httplib::Response & res) {
+        server_context & ctx_pool = get_pool(req);
+
         if (!params.endpoint_metrics) {
             res_error(res, format_error_response("This server does not support metrics endpoint. Start it with `--metrics`", ERROR_TYPE_NOT_SUPPORTED));
             return;
         }
 
         // request slots data using task queue
-        int task_id = ctx_server.queue_tasks.get_new_id();
+        int task_id = ctx_pool.queue_tasks.get_new_id();
         {
             server_task task(SERVER_TASK_TYPE_METRICS);
             task.id = task_id;
-            ctx_server.queue_results.add_waiting_task_id(task_id);
-            ctx_server.queue_tasks.post(std::move(task), true); // high-priority task
+            ctx_pool.queue_results.add_waiting_task_id(task_id);
+            ctx_pool.queue_tasks.post(std::move(task), true); // high-priority task
         }
 
         // get the result
-        server_task_result_ptr result = ctx_server.queue_results.recv(task_id);
-        ctx_server.queue_results.remove_waiting_task_id(task_id);
+        server_task_result_ptr result = ctx_pool.queue_results.recv(task_id);
+        ctx_pool.queue_results.remove_waiting_task_id(task_id);
 
         if (result->is_error()) {
             res_error(res, result->to_json());
@@ -4102,6 +4466,18 @@ int main(int argc, char ** argv) {
                     {"name",  "requests_deferred"},
                     {"help",  "Number of requests deferred."},
                     {"value",  (uint64_t) res_metrics->n_tasks_deferred}
+            },{
+                    {"name",  "threads_decode"},
+                    {"help",  "Number of threads used for the token generation batches of the processing requests."},
+                    {"value",  res_metrics->n_threads_decode}
+            },{
+                    {"name",  "threads_prompt"},
+                    {"help",  "Number of threads used for the prompt processing batches."},
+                    {"value",  res_metrics->n_threads_prompt}
+            },{
+                    {"name",  "threads_free"},
+                    {"help",  "Number of threads left free by the adaptive number of threads for token generation."},
+                    {"value",  res_metrics->n_threads_decode_max - res_metrics->n_threads_decode}
             }}}
         };
 
@@ -4128,7 +4504,38 @@ int main(int argc, char ** argv) {
         res.status = 200; // HTTP OK
     };
 
-    const auto handle_slots_save = [&ctx_server, &res_error, &res_ok, &params](const httplib::Request & req, httplib::Response & res, int id_slot) {
+    const auto handle_profile = [&](const httplib::Request & req, httplib::Response & res) {
+        server_context & ctx_pool = get_pool(req);
+
+        if (!params.profile_ops) {
+            res_error(res, format_error_response("This server does not support profile endpoint. Start it with `--profile-ops`", ERROR_TYPE_NOT_SUPPORTED));
+            return;
+        }
+
+        const std::string format = req.has_param("format") ? req.get_param_value("format") : "summary";
+        if (format != "summary" && format != "trace") {
+            res_error(res, format_error_response("Invalid format, must be `summary` or `trace`", ERROR_TYPE_INVALID_REQUEST));
+            return;
+        }
+
+        // the profile is guarded by the scheduler, it can be read while the server is decoding
+        const auto profile_fn = format == "trace" ? llama_perf_ops_trace : llama_perf_ops_summary;
+
+        std::string profile(profile_fn(ctx_pool.ctx, nullptr, 0) + 1, '\0');
+        const size_t n = profile_fn(ctx_pool.ctx, profile.data(), profile.size());
+        profile.resize(std::min(n, profile.size() - 1));
+
+        if (req.has_param("reset") && req.get_param_value("reset") != "0" && req.get_param_value("reset") != "false") {
+            llama_perf_ops_reset(ctx_pool.ctx);
+        }
+
+        res.set_content(profile, format == "trace" ? MIMETYPE_JSON : "text/markdown; charset=utf-8");
+        res.status = 200; // HTTP OK
+    };
+
+    const auto handle_slots_save = [&get_pool, &res_error, &res_ok, &params](const httplib::Request & req, httplib::Response & res, int id_slot) {
+        server_context & ctx_pool = get_pool(req);
+
         json request_data = json::parse(req.body);
         std::string filename = request_data.at("filename");
         if (!fs_validate_filename(filename)) {
@@ -4137,7 +4544,7 @@ int main(int argc, char ** argv) {
         }
         std::string filepath = params.slot_save_path + filename;
 
-        int task_id = ctx_server.queue_tasks.get_new_id();
+        int task_id = ctx_pool.queue_tasks.get_new_id();
         {
             server_task task(SERVER_TASK_TYPE_SLOT_SAVE);
             task.id = task_id;
@@ -4145,12 +4552,12 @@ int main(int argc, char ** argv) {
             task.slot_action.filename = filename;
             task.slot_action.filepath = filepath;
 
-            ctx_server.queue_results.add_waiting_task_id(task_id);
-            ctx_server.queue_tasks.post(std::move(task));
+            ctx_pool.queue_results.add_waiting_task_id(task_id);
+            ctx_pool.queue_tasks.post(std::move(task));
         }
 
-        server_task_result_ptr result = ctx_server.queue_results.recv(task_id);
-        ctx_server.queue_results.remove_waiting_task_id(task_id);
+        server_task_result_ptr result = ctx_pool.queue_results.recv(task_id);
+        ctx_pool.queue_results.remove_waiting_task_id(task_id);
 
         if (result->is_error()) {
             res_error(res, result->to_json());
@@ -4160,7 +4567,9 @@ int main(int argc, char ** argv) {
         res_ok(res, result->to_json());
     };
 
-    const auto handle_slots_restore = [&ctx_server, &res_error, &res_ok, &params](const httplib::Request & req, httplib::Response & res, int id_slot) {
+    const auto handle_slots_restore = [&get_pool, &res_error, &res_ok, &params](const httplib::Request & req, httplib::Response & res, int id_slot) {
+        server_context & ctx_pool = get_pool(req);
+
         json request_data = json::parse(req.body);
         std::string filename = request_data.at("filename");
         if (!fs_validate_filename(filename)) {
@@ -4169,7 +4578,7 @@ int main(int argc, char ** argv) {
         }
         std::string filepath = params.slot_save_path + filename;
 
-        int task_id = ctx_server.queue_tasks.get_new_id();
+        int task_id = ctx_pool.queue_tasks.get_new_id();
         {
             server_task task(SERVER_TASK_TYPE_SLOT_RESTORE);
             task.id = task_id;
@@ -4177,12 +4586,12 @@ int main(int argc, char ** argv) {
             task.slot_action.filename = filename;
             task.slot_action.filepath = filepath;
 
-            ctx_server.queue_results.add_waiting_task_id(task_id);
-            ctx_server.queue_tasks.post(std::move(task));
+            ctx_pool.queue_results.add_waiting_task_id(task_id);
+            ctx_pool.queue_tasks.post(std::move(task));
         }
 
-        server_task_result_ptr result = ctx_server.queue_results.recv(task_id);
-        ctx_server.queue_results.remove_waiting_task_id(task_id);
+        server_task_result_ptr result = ctx_pool.queue_results.recv(task_id);
+        ctx_pool.queue_results.remove_waiting_task_id(task_id);
 
         if (result->is_error()) {
             res_error(res, result->to_json());
@@ -4193,19 +4602,21 @@ int main(int argc, char ** argv) {
         res_ok(res, result->to_json());
     };
 
-    const auto handle_slots_erase = [&ctx_server, &res_error, &res_ok](const httplib::Request & /* req */, httplib::Response & res, int id_slot) {
-        int task_id = ctx_server.queue_tasks.get_new_id();
+    const auto handle_slots_erase = [&get_pool, &res_error, &res_ok](const httplib::Request & req, httplib::Response & res, int id_slot) {
+        server_context & ctx_pool = get_pool(req);
+
+        int task_id = ctx_pool.queue_tasks.get_new_id();
         {
             server_task task(SERVER_TASK_TYPE_SLOT_ERASE);
             task.id = task_id;
             task.slot_action.slot_id = id_slot;
 
-            ctx_server.queue_results.add_waiting_task_id(task_id);
-            ctx_server.queue_tasks.post(std::move(task));
+            ctx_pool.queue_results.add_waiting_task_id(task_id);
+            ctx_pool.queue_tasks.post(std::move(task));
         }
 
-        server_task_result_ptr result = ctx_server.queue_results.recv(task_id);
-        ctx_server.queue_results.remove_waiting_task_id(task_id);
+        server_task_result_ptr result = ctx_pool.queue_results.recv(task_id);
+        ctx_pool.queue_results.remove_waiting_task_id(task_id);
 
         if (result->is_error()) {
             res_error(res, result->to_json());
@@ -4245,23 +4656,25 @@ int main(int argc, char ** argv) {
         }
     };
 
-    const auto handle_props = [&ctx_server, &res_ok](const httplib::Request &, httplib::Response & res) {
+    const auto handle_props = [&get_pool, &res_ok](const httplib::Request & req, httplib::Response & res) {
+        server_context & ctx_pool = get_pool(req);
+
         // this endpoint is publicly available, please only return what is safe to be exposed
         json data = {
-            { "default_generation_settings", ctx_server.default_generation_settings_for_props },
-            { "total_slots",                 ctx_server.params_base.n_parallel },
-            { "model_path",                  ctx_server.params_base.model.path },
+            { "default_generation_settings", ctx_pool.default_generation_settings_for_props },
+            { "total_slots",                 ctx_pool.params_base.n_parallel },
+            { "model_path",                  ctx_pool.params_base.model.path },
             { "modalities",                  json{
-                {"vision", ctx_server.oai_parser_opt.allow_image},
-                {"audio",  ctx_server.oai_parser_opt.allow_audio},
+                {"vision", ctx_pool.oai_parser_opt.allow_image},
+                {"audio",  ctx_pool.oai_parser_opt.allow_audio},
             } },
-            { "chat_template",               common_chat_templates_source(ctx_server.chat_templates.get()) },
-            { "bos_token",                   common_token_to_piece(ctx_server.ctx, llama_vocab_bos(ctx_server.vocab), /* special= */ true)},
-            { "eos_token",                   common_token_to_piece(ctx_server.ctx, llama_vocab_eos(ctx_server.vocab), /* special= */ true)},
+            { "chat_template",               common_chat_templates_source(ctx_pool.chat_templates.get()) },
+            { "bos_token",                   common_token_to_piece(ctx_pool.ctx, llama_vocab_bos(ctx_pool.vocab), /* special= */ true)},
+            { "eos_token",                   common_token_to_piece(ctx_pool.ctx, llama_vocab_eos(ctx_pool.vocab), /* special= */ true)},
             { "build_info",                  build_info },
         };
-        if (ctx_server.params_base.use_jinja) {
-            if (auto tool_use_src = common_chat_templates_source(ctx_server.chat_templates.get(), "tool_use")) {
+        if (ctx_pool.params_base.use_jinja) {
+            if (auto tool_use_src = common_chat_templates_source(ctx_pool.chat_templates.get(), "tool_use")) {
                 data["chat_template_tool_use"] = tool_use_src;
             }
         }
@@ -4312,7 +4725,8 @@ int main(int argc, char ** argv) {
 
     // handle completion-like requests (completion, chat, infill)
     // we can optionally provide a custom format for partial results and final results
-    const auto handle_completions_impl = [&ctx_server, &res_error, &res_ok](
+    const auto handle_completions_impl = [&res_error, &res_ok](
+            server_context & ctx_pool,
             server_task_type type,
             json & data,
             const std::vector<raw_buffer> & files,
@@ -4332,13 +4746,13 @@ int main(int argc, char ** argv) {
 
             // process files
             mtmd::bitmaps bitmaps;
-            const bool has_mtmd = ctx_server.mctx != nullptr;
+            const bool has_mtmd = ctx_pool.mctx != nullptr;
             {
                 if (!has_mtmd && !files.empty()) {
                     throw std::runtime_error("This server does not support multimodal");
                 }
                 for (auto & file : files) {
-                    mtmd::bitmap bmp(mtmd_helper_bitmap_init_from_buf(ctx_server.mctx, file.data(), file.size()));
+                    mtmd::bitmap bmp(mtmd_helper_bitmap_init_from_buf(ctx_pool.mctx, file.data(), file.size()));
                     if (!bmp.ptr) {
                         throw std::runtime_error("Failed to load image or audio file");
                     }
@@ -4362,7 +4776,7 @@ int main(int argc, char ** argv) {
                 };
                 mtmd::input_chunks chunks(mtmd_input_chunks_init());
                 auto bitmaps_c_ptr = bitmaps.c_ptr();
-                int32_t tokenized = mtmd_tokenize(ctx_server.mctx,
+                int32_t tokenized = mtmd_tokenize(ctx_pool.mctx,
                                                     chunks.ptr.get(),
                                                     &inp_txt,
                                                     bitmaps_c_ptr.data(),
@@ -4375,9 +4789,9 @@ int main(int argc, char ** argv) {
                 inputs.push_back(std::move(tmp));
             } else {
                 // non-multimodal version
-                auto tokenized_prompts = tokenize_input_prompts(ctx_server.vocab, prompt, true, true);
+                auto tokenized_prompts = tokenize_input_prompts(ctx_pool.vocab, prompt, true, true, ctx_pool.params_base.cpuparams.n_threads);
                 for (auto & p : tokenized_prompts) {
-                    auto tmp = server_tokens(p, ctx_server.mctx != nullptr);
+                    auto tmp = server_tokens(p, ctx_pool.mctx != nullptr);
                     inputs.push_back(std::move(tmp));
                 }
             }
@@ -4386,13 +4800,13 @@ int main(int argc, char ** argv) {
             for (size_t i = 0; i < inputs.size(); i++) {
                 server_task task = server_task(type);
 
-                task.id    = ctx_server.queue_tasks.get_new_id();
+                task.id    = ctx_pool.queue_tasks.get_new_id();
                 task.index = i;
 
                 task.prompt_tokens    = std::move(inputs[i]);
                 task.params           = server_task::params_from_json_cmpl(
-                        ctx_server.ctx,
-                        ctx_server.params_base,
+                        ctx_pool.ctx,
+                        ctx_pool.params_base,
                         data);
                 task.id_selected_slot = json_value(data, "id_slot", -1);
 
@@ -4405,8 +4819,8 @@ int main(int argc, char ** argv) {
             }
 
             task_ids = server_task::get_list_id(tasks);
-            ctx_server.queue_results.add_waiting_tasks(tasks);
-            ctx_server.queue_tasks.post(std::move(tasks));
+            ctx_pool.queue_results.add_waiting_tasks(tasks);
+            ctx_pool.queue_tasks.post(std::move(tasks));
         } catch (const std::exception & e) {
             res_error(res, format_error_response(e.what(), ERROR_TYPE_INVALID_REQUEST));
             return;
@@ -4415,7 +4829,7 @@ int main(int argc, char ** argv) {
         bool stream = json_value(data, "stream", false);
 
         if (!stream) {
-            ctx_server.receive_multi_results(task_ids, [&](std::vector<server_task_result_ptr> & results) {
+            ctx_pool.receive_multi_results(task_ids, [&](std::vector<server_task_result_ptr> & results) {
                 if (results.size() == 1) {
                     // single result
                     res_ok(res, results[0]->to_json());
@@ -4431,10 +4845,10 @@ int main(int argc, char ** argv) {
                 res_error(res, error_data);
             }, is_connection_closed);
 
-            ctx_server.queue_results.remove_waiting_task_ids(task_ids);
+            ctx_pool.queue_results.remove_waiting_task_ids(task_ids);
         } else {
-            const auto chunked_content_provider = [task_ids, &ctx_server, oaicompat](size_t, httplib::DataSink & sink) {
-                ctx_server.receive_cmpl_results_stream(task_ids, [&](server_task_result_ptr & result) -> bool {
+            const auto chunked_content_provider = [task_ids, &ctx_pool, oaicompat](size_t, httplib::DataSink & sink) {
+                ctx_pool.receive_cmpl_results_stream(task_ids, [&](server_task_result_ptr & result) -> bool {
                     json res_json = result->to_json();
                     if (res_json.is_array()) {
                         for (const auto & res : res_json) {
@@ -4461,18 +4875,19 @@ int main(int argc, char ** argv) {
                 return false;
             };
 
-            auto on_complete = [task_ids, &ctx_server] (bool) {
-                ctx_server.queue_results.remove_waiting_task_ids(task_ids);
+            auto on_complete = [task_ids, &ctx_pool] (bool) {
+                ctx_pool.queue_results.remove_waiting_task_ids(task_ids);
             };
 
             res.set_chunked_content_provider("text/event-stream", chunked_content_provider, on_complete);
         }
     };
 
-    const auto handle_completions = [&handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
+    const auto handle_completions = [&get_pool, &handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
         json data = json::parse(req.body);
         std::vector<raw_buffer> files; // dummy
         handle_completions_impl(
+            get_pool(req, data),
             SERVER_TASK_TYPE_COMPLETION,
             data,
             files,
@@ -4481,10 +4896,12 @@ int main(int argc, char ** argv) {
             OAICOMPAT_TYPE_NONE);
     };
 
-    const auto handle_completions_oai = [&handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
-        json data = oaicompat_completion_params_parse(json::parse(req.body));
+    const auto handle_completions_oai = [&get_pool, &handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
+        const json body = json::parse(req.body);
+        json data = oaicompat_completion_params_parse(body);
         std::vector<raw_buffer> files; // dummy
         handle_completions_impl(
+            get_pool(req, body),
             SERVER_TASK_TYPE_COMPLETION,
             data,
             files,
@@ -4493,7 +4910,7 @@ int main(int argc, char ** argv) {
             OAICOMPAT_TYPE_COMPLETION);
     };
 
-    const auto handle_infill = [&ctx_server, &res_error, &handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
+    const auto handle_infill = [&ctx_server, &get_pool, &res_error, &handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
         // check model compatibility
         std::string err;
         if (llama_vocab_fim_pre(ctx_server.vocab) == LLAMA_TOKEN_NULL) {
@@ -4548,7 +4965,7 @@ int main(int argc, char ** argv) {
         data["input_extra"] = input_extra; // default to empty array if it's not exist
 
         std::string prompt = json_value(data, "prompt", std::string());
-        std::vector<llama_tokens> tokenized_prompts = tokenize_input_prompts(ctx_server.vocab, prompt, false, true);
+        std::vector<llama_tokens> tokenized_prompts = tokenize_input_prompts(ctx_server.vocab, prompt, false, true, ctx_server.params_base.cpuparams.n_threads);
         SRV_DBG("creating infill tasks, n_prompts = %d\n", (int) tokenized_prompts.size());
         data["prompt"] = format_infill(
             ctx_server.vocab,
@@ -4564,6 +4981,7 @@ int main(int argc, char ** argv) {
 
         std::vector<raw_buffer> files; // dummy
         handle_completions_impl(
+            get_pool(req, data),
             SERVER_TASK_TYPE_INFILL,
             data,
             files,
@@ -4572,7 +4990,7 @@ int main(int argc, char ** argv) {
             OAICOMPAT_TYPE_NONE); // infill is not OAI compatible
     };
 
-    const auto handle_chat_completions = [&ctx_server, &handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
+    const auto handle_chat_completions = [&ctx_server, &get_pool, &handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
         LOG_DBG("request: %s\n", req.body.c_str());
 
         auto body = json::parse(req.body);
@@ -4623,6 +5041,7 @@ int main(int argc, char ** argv) {
             files);
 
         handle_completions_impl(
+            get_pool(req, body),
             SERVER_TASK_TYPE_COMPLETION,
             data,
             files,
@@ -4684,6 +5103,16 @@ int main(int argc, char ** argv) {
             }}
         };
 
+        for (const auto & pool : params.server_pools) {
+            models["data"].push_back({
+                {"id",       pool.alias},
+                {"object",   "model"},
+                {"created",  std::time(0)},
+                {"owned_by", "llamacpp"},
+                {"meta",     model_meta},
+            });
+        }
+
         res_ok(res, models);
     };
 
@@ -4741,7 +5170,7 @@ int main(int argc, char ** argv) {
         res_ok(res, data);
     };
 
-    const auto handle_embeddings_impl = [&ctx_server, &res_error, &res_ok](const httplib::Request & req, httplib::Response & res, oaicompat_type oaicompat) {
+    const auto handle_embeddings_impl = [&ctx_server, &get_pool, &res_error, &res_ok](const httplib::Request & req, httplib::Response & res, oaicompat_type oaicompat) {
         if (!ctx_server.params_base.embedding) {
             res_error(res, format_error_response("This server does not support embeddings. Start it with `--embeddings`", ERROR_TYPE_NOT_SUPPORTED));
             return;
@@ -4753,6 +5182,7 @@ int main(int argc, char ** argv) {
         }
 
         const json body = json::parse(req.body);
+        server_context & ctx_pool = get_pool(req, body);
 
         // for the shape of input/content, see tokenize_input_prompts()
         json prompt;
@@ -4777,7 +5207,7 @@ int main(int argc, char ** argv) {
             }
         }
 
-        auto tokenized_prompts = tokenize_input_prompts(ctx_server.vocab, prompt, true, true);
+        auto tokenized_prompts = tokenize_input_prompts(ctx_pool.vocab, prompt, true, true, ctx_pool.params_base.cpuparams.n_threads);
         for (const auto & tokens : tokenized_prompts) {
             // this check is necessary for models that do not add BOS token to the input
             if (tokens.empty()) {
@@ -4789,8 +5219,8 @@ int main(int argc, char ** argv) {
         int embd_normalize = 2; // default to Euclidean/L2 norm
         if (body.count("embd_normalize") != 0) {
             embd_normalize = body.at("embd_normalize");
-            if (llama_pooling_type(ctx_server.ctx) == LLAMA_POOLING_TYPE_NONE) {
-                SRV_DBG("embd_normalize is not supported by pooling type %d, ignoring it\n", llama_pooling_type(ctx_server.ctx));
+            if (llama_pooling_type(ctx_pool.ctx) == LLAMA_POOLING_TYPE_NONE) {
+                SRV_DBG("embd_normalize is not supported by pooling type %d, ignoring it\n", llama_pooling_type(ctx_pool.ctx));
             }
         }
 
@@ -4803,9 +5233,9 @@ int main(int argc, char ** argv) {
             for (size_t i = 0; i < tokenized_prompts.size(); i++) {
                 server_task task = server_task(SERVER_TASK_TYPE_EMBEDDING);
 
-                task.id            = ctx_server.queue_tasks.get_new_id();
+                task.id            = ctx_pool.queue_tasks.get_new_id();
                 task.index         = i;
-                task.prompt_tokens = server_tokens(tokenized_prompts[i], ctx_server.mctx != nullptr);
+                task.prompt_tokens = server_tokens(tokenized_prompts[i], ctx_pool.mctx != nullptr);
 
                 // OAI-compat
                 task.params.oaicompat = oaicompat;
@@ -4815,12 +5245,12 @@ int main(int argc, char ** argv) {
             }
 
             task_ids = server_task::get_list_id(tasks);
-            ctx_server.queue_results.add_waiting_tasks(tasks);
-            ctx_server.queue_tasks.post(std::move(tasks));
+            ctx_pool.queue_results.add_waiting_tasks(tasks);
+            ctx_pool.queue_tasks.post(std::move(tasks));
         }
 
         // get the result
-        ctx_server.receive_multi_results(task_ids, [&](std::vector<server_task_result_ptr> & results) {
+        ctx_pool.receive_multi_results(task_ids, [&](std::vector<server_task_result_ptr> & results) {
             for (auto & res : results) {
                 GGML_ASSERT(dynamic_cast<server_task_result_embd*>(res.get()) != nullptr);
                 responses.push_back(res->to_json());
@@ -4830,7 +5260,7 @@ int main(int argc, char ** argv) {
             error = true;
         }, req.is_connection_closed);
 
-        ctx_server.queue_results.remove_waiting_task_ids(task_ids);
+        ctx_pool.queue_results.remove_waiting_task_ids(task_ids);
 
         if (error) {
             return;
@@ -4851,13 +5281,14 @@ int main(int argc, char ** argv) {
         handle_embeddings_impl(req, res, OAICOMPAT_TYPE_EMBEDDING);
     };
 
-    const auto handle_rerank = [&ctx_server, &res_error, &res_ok](const httplib::Request & req, httplib::Response & res) {
+    const auto handle_rerank = [&ctx_server, &get_pool, &res_error, &res_ok](const httplib::Request & req, httplib::Response & res) {
         if (!ctx_server.params_base.embedding || ctx_server.params_base.pooling_type != LLAMA_POOLING_TYPE_RANK) {
             res_error(res, format_error_response("This server does not support reranking. Start it with `--reranking`", ERROR_TYPE_NOT_SUPPORTED));
             return;
         }
 
         const json body = json::parse(req.body);
+        server_context & ctx_pool = get_pool(req, body);
 
         // TODO: implement
         //int top_n = 1;
@@ -4892,7 +5323,7 @@ int main(int argc, char ** argv) {
             return;
         }
 
-        llama_tokens tokenized_query = tokenize_input_prompts(ctx_server.vocab, query, /* add_special */ false, true)[0];
+        llama_tokens tokenized_query = tokenize_input_prompts(ctx_pool.vocab, query, /* add_special */ false, true, ctx_pool.params_base.cpuparams.n_threads)[0];
 
         // create and queue the task
         json responses = json::array();
@@ -4900,23 +5331,23 @@ int main(int argc, char ** argv) {
         std::unordered_set<int> task_ids;
         {
             std::vector<server_task> tasks;
-            auto tokenized_docs = tokenize_input_prompts(ctx_server.vocab, documents, /* add_special */ false, true);
+            auto tokenized_docs = tokenize_input_prompts(ctx_pool.vocab, documents, /* add_special */ false, true, ctx_pool.params_base.cpuparams.n_threads);
             tasks.reserve(tokenized_docs.size());
             for (size_t i = 0; i < tokenized_docs.size(); i++) {
-                auto tmp = format_rerank(ctx_server.vocab, tokenized_query, tokenized_docs[i]);
+                auto tmp = format_rerank(ctx_pool.vocab, tokenized_query, tokenized_docs[i]);
                 server_task task   = server_task(SERVER_TASK_TYPE_RERANK);
-                task.id            = ctx_server.queue_tasks.get_new_id();
+                task.id            = ctx_pool.queue_tasks.get_new_id();
                 task.index         = i;
-                task.prompt_tokens = server_tokens(tmp, ctx_server.mctx != nullptr);
+                task.prompt_tokens = server_tokens(tmp, ctx_pool.mctx != nullptr);
                 tasks.push_back(std::move(task));
             }
 
             task_ids = server_task::get_list_id(tasks);
-            ctx_server.queue_results.add_waiting_tasks(tasks);
-            ctx_server.queue_tasks.post(std::move(tasks));
+            ctx_pool.queue_results.add_waiting_tasks(tasks);
+            ctx_pool.queue_tasks.post(std::move(tasks));
         }
 
-        ctx_server.receive_multi_results(task_ids, [&](std::vector<server_task_result_ptr> & results) {
+        ctx_pool.receive_multi_results(task_ids, [&](std::vector<server_task_result_ptr> & results) {
             for (auto & res : results) {
                 GGML_ASSERT(dynamic_cast<server_task_result_rerank*>(res.get()) != nullptr);
                 responses.push_back(res->to_json());
@@ -4940,9 +5371,11 @@ int main(int argc, char ** argv) {
         res_ok(res, root);
     };
 
-    const auto handle_lora_adapters_list = [&](const httplib::Request &, httplib::Response & res) {
+    const auto handle_lora_adapters_list = [&](const httplib::Request & req, httplib::Response & res) {
+        server_context & ctx_pool = get_pool(req);
+
         json result = json::array();
-        const auto & loras = ctx_server.params_base.lora_adapters;
+        const auto & loras = ctx_pool.params_base.lora_adapters;
         for (size_t i = 0; i < loras.size(); ++i) {
             auto & lora = loras[i];
             result.push_back({
@@ -4957,23 +5390,24 @@ int main(int argc, char ** argv) {
 
     const auto handle_lora_adapters_apply = [&](const httplib::Request & req, httplib::Response & res) {
         const json body = json::parse(req.body);
+        server_context & ctx_pool = get_pool(req, body);
         if (!body.is_array()) {
             res_error(res, format_error_response("Request body must be an array", ERROR_TYPE_INVALID_REQUEST));
             return;
         }
 
-        int task_id = ctx_server.queue_tasks.get_new_id();
+        int task_id = ctx_pool.queue_tasks.get_new_id();
         {
             server_task task(SERVER_TASK_TYPE_SET_LORA);
             task.id = task_id;
-            task.set_lora = parse_lora_request(ctx_server.params_base.lora_adapters, body);
-            ctx_server.queue_results.add_waiting_task_id(task_id);
-            ctx_server.queue_tasks.post(std::move(task));
+            task.set_lora = parse_lora_request(ctx_pool.params_base.lora_adapters, body);
+            ctx_pool.queue_results.add_waiting_task_id(task_id);
+            ctx_pool.queue_tasks.post(std::move(task));
         }
 
         // get the result
-        server_task_result_ptr result = ctx_server.queue_results.recv(task_id);
-        ctx_server.queue_results.remove_waiting_task_id(task_id);
+        server_task_result_ptr result = ctx_pool.queue_results.recv(task_id);
+        ctx_pool.queue_results.remove_waiting_task_id(task_id);
 
         if (result->is_error()) {
             res_error(res, result->to_json());
@@ -5019,6 +5453,7 @@ int main(int argc, char ** argv) {
     // register API routes
     svr->Get (params.api_prefix + "/health",              handle_health); // public endpoint (no API key check)
     svr->Get (params.api_prefix + "/metrics",             handle_metrics);
+    svr->Get (params.api_prefix + "/profile",             handle_profile);
     svr->Get (params.api_prefix + "/props",               handle_props);
     svr->Post(params.api_prefix + "/props",               handle_props_change);
     svr->Post(params.api_prefix + "/api/show",            handle_api_show);
@@ -5054,16 +5489,23 @@ int main(int argc, char ** argv) {
     //
     if (params.n_threads_http < 1) {
         // +2 threads for monitoring endpoints
-        params.n_threads_http = std::max(params.n_parallel + 2, (int32_t) std::thread::hardware_concurrency() - 1);
+        params.n_threads_http = std::max(params.n_parallel * (1 + (int32_t) params.server_pools.size()) + 2, (int32_t) std::thread::hardware_concurrency() - 1);
     }
     log_data["n_threads_http"] =  std::to_string(params.n_threads_http);
     svr->new_task_queue = [&params] { return new httplib::ThreadPool(params.n_threads_http); };
 
     // clean up function, to be called before exit
-    auto clean_up = [&svr, &ctx_server]() {
+    auto clean_up = [&svr, &ctx_server, &ctx_pools, &ctx_pools_threads]() {
         SRV_INF("%s: cleaning up before exit...\n", __func__);
         svr->stop();
         ctx_server.queue_results.terminate();
+        for (auto & ctx_pool : ctx_pools) {
+            ctx_pool->queue_tasks.terminate();
+            ctx_pool->queue_results.terminate();
+        }
+        for (auto & t : ctx_pools_threads) {
+            t.join();
+        }
         llama_backend_free();
     };
 
@@ -5112,6 +5554,30 @@ int main(int argc, char ** argv) {
     }
 
     ctx_server.init();
+
+    for (const auto & pool : params.server_pools) {
+        LOG_INF("%s: creating pool '%s', n_threads = %d\n", __func__, pool.alias.c_str(), pool.cpuparams.n_threads);
+
+        common_params params_pool = params;
+
+        params_pool.model_alias     = pool.alias;
+        params_pool.cpuparams       = pool.cpuparams;
+        params_pool.cpuparams_batch = pool.cpuparams;
+
+        auto ctx_pool = std::make_unique<server_context>();
+        ctx_pool->slot_snapshots = &slot_snapshots;
+        if (!ctx_pool->load_model(params_pool, &ctx_server)) {
+            clean_up();
+            t.join();
+            LOG_ERR("%s: exiting due to pool creation error\n", __func__);
+            return 1;
+        }
+        ctx_pool->init();
+        ctx_pool->slot_prompt_similarity = params.slot_prompt_similarity;
+
+        ctx_pools.push_back(std::move(ctx_pool));
+    }
+
     state.store(SERVER_STATE_READY);
 
     LOG_INF("%s: model loaded\n", __func__);
@@ -5151,9 +5617,29 @@ int main(int argc, char ** argv) {
         ctx_server.update_slots();
     });
 
+    // each pool runs its own loop, in its own thread
+    for (auto & ctx_pool : ctx_pools) {
+        server_context * pool = ctx_pool.get();
+
+        pool->queue_tasks.on_new_task([pool](server_task && task) {
+            pool->process_single_task(std::move(task));
+        });
+
+        pool->queue_tasks.on_update_slots([pool]() {
+            pool->update_slots();
+        });
+
+        ctx_pools_threads.emplace_back([pool]() {
+            pool->queue_tasks.start_loop();
+        });
+    }
+
     shutdown_handler = [&](int) {
         // this will unblock start_loop()
         ctx_server.queue_tasks.terminate();
+        for (auto & ctx_pool : ctx_pools) {
+            ctx_pool->queue_tasks.terminate();
+        }
     };
 
 #if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
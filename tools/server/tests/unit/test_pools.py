@@ -0,0 +1,76 @@
+import pytest
+from utils import *
+
+server = ServerPreset.tinyllama2()
+
+TEST_API_KEY = "sk-main-key"
+TEST_POOL_API_KEY = "sk-pool-key"
+
+@pytest.fixture(scope="module", autouse=True)
+def create_server():
+    global server
+    server = ServerPreset.tinyllama2()
+    server.api_key = TEST_API_KEY
+    server.pools = [f"keyed,api-key={TEST_POOL_API_KEY}", "named,threads=1"]
+    server.server_slots = True
+
+
+def get_tokens_predicted(api_key: str, model: str | None = None) -> int:
+    global server
+    path = "/slots" if model is None else f"/slots?model={model}"
+    res = server.make_request("GET", path, headers={
+        "Authorization": f"Bearer {api_key}",
+    })
+    assert res.status_code == 200
+    return sum(slot["next_token"]["n_decoded"] for slot in res.body)
+
+
+def test_pools_models():
+    global server
+    server.start()
+    res = server.make_request("GET", "/v1/models")
+    assert res.status_code == 200
+    ids = [model["id"] for model in res.body["data"]]
+    assert "keyed" in ids
+    assert "named" in ids
+
+
+def test_pools_routing():
+    global server
+    server.start()
+
+    # by API key
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "I believe the meaning of life is",
+        "n_predict": 5,
+    }, headers={
+        "Authorization": f"Bearer {TEST_POOL_API_KEY}",
+    })
+    assert res.status_code == 200
+    n_keyed = res.body["timings"]["predicted_n"]
+
+    # by model alias
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "I believe the meaning of life is",
+        "n_predict": 7,
+        "model": "named",
+    }, headers={
+        "Authorization": f"Bearer {TEST_API_KEY}",
+    })
+    assert res.status_code == 200
+    n_named = res.body["timings"]["predicted_n"]
+
+    # main pool
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "I believe the meaning of life is",
+        "n_predict": 9,
+    }, headers={
+        "Authorization": f"Bearer {TEST_API_KEY}",
+    })
+    assert res.status_code == 200
+    n_main = res.body["timings"]["predicted_n"]
+
+    # each pool has only decoded the tokens of its own request
+    assert get_tokens_predicted(TEST_POOL_API_KEY) == n_keyed
+    assert get_tokens_predicted(TEST_API_KEY, "named") == n_named
+    assert get_tokens_predicted(TEST_API_KEY) == n_main
@@ -96,3 +96,121 @@ def test_slot_erase():
     assert res.status_code == 200
     assert match_regex("(Whiskers|Flana)+", res.body["content"])
     assert res.body["timings"]["prompt_n"] == 21  # all tokens are processed
+
+
+def test_slot_save_append():
+    global server
+    server.start()
+
+    prompt = server.make_request("POST", "/tokenize", data={
+        "content": "What is the capital of France?",
+    }).body["tokens"]
+
+    res = server.make_request("POST", "/completion", data={
+        "prompt": prompt,
+        "id_slot": 1,
+        "cache_prompt": True,
+        "n_predict": 8,
+        "return_tokens": True,
+    })
+    assert res.status_code == 200
+    generated = res.body["tokens"]
+
+    res = server.make_request("POST", "/slots/1?action=save", data={
+        "filename": "slot1_append.bin",
+    })
+    assert res.status_code == 200
+    n_saved   = res.body["n_saved"]
+    n_written = res.body["n_written"]
+
+    # continue from the cached tokens, the next save only appends the new ones
+    question = server.make_request("POST", "/tokenize", data={
+        "content": " And Germany?",
+    }).body["tokens"]
+
+    res = server.make_request("POST", "/completion", data={
+        "prompt": prompt + generated + question,
+        "id_slot": 1,
+        "cache_prompt": True,
+        "n_predict": 8,
+    })
+    assert res.status_code == 200
+
+    res = server.make_request("POST", "/slots/1?action=save", data={
+        "filename": "slot1_append.bin",
+    })
+    assert res.status_code == 200
+    assert res.body["n_saved"] > n_saved
+    assert res.body["n_written"] < n_written
+    n_saved = res.body["n_saved"]
+
+    # the whole prompt cache is restored from the chunks of the file
+    res = server.make_request("POST", "/slots/0?action=restore", data={
+        "filename": "slot1_append.bin",
+    })
+    assert res.status_code == 200
+    assert res.body["n_restored"] == n_saved
+
+
+def test_slot_save_append_swa():
+    # the SWA cache only holds the last tokens, an appended chunk larger than it must still be restored
+    server = ServerPreset.tinygemma3()
+    server.mmproj_url = None
+    server.no_mmproj = True  # the slots of a multimodal server cannot be saved
+    server.slot_save_path = "./tmp"
+    server.temperature = 0.0
+    server.start()
+
+    prompt = server.make_request("POST", "/tokenize", data={
+        "content": "What is the capital of France?",
+    }).body["tokens"]
+
+    res = server.make_request("POST", "/completion", data={
+        "prompt": prompt,
+        "id_slot": 1,
+        "cache_prompt": True,
+        "return_tokens": True,
+    })
+    assert res.status_code == 200
+    prompt += res.body["tokens"]
+
+    res = server.make_request("POST", "/slots/1?action=save", data={
+        "filename": "slot1_append_swa.bin",
+    })
+    assert res.status_code == 200
+
+    # several batches of new tokens
+    question = server.make_request("POST", "/tokenize", data={
+        "content": " And Germany?" * 50,
+    }).body["tokens"]
+    prompt += question
+
+    res = server.make_request("POST", "/completion", data={
+        "prompt": prompt,
+        "id_slot": 1,
+        "cache_prompt": True,
+        "return_tokens": True,
+    })
+    assert res.status_code == 200
+    prompt += res.body["tokens"]
+
+    res = server.make_request("POST", "/slots/1?action=save", data={
+        "filename": "slot1_append_swa.bin",
+    })
+    assert res.status_code == 200
+    n_saved = res.body["n_saved"]
+
+    res = server.make_request("POST", "/slots/0?action=restore", data={
+        "filename": "slot1_append_swa.bin",
+    })
+    assert res.status_code == 200
+    assert res.body["n_restored"] == n_saved
+
+    # the restored cache is used
+    res = server.make_request("POST", "/completion", data={
+        "prompt": prompt,
+        "id_slot": 0,
+        "cache_prompt": True,
+    })
+    assert res.status_code == 200
+    assert res.body["timings"]["prompt_n"] == 1
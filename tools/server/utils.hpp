@@ -197,28 +197,44 @@ static llama_tokens tokenize_mixed(const llama_vocab * vocab, const json & json_
  * - "prompt": ["string1", [12, 34, 56]]
  * - "prompt": [[12, 34, 56], [78, 90, 12]]
  * - "prompt": [[12, 34, "string", 56, 78], [12, 34, 56]]
+ * the string prompts are tokenized with n_threads threads
  */
-static std::vector<llama_tokens> tokenize_input_prompts(const llama_vocab * vocab, const json & json_prompt, bool add_special, bool parse_special) {
+static std::vector<llama_tokens> tokenize_input_prompts(const llama_vocab * vocab, const json & json_prompt, bool add_special, bool parse_special, int32_t n_threads) {
     std::vector<llama_tokens> result;
-    if (json_prompt.is_string() || json_is_array_of_mixed_numbers_strings(json_prompt)) {
-        // string or mixed
+    if (json_prompt.is_string()) {
+        // string - large prompts are split and tokenized in parallel
+        result = common_tokenize_batch(vocab, { json_prompt.get<std::string>() }, add_special, parse_special, n_threads);
+    } else if (json_is_array_of_mixed_numbers_strings(json_prompt)) {
+        // mixed
         result.push_back(tokenize_mixed(vocab, json_prompt, add_special, parse_special));
     } else if (json_is_array_of_numbers(json_prompt)) {
         // array of tokens
         result.push_back(json_prompt.get<llama_tokens>());
     } else if (json_prompt.is_array()) {
-        // array of prompts
-        result.reserve(json_prompt.size());
-        for (const auto & p : json_prompt) {
-            if (p.is_string() || json_is_array_of_mixed_numbers_strings(p)) {
-                result.push_back(tokenize_mixed(vocab, p, add_special, parse_special));
+        // array of prompts - the string prompts are tokenized together, in parallel
+        std::vector<std::string> texts;
+        std::vector<size_t>      texts_idx;
+
+        result.resize(json_prompt.size());
+        for (size_t i = 0; i < json_prompt.size(); ++i) {
+            const auto & p = json_prompt[i];
+            if (p.is_string()) {
+                texts.push_back(p.get<std::string>());
+                texts_idx.push_back(i);
+            } else if (json_is_array_of_mixed_numbers_strings(p)) {
+                result[i] = tokenize_mixed(vocab, p, add_special, parse_special);
             } else if (json_is_array_of_numbers(p)) {
                 // array of tokens
-                result.push_back(p.get<llama_tokens>());
+                result[i] = p.get<llama_tokens>();
             } else {
                 throw std::runtime_error("element of \"prompt\" must be a string, an list of tokens, or a list of mixed strings & tokens");
             }
         }
+
+        auto tokenized = common_tokenize_batch(vocab, texts, add_special, parse_special, n_threads);
+        for (size_t i = 0; i < texts.size(); ++i) {
+            result[texts_idx[i]] = std::move(tokenized[i]);
+        }
     } else {
         throw std::runtime_error("\"prompt\" must be a string, an list of tokens, a list of mixed strings & tokens, or a list of prompts");
     }
@@ -1003,22 +1019,35 @@ static std::string safe_json_to_str(const json & data) {
 
 static std::vector<llama_token_data> get_token_probabilities(llama_context * ctx, int idx) {
     std::vector<llama_token_data> cur;
-    const auto * logits = llama_get_logits_ith(ctx, idx);
 
-    const llama_model * model = llama_get_model(ctx);
-    const llama_vocab * vocab = llama_model_get_vocab(model);
+    const int n_top = llama_n_logits_top(ctx);
+    if (n_top > 0) {
+        // only the top logits are available (already sorted) - the probabilities are normalized over them
+        const auto * logits = llama_get_logits_top_ith(ctx, idx);
+        const auto * ids    = llama_get_logits_top_ids_ith(ctx, idx);
 
-    const int n_vocab = llama_vocab_n_tokens(vocab);
+        cur.resize(n_top);
+        for (int i = 0; i < n_top; i++) {
+            cur[i] = llama_token_data{ids[i], logits[i], 0.0f};
+        }
+    } else {
+        const auto * logits = llama_get_logits_ith(ctx, idx);
 
-    cur.resize(n_vocab);
-    for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
-        cur[token_id] = llama_token_data{token_id, logits[token_id], 0.0f};
-    }
+        const llama_model * model = llama_get_model(ctx);
+        const llama_vocab * vocab = llama_model_get_vocab(model);
 
-    // sort tokens by logits
-    std::sort(cur.begin(), cur.end(), [](const llama_token_data & a, const llama_token_data & b) {
-        return a.logit > b.logit;
-    });
+        const int n_vocab = llama_vocab_n_tokens(vocab);
+
+        cur.resize(n_vocab);
+        for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
+            cur[token_id] = llama_token_data{token_id, logits[token_id], 0.0f};
+        }
+
+        // sort tokens by logits
+        std::sort(cur.begin(), cur.end(), [](const llama_token_data & a, const llama_token_data & b) {
+            return a.logit > b.logit;
+        });
+    }
 
     // apply softmax
     float max_l = cur[0].logit;